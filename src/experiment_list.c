@@ -67,6 +67,11 @@ void create_experiment_list(experiment_list_t* list) {
 	VkBool32 fig1 = getenv("EXP_FIG1") ? VK_TRUE : VK_FALSE;
 	VkBool32 compute_gt = getenv("COMPUTE_GT") ? VK_TRUE : VK_FALSE;
 	VkBool32 ensure_correct = getenv("EXP_ENSURE_CORRECT") ? VK_TRUE : VK_FALSE;
+	VkBool32 light_selection = getenv("EXP_LIGHT_SELECTION") ? VK_TRUE : VK_FALSE;
+	VkBool32 candidate_counts = getenv("EXP_CANDIDATE_COUNT") ? VK_TRUE : VK_FALSE;
+	VkBool32 target_functions = getenv("EXP_TARGET_FUNCTION") ? VK_TRUE : VK_FALSE;
+	VkBool32 light_quantization = getenv("EXP_LIGHT_QUANTIZATION") ? VK_TRUE : VK_FALSE;
+	VkBool32 compute_shading = getenv("EXP_COMPUTE_SHADING") ? VK_TRUE : VK_FALSE;
 	
 	char* sample_str = getenv("NUM_SAMPLES");
 	uint32_t sample_count = 0;
@@ -107,7 +112,8 @@ void create_experiment_list(experiment_list_t* list) {
 			.exposure_factor = 1.5f, .roughness_factor = 0.1f, .sample_count = 1, .sample_count_light = 1,
 			.mis_heuristic = mis_heuristic_optimal_clamped, .mis_visibility_estimate = 0.5f, .animate_noise = VK_TRUE,
 			.show_polygonal_lights = VK_FALSE, .accum = VK_TRUE,
-			.light_sampling = light_reservoir, .fast_atan = VK_FALSE
+			.light_sampling = light_reservoir, .candidate_count = 32, .fast_atan = VK_FALSE,
+			.light_cache_probability = 0.5f, .light_cache_cell_scale = 0.02f
 		};
 		experiment_t bistro_base = {
 			.scene_index = scene_bistro_outside,
@@ -165,7 +171,8 @@ void create_experiment_list(experiment_list_t* list) {
 			.exposure_factor = 1.5f, .roughness_factor = 0.1f, .sample_count = 1, .sample_count_light = 1,
 			.mis_heuristic = mis_heuristic_optimal_clamped, .mis_visibility_estimate = 0.5f, .animate_noise = VK_TRUE,
 			.show_polygonal_lights = VK_FALSE, .accum = VK_TRUE,
-			.light_sampling = light_reservoir, .fast_atan = VK_FALSE
+			.light_sampling = light_reservoir, .candidate_count = 32, .fast_atan = VK_FALSE,
+			.light_cache_probability = 0.5f, .light_cache_cell_scale = 0.02f
 		};
 		experiment_t bistro_base = {
 			.scene_index = scene_bistro_inside,
@@ -215,7 +222,8 @@ void create_experiment_list(experiment_list_t* list) {
 			.exposure_factor = 1.5f, .roughness_factor = 0.05f, .sample_count = 1, .sample_count_light = 1,
 			.mis_heuristic = mis_heuristic_optimal_clamped, .mis_visibility_estimate = 0.5f, .animate_noise = VK_TRUE,
 			.show_polygonal_lights = VK_FALSE, .accum = VK_TRUE,
-			.light_sampling = light_reservoir, .fast_atan = VK_FALSE
+			.light_sampling = light_reservoir, .candidate_count = 32, .fast_atan = VK_FALSE,
+			.light_cache_probability = 0.5f, .light_cache_cell_scale = 0.02f
 		};
 		experiment_t bistro_base = {
 			.scene_index = scene,
@@ -241,7 +249,8 @@ void create_experiment_list(experiment_list_t* list) {
 			.exposure_factor = 1.5f, .roughness_factor = rough_factor, .sample_count = 1, .sample_count_light = 1,
 			.mis_heuristic = mis_heuristic_optimal_clamped, .mis_visibility_estimate = 0.5f, .animate_noise = VK_TRUE,
 			.show_polygonal_lights = VK_FALSE, .accum = VK_TRUE,
-			.light_sampling = light_reservoir, .fast_atan = VK_FALSE
+			.light_sampling = light_reservoir, .candidate_count = 32, .fast_atan = VK_FALSE,
+			.light_cache_probability = 0.5f, .light_cache_cell_scale = 0.02f
 		};
 		experiment_t bistro_base = {
 			.scene_index = scene,
@@ -267,7 +276,8 @@ void create_experiment_list(experiment_list_t* list) {
 			.exposure_factor = 1.5f, .roughness_factor = 0.3f, .sample_count = 1, .sample_count_light = 1,
 			.mis_heuristic = mis_heuristic_optimal_clamped, .mis_visibility_estimate = 0.5f, .animate_noise = VK_TRUE,
 			.show_polygonal_lights = VK_FALSE, .accum = VK_TRUE,
-			.light_sampling = light_reservoir, .fast_atan = VK_FALSE
+			.light_sampling = light_reservoir, .candidate_count = 32, .fast_atan = VK_FALSE,
+			.light_cache_probability = 0.5f, .light_cache_cell_scale = 0.02f
 		};
 		experiment_t bistro_base = {
 			.scene_index = scene,
@@ -293,7 +303,8 @@ void create_experiment_list(experiment_list_t* list) {
 			.exposure_factor = 1.5f, .roughness_factor = diffuse_factor, .sample_count = 1, .sample_count_light = 1,
 			.mis_heuristic = mis_heuristic_optimal_clamped, .mis_visibility_estimate = 0.5f, .animate_noise = VK_TRUE,
 			.show_polygonal_lights = VK_FALSE, .accum = VK_TRUE,
-			.light_sampling = light_reservoir, .fast_atan = VK_FALSE
+			.light_sampling = light_reservoir, .candidate_count = 32, .fast_atan = VK_FALSE,
+			.light_cache_probability = 0.5f, .light_cache_cell_scale = 0.02f
 		};
 		experiment_t bistro_base = {
 			.scene_index = scene,
@@ -395,6 +406,138 @@ void create_experiment_list(experiment_list_t* list) {
 			++count;
 		}
 
+		// Compare strategies for picking lights, both at equal sample count
+		// and for run time measurements
+		if (light_selection) {
+			light_sampling_strategies_t strategies[] = { light_uniform, light_power, light_reservoir, light_reservoir_power, light_reservoir_bvh, light_reservoir_cache };
+			const char* strategy_names[] = { "select_uniform", "select_power", "ris_uniform", "ris_power", "ris_bvh", "ris_cache" };
+			const char* strategy_time_names[] = { "select_uniform_time", "select_power_time", "ris_uniform_time", "ris_power_time", "ris_bvh_time", "ris_cache_time" };
+			for (uint32_t j = 0; j != COUNT_OF(strategies); ++j) {
+				experiments[count] = base;
+				experiments[count].num_samples = sample_count;
+				experiments[count].render_settings.light_sampling = strategies[j];
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = copy_string(strategy_names[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+
+				experiments[count] = base;
+				experiments[count].num_samples = 1000;
+				experiments[count].ss_per_frame = VK_FALSE;
+				experiments[count].render_settings.light_sampling = strategies[j];
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = copy_string(strategy_time_names[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+			}
+		}
+
+		// Sweep the number of RIS candidates, both at equal sample count and
+		// for run time measurements. The last entry uses adaptive M.
+		if (candidate_counts) {
+			uint32_t candidate_count_list[] = { 4, 8, 16, 32, 64, 32 };
+			for (uint32_t j = 0; j != COUNT_OF(candidate_count_list); ++j) {
+				VkBool32 adaptive = (j + 1 == COUNT_OF(candidate_count_list));
+				experiments[count] = base;
+				experiments[count].num_samples = sample_count;
+				experiments[count].render_settings.candidate_count = candidate_count_list[j];
+				experiments[count].render_settings.adaptive_candidate_count = adaptive;
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = adaptive ? copy_string("ris_m_adaptive") : format_uint("ris_m_%u", candidate_count_list[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+
+				experiments[count] = base;
+				experiments[count].num_samples = 1000;
+				experiments[count].ss_per_frame = VK_FALSE;
+				experiments[count].render_settings.candidate_count = candidate_count_list[j];
+				experiments[count].render_settings.adaptive_candidate_count = adaptive;
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = adaptive ? copy_string("ris_m_adaptive_time") : format_uint("ris_m_%u_time", candidate_count_list[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+			}
+		}
+
+		// Compare RIS target functions. Error per frame from the first and
+		// frame times from the second experiment give time-to-error.
+		if (target_functions) {
+			ris_target_function_t targets[] = { ris_target_exact, ris_target_form_factor };
+			const char* target_names[] = { "ris_target_exact", "ris_target_form_factor" };
+			const char* target_time_names[] = { "ris_target_exact_time", "ris_target_form_factor_time" };
+			for (uint32_t j = 0; j != COUNT_OF(targets); ++j) {
+				experiments[count] = base;
+				experiments[count].num_samples = sample_count;
+				experiments[count].render_settings.ris_target_function = targets[j];
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = copy_string(target_names[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+
+				experiments[count] = base;
+				experiments[count].num_samples = 1000;
+				experiments[count].ss_per_frame = VK_FALSE;
+				experiments[count].render_settings.ris_target_function = targets[j];
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = copy_string(target_time_names[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+			}
+		}
+
+		// Compare full precision and quantized light vertices. The quantization
+		// error gets printed when the light buffer is created.
+		if (light_quantization) {
+			const char* quantization_names[] = { "lights_fp32", "lights_quantized" };
+			const char* quantization_time_names[] = { "lights_fp32_time", "lights_quantized_time" };
+			for (uint32_t j = 0; j != COUNT_OF(quantization_names); ++j) {
+				experiments[count] = base;
+				experiments[count].num_samples = sample_count;
+				experiments[count].render_settings.quantize_light_vertices = (j == 1);
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = copy_string(quantization_names[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+
+				experiments[count] = base;
+				experiments[count].num_samples = 1000;
+				experiments[count].ss_per_frame = VK_FALSE;
+				experiments[count].render_settings.quantize_light_vertices = (j == 1);
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = copy_string(quantization_time_names[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+			}
+		}
+
+		// Compare shading in a fragment shader, in a compute shader and in
+		// wavefront stages. The images should match, the timings tell which
+		// one is faster.
+		if (compute_shading) {
+			const char* shading_names[] = { "shading_fragment", "shading_compute", "shading_wavefront" };
+			const char* shading_time_names[] = { "shading_fragment_time", "shading_compute_time", "shading_wavefront_time" };
+			for (uint32_t j = 0; j != COUNT_OF(shading_names); ++j) {
+				experiments[count] = base;
+				experiments[count].num_samples = sample_count;
+				experiments[count].render_settings.compute_shading = (j >= 1);
+				experiments[count].render_settings.wavefront_shading = (j == 2);
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = copy_string(shading_names[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+
+				experiments[count] = base;
+				experiments[count].num_samples = 1000;
+				experiments[count].ss_per_frame = VK_FALSE;
+				experiments[count].render_settings.compute_shading = (j >= 1);
+				experiments[count].render_settings.wavefront_shading = (j == 2);
+				experiments[count].render_settings.polygon_sampling_technique = sample_polygon_ltc_cp;
+				experiments[count].exp_name = copy_string(shading_time_names[j]);
+				fill_path_info(&experiments[count]);
+				++count;
+			}
+		}
+
 		// Check if GT computation is asked for
 		if (compute_gt) {
 			experiments[count] = base;
@@ -414,7 +557,8 @@ void create_experiment_list(experiment_list_t* list) {
 			.exposure_factor = 2.0f, .roughness_factor = 0.1f, .sample_count = 1, .sample_count_light = 1,
 			.mis_heuristic = mis_heuristic_optimal_clamped, .mis_visibility_estimate = 0.5f, .animate_noise = VK_TRUE,
 			.show_polygonal_lights = VK_FALSE, .accum = VK_TRUE,
-			.light_sampling = light_reservoir, .fast_atan = VK_FALSE
+			.light_sampling = light_reservoir, .candidate_count = 32, .fast_atan = VK_FALSE,
+			.light_cache_probability = 0.5f, .light_cache_cell_scale = 0.02f
 		};
 		experiment_t bistro_base = {
 			.scene_index = scene_bistro_outside,
@@ -29,14 +29,16 @@
 static double g_recorded_times[FRAME_TIME_COUNT] = {0.0};
 //! The most recently written entry in the ring buffer record_times
 static uint32_t g_recorded_time_index = FRAME_TIME_COUNT - 1;
+//! The GPU time of the light culling pass in the last recorded frame
+static float g_light_culling_time = 0.0f;
 
 void reset_timer_buffer() {
 	g_recorded_time_index = FRAME_TIME_COUNT - 1;
 }
 
-void record_frame_time(uint32_t swapchain_index, VkQueryPool pool, VkDevice device, float ts_period, FILE* timings, uint32_t accum_num) {
-	uint64_t timestamps[2];
-	VkResult result = vkGetQueryPoolResults(device, pool, swapchain_index*2, 2, 2*sizeof(uint64_t), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+void record_frame_time(uint32_t swapchain_index, VkQueryPool pool, VkDevice device, float ts_period, FILE* timings, uint32_t accum_num, VkBool32 light_culling) {
+	uint64_t timestamps[QUERIES_PER_FRAME];
+	VkResult result = vkGetQueryPoolResults(device, pool, swapchain_index * QUERIES_PER_FRAME, QUERIES_PER_FRAME, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
 	if (result == VK_NOT_READY) {
 		return;
 	} else if (result == VK_SUCCESS) {
@@ -46,7 +48,12 @@ void record_frame_time(uint32_t swapchain_index, VkQueryPool pool, VkDevice devi
 		uint64_t timestamp_units = timestamps[1] - timestamps[0];
 		float timestamp_ns = (float)timestamp_units / ts_period;
 		g_recorded_times[g_recorded_time_index] = timestamp_ns * 1e-9;
-		if (timings != NULL) {
+		float culling_ns = (float) (timestamps[3] - timestamps[2]) / ts_period;
+		g_light_culling_time = light_culling ? culling_ns * 1e-9f : 0.0f;
+		if (timings != NULL && light_culling) {
+			fprintf(timings, "%i,%f,%f\n", accum_num, timestamp_ns * 1e-6, culling_ns * 1e-6);
+		}
+		else if (timings != NULL) {
 			fprintf(timings, "%i,%f\n", accum_num, timestamp_ns * 1e-6);
 		}
 	} else {
@@ -91,6 +98,11 @@ float get_frame_time(uint32_t get_last) {
 }
 
 
+float get_light_culling_time() {
+	return g_light_culling_time;
+}
+
+
 void print_frame_time(float interval_in_seconds) {
 	double current_time = g_recorded_times[g_recorded_time_index];
 	static double last_print_time = 0.0;
@@ -23,7 +23,9 @@ void reset_timer_buffer();
 
 //! Invoke this function exactly once per frame to record the current time.
 //! Only then the other functions defined in this header will be available.
-void record_frame_time(uint32_t swapchain_index, VkQueryPool pool, VkDevice device, float ts_period, FILE* timings, uint32_t accum_num);
+//! If light_culling is VK_TRUE, the time of the light culling pass is also
+//! recorded and written to timings as additional column.
+void record_frame_time(uint32_t swapchain_index, VkQueryPool pool, VkDevice device, float ts_period, FILE* timings, uint32_t accum_num, VkBool32 light_culling);
 
 
 //! Retrieves the current estimate of the frame time in seconds. It is the
@@ -31,6 +33,11 @@ void record_frame_time(uint32_t swapchain_index, VkQueryPool pool, VkDevice devi
 float get_frame_time(uint32_t get_last);
 
 
+//! Retrieves the time in seconds taken by the light culling pass in the most
+//! recently recorded frame
+float get_light_culling_time();
+
+
 //! Prints the current estimate of the total frame time periodically, namely
 //! once per given time interval (assuming that this function is invoked each
 //! frame)
@@ -0,0 +1,418 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "light_bvh.h"
+#include "math_utilities.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+//! The number of bins per split decision during BVH construction
+#define LIGHT_BVH_BIN_COUNT 12
+
+
+//! Bounds for a set of lights, i.e. the data of a node without topology
+typedef struct light_bounds_s {
+	//! The number of lights that have been merged into these bounds
+	uint32_t light_count;
+	float aabb_min[3], aabb_max[3];
+	float power;
+	float axis[3];
+	float theta_o;
+} light_bounds_t;
+
+
+//! A single light along with its bounds and its position in the input array
+typedef struct light_bvh_primitive_s {
+	light_bounds_t bounds;
+	float centroid[3];
+	uint32_t light_index;
+} light_bvh_primitive_t;
+
+
+//! State shared across recursive invocations of build_light_bvh_subtree()
+typedef struct light_bvh_builder_s {
+	light_bvh_t* bvh;
+	light_bvh_primitive_t* primitives;
+	//! The index of the next node that will be written
+	uint32_t next_node_index;
+} light_bvh_builder_t;
+
+
+uint32_t get_light_bvh_node_count(uint32_t light_count) {
+	return (light_count > 0) ? (2 * light_count - 1) : 1;
+}
+
+
+//! Returns the dot product of two 3D vectors
+static inline float dot_3(const float lhs[3], const float rhs[3]) {
+	return lhs[0] * rhs[0] + lhs[1] * rhs[1] + lhs[2] * rhs[2];
+}
+
+
+/*! Merges the bidirectional orientation cone given by axis_b and theta_b into
+	the one given by axis and theta_o. Angles are in radians. This is the cone
+	union from Conty Estevez and Kulla with an additional sign flip of axis_b
+	to account for two-sided emitters.*/
+static void merge_orientation_cones(float axis[3], float* theta_o, const float axis_b_in[3], float theta_b) {
+	float axis_a[3] = { axis[0], axis[1], axis[2] };
+	float axis_b[3] = { axis_b_in[0], axis_b_in[1], axis_b_in[2] };
+	float theta_a = *theta_o;
+	if (dot_3(axis_a, axis_b) < 0.0f)
+		for (uint32_t i = 0; i != 3; ++i)
+			axis_b[i] = -axis_b[i];
+	// Make sure that cone a is the wider one
+	if (theta_b > theta_a) {
+		float swap_axis[3] = { axis_a[0], axis_a[1], axis_a[2] };
+		memcpy(axis_a, axis_b, sizeof(axis_a));
+		memcpy(axis_b, swap_axis, sizeof(axis_b));
+		float swap_theta = theta_a;
+		theta_a = theta_b;
+		theta_b = swap_theta;
+	}
+	float cos_theta_d = dot_3(axis_a, axis_b);
+	float theta_d = acosf((cos_theta_d > 1.0f) ? 1.0f : cos_theta_d);
+	// Cone a may contain cone b already
+	if (theta_d + theta_b <= theta_a) {
+		memcpy(axis, axis_a, sizeof(float) * 3);
+		*theta_o = theta_a;
+		return;
+	}
+	float theta_merged = 0.5f * (theta_a + theta_d + theta_b);
+	// A bidirectional cone with an opening angle of pi / 2 covers everything
+	if (theta_merged >= 0.5f * M_PI_F) {
+		memcpy(axis, axis_a, sizeof(float) * 3);
+		*theta_o = 0.5f * M_PI_F;
+		return;
+	}
+	// Rotate axis a towards axis b
+	float rotation_axis[3] = {
+		axis_a[1] * axis_b[2] - axis_a[2] * axis_b[1],
+		axis_a[2] * axis_b[0] - axis_a[0] * axis_b[2],
+		axis_a[0] * axis_b[1] - axis_a[1] * axis_b[0],
+	};
+	float rotation_axis_length = sqrtf(dot_3(rotation_axis, rotation_axis));
+	if (rotation_axis_length < 1.0e-7f) {
+		memcpy(axis, axis_a, sizeof(float) * 3);
+		*theta_o = theta_merged;
+		return;
+	}
+	for (uint32_t i = 0; i != 3; ++i)
+		rotation_axis[i] /= rotation_axis_length;
+	float theta_r = theta_merged - theta_a;
+	float cos_theta_r = cosf(theta_r);
+	float sin_theta_r = sinf(theta_r);
+	// Rodrigues' rotation formula, simplified since axis_a and rotation_axis
+	// are orthogonal
+	float rotated[3] = {
+		cos_theta_r * axis_a[0] + sin_theta_r * (rotation_axis[1] * axis_a[2] - rotation_axis[2] * axis_a[1]),
+		cos_theta_r * axis_a[1] + sin_theta_r * (rotation_axis[2] * axis_a[0] - rotation_axis[0] * axis_a[2]),
+		cos_theta_r * axis_a[2] + sin_theta_r * (rotation_axis[0] * axis_a[1] - rotation_axis[1] * axis_a[0]),
+	};
+	float rotated_length = sqrtf(dot_3(rotated, rotated));
+	for (uint32_t i = 0; i != 3; ++i)
+		axis[i] = rotated[i] / rotated_length;
+	*theta_o = theta_merged;
+}
+
+
+//! Merges the bounds rhs into the bounds lhs
+static void merge_light_bounds(light_bounds_t* lhs, const light_bounds_t* rhs) {
+	if (rhs->light_count == 0)
+		return;
+	if (lhs->light_count == 0) {
+		(*lhs) = (*rhs);
+		return;
+	}
+	for (uint32_t i = 0; i != 3; ++i) {
+		lhs->aabb_min[i] = (rhs->aabb_min[i] < lhs->aabb_min[i]) ? rhs->aabb_min[i] : lhs->aabb_min[i];
+		lhs->aabb_max[i] = (rhs->aabb_max[i] > lhs->aabb_max[i]) ? rhs->aabb_max[i] : lhs->aabb_max[i];
+	}
+	lhs->power += rhs->power;
+	merge_orientation_cones(lhs->axis, &lhs->theta_o, rhs->axis, rhs->theta_o);
+	lhs->light_count += rhs->light_count;
+}
+
+
+//! Computes bounds for a single light, which must be up to date (see
+//! update_polygonal_light()). If an animation is given, the bounds cover all
+//! poses.
+static void get_single_light_bounds(light_bounds_t* bounds, const polygonal_light_t* light, const polygonal_light_animation_t* animation) {
+	bounds->light_count = 1;
+	if (animation)
+		get_animated_polygonal_light_aabb(bounds->aabb_min, bounds->aabb_max, light, animation);
+	else {
+		memcpy(bounds->aabb_min, light->vertices_world_space, sizeof(bounds->aabb_min));
+		memcpy(bounds->aabb_max, light->vertices_world_space, sizeof(bounds->aabb_max));
+		for (uint32_t j = 1; j != light->vertex_count; ++j) {
+			for (uint32_t k = 0; k != 3; ++k) {
+				float coordinate = light->vertices_world_space[j * 4 + k];
+				bounds->aabb_min[k] = (coordinate < bounds->aabb_min[k]) ? coordinate : bounds->aabb_min[k];
+				bounds->aabb_max[k] = (coordinate > bounds->aabb_max[k]) ? coordinate : bounds->aabb_max[k];
+			}
+		}
+	}
+	memcpy(bounds->axis, light->plane, sizeof(bounds->axis));
+	bounds->theta_o = 0.0f;
+	bounds->power = get_polygonal_light_power(light);
+}
+
+
+//! Copies the given bounds into a node, leaving its topology untouched
+static void write_light_bvh_node_bounds(light_bvh_node_t* node, const light_bounds_t* bounds) {
+	memcpy(node->aabb_min, bounds->aabb_min, sizeof(node->aabb_min));
+	memcpy(node->aabb_max, bounds->aabb_max, sizeof(node->aabb_max));
+	memcpy(node->axis, bounds->axis, sizeof(node->axis));
+	node->power = bounds->power;
+	node->theta_o = bounds->theta_o;
+}
+
+
+//! Reads the bounds stored in a node. Empty nodes are not distinguished.
+static void read_light_bvh_node_bounds(light_bounds_t* bounds, const light_bvh_node_t* node) {
+	bounds->light_count = 1;
+	memcpy(bounds->aabb_min, node->aabb_min, sizeof(bounds->aabb_min));
+	memcpy(bounds->aabb_max, node->aabb_max, sizeof(bounds->aabb_max));
+	memcpy(bounds->axis, node->axis, sizeof(bounds->axis));
+	bounds->power = node->power;
+	bounds->theta_o = node->theta_o;
+}
+
+
+/*! Returns a cost that is proportional to the surface area orientation
+	heuristic for the given bounds. The orientation measure assumes Lambertian
+	emission (theta_e = pi / 2).*/
+static float get_light_bounds_cost(const light_bounds_t* bounds) {
+	if (bounds->light_count == 0)
+		return 0.0f;
+	float extent[3];
+	for (uint32_t i = 0; i != 3; ++i)
+		extent[i] = bounds->aabb_max[i] - bounds->aabb_min[i];
+	float surface_area = 2.0f * (extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0]);
+	// Points and flat boxes should not get a cost of zero
+	surface_area += 1.0e-6f;
+	float theta_o = bounds->theta_o;
+	float theta_w = theta_o + 0.5f * M_PI_F;
+	theta_w = (theta_w < M_PI_F) ? theta_w : M_PI_F;
+	float sin_theta_o = sinf(theta_o);
+	float cos_theta_o = cosf(theta_o);
+	float orientation_measure = 2.0f * M_PI_F * (1.0f - cos_theta_o)
+		+ 0.5f * M_PI_F * (2.0f * theta_w * sin_theta_o - cosf(theta_o - 2.0f * theta_w) - 2.0f * theta_o * sin_theta_o + cos_theta_o);
+	return bounds->power * surface_area * orientation_measure;
+}
+
+
+//! Comparison functions for qsort() that order primitives by their centroid
+//! along the x-, y- or z-axis
+static int compare_primitives_x(const void* lhs, const void* rhs) {
+	float difference = ((const light_bvh_primitive_t*) lhs)->centroid[0] - ((const light_bvh_primitive_t*) rhs)->centroid[0];
+	return (difference > 0.0f) - (difference < 0.0f);
+}
+static int compare_primitives_y(const void* lhs, const void* rhs) {
+	float difference = ((const light_bvh_primitive_t*) lhs)->centroid[1] - ((const light_bvh_primitive_t*) rhs)->centroid[1];
+	return (difference > 0.0f) - (difference < 0.0f);
+}
+static int compare_primitives_z(const void* lhs, const void* rhs) {
+	float difference = ((const light_bvh_primitive_t*) lhs)->centroid[2] - ((const light_bvh_primitive_t*) rhs)->centroid[2];
+	return (difference > 0.0f) - (difference < 0.0f);
+}
+
+
+/*! Splits the given range of primitives into two non-empty ranges and returns
+	the index of the first primitive of the second range. The primitives get
+	reordered accordingly.*/
+static uint32_t split_light_bvh_primitives(light_bvh_primitive_t* primitives, uint32_t begin, uint32_t end) {
+	// Determine the longest axis of the centroid bounds
+	float centroid_min[3], centroid_max[3];
+	memcpy(centroid_min, primitives[begin].centroid, sizeof(centroid_min));
+	memcpy(centroid_max, primitives[begin].centroid, sizeof(centroid_max));
+	for (uint32_t i = begin + 1; i != end; ++i) {
+		for (uint32_t j = 0; j != 3; ++j) {
+			centroid_min[j] = (primitives[i].centroid[j] < centroid_min[j]) ? primitives[i].centroid[j] : centroid_min[j];
+			centroid_max[j] = (primitives[i].centroid[j] > centroid_max[j]) ? primitives[i].centroid[j] : centroid_max[j];
+		}
+	}
+	uint32_t axis = 0;
+	for (uint32_t j = 1; j != 3; ++j)
+		if (centroid_max[j] - centroid_min[j] > centroid_max[axis] - centroid_min[axis])
+			axis = j;
+	float extent = centroid_max[axis] - centroid_min[axis];
+	uint32_t split = (begin + end) / 2;
+	if (extent > 0.0f) {
+		// Bin the primitives
+		light_bounds_t bins[LIGHT_BVH_BIN_COUNT];
+		memset(bins, 0, sizeof(bins));
+		float bin_factor = LIGHT_BVH_BIN_COUNT / extent;
+		for (uint32_t i = begin; i != end; ++i) {
+			int32_t bin = (int32_t) ((primitives[i].centroid[axis] - centroid_min[axis]) * bin_factor);
+			bin = (bin < LIGHT_BVH_BIN_COUNT) ? bin : (LIGHT_BVH_BIN_COUNT - 1);
+			merge_light_bounds(&bins[bin], &primitives[i].bounds);
+		}
+		// Sweep from the right to get bounds for all suffixes
+		light_bounds_t suffixes[LIGHT_BVH_BIN_COUNT];
+		suffixes[LIGHT_BVH_BIN_COUNT - 1] = bins[LIGHT_BVH_BIN_COUNT - 1];
+		for (int32_t i = LIGHT_BVH_BIN_COUNT - 2; i >= 0; --i) {
+			suffixes[i] = suffixes[i + 1];
+			merge_light_bounds(&suffixes[i], &bins[i]);
+		}
+		// Sweep from the left and find the cheapest split
+		light_bounds_t prefix;
+		memset(&prefix, 0, sizeof(prefix));
+		float min_cost = 3.4e38f;
+		int32_t best_bin = -1;
+		for (uint32_t i = 0; i != LIGHT_BVH_BIN_COUNT - 1; ++i) {
+			merge_light_bounds(&prefix, &bins[i]);
+			if (prefix.light_count == 0 || suffixes[i + 1].light_count == 0)
+				continue;
+			float cost = get_light_bounds_cost(&prefix) + get_light_bounds_cost(&suffixes[i + 1]);
+			if (cost < min_cost) {
+				min_cost = cost;
+				best_bin = (int32_t) i;
+			}
+		}
+		// Partition the primitives
+		if (best_bin >= 0) {
+			uint32_t left = begin;
+			uint32_t right = end;
+			while (left < right) {
+				int32_t bin = (int32_t) ((primitives[left].centroid[axis] - centroid_min[axis]) * bin_factor);
+				bin = (bin < LIGHT_BVH_BIN_COUNT) ? bin : (LIGHT_BVH_BIN_COUNT - 1);
+				if (bin <= best_bin)
+					++left;
+				else {
+					--right;
+					light_bvh_primitive_t swap = primitives[left];
+					primitives[left] = primitives[right];
+					primitives[right] = swap;
+				}
+			}
+			if (left != begin && left != end)
+				return left;
+		}
+	}
+	// Fall back to a median split
+	int (*comparisons[3])(const void*, const void*) = { compare_primitives_x, compare_primitives_y, compare_primitives_z };
+	qsort(primitives + begin, end - begin, sizeof(light_bvh_primitive_t), comparisons[axis]);
+	return split;
+}
+
+
+//! Recursively builds the subtree for the given range of primitives and
+//! returns the index of its root node
+static uint32_t build_light_bvh_subtree(light_bvh_builder_t* builder, uint32_t begin, uint32_t end, uint32_t depth) {
+	light_bvh_t* bvh = builder->bvh;
+	uint32_t node_index = builder->next_node_index++;
+	bvh->max_depth = (depth > bvh->max_depth) ? depth : bvh->max_depth;
+	light_bounds_t bounds;
+	memset(&bounds, 0, sizeof(bounds));
+	for (uint32_t i = begin; i != end; ++i)
+		merge_light_bounds(&bounds, &builder->primitives[i].bounds);
+	light_bvh_node_t* node = &bvh->nodes[node_index];
+	write_light_bvh_node_bounds(node, &bounds);
+	if (end - begin == 1) {
+		node->child_or_light_index = LIGHT_BVH_LEAF_BIT | builder->primitives[begin].light_index;
+		return node_index;
+	}
+	uint32_t split = split_light_bvh_primitives(builder->primitives, begin, end);
+	// The first child comes right after this node
+	build_light_bvh_subtree(builder, begin, split, depth + 1);
+	node->child_or_light_index = build_light_bvh_subtree(builder, split, end, depth + 1);
+	return node_index;
+}
+
+
+int build_light_bvh(light_bvh_t* bvh, const polygonal_light_t* lights, const polygonal_light_animation_t* animations, uint32_t light_count) {
+	memset(bvh, 0, sizeof(*bvh));
+	bvh->node_count = get_light_bvh_node_count(light_count);
+	bvh->nodes = malloc(sizeof(light_bvh_node_t) * bvh->node_count);
+	if (!bvh->nodes) {
+		printf("Failed to allocate %u nodes for the light BVH.\n", bvh->node_count);
+		destroy_light_bvh(bvh);
+		return 1;
+	}
+	memset(bvh->nodes, 0, sizeof(light_bvh_node_t) * bvh->node_count);
+	bvh->max_depth = 1;
+	if (light_count == 0) {
+		bvh->nodes[0].child_or_light_index = LIGHT_BVH_LEAF_BIT;
+		bvh->nodes[0].axis[2] = 1.0f;
+		return 0;
+	}
+	// Gather bounds for all lights
+	light_bvh_primitive_t* primitives = malloc(sizeof(light_bvh_primitive_t) * light_count);
+	if (!primitives) {
+		printf("Failed to allocate %u primitives for the light BVH.\n", light_count);
+		destroy_light_bvh(bvh);
+		return 1;
+	}
+	for (uint32_t i = 0; i != light_count; ++i) {
+		const polygonal_light_t* light = &lights[i];
+		light_bvh_primitive_t* primitive = &primitives[i];
+		memset(primitive, 0, sizeof(*primitive));
+		primitive->light_index = i;
+		light_bounds_t* bounds = &primitive->bounds;
+		get_single_light_bounds(bounds, light, animations ? &animations[i] : NULL);
+		for (uint32_t k = 0; k != 3; ++k)
+			primitive->centroid[k] = 0.5f * (bounds->aabb_min[k] + bounds->aabb_max[k]);
+	}
+	// Build the hierarchy recursively
+	light_bvh_builder_t builder = {
+		.bvh = bvh,
+		.primitives = primitives,
+		.next_node_index = 0,
+	};
+	build_light_bvh_subtree(&builder, 0, light_count, 1);
+	free(primitives);
+	return 0;
+}
+
+
+int refit_light_bvh(light_bvh_t* bvh, uint8_t* node_changed, const polygonal_light_t* lights, const polygonal_light_animation_t* animations, uint32_t light_count, const uint8_t* light_dirty) {
+	if (light_count == 0)
+		return 0;
+	int power_changed = 0;
+	// Children come after their parents in depth-first order, so a backward
+	// traversal visits them first
+	for (uint32_t i = bvh->node_count; i-- != 0;) {
+		light_bvh_node_t* node = &bvh->nodes[i];
+		light_bounds_t bounds;
+		if (node->child_or_light_index & LIGHT_BVH_LEAF_BIT) {
+			uint32_t light_index = node->child_or_light_index & ~LIGHT_BVH_LEAF_BIT;
+			if (!light_dirty[light_index])
+				continue;
+			get_single_light_bounds(&bounds, &lights[light_index], animations ? &animations[light_index] : NULL);
+			power_changed |= (bounds.power != node->power);
+		}
+		else {
+			uint32_t second_child = node->child_or_light_index;
+			if (!node_changed[i + 1] && !node_changed[second_child])
+				continue;
+			read_light_bvh_node_bounds(&bounds, &bvh->nodes[i + 1]);
+			light_bounds_t second_bounds;
+			read_light_bvh_node_bounds(&second_bounds, &bvh->nodes[second_child]);
+			merge_light_bounds(&bounds, &second_bounds);
+		}
+		write_light_bvh_node_bounds(node, &bounds);
+		node_changed[i] = 1;
+	}
+	return power_changed;
+}
+
+
+void destroy_light_bvh(light_bvh_t* bvh) {
+	free(bvh->nodes);
+	memset(bvh, 0, sizeof(*bvh));
+}
@@ -0,0 +1,95 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include "polygonal_light.h"
+#include <stdint.h>
+
+
+//! Leaves of the light BVH have this bit set in child_or_light_index. The
+//! remaining bits are the index of the polygonal light.
+#define LIGHT_BVH_LEAF_BIT 0x80000000
+
+/*! A node of a bounding volume hierarchy over polygonal lights in the spirit
+	of Conty Estevez and Kulla, "Importance Sampling of Many Lights with
+	Adaptive Tree Splitting", HPG 2018. Nodes bound positions, orientations and
+	emitted power of all lights below them. Lights emit on both sides, so the
+	orientation cone is bidirectional, i.e. it bounds normals up to sign. The
+	layout matches light_bvh_node_t in light_bvh.glsl.*/
+typedef struct light_bvh_node_s {
+	//! The corner of the axis-aligned bounding box with minimal coordinates
+	float aabb_min[3];
+	//! The total power emitted by all lights below this node
+	//! \see get_polygonal_light_power()
+	float power;
+	//! The corner of the axis-aligned bounding box with maximal coordinates
+	float aabb_max[3];
+	//! The angle in radians between axis and (up to sign) any light normal
+	//! below this node. At most pi / 2.
+	float theta_o;
+	//! The normalized axis of the orientation cone
+	float axis[3];
+	/*! For inner nodes, this is the index of the second child. The first
+		child immediately follows its parent in depth-first order. For leaves,
+		LIGHT_BVH_LEAF_BIT is set and the remaining bits give the light index.*/
+	uint32_t child_or_light_index;
+} light_bvh_node_t;
+
+
+//! A bounding volume hierarchy over polygonal lights with one light per leaf
+typedef struct light_bvh_s {
+	//! The number of nodes. For n > 0 lights, it is 2 * n - 1.
+	uint32_t node_count;
+	//! All nodes in depth-first order. The root is at index 0.
+	light_bvh_node_t* nodes;
+	//! The number of nodes on the longest path from the root to a leaf
+	uint32_t max_depth;
+} light_bvh_t;
+
+
+//! Returns the number of nodes that build_light_bvh() will produce for the
+//! given number of lights
+EXTERN_C uint32_t get_light_bvh_node_count(uint32_t light_count);
+
+/*! Builds a light BVH for the given polygonal lights. The lights must be up to
+	date (see update_polygonal_light()). Splits are chosen along the longest
+	axis using a binned version of the surface area orientation heuristic. If
+	there are no lights, a single leaf with zero power is created such that
+	the BVH can always be bound.
+	\param bvh The output object. Use destroy_light_bvh() for cleanup.
+	\param lights An array of light_count polygonal lights.
+	\param animations NULL for static lights or an array of light_count
+		animations. In the latter case, nodes bound all poses of the lights.
+	\param light_count The number of polygonal lights.
+	\return 0 on success.*/
+EXTERN_C int build_light_bvh(light_bvh_t* bvh, const polygonal_light_t* lights, const polygonal_light_animation_t* animations, uint32_t light_count);
+
+/*! Updates the bounds of all nodes above the given lights in a light BVH
+	that has been built by build_light_bvh(). The topology is retained, so the
+	hierarchy gets less efficient as lights move far from where they were at
+	build time, but it remains correct.
+	\param bvh The BVH to update in place.
+	\param node_changed One entry per node. Entries for nodes that have been
+		updated are set to one, others are left untouched. Pass zeros.
+	\param lights The array of light_count polygonal lights used to build the
+		BVH. Lights with non-zero entries in light_dirty must be up to date.
+	\param animations NULL or animations as for build_light_bvh().
+	\param light_dirty One entry per light, non-zero for lights that changed.
+	\return Non-zero if the power of any light has changed.*/
+EXTERN_C int refit_light_bvh(light_bvh_t* bvh, uint8_t* node_changed, const polygonal_light_t* lights, const polygonal_light_animation_t* animations, uint32_t light_count, const uint8_t* light_dirty);
+
+//! Frees memory and zeros the object
+EXTERN_C void destroy_light_bvh(light_bvh_t* bvh);
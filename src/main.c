@@ -21,9 +21,12 @@
 #include "frame_timer.h"
 #include "user_interface.h"
 #include "textures.h"
+#include "light_bvh.h"
 #include "fs.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -51,9 +54,15 @@ void quick_save(scene_specification_t* scene) {
 	fwrite(&scene->camera, sizeof(scene->camera), 1, file);
 	uint32_t legacy_count = 0;
 	fwrite(&legacy_count, sizeof(uint32_t), 1, file);
-	fwrite(&scene->polygonal_light_count, sizeof(uint32_t), 1, file);
+	// Lights extracted from the scene are not saved
+	uint32_t saved_light_count = 0;
+	for (uint32_t i = 0; i != scene->polygonal_light_count; ++i)
+		saved_light_count += scene->polygonal_lights[i].shared_vertices ? 0 : 1;
+	fwrite(&saved_light_count, sizeof(uint32_t), 1, file);
 	for (uint32_t i = 0; i != scene->polygonal_light_count; ++i) {
 		polygonal_light_t* light = &scene->polygonal_lights[i];
+		if (light->shared_vertices)
+			continue;
 		fwrite(light, POLYGONAL_LIGHT_QUICKSAVE_SIZE, 1, file);
 		size_t path_size = 0;
 		if (light->texture_file_path) {
@@ -96,8 +105,6 @@ void quick_load(scene_specification_t* scene, application_updates_t* updates) {
 	for (uint32_t i = 0; i != scene->polygonal_light_count; ++i) {
 		polygonal_light_t* light = &scene->polygonal_lights[i];
 		fread(light, POLYGONAL_LIGHT_QUICKSAVE_SIZE, 1, file);
-		if (i < old_polygonal_light_count && light->vertex_count != old_polygonal_lights[i].vertex_count)
-			vertex_count_changed = VK_TRUE;
 		// Quick fix for legacy files
 		if (light->scaling_y <= 0.0f) light->scaling_y = light->scaling_x;
 		// Read the texture file path (if any)
@@ -112,19 +119,77 @@ void quick_load(scene_specification_t* scene, application_updates_t* updates) {
 		}
 		// Read NULL pointers for backward compatibility
 		fread(&light->vertices_plane_space, sizeof(float*), 2, file);
+		light->shared_vertices = 0;
 		// Allocate and read vertex locations
 		set_polygonal_light_vertex_count(light, light->vertex_count);
 		fread(light->vertices_plane_space, sizeof(float), 4 * light->vertex_count, file);
 	}
+	fclose(file);
+	// Merge triangles that make up a larger polygon
+	if (scene->merge_coplanar_lights)
+		scene->polygonal_light_count = merge_coplanar_polygonal_lights(scene->polygonal_lights, scene->polygonal_light_count, scene->max_merged_light_vertex_count);
+	for (uint32_t i = 0; i != scene->polygonal_light_count && i < old_polygonal_light_count; ++i)
+		if (scene->polygonal_lights[i].vertex_count != old_polygonal_lights[i].vertex_count)
+			vertex_count_changed = VK_TRUE;
 	for (uint32_t i = 0; i != old_polygonal_light_count; ++i)
 		destroy_polygonal_light(&old_polygonal_lights[i]);
 	free(old_polygonal_lights);
-	fclose(file);
 	if (updates)
 		updates->update_light_count |= old_polygonal_light_count != scene->polygonal_light_count || vertex_count_changed;
 }
 
 
+/*! Removes all polygonal lights with shared vertices from the given scene
+	specification, i.e. those that were appended by
+	append_emissive_lights().*/
+void remove_emissive_lights(scene_specification_t* scene) {
+	uint32_t light_count = 0;
+	for (uint32_t i = 0; i != scene->polygonal_light_count; ++i)
+		if (!scene->polygonal_lights[i].shared_vertices)
+			scene->polygonal_lights[light_count++] = scene->polygonal_lights[i];
+	scene->polygonal_light_count = light_count;
+}
+
+
+/*! Appends the lights that have been extracted from emissive triangles of the
+	given scene to the polygonal lights of the scene specification. The
+	appended lights refer to vertices owned by the scene, so they have to be
+	removed using remove_emissive_lights() before the scene is destroyed.
+	\return 0 on success.*/
+int append_emissive_lights(scene_specification_t* scene_specification, const scene_t* scene) {
+	if (!scene->emissive_light_count)
+		return 0;
+	uint32_t light_count = scene_specification->polygonal_light_count + scene->emissive_light_count;
+	polygonal_light_t* lights = realloc(scene_specification->polygonal_lights, sizeof(polygonal_light_t) * light_count);
+	if (!lights) {
+		printf("Failed to allocate memory for %u polygonal lights.\n", light_count);
+		return 1;
+	}
+	memcpy(lights + scene_specification->polygonal_light_count, scene->emissive_lights, sizeof(polygonal_light_t) * scene->emissive_light_count);
+	// Merged lights own their vertices but here, they belong to the scene
+	for (uint32_t i = scene_specification->polygonal_light_count; i != light_count; ++i)
+		lights[i].shared_vertices = 1;
+	scene_specification->polygonal_lights = lights;
+	scene_specification->polygonal_light_count = light_count;
+	return 0;
+}
+
+
+/*! Translates settings in the given scene specification into a request for
+	load_scene(). The request refers to memory of the scene specification.
+	\return request or NULL if no lights should be extracted.*/
+const emissive_light_request_t* get_emissive_light_request(emissive_light_request_t* request, const scene_specification_t* scene) {
+	if (!scene->extract_emissive_lights)
+		return NULL;
+	request->use_light_flag = VK_TRUE;
+	request->material_count = scene->light_material_count;
+	request->material_names = (const char* const*) scene->light_material_names;
+	memcpy(request->radiance, scene->emissive_light_radiance, sizeof(request->radiance));
+	request->max_merged_vertex_count = scene->merge_coplanar_lights ? scene->max_merged_light_vertex_count : 0;
+	return request;
+}
+
+
 //! Fills the given object with a complete specification of the default scene
 void specify_default_scene(scene_specification_t* scene) {
 	uint32_t scene_index = scene_zeroday;
@@ -160,6 +225,15 @@ void specify_default_scene(scene_specification_t* scene) {
 	default_light.vertices_plane_space[3 * 4 + 1] = 1.0f;
 	scene->polygonal_lights = malloc(sizeof(default_light));
 	scene->polygonal_lights[0] = default_light;
+	// Lights from emissive triangles are off by default, because the
+	// quicksaves already hold lights for flagged triangles
+	scene->extract_emissive_lights = VK_FALSE;
+	scene->emissive_light_radiance[0] = scene->emissive_light_radiance[1] = scene->emissive_light_radiance[2] = 1.0f;
+	// Merging lights changes the light count, so it is optional as well
+	scene->merge_coplanar_lights = VK_FALSE;
+	scene->max_merged_light_vertex_count = 8;
+	// Streaming starts with blurry textures, so it is opt-in
+	scene->stream_textures = VK_FALSE;
 	// Try to quick load. Upon success, it will override the defaults above.
 	quick_load(scene, NULL);
 }
@@ -212,6 +286,9 @@ void destroy_scene_specification(scene_specification_t* scene) {
 	for (uint32_t i = 0; i != scene->polygonal_light_count; ++i)
 		destroy_polygonal_light(&scene->polygonal_lights[i]);
 	free(scene->polygonal_lights);
+	for (uint32_t i = 0; i != scene->light_material_count; ++i)
+		free(scene->light_material_names[i]);
+	free(scene->light_material_names);
 	memset(scene, 0, sizeof(*scene));
 }
 
@@ -222,6 +299,9 @@ void specify_default_render_settings(render_settings_t* settings) {
 	settings->roughness_factor = 1.0f;
 	settings->sample_count = 1;
 	settings->sample_count_light = 1;
+	settings->candidate_count = 32;
+	settings->adaptive_candidate_count = VK_FALSE;
+	settings->ris_target_function = ris_target_exact;
 	settings->mis_heuristic = mis_heuristic_optimal_clamped;
 	settings->mis_visibility_estimate = 0.5f;
 	settings->polygon_sampling_technique = sample_polygon_ltc_cp;
@@ -233,6 +313,22 @@ void specify_default_render_settings(render_settings_t* settings) {
 	settings->animate_noise = VK_TRUE;
 	settings->v_sync = VK_FALSE;
 	settings->show_gui = VK_TRUE;
+	settings->temporal_reuse = VK_FALSE;
+	settings->spatial_reuse = VK_FALSE;
+	settings->spatial_reuse_neighbour_count = 5;
+	settings->spatial_reuse_radius = 30.0f;
+	settings->light_culling = VK_FALSE;
+	settings->light_culling_threshold = 1.0e-3f;
+	settings->light_cluster_capacity = 1024;
+	settings->light_cache_probability = 0.5f;
+	settings->light_cache_cell_scale = 0.02f;
+	settings->light_cache_power_fallback = VK_FALSE;
+	settings->quantize_light_vertices = VK_FALSE;
+	settings->animate_lights = VK_FALSE;
+	settings->light_animation_amplitude = 0.5f;
+	settings->light_animation_frequency = 0.25f;
+	settings->compute_shading = VK_FALSE;
+	settings->wavefront_shading = VK_FALSE;
 }
 
 
@@ -271,7 +367,7 @@ int create_render_targets(render_targets_t* targets, const device_t* device, con
 				.format = VK_FORMAT_R32_UINT,
 				.extent = {swapchain->extent.width, swapchain->extent.height, 1},
 				.mipLevels = 1, .arrayLayers = 1, .samples = 1,
-				.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT
+				.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT
 			},
 			.view_info = {
 				.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -288,7 +384,7 @@ int create_render_targets(render_targets_t* targets, const device_t* device, con
 				.format = VK_FORMAT_R32G32B32A32_SFLOAT,
 				.extent = {swapchain->extent.width, swapchain->extent.height, 1},
 				.mipLevels = 1, .arrayLayers = 1, .samples = 1,
-				.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT
+				.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT
 			},
 			.view_info = {
 				.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -356,6 +452,78 @@ int create_render_targets(render_targets_t* targets, const device_t* device, con
 }
 
 
+//! The size in bytes of a single stored_reservoir_t in reservoir.glsl
+#define STORED_RESERVOIR_SIZE 32
+//! Stored reservoirs use 20 bits for light indices. Temporal reuse is
+//! disabled for scenes with more lights.
+#define STORED_RESERVOIR_MAX_LIGHT_COUNT 0xFFFFF
+//! The number of cells in the light cache. Must be a power of two.
+#define LIGHT_CACHE_CELL_COUNT (1 << 18)
+//! The number of lights stored per cell of the light cache
+#define LIGHT_CACHE_SLOT_COUNT 8
+//! The light cache uses 20 bits for light indices as well. For scenes with
+//! more lights, uniform candidate sampling is used instead.
+#define LIGHT_CACHE_MAX_LIGHT_COUNT 0xFFFFF
+
+//! Frees objects and zeros
+void destroy_reservoir_buffers(reservoir_buffers_t* reservoir_buffers, const device_t* device) {
+	destroy_buffers(&reservoir_buffers->buffers, device);
+	destroy_buffers(&reservoir_buffers->light_cache, device);
+	memset(reservoir_buffers, 0, sizeof(*reservoir_buffers));
+}
+
+//! Creates one buffer of per-pixel reservoirs per swapchain image and the
+//! light cache. They get cleared before they are used for the first time.
+int create_reservoir_buffers(reservoir_buffers_t* reservoir_buffers, const device_t* device, const swapchain_t* swapchain) {
+	memset(reservoir_buffers, 0, sizeof(*reservoir_buffers));
+	VkBufferCreateInfo reservoir_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = (VkDeviceSize) STORED_RESERVOIR_SIZE * swapchain->extent.width * swapchain->extent.height,
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+	};
+	VkBufferCreateInfo* reservoir_buffer_infos = malloc(sizeof(VkBufferCreateInfo) * swapchain->image_count);
+	for (uint32_t i = 0; i != swapchain->image_count; ++i)
+		reservoir_buffer_infos[i] = reservoir_buffer_info;
+	if (create_aligned_buffers(&reservoir_buffers->buffers, device, reservoir_buffer_infos, swapchain->image_count, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, device->physical_device_properties.limits.minStorageBufferOffsetAlignment)) {
+		printf("Failed to create reservoir buffers.\n");
+		free(reservoir_buffer_infos);
+		destroy_reservoir_buffers(reservoir_buffers, device);
+		return 1;
+	}
+	free(reservoir_buffer_infos);
+	VkBufferCreateInfo light_cache_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = sizeof(uint32_t) * (LIGHT_CACHE_SLOT_COUNT + 1) * LIGHT_CACHE_CELL_COUNT,
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+	};
+	if (create_buffers(&reservoir_buffers->light_cache, device, &light_cache_info, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+		printf("Failed to create the light cache.\n");
+		destroy_reservoir_buffers(reservoir_buffers, device);
+		return 1;
+	}
+	reservoir_buffers->clear_pending = VK_TRUE;
+	return 0;
+}
+
+//! Records commands that clear all reservoir buffers and the light cache, if
+//! that is pending, and
+//! makes the result visible to the shading pass
+void record_reservoir_buffer_clear(VkCommandBuffer cmd, reservoir_buffers_t* reservoir_buffers) {
+	if (!reservoir_buffers->clear_pending)
+		return;
+	for (uint32_t i = 0; i != reservoir_buffers->buffers.buffer_count; ++i)
+		vkCmdFillBuffer(cmd, reservoir_buffers->buffers.buffers[i].buffer, 0, VK_WHOLE_SIZE, 0);
+	vkCmdFillBuffer(cmd, reservoir_buffers->light_cache.buffers[0].buffer, 0, VK_WHOLE_SIZE, 0);
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	reservoir_buffers->clear_pending = VK_FALSE;
+}
+
+
 //! Frees objects and zeros
 void destroy_constant_buffers(constant_buffers_t* constant_buffers, const device_t* device) {
 	if (constant_buffers->data)
@@ -451,81 +619,378 @@ int create_and_assign_light_textures(images_t* light_textures, const device_t* d
 	return result;
 }
 
+//! Computes where each array of polygonal light data begins in the light
+//! buffer, following std430 rules
+void get_polygonal_light_buffer_layout(polygonal_light_buffer_layout_t* layout, const scene_specification_t* scene_specification, VkBool32 quantized) {
+	layout->quantized = quantized;
+	layout->light_count = (scene_specification->polygonal_light_count > 0) ? scene_specification->polygonal_light_count : 1;
+	layout->vertex_count = 0;
+	for (uint32_t i = 0; i != scene_specification->polygonal_light_count; ++i)
+		layout->vertex_count += scene_specification->polygonal_lights[i].vertex_count;
+	if (layout->vertex_count == 0)
+		layout->vertex_count = 1;
+	size_t vec4_array_size = sizeof(float) * 4 * layout->light_count;
+	layout->planes = 0;
+	// Arrays of vec4 are aligned to 16 bytes
+	size_t plane_size = quantized ? (sizeof(uint32_t) * layout->light_count) : vec4_array_size;
+	layout->radiance_area = layout->planes + (plane_size + 15) / 16 * 16;
+	layout->bounding_spheres = layout->radiance_area + vec4_array_size;
+	layout->vertex_ranges = layout->bounding_spheres + vec4_array_size;
+	size_t vertex_range_size = sizeof(uint32_t) * 2 * layout->light_count;
+	// Vertices are aligned to their size. A pool of uvec2 only needs 8 bytes,
+	// so for an odd light count quantized vertices start right after the
+	// vertex ranges.
+	size_t vertex_size = quantized ? (sizeof(uint32_t) * 2) : (sizeof(float) * 4);
+	layout->vertices = layout->vertex_ranges + (vertex_range_size + vertex_size - 1) / vertex_size * vertex_size;
+	layout->size = layout->vertices + vertex_size * layout->vertex_count;
+}
+
+
+/*! Prints how much quantized light vertices and normals deviate from the full
+	precision ones. Positions errors are given in world space units and
+	relative to the radius of the bounding sphere.*/
+void print_light_quantization_error(const void* data, const polygonal_light_buffer_layout_t* layout, const scene_specification_t* scene_specification) {
+	const uint32_t* packed_normals = (const uint32_t*) (((const char*) data) + layout->planes);
+	const float* bounding_spheres = (const float*) (((const char*) data) + layout->bounding_spheres);
+	const uint32_t* quantized_vertices = (const uint32_t*) (((const char*) data) + layout->vertices);
+	double max_error = 0.0, max_relative_error = 0.0, error_sum = 0.0;
+	double max_normal_angle = 0.0;
+	uint32_t vertex_index = 0;
+	for (uint32_t i = 0; i != scene_specification->polygonal_light_count; ++i) {
+		const polygonal_light_t* light = &scene_specification->polygonal_lights[i];
+		const float* bounding_sphere = bounding_spheres + 4 * i;
+		for (uint32_t j = 0; j != light->vertex_count; ++j, ++vertex_index) {
+			float vertex[3];
+			dequantize_polygonal_light_vertex(vertex, quantized_vertices + 2 * vertex_index, bounding_sphere);
+			double error_squared = 0.0;
+			for (uint32_t k = 0; k != 3; ++k) {
+				double difference = vertex[k] - light->vertices_world_space[4 * j + k];
+				error_squared += difference * difference;
+			}
+			double error = sqrt(error_squared);
+			error_sum += error;
+			max_error = (error > max_error) ? error : max_error;
+			double relative_error = (bounding_sphere[3] > 0.0f) ? (error / bounding_sphere[3]) : 0.0;
+			max_relative_error = (relative_error > max_relative_error) ? relative_error : max_relative_error;
+		}
+		float normal[3];
+		dequantize_polygonal_light_normal(normal, packed_normals[i]);
+		double cos_angle = normal[0] * light->plane[0] + normal[1] * light->plane[1] + normal[2] * light->plane[2];
+		double angle = acos((cos_angle > 1.0) ? 1.0 : cos_angle) * (180.0 / M_PI_F);
+		max_normal_angle = (angle > max_normal_angle) ? angle : max_normal_angle;
+	}
+	printf("Light quantization error: vertices max. %.3e (%.3e relative to bounding radius), mean %.3e; normals max. %.3e degrees.\n",
+		max_error, max_relative_error, (vertex_index > 0) ? (error_sum / vertex_index) : 0.0, max_normal_angle);
+}
+
+//! Writes data for a single light to the given memory location using the
+//! given layout. Its vertices go to the vertex pool starting at vertex_offset.
+//! update_polygonal_light() must have been called.
+void write_light(void* data, const polygonal_light_buffer_layout_t* layout, uint32_t light_index, uint32_t vertex_offset, const polygonal_light_t* light) {
+	float* planes = (float*) (((char*) data) + layout->planes);
+	float* radiance_area = (float*) (((char*) data) + layout->radiance_area);
+	float* bounding_spheres = (float*) (((char*) data) + layout->bounding_spheres);
+	uint32_t* vertex_ranges = (uint32_t*) (((char*) data) + layout->vertex_ranges);
+	float* vertices = (float*) (((char*) data) + layout->vertices);
+	uint32_t i = light_index;
+	// Write per-light data
+	memcpy(radiance_area + 4 * i, light->surface_radiance, sizeof(float) * 3);
+	radiance_area[4 * i + 3] = light->area;
+	get_polygonal_light_bounding_sphere(bounding_spheres + 4 * i, light);
+	vertex_ranges[2 * i + 0] = vertex_offset;
+	vertex_ranges[2 * i + 1] = light->vertex_count;
+	// Write the plane and vertices
+	if (layout->quantized)
+		quantize_polygonal_light(((uint32_t*) planes) + i, ((uint32_t*) vertices) + 2 * vertex_offset, bounding_spheres + 4 * i, light);
+	else {
+		memcpy(planes + 4 * i, light->plane, sizeof(float) * 4);
+		memcpy(vertices + 4 * vertex_offset, light->vertices_world_space, sizeof(float) * 4 * light->vertex_count);
+	}
+}
+
+/*! Writes the data that the light animation pass needs for a single light.
+	\param data Pointer to the beginning of the animation data (i.e. at
+		light_buffers_t::animation_offset in the light buffer).
+	\param vertex_offset The index of the first vertex of the light in the
+		vertex pool.*/
+void write_light_animation(void* data, const polygonal_light_buffer_layout_t* layout, uint32_t light_index, uint32_t vertex_offset, const polygonal_light_t* light, const polygonal_light_animation_t* animation) {
+	animated_polygonal_light_t* animated_lights = (animated_polygonal_light_t*) data;
+	float* plane_space_vertices = (float*) (animated_lights + layout->light_count);
+	animated_polygonal_light_t* animated = &animated_lights[light_index];
+	memcpy(animated->translation, light->translation, sizeof(animated->translation));
+	memcpy(animated->rotation_angles, light->rotation_angles, sizeof(animated->rotation_angles));
+	animated->scaling_x = light->scaling_x;
+	animated->scaling_y = light->scaling_y;
+	animated->animation = *animation;
+	for (uint32_t i = 0; i != light->vertex_count; ++i) {
+		plane_space_vertices[2 * (vertex_offset + i) + 0] = light->vertices_plane_space[4 * i + 0];
+		plane_space_vertices[2 * (vertex_offset + i) + 1] = light->vertices_plane_space[4 * i + 1];
+	}
+}
+
 //! Writes lights matching the current state of the application to the given
-//! memory location
+//! memory location using the layout from get_polygonal_light_buffer_layout()
 void write_lights(void* data, application_t* app) {
-	// Write polygonal lights
-	uint32_t max_vertex_count = get_max_polygonal_light_vertex_count(&app->scene_specification);
-	size_t offset = 0;
-	const uint32_t zero = 0;
+	polygonal_light_buffer_layout_t layout;
+	get_polygonal_light_buffer_layout(&layout, &app->scene_specification, app->light_buffers.quantized_vertices);
+	// Without lights, a single dummy light is written
+	memset(data, 0, layout.size);
 	printf("Found %d triangle lights\n", app->scene_specification.polygonal_light_count);
+	uint32_t vertex_offset = 0;
 	for (uint32_t i = 0; i != app->scene_specification.polygonal_light_count; ++i) {
 		polygonal_light_t* light = &app->scene_specification.polygonal_lights[i];
 		// Ensure that redundant attributes (including the texture index) are
 		// up to date
 		update_polygonal_light(light);
-		// Make the structure to upload ready
-		polygonal_light_upload_t upload_light = {
-			.surface_radiance[0] = light->surface_radiance[0],
-			.surface_radiance[1] = light->surface_radiance[1],
-			.surface_radiance[2] = light->surface_radiance[2],
-			.plane[0] = light->plane[0],
-			.plane[1] = light->plane[1],
-			.plane[2] = light->plane[2],
-			.plane[3] = light->plane[3],
-			.vertex_count = light->vertex_count,
-		};
 		create_and_assign_light_textures(NULL, &app->device, &app->scene_specification);
-		// Write fixed-size data
-		memcpy(((char*) data) + offset, &upload_light, POLYGONAL_LIGHT_FIXED_CONSTANT_BUFFER_SIZE);
-		offset += POLYGONAL_LIGHT_FIXED_CONSTANT_BUFFER_SIZE;
+		// Append the light and its vertices
+		write_light(data, &layout, i, vertex_offset, light);
+		vertex_offset += light->vertex_count;
+	}
+	if (layout.quantized)
+		print_light_quantization_error(data, &layout, &app->scene_specification);
+}
 
-		// Write vertex world space
-		memcpy(((char*) data) + offset, light->vertices_world_space, sizeof(float) * 4 * light->vertex_count);
-		if (light->vertex_count < max_vertex_count)
-			// Repeat the first vertex
-			memcpy(((char*) data) + offset + sizeof(float) * 4 * light->vertex_count, light->vertices_world_space, sizeof(float) * 4);
-		offset += sizeof(float) * 4 * max_vertex_count;
+/*! Flags a polygonal light as changed, such that its data in the light buffer
+	along with the light BVH and the alias table get updated when the next
+	frame is recorded. This is cheap and does not stall. The number of lights
+	and their vertex counts must not change, otherwise update_light_count has
+	to be used instead.*/
+void mark_polygonal_light_dirty(light_buffers_t* light_buffers, uint32_t light_index) {
+	if (light_buffers->dirty_lights[light_index])
+		return;
+	light_buffers->dirty_lights[light_index] = 1;
+	light_buffers->dirty_light_indices[light_buffers->dirty_light_count++] = light_index;
+}
+
+/*! Copies the given byte range of the host copy of the light buffer into the
+	staging buffer right after the previously staged range and adds a copy
+	region for it. Adjacent ranges are merged into one region.
+	\param region_count The number of used entries in
+		light_buffers->copy_regions. Gets updated.
+	\param slice_offset The offset in bytes of the staging slice that is used
+		for the current frame.*/
+void stage_light_buffer_range(light_buffers_t* light_buffers, uint32_t* region_count, VkDeviceSize slice_offset, VkDeviceSize offset, VkDeviceSize size) {
+	VkBufferCopy* last = (*region_count > 0) ? &light_buffers->copy_regions[*region_count - 1] : NULL;
+	VkDeviceSize staging_offset = last ? (last->srcOffset + last->size) : slice_offset;
+	memcpy(((char*) light_buffers->staging_data) + staging_offset, ((const char*) light_buffers->data) + offset, size);
+	if (last && last->dstOffset + last->size == offset)
+		last->size += size;
+	else {
+		VkBufferCopy region = { .srcOffset = staging_offset, .dstOffset = offset, .size = size };
+		light_buffers->copy_regions[(*region_count)++] = region;
 	}
 }
 
+/*! Records commands that copy data of all lights that have been marked using
+	mark_polygonal_light_dirty() into the light buffer. The light BVH is
+	refit and the alias table is rebuilt, if necessary, and changed nodes and
+	entries are copied as well. Data is staged in the slice of the staging
+	buffer for the given swapchain image. The copies are made visible to the
+	light culling pass and the shading pass.*/
+void record_light_buffer_updates(VkCommandBuffer cmd, application_t* app, uint32_t swapchain_index) {
+	light_buffers_t* light_buffers = &app->light_buffers;
+	if (light_buffers->dirty_light_count == 0)
+		return;
+	scene_specification_t* scene_specification = &app->scene_specification;
+	polygonal_light_buffer_layout_t layout;
+	get_polygonal_light_buffer_layout(&layout, scene_specification, light_buffers->quantized_vertices);
+	VkDeviceSize slice_offset = (VkDeviceSize) light_buffers->size * (swapchain_index % light_buffers->staging_slice_count);
+	uint32_t region_count = 0;
+	// Update the host copy for all dirty lights and stage what has changed.
+	// Vertex ranges stay the same.
+	const uint32_t* vertex_ranges = (const uint32_t*) (((const char*) light_buffers->data) + layout.vertex_ranges);
+	VkDeviceSize plane_size = layout.quantized ? sizeof(uint32_t) : (sizeof(float) * 4);
+	VkDeviceSize vertex_size = layout.quantized ? (sizeof(uint32_t) * 2) : (sizeof(float) * 4);
+	for (uint32_t j = 0; j != light_buffers->dirty_light_count; ++j) {
+		uint32_t i = light_buffers->dirty_light_indices[j];
+		polygonal_light_t* light = &scene_specification->polygonal_lights[i];
+		if (light->vertex_count != vertex_ranges[2 * i + 1]) {
+			printf("The vertex count of polygonal light %u has changed without a request to update the light count. Ignoring the change.\n", i);
+			light_buffers->dirty_lights[i] = 0;
+			continue;
+		}
+		update_polygonal_light(light);
+		write_light(light_buffers->data, &layout, i, vertex_ranges[2 * i + 0], light);
+		stage_light_buffer_range(light_buffers, &region_count, slice_offset, layout.planes + plane_size * i, plane_size);
+		stage_light_buffer_range(light_buffers, &region_count, slice_offset, layout.radiance_area + sizeof(float) * 4 * i, sizeof(float) * 4);
+		stage_light_buffer_range(light_buffers, &region_count, slice_offset, layout.bounding_spheres + sizeof(float) * 4 * i, sizeof(float) * 4);
+		stage_light_buffer_range(light_buffers, &region_count, slice_offset, layout.vertices + vertex_size * vertex_ranges[2 * i + 0], vertex_size * light->vertex_count);
+		// The animation pass overwrites all of the above and needs its inputs
+		if (light_buffers->animated) {
+			generate_polygonal_light_animation(&light_buffers->animations[i], i, app->render_settings.light_animation_amplitude, app->render_settings.light_animation_frequency);
+			write_light_animation(((char*) light_buffers->data) + light_buffers->animation_offset, &layout, i, vertex_ranges[2 * i + 0], light, &light_buffers->animations[i]);
+			VkDeviceSize plane_space_vertices_offset = light_buffers->animation_offset + sizeof(animated_polygonal_light_t) * layout.light_count;
+			stage_light_buffer_range(light_buffers, &region_count, slice_offset, light_buffers->animation_offset + sizeof(animated_polygonal_light_t) * i, sizeof(animated_polygonal_light_t));
+			stage_light_buffer_range(light_buffers, &region_count, slice_offset, plane_space_vertices_offset + sizeof(float) * 2 * vertex_ranges[2 * i + 0], sizeof(float) * 2 * light->vertex_count);
+		}
+	}
+	// Refit the light BVH and stage changed nodes
+	light_bvh_t bvh = {
+		.node_count = light_buffers->bvh_size / sizeof(light_bvh_node_t),
+		.nodes = (light_bvh_node_t*) (((char*) light_buffers->data) + light_buffers->bvh_offset),
+		.max_depth = light_buffers->bvh_max_depth,
+	};
+	memset(light_buffers->bvh_nodes_changed, 0, bvh.node_count);
+	int power_changed = refit_light_bvh(&bvh, light_buffers->bvh_nodes_changed, scene_specification->polygonal_lights, light_buffers->animations, scene_specification->polygonal_light_count, light_buffers->dirty_lights);
+	for (uint32_t i = 0; i != bvh.node_count; ++i)
+		if (light_buffers->bvh_nodes_changed[i])
+			stage_light_buffer_range(light_buffers, &region_count, slice_offset, light_buffers->bvh_offset + sizeof(light_bvh_node_t) * i, sizeof(light_bvh_node_t));
+	// The alias table only depends on the power of lights
+	if (power_changed) {
+		uint32_t entry_count = light_buffers->alias_table_size / sizeof(polygonal_light_alias_entry_t);
+		polygonal_light_alias_entry_t* old_entries = (polygonal_light_alias_entry_t*) (((char*) light_buffers->data) + light_buffers->alias_table_offset);
+		polygonal_light_alias_entry_t* new_entries = malloc(light_buffers->alias_table_size);
+		write_polygonal_light_alias_table(new_entries, scene_specification->polygonal_lights, scene_specification->polygonal_light_count);
+		for (uint32_t i = 0; i != entry_count; ++i) {
+			if (memcmp(&old_entries[i], &new_entries[i], sizeof(polygonal_light_alias_entry_t)) != 0) {
+				old_entries[i] = new_entries[i];
+				stage_light_buffer_range(light_buffers, &region_count, slice_offset, light_buffers->alias_table_offset + sizeof(polygonal_light_alias_entry_t) * i, sizeof(polygonal_light_alias_entry_t));
+			}
+		}
+		free(new_entries);
+	}
+	// All dirty lights are handled now
+	for (uint32_t j = 0; j != light_buffers->dirty_light_count; ++j)
+		light_buffers->dirty_lights[light_buffers->dirty_light_indices[j]] = 0;
+	light_buffers->dirty_light_count = 0;
+	if (region_count == 0)
+		return;
+	// Make the staged data available to the device
+	const VkBufferCopy* last = &light_buffers->copy_regions[region_count - 1];
+	vmaFlushAllocation(app->allocator, light_buffers->staging_allocation, slice_offset, last->srcOffset + last->size - slice_offset);
+	// Previous frames may still read the light buffer
+	VkMemoryBarrier read_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &read_barrier, 0, NULL, 0, NULL);
+	vkCmdCopyBuffer(cmd, light_buffers->staging_buffer, light_buffers->buffer, region_count, light_buffers->copy_regions);
+	VkMemoryBarrier write_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &write_barrier, 0, NULL, 0, NULL);
+}
+
 //! Frees objects and zeros
 void destroy_light_buffers(light_buffers_t* light_buffers, const device_t* device, VmaAllocator allocator) {
 	vmaDestroyBuffer(allocator, light_buffers->buffer, light_buffers->allocation);
+	vmaDestroyBuffer(allocator, light_buffers->staging_buffer, light_buffers->staging_allocation);
+	free(light_buffers->data);
+	free(light_buffers->dirty_lights);
+	free(light_buffers->dirty_light_indices);
+	free(light_buffers->copy_regions);
+	free(light_buffers->bvh_nodes_changed);
+	free(light_buffers->animations);
 	memset(light_buffers, 0, sizeof(*light_buffers));
 }
 
-//! Allocates constant buffers and maps their memory
+//! Allocates the light buffer, the staging buffer and memory for tracking
+//! changes, then uploads all lights
 int create_light_buffers(light_buffers_t* light_buffers, const device_t* device, const swapchain_t* swapchain, const scene_specification_t* scene_specification, application_t *app) {
 	memset(light_buffers, 0, sizeof(*light_buffers));
+	light_buffers->quantized_vertices = app->render_settings.quantize_light_vertices;
+	light_buffers->animated = app->render_settings.animate_lights;
 	// Compute the total size for the light buffer
-	size_t polygonal_light_size = POLYGONAL_LIGHT_FIXED_CONSTANT_BUFFER_SIZE + sizeof(float) * (12 * get_max_polygonal_light_vertex_count(scene_specification) - 8);
-	size_t size = scene_specification->polygonal_light_count * polygonal_light_size;
-	if (scene_specification->polygonal_light_count == 0) size += polygonal_light_size;
+	polygonal_light_buffer_layout_t layout;
+	get_polygonal_light_buffer_layout(&layout, scene_specification, light_buffers->quantized_vertices);
+	size_t size = layout.size;
+	// The light BVH follows the lights in the same buffer
+	VkDeviceSize alignment = device->physical_device_properties.limits.minStorageBufferOffsetAlignment;
+	size = (size + alignment - 1) / alignment * alignment;
+	light_buffers->bvh_offset = (uint32_t) size;
+	uint32_t bvh_node_count = get_light_bvh_node_count(scene_specification->polygonal_light_count);
+	light_buffers->bvh_size = (uint32_t) (sizeof(light_bvh_node_t) * bvh_node_count);
+	size += light_buffers->bvh_size;
+	// Followed by the alias table
+	size = (size + alignment - 1) / alignment * alignment;
+	light_buffers->alias_table_offset = (uint32_t) size;
+	uint32_t alias_table_entry_count = (scene_specification->polygonal_light_count > 0) ? scene_specification->polygonal_light_count : 1;
+	light_buffers->alias_table_size = (uint32_t) (sizeof(polygonal_light_alias_entry_t) * alias_table_entry_count);
+	size += light_buffers->alias_table_size;
+	// And by the input of the light animation pass
+	if (light_buffers->animated) {
+		size = (size + alignment - 1) / alignment * alignment;
+		light_buffers->animation_offset = (uint32_t) size;
+		light_buffers->animation_size = (uint32_t) (sizeof(animated_polygonal_light_t) * layout.light_count + sizeof(float) * 2 * layout.vertex_count);
+		size += light_buffers->animation_size;
+	}
+	// Slices of the staging buffer start at multiples of this size, so keep
+	// them aligned for flushes
+	VkDeviceSize atom_size = device->physical_device_properties.limits.nonCoherentAtomSize;
+	size = (size + atom_size - 1) / atom_size * atom_size;
+	light_buffers->size = (uint32_t) size;
+
+	// Allocate memory for the host copy and change tracking. Each light
+	// produces at most six copy regions, nodes and alias table entries at
+	// most one each.
+	light_buffers->data = malloc(size);
+	light_buffers->dirty_lights = calloc(layout.light_count, sizeof(uint8_t));
+	light_buffers->dirty_light_indices = malloc(sizeof(uint32_t) * layout.light_count);
+	light_buffers->copy_regions = malloc(sizeof(VkBufferCopy) * (6 * layout.light_count + bvh_node_count + alias_table_entry_count));
+	light_buffers->bvh_nodes_changed = malloc(sizeof(uint8_t) * bvh_node_count);
+	if (light_buffers->animated)
+		light_buffers->animations = malloc(sizeof(polygonal_light_animation_t) * layout.light_count);
+	if (!light_buffers->data || !light_buffers->dirty_lights || !light_buffers->dirty_light_indices || !light_buffers->copy_regions || !light_buffers->bvh_nodes_changed
+		|| (light_buffers->animated && !light_buffers->animations)) {
+		printf("Failed to allocate host memory for light buffers.\n");
+		destroy_light_buffers(light_buffers, device, app->allocator);
+		return 1;
+	}
+	memset(light_buffers->data, 0, size);
 
-	// Create a staging buffer on CPU side
+	// Create the persistently mapped staging buffer with one slice per
+	// swapchain image
+	light_buffers->staging_slice_count = swapchain->image_count;
 	VkBufferCreateInfo staging_buffer_info = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
 		.pNext = NULL,
-		.size = size,
+		.size = size * light_buffers->staging_slice_count,
 		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
 	};
-	VmaAllocationCreateInfo staging_alloc_info = { .usage = VMA_MEMORY_USAGE_CPU_ONLY };
-	VkBuffer staging_buffer;
-	VmaAllocation staging_allocation;
-	if (vmaCreateBuffer(app->allocator, &staging_buffer_info, &staging_alloc_info, &staging_buffer, &staging_allocation, NULL)) {
+	VmaAllocationCreateInfo staging_alloc_info = {
+		.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+		.usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+	};
+	VmaAllocationInfo staging_allocation_info;
+	if (vmaCreateBuffer(app->allocator, &staging_buffer_info, &staging_alloc_info, &light_buffers->staging_buffer, &light_buffers->staging_allocation, &staging_allocation_info)) {
 		printf("Failed to create staging buffer\n");
+		destroy_light_buffers(light_buffers, device, app->allocator);
 		return 1;
 	}
+	light_buffers->staging_data = staging_allocation_info.pMappedData;
 
-	// Write the data to the staging buffer
-	void *data;
-	vmaMapMemory(app->allocator, staging_allocation, &data);
+	// Write the data to the host copy
+	void* data = light_buffers->data;
 	write_lights(data, app);
-	vmaUnmapMemory(app->allocator, staging_allocation);
+	if (light_buffers->animated) {
+		uint32_t vertex_offset = 0;
+		for (uint32_t i = 0; i != scene_specification->polygonal_light_count; ++i) {
+			const polygonal_light_t* light = &scene_specification->polygonal_lights[i];
+			generate_polygonal_light_animation(&light_buffers->animations[i], i, app->render_settings.light_animation_amplitude, app->render_settings.light_animation_frequency);
+			write_light_animation(((char*) data) + light_buffers->animation_offset, &layout, i, vertex_offset, light, &light_buffers->animations[i]);
+			vertex_offset += light->vertex_count;
+		}
+	}
+	// Build the light BVH, now that all lights are up to date
+	light_bvh_t bvh;
+	if (build_light_bvh(&bvh, app->scene_specification.polygonal_lights, light_buffers->animations, app->scene_specification.polygonal_light_count)) {
+		printf("Failed to build a light BVH for %u polygonal lights.\n", app->scene_specification.polygonal_light_count);
+		destroy_light_buffers(light_buffers, device, app->allocator);
+		return 1;
+	}
+	memcpy(((char*) data) + light_buffers->bvh_offset, bvh.nodes, light_buffers->bvh_size);
+	light_buffers->bvh_max_depth = bvh.max_depth;
+	destroy_light_bvh(&bvh);
+	write_polygonal_light_alias_table((polygonal_light_alias_entry_t*) (((char*) data) + light_buffers->alias_table_offset), app->scene_specification.polygonal_lights, app->scene_specification.polygonal_light_count);
+	// Stage all of it in the first slice
+	memcpy(light_buffers->staging_data, data, size);
+	vmaFlushAllocation(app->allocator, light_buffers->staging_allocation, 0, size);
 
 	// Allocate a buffer on the GPU
-	light_buffers->size = size;
 	VkBufferCreateInfo light_buffer_info = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
 		.size = size,
@@ -535,7 +1000,6 @@ int create_light_buffers(light_buffers_t* light_buffers, const device_t* device,
 	if (vmaCreateBuffer(app->allocator, &light_buffer_info, &light_alloc_info, &light_buffers->buffer, &light_buffers->allocation, NULL)) {
 		printf("Failed to create light buffers.\n");
 		destroy_light_buffers(light_buffers, device, app->allocator);
-		vmaDestroyBuffer(app->allocator, staging_buffer, staging_allocation);
 		return 1;
 	}
 
@@ -550,7 +1014,6 @@ int create_light_buffers(light_buffers_t* light_buffers, const device_t* device,
 	};
 	if (vkAllocateCommandBuffers(device->device, &cmd_buffer_info, &cmd)) {
 		destroy_light_buffers(light_buffers, device, app->allocator);
-		vmaDestroyBuffer(app->allocator, staging_buffer, staging_allocation);
 		return 1;
 	};
 
@@ -563,7 +1026,6 @@ int create_light_buffers(light_buffers_t* light_buffers, const device_t* device,
 	if (vkCreateFence(device->device, &fence_info, NULL, &fence)) {
 		printf("Failed to create copy fence\n");
 		destroy_light_buffers(light_buffers, device, app->allocator);
-		vmaDestroyBuffer(app->allocator, staging_buffer, staging_allocation);
 		vkFreeCommandBuffers(device->device, device->command_pool, 1, &cmd);
 		return 1;
 	}
@@ -575,7 +1037,6 @@ int create_light_buffers(light_buffers_t* light_buffers, const device_t* device,
 	};
 	if (vkBeginCommandBuffer(cmd, &begin_info)) {
 		destroy_light_buffers(light_buffers, device, app->allocator);
-		vmaDestroyBuffer(app->allocator, staging_buffer, staging_allocation);
 		vkFreeCommandBuffers(device->device, device->command_pool, 1, &cmd);
 		vkDestroyFence(device->device, fence, NULL);
 		return 1;
@@ -586,12 +1047,11 @@ int create_light_buffers(light_buffers_t* light_buffers, const device_t* device,
 		.srcOffset = 0,
 		.size = size,
 	};
-	vkCmdCopyBuffer(cmd, staging_buffer, light_buffers->buffer, 1, &buffer_copy);
+	vkCmdCopyBuffer(cmd, light_buffers->staging_buffer, light_buffers->buffer, 1, &buffer_copy);
 
 	// End recording commands
 	if (vkEndCommandBuffer(cmd)) {
 		destroy_light_buffers(light_buffers, device, app->allocator);
-		vmaDestroyBuffer(app->allocator, staging_buffer, staging_allocation);
 		vkFreeCommandBuffers(device->device, device->command_pool, 1, &cmd);
 		vkDestroyFence(device->device, fence, NULL);
 		return 1;
@@ -610,7 +1070,6 @@ int create_light_buffers(light_buffers_t* light_buffers, const device_t* device,
 	};
 	if (vkQueueSubmit(device->queue, 1, &submit_info, fence)) {
 		destroy_light_buffers(light_buffers, device, app->allocator);
-		vmaDestroyBuffer(app->allocator, staging_buffer, staging_allocation);
 		vkFreeCommandBuffers(device->device, device->command_pool, 1, &cmd);
 		vkDestroyFence(device->device, fence, NULL);
 		return 1;
@@ -625,7 +1084,7 @@ int create_light_buffers(light_buffers_t* light_buffers, const device_t* device,
 
 	// Destroy stuff
 	vkDestroyFence(device->device, fence, NULL);
-	vmaDestroyBuffer(app->allocator, staging_buffer, staging_allocation);
+	vkFreeCommandBuffers(device->device, device->command_pool, 1, &cmd);
 	
 	return 0;
 }
@@ -641,7 +1100,7 @@ void destroy_geometry_pass(geometry_pass_t* pass, const device_t* device) {
 
 //! Creates Vulkan objects for the geometry pass
 int create_geometry_pass(geometry_pass_t* pass, const device_t* device, const swapchain_t* swapchain,
-	const scene_t* scene, const constant_buffers_t* constant_buffers, const render_targets_t* render_targets, const render_pass_t* render_pass)
+	const scene_t* scene, const constant_buffers_t* constant_buffers, const render_targets_t* render_targets, const render_pass_t* render_pass, VkPipelineCache pipeline_cache)
 {
 	memset(pass, 0, sizeof(*pass));
 	pipeline_with_bindings_t* pipeline = &pass->pipeline;
@@ -702,10 +1161,565 @@ int create_geometry_pass(geometry_pass_t* pass, const device_t* device, const sw
 	VkVertexInputAttributeDescription vertex_attribute = {.location = 0, .binding = 0, .format = VK_FORMAT_R32G32_UINT, .offset = 0};
 	VkPipelineVertexInputStateCreateInfo vertex_input_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-		.vertexBindingDescriptionCount = 1,
-		.pVertexBindingDescriptions = &vertex_binding,
-		.vertexAttributeDescriptionCount = 1,
-		.pVertexAttributeDescriptions = &vertex_attribute
+		.vertexBindingDescriptionCount = 1,
+		.pVertexBindingDescriptions = &vertex_binding,
+		.vertexAttributeDescriptionCount = 1,
+		.pVertexAttributeDescriptions = &vertex_attribute
+	};
+	VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.primitiveRestartEnable = VK_FALSE,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
+	};
+	VkPipelineRasterizationStateCreateInfo raster_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = VK_CULL_MODE_BACK_BIT,
+		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+		.lineWidth = 1.0f,
+	};
+	VkPipelineColorBlendAttachmentState blend_attachment_state = {
+		.alphaBlendOp = VK_BLEND_OP_ADD,
+		.colorBlendOp = VK_BLEND_OP_ADD,
+		.srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
+		.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+	};
+	VkPipelineColorBlendStateCreateInfo blend_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.attachmentCount = 1,
+		.pAttachments = &blend_attachment_state,
+		.logicOp = VK_LOGIC_OP_NO_OP,
+		.blendConstants = {1.0f, 1.0f, 1.0f, 1.0f}
+	};
+	VkViewport viewport = {
+		.x = 0.0f, .y = 0.0f,
+		.width = (float)swapchain->extent.width, .height = (float)swapchain->extent.height,
+		.minDepth = 0.0f, .maxDepth = 1.0f
+	};
+	VkRect2D scissor = {.extent = swapchain->extent};
+	VkPipelineViewportStateCreateInfo viewport_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.scissorCount = 1,
+		.pScissors = &scissor,
+		.pViewports = &viewport
+	};
+	VkPipelineDepthStencilStateCreateInfo depth_stencil_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.depthTestEnable = VK_TRUE,
+		.depthWriteEnable = VK_TRUE,
+		.depthCompareOp = VK_COMPARE_OP_LESS
+	};
+	VkPipelineMultisampleStateCreateInfo multi_sample_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+	};
+	VkPipelineShaderStageCreateInfo shader_stages[2] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_VERTEX_BIT,
+			.module = pass->vertex_shader.module,
+			.pName = "main"
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.module = pass->fragment_shader.module,
+			.pName = "main"
+		}
+	};
+	VkGraphicsPipelineCreateInfo pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.layout = pipeline->pipeline_layout,
+		.pVertexInputState = &vertex_input_info,
+		.pInputAssemblyState = &input_assembly_info,
+		.pRasterizationState = &raster_info,
+		.pColorBlendState = &blend_info,
+		.pTessellationState = NULL,
+		.pMultisampleState = &multi_sample_info,
+		.pDynamicState = NULL,
+		.pViewportState = &viewport_info,
+		.pDepthStencilState = &depth_stencil_info,
+		.stageCount = 2,
+		.pStages = shader_stages,
+		.renderPass = render_pass->render_pass,
+		.subpass = 0
+	};
+	if (vkCreateGraphicsPipelines(device->device, pipeline_cache, 1, &pipeline_info, NULL, &pass->pipeline.pipeline)) {
+		printf("Failed to create a graphics pipeline for the geometry pass.\n");
+		destroy_geometry_pass(pass, device);
+		return 1;
+	}
+	return 0;
+}
+
+
+//! The size in pixels of screen-space tiles for light clusters
+#define LIGHT_CLUSTER_TILE_SIZE 64
+//! The number of depth slices for light clusters
+#define LIGHT_CLUSTER_DEPTH_SLICE_COUNT 16
+//! With light culling, the probability of picking a light from the list of
+//! the cluster rather than from all lights. It must be less than one.
+#define LIGHT_CLUSTER_PROBABILITY 0.9f
+
+//! Returns VK_TRUE iff light culling is enabled and compatible with the
+//! chosen light sampling strategy
+VkBool32 use_light_culling(const render_settings_t* settings) {
+	return settings->light_culling && (settings->light_sampling == light_uniform || settings->light_sampling == light_reservoir);
+}
+
+//! Frees objects and zeros
+void destroy_light_culling_pass(light_culling_pass_t* pass, const device_t* device) {
+	destroy_pipeline_with_bindings(&pass->pipeline, device);
+	destroy_shader(&pass->compute_shader, device);
+	destroy_buffers(&pass->cluster_buffer, device);
+	if (pass->overflow_data)
+		vkUnmapMemory(device->device, pass->overflow_buffers.memory);
+	destroy_buffers(&pass->overflow_buffers, device);
+	memset(pass, 0, sizeof(*pass));
+}
+
+//! Creates Vulkan objects for the light culling pass
+int create_light_culling_pass(light_culling_pass_t* pass, application_t* app) {
+	memset(pass, 0, sizeof(*pass));
+	const device_t* device = &app->device;
+	const swapchain_t* swapchain = &app->swapchain;
+	VkBool32 light_culling = use_light_culling(&app->render_settings);
+	// Create the buffer for the clusters. Without light culling, it only
+	// serves as dummy binding.
+	pass->cluster_counts[0] = (swapchain->extent.width + LIGHT_CLUSTER_TILE_SIZE - 1) / LIGHT_CLUSTER_TILE_SIZE;
+	pass->cluster_counts[1] = (swapchain->extent.height + LIGHT_CLUSTER_TILE_SIZE - 1) / LIGHT_CLUSTER_TILE_SIZE;
+	pass->cluster_counts[2] = LIGHT_CLUSTER_DEPTH_SLICE_COUNT;
+	uint32_t cluster_count = pass->cluster_counts[0] * pass->cluster_counts[1] * pass->cluster_counts[2];
+	uint32_t capacity = app->render_settings.light_cluster_capacity;
+	pass->cluster_capacity = (capacity < 1) ? 1 : ((capacity > MAX_LIGHT_CLUSTER_CAPACITY) ? MAX_LIGHT_CLUSTER_CAPACITY : capacity);
+	VkBufferCreateInfo cluster_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = light_culling ? (sizeof(uint32_t) * (VkDeviceSize) cluster_count * (1 + pass->cluster_capacity)) : (sizeof(uint32_t) * 4),
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+	};
+	if (create_buffers(&pass->cluster_buffer, device, &cluster_buffer_info, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+		printf("Failed to create a buffer for light clusters with room for %u lights per cluster.\n", pass->cluster_capacity);
+		destroy_light_culling_pass(pass, device);
+		return 1;
+	}
+	if (!light_culling)
+		return 0;
+	// Create buffers through which the host learns how many lists overflowed
+	VkBufferCreateInfo* overflow_buffer_infos = malloc(sizeof(VkBufferCreateInfo) * swapchain->image_count);
+	for (uint32_t i = 0; i != swapchain->image_count; ++i) {
+		VkBufferCreateInfo overflow_buffer_info = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.size = sizeof(uint32_t),
+			.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		};
+		overflow_buffer_infos[i] = overflow_buffer_info;
+	}
+	int overflow_result = create_aligned_buffers(&pass->overflow_buffers, device, overflow_buffer_infos, swapchain->image_count,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, device->physical_device_properties.limits.minStorageBufferOffsetAlignment);
+	free(overflow_buffer_infos);
+	if (overflow_result || vkMapMemory(device->device, pass->overflow_buffers.memory, 0, VK_WHOLE_SIZE, 0, &pass->overflow_data)) {
+		printf("Failed to create buffers for counting overflowing light clusters.\n");
+		destroy_light_culling_pass(pass, device);
+		return 1;
+	}
+	memset(pass->overflow_data, 0, pass->overflow_buffers.size);
+	// Create descriptor sets
+	VkDescriptorSetLayoutBinding layout_bindings[] = {
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER },
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },	// Lights
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },	// Clusters
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },	// Overflow count
+	};
+	descriptor_set_request_t set_request = {
+		.stage_flags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.min_descriptor_count = 1,
+		.binding_count = COUNT_OF(layout_bindings),
+		.bindings = layout_bindings,
+	};
+	if (create_descriptor_sets(&pass->pipeline, device, &set_request, swapchain->image_count, NULL, 0)) {
+		printf("Failed to allocate descriptor sets for the light culling pass.\n");
+		destroy_light_culling_pass(pass, device);
+		return 1;
+	}
+	VkDescriptorBufferInfo constant_buffer_info = { .offset = 0 };
+	VkDescriptorBufferInfo light_buffer_info = {
+		.buffer = app->light_buffers.buffer,
+		.offset = 0, .range = app->light_buffers.bvh_offset
+	};
+	VkDescriptorBufferInfo cluster_buffer_info_write = {
+		.buffer = pass->cluster_buffer.buffers[0].buffer,
+		.offset = 0, .range = pass->cluster_buffer.buffers[0].size
+	};
+	VkDescriptorBufferInfo overflow_buffer_info = { .offset = 0 };
+	VkWriteDescriptorSet descriptor_set_writes[] = {
+		{ .dstBinding = 0, .pBufferInfo = &constant_buffer_info },
+		{ .dstBinding = 1, .pBufferInfo = &light_buffer_info },
+		{ .dstBinding = 2, .pBufferInfo = &cluster_buffer_info_write },
+		{ .dstBinding = 3, .pBufferInfo = &overflow_buffer_info },
+	};
+	complete_descriptor_set_write(COUNT_OF(descriptor_set_writes), descriptor_set_writes, &set_request);
+	for (uint32_t i = 0; i != swapchain->image_count; ++i) {
+		constant_buffer_info.buffer = app->constant_buffers.buffers.buffers[i].buffer;
+		constant_buffer_info.range = app->constant_buffers.buffers.buffers[i].size;
+		overflow_buffer_info.buffer = pass->overflow_buffers.buffers[i].buffer;
+		overflow_buffer_info.range = pass->overflow_buffers.buffers[i].size;
+		for (uint32_t j = 0; j != COUNT_OF(descriptor_set_writes); ++j)
+			descriptor_set_writes[j].dstSet = pass->pipeline.descriptor_sets[i];
+		vkUpdateDescriptorSets(device->device, COUNT_OF(descriptor_set_writes), descriptor_set_writes, 0, NULL);
+	}
+	// Compile the compute shader
+	uint32_t light_count = app->scene_specification.polygonal_light_count;
+	char* defines[] = {
+		format_uint("POLYGONAL_LIGHT_COUNT=%u", light_count),
+		format_uint("POLYGONAL_LIGHT_ARRAY_SIZE=%u", (light_count > 0) ? light_count : 1),
+		format_uint("QUANTIZED_LIGHT_VERTICES=%u", app->light_buffers.quantized_vertices),
+		format_uint("LIGHT_CLUSTER_TILE_SIZE=%u", LIGHT_CLUSTER_TILE_SIZE),
+		format_uint("LIGHT_CLUSTER_COUNT_X=%u", pass->cluster_counts[0]),
+		format_uint("LIGHT_CLUSTER_COUNT_Y=%u", pass->cluster_counts[1]),
+		format_uint("LIGHT_CLUSTER_DEPTH_SLICE_COUNT=%u", pass->cluster_counts[2]),
+		format_uint("LIGHT_CLUSTER_MAX_LIGHT_COUNT=%u", pass->cluster_capacity),
+		format_float("LIGHT_CULLING_THRESHOLD=%f", app->render_settings.light_culling_threshold),
+	};
+	shader_request_t compute_shader_request = {
+		.shader_file_path = "src/shaders/light_culling.comp.glsl",
+		.include_path = "src/shaders",
+		.entry_point = "main",
+		.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+		.define_count = COUNT_OF(defines),
+		.defines = defines
+	};
+	int compile_result = compile_glsl_shader_with_second_chance(&pass->compute_shader, device, &compute_shader_request);
+	for (uint32_t i = 0; i != COUNT_OF(defines); ++i)
+		free(defines[i]);
+	if (compile_result) {
+		printf("Failed to compile the compute shader for the light culling pass.\n");
+		destroy_light_culling_pass(pass, device);
+		return 1;
+	}
+	// Create the compute pipeline
+	VkComputePipelineCreateInfo pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.layout = pass->pipeline.pipeline_layout,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = pass->compute_shader.module,
+			.pName = "main"
+		}
+	};
+	if (vkCreateComputePipelines(device->device, app->pipeline_cache.cache, 1, &pipeline_info, NULL, &pass->pipeline.pipeline)) {
+		printf("Failed to create a compute pipeline for the light culling pass.\n");
+		destroy_light_culling_pass(pass, device);
+		return 1;
+	}
+	return 0;
+}
+
+/*! Records commands for the light culling pass (if enabled) and surrounds
+	them by timestamps with the given query indices.*/
+void record_light_culling_pass(VkCommandBuffer cmd, const light_culling_pass_t* pass, VkQueryPool query_pool, uint32_t first_query, uint32_t swapchain_index) {
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, first_query);
+	if (pass->pipeline.pipeline) {
+		// Reset the overflow count for this frame
+		const buffer_t* overflow_buffer = &pass->overflow_buffers.buffers[swapchain_index];
+		vkCmdFillBuffer(cmd, overflow_buffer->buffer, 0, overflow_buffer->size, 0);
+		VkMemoryBarrier fill_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		};
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fill_barrier, 0, NULL, 0, NULL);
+		// The previous frame must be done reading clusters
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass->pipeline.pipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+			pass->pipeline.pipeline_layout, 0, 1, &pass->pipeline.descriptor_sets[swapchain_index], 0, NULL);
+		vkCmdDispatch(cmd, pass->cluster_counts[0], pass->cluster_counts[1], pass->cluster_counts[2]);
+		VkMemoryBarrier barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		};
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+		// The host reads the overflow count once the frame has finished
+		VkMemoryBarrier host_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		};
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier, 0, NULL, 0, NULL);
+	}
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool, first_query + 1);
+}
+
+
+/*! Updates pass->overflow_rate using the count written by the light culling
+	pass for the given swapchain image. Rendering with this image must have
+	finished.*/
+void read_light_culling_overflow(light_culling_pass_t* pass, uint32_t swapchain_index) {
+	if (!pass->pipeline.pipeline)
+		return;
+	uint32_t cluster_count = pass->cluster_counts[0] * pass->cluster_counts[1] * pass->cluster_counts[2];
+	const uint32_t* overflow_count = (const uint32_t*) ((const char*) pass->overflow_data + pass->overflow_buffers.buffers[swapchain_index].offset);
+	pass->overflow_rate = (float) (*overflow_count) / (float) cluster_count;
+}
+
+
+//! The number of lights that are handled by one work group of the light
+//! animation pass
+#define LIGHT_ANIMATION_GROUP_SIZE 64
+
+//! Frees objects and zeros
+void destroy_light_animation_pass(light_animation_pass_t* pass, const device_t* device) {
+	destroy_pipeline_with_bindings(&pass->pipeline, device);
+	destroy_shader(&pass->compute_shader, device);
+	memset(pass, 0, sizeof(*pass));
+}
+
+//! Creates Vulkan objects for the light animation pass. If lights are not
+//! animated, nothing is created.
+int create_light_animation_pass(light_animation_pass_t* pass, application_t* app) {
+	memset(pass, 0, sizeof(*pass));
+	const device_t* device = &app->device;
+	const swapchain_t* swapchain = &app->swapchain;
+	uint32_t light_count = app->scene_specification.polygonal_light_count;
+	if (!app->light_buffers.animated || light_count == 0)
+		return 0;
+	pass->group_count = (light_count + LIGHT_ANIMATION_GROUP_SIZE - 1) / LIGHT_ANIMATION_GROUP_SIZE;
+	// Create descriptor sets
+	VkDescriptorSetLayoutBinding layout_bindings[] = {
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER },
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },	// Lights
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },	// Animated lights
+	};
+	descriptor_set_request_t set_request = {
+		.stage_flags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.min_descriptor_count = 1,
+		.binding_count = COUNT_OF(layout_bindings),
+		.bindings = layout_bindings,
+	};
+	if (create_descriptor_sets(&pass->pipeline, device, &set_request, swapchain->image_count, NULL, 0)) {
+		printf("Failed to allocate descriptor sets for the light animation pass.\n");
+		destroy_light_animation_pass(pass, device);
+		return 1;
+	}
+	VkDescriptorBufferInfo constant_buffer_info = { .offset = 0 };
+	VkDescriptorBufferInfo light_buffer_info = {
+		.buffer = app->light_buffers.buffer,
+		.offset = 0, .range = app->light_buffers.bvh_offset
+	};
+	VkDescriptorBufferInfo animation_buffer_info = {
+		.buffer = app->light_buffers.buffer,
+		.offset = app->light_buffers.animation_offset, .range = app->light_buffers.animation_size
+	};
+	VkWriteDescriptorSet descriptor_set_writes[] = {
+		{ .dstBinding = 0, .pBufferInfo = &constant_buffer_info },
+		{ .dstBinding = 1, .pBufferInfo = &light_buffer_info },
+		{ .dstBinding = 2, .pBufferInfo = &animation_buffer_info },
+	};
+	complete_descriptor_set_write(COUNT_OF(descriptor_set_writes), descriptor_set_writes, &set_request);
+	for (uint32_t i = 0; i != swapchain->image_count; ++i) {
+		constant_buffer_info.buffer = app->constant_buffers.buffers.buffers[i].buffer;
+		constant_buffer_info.range = app->constant_buffers.buffers.buffers[i].size;
+		for (uint32_t j = 0; j != COUNT_OF(descriptor_set_writes); ++j)
+			descriptor_set_writes[j].dstSet = pass->pipeline.descriptor_sets[i];
+		vkUpdateDescriptorSets(device->device, COUNT_OF(descriptor_set_writes), descriptor_set_writes, 0, NULL);
+	}
+	// Compile the compute shader
+	char* defines[] = {
+		format_uint("POLYGONAL_LIGHT_COUNT=%u", light_count),
+		format_uint("POLYGONAL_LIGHT_ARRAY_SIZE=%u", light_count),
+		format_uint("QUANTIZED_LIGHT_VERTICES=%u", app->light_buffers.quantized_vertices),
+		format_uint("LIGHT_ANIMATION_GROUP_SIZE=%u", LIGHT_ANIMATION_GROUP_SIZE),
+	};
+	shader_request_t compute_shader_request = {
+		.shader_file_path = "src/shaders/light_animation.comp.glsl",
+		.include_path = "src/shaders",
+		.entry_point = "main",
+		.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+		.define_count = COUNT_OF(defines),
+		.defines = defines
+	};
+	int compile_result = compile_glsl_shader_with_second_chance(&pass->compute_shader, device, &compute_shader_request);
+	for (uint32_t i = 0; i != COUNT_OF(defines); ++i)
+		free(defines[i]);
+	if (compile_result) {
+		printf("Failed to compile the compute shader for the light animation pass.\n");
+		destroy_light_animation_pass(pass, device);
+		return 1;
+	}
+	// Create the compute pipeline
+	VkComputePipelineCreateInfo pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.layout = pass->pipeline.pipeline_layout,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = pass->compute_shader.module,
+			.pName = "main"
+		}
+	};
+	if (vkCreateComputePipelines(device->device, app->pipeline_cache.cache, 1, &pipeline_info, NULL, &pass->pipeline.pipeline)) {
+		printf("Failed to create a compute pipeline for the light animation pass.\n");
+		destroy_light_animation_pass(pass, device);
+		return 1;
+	}
+	return 0;
+}
+
+//! Records commands for the light animation pass (if enabled), which
+//! overwrite lights in the light buffer
+void record_light_animation_pass(VkCommandBuffer cmd, const light_animation_pass_t* pass, uint32_t swapchain_index) {
+	if (!pass->pipeline.pipeline)
+		return;
+	// The previous frame must be done reading lights and uploads of changed
+	// lights must be done writing them
+	VkMemoryBarrier read_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &read_barrier, 0, NULL, 0, NULL);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass->pipeline.pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+		pass->pipeline.pipeline_layout, 0, 1, &pass->pipeline.descriptor_sets[swapchain_index], 0, NULL);
+	vkCmdDispatch(cmd, pass->group_count, 1, 1);
+	VkMemoryBarrier write_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &write_barrier, 0, NULL, 0, NULL);
+}
+
+
+//! The number of bytes of shared memory that compute shading may use to stage
+//! polygonal lights. Vulkan guarantees 16 KiB per work group.
+#define SHARED_POLYGONAL_LIGHTS_MAX_SIZE 16384
+//! The size in bytes of a single wavefront_sample_t in shading_pass.frag.glsl
+#define WAVEFRONT_SAMPLE_SIZE 48
+//! The number of queue entries handled by one work group in the wavefront
+//! stages after candidate generation
+#define WAVEFRONT_GROUP_SIZE 64
+//! The number of buffers in shading_pass_t::wavefront_buffers
+#define WAVEFRONT_BUFFER_COUNT 4
+
+//! Destroys the pipelines of the shading pass but keeps shaders and bindings
+void destroy_shading_pipelines(shading_pass_t* pass, const device_t* device) {
+	if (pass->pipeline.pipeline)
+		vkDestroyPipeline(device->device, pass->pipeline.pipeline, NULL);
+	pass->pipeline.pipeline = VK_NULL_HANDLE;
+	if (pass->spatial_reuse_pipeline)
+		vkDestroyPipeline(device->device, pass->spatial_reuse_pipeline, NULL);
+	pass->spatial_reuse_pipeline = VK_NULL_HANDLE;
+	for (uint32_t i = 0; i != COUNT_OF(pass->wavefront_pipelines); ++i) {
+		if (pass->wavefront_pipelines[i])
+			vkDestroyPipeline(device->device, pass->wavefront_pipelines[i], NULL);
+		pass->wavefront_pipelines[i] = VK_NULL_HANDLE;
+	}
+}
+
+//! Frees objects and zeros
+void destroy_shading_pass(shading_pass_t* pass, const device_t* device) {
+	destroy_shading_pipelines(pass, device);
+	destroy_pipeline_with_bindings(&pass->pipeline, device);
+	destroy_shader(&pass->vertex_shader, device);
+	destroy_shader(&pass->fragment_shader, device);
+	destroy_shader(&pass->spatial_reuse_fragment_shader, device);
+	for (uint32_t i = 0; i != COUNT_OF(pass->wavefront_pipelines); ++i)
+		destroy_shader(&pass->wavefront_shaders[i], device);
+	destroy_buffers(&pass->wavefront_buffers, device);
+	if (pass->light_texture_sampler)
+		vkDestroySampler(device->device, pass->light_texture_sampler, NULL);
+	memset(pass, 0, sizeof(*pass));
+}
+
+//! Fills the specialization constants for the shading pass using the current
+//! render settings
+void get_shading_specialization(shading_specialization_t* specialization, const render_settings_t* settings) {
+	specialization->mis_heuristic = (uint32_t) settings->mis_heuristic;
+	specialization->candidate_count = (settings->candidate_count < 1) ? 1
+		: ((settings->candidate_count > MAX_CANDIDATE_COUNT) ? MAX_CANDIDATE_COUNT : (int32_t) settings->candidate_count);
+	specialization->spatial_reuse_neighbour_count = settings->spatial_reuse_neighbour_count;
+	specialization->spatial_reuse_radius = settings->spatial_reuse_radius;
+	specialization->light_cache_probability = (settings->light_cache_probability < 0.95f) ? settings->light_cache_probability : 0.95f;
+	specialization->light_cache_cell_scale = settings->light_cache_cell_scale;
+	specialization->light_cache_power_fallback = settings->light_cache_power_fallback;
+}
+
+/*! Creates all pipelines of the shading pass from the shaders that
+	create_shading_pass() has compiled, using specialization constants for the
+	current render settings. Pipelines have to be destroyed first.*/
+int create_shading_pipelines(shading_pass_t* pass, application_t* app) {
+	const device_t* device = &app->device;
+	const swapchain_t* swapchain = &app->swapchain;
+	pipeline_with_bindings_t* pipeline = &pass->pipeline;
+	VkBool32 spatial_reuse = (pass->spatial_reuse_fragment_shader.module != VK_NULL_HANDLE);
+	// Map the specialization constants
+	shading_specialization_t specialization;
+	get_shading_specialization(&specialization, &app->render_settings);
+	VkSpecializationMapEntry specialization_entries[] = {
+		{ .constantID = 0, .offset = offsetof(shading_specialization_t, mis_heuristic), .size = sizeof(uint32_t) },
+		{ .constantID = 1, .offset = offsetof(shading_specialization_t, candidate_count), .size = sizeof(int32_t) },
+		{ .constantID = 2, .offset = offsetof(shading_specialization_t, spatial_reuse_neighbour_count), .size = sizeof(uint32_t) },
+		{ .constantID = 3, .offset = offsetof(shading_specialization_t, spatial_reuse_radius), .size = sizeof(float) },
+		{ .constantID = 4, .offset = offsetof(shading_specialization_t, light_cache_probability), .size = sizeof(float) },
+		{ .constantID = 5, .offset = offsetof(shading_specialization_t, light_cache_cell_scale), .size = sizeof(float) },
+		{ .constantID = 6, .offset = offsetof(shading_specialization_t, light_cache_power_fallback), .size = sizeof(VkBool32) },
+	};
+	VkSpecializationInfo specialization_info = {
+		.mapEntryCount = COUNT_OF(specialization_entries),
+		.pMapEntries = specialization_entries,
+		.dataSize = sizeof(specialization),
+		.pData = &specialization,
+	};
+	if (pass->compute) {
+		// Create the compute pipelines
+		VkComputePipelineCreateInfo compute_pipeline_info = {
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.layout = pipeline->pipeline_layout,
+			.stage = {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = pass->fragment_shader.module,
+				.pName = "main",
+				.pSpecializationInfo = &specialization_info
+			}
+		};
+		if (vkCreateComputePipelines(device->device, app->pipeline_cache.cache, 1, &compute_pipeline_info, NULL, &pipeline->pipeline)) {
+			printf("Failed to create a compute pipeline for the shading pass.\n");
+			destroy_shading_pipelines(pass, device);
+			return 1;
+		}
+		for (uint32_t i = 0; i != COUNT_OF(pass->wavefront_pipelines) && pass->wavefront; ++i) {
+			compute_pipeline_info.stage.module = pass->wavefront_shaders[i].module;
+			if (vkCreateComputePipelines(device->device, app->pipeline_cache.cache, 1, &compute_pipeline_info, NULL, &pass->wavefront_pipelines[i])) {
+				printf("Failed to create a compute pipeline for wavefront shading.\n");
+				destroy_shading_pipelines(pass, device);
+				return 1;
+			}
+		}
+		if (!spatial_reuse)
+			return 0;
+		compute_pipeline_info.stage.module = pass->spatial_reuse_fragment_shader.module;
+		if (vkCreateComputePipelines(device->device, app->pipeline_cache.cache, 1, &compute_pipeline_info, NULL, &pass->spatial_reuse_pipeline)) {
+			printf("Failed to create a compute pipeline for the spatial reuse pass.\n");
+			destroy_shading_pipelines(pass, device);
+			return 1;
+		}
+		return 0;
+	}
+	// Define the graphics pipeline state
+	VkVertexInputBindingDescription vertex_binding = { .binding = 0, .stride = sizeof(int8_t) * 2 };
+	VkVertexInputAttributeDescription vertex_attribute = { .location = 0, .binding = 0, .format = VK_FORMAT_R8G8_SINT };
+	VkPipelineVertexInputStateCreateInfo vertex_input_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = 1, .pVertexBindingDescriptions = &vertex_binding,
+		.vertexAttributeDescriptionCount = 1, .pVertexAttributeDescriptions = &vertex_attribute,
 	};
 	VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
@@ -715,44 +1729,39 @@ int create_geometry_pass(geometry_pass_t* pass, const device_t* device, const sw
 	VkPipelineRasterizationStateCreateInfo raster_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
 		.polygonMode = VK_POLYGON_MODE_FILL,
-		.cullMode = VK_CULL_MODE_BACK_BIT,
-		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+		.cullMode = VK_CULL_MODE_NONE,
 		.lineWidth = 1.0f,
 	};
 	VkPipelineColorBlendAttachmentState blend_attachment_state = {
+		.blendEnable = VK_FALSE,
 		.alphaBlendOp = VK_BLEND_OP_ADD,
 		.colorBlendOp = VK_BLEND_OP_ADD,
-		.srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
-		.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
 		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
 		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
 		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
 	};
 	VkPipelineColorBlendStateCreateInfo blend_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-		.attachmentCount = 1,
-		.pAttachments = &blend_attachment_state,
+		.attachmentCount = 1, .pAttachments = &blend_attachment_state,
 		.logicOp = VK_LOGIC_OP_NO_OP,
 		.blendConstants = {1.0f, 1.0f, 1.0f, 1.0f}
 	};
 	VkViewport viewport = {
 		.x = 0.0f, .y = 0.0f,
-		.width = (float)swapchain->extent.width, .height = (float)swapchain->extent.height,
+		.width = (float) swapchain->extent.width, .height = (float) swapchain->extent.height,
 		.minDepth = 0.0f, .maxDepth = 1.0f
 	};
 	VkRect2D scissor = {.extent = swapchain->extent};
 	VkPipelineViewportStateCreateInfo viewport_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-		.viewportCount = 1,
-		.scissorCount = 1,
-		.pScissors = &scissor,
-		.pViewports = &viewport
+		.viewportCount = 1, .pViewports = &viewport,
+		.scissorCount = 1, .pScissors = &scissor,
 	};
 	VkPipelineDepthStencilStateCreateInfo depth_stencil_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-		.depthTestEnable = VK_TRUE,
-		.depthWriteEnable = VK_TRUE,
-		.depthCompareOp = VK_COMPARE_OP_LESS
+		.depthTestEnable = VK_FALSE, .depthWriteEnable = VK_FALSE
 	};
 	VkPipelineMultisampleStateCreateInfo multi_sample_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
@@ -769,7 +1778,8 @@ int create_geometry_pass(geometry_pass_t* pass, const device_t* device, const sw
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 			.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
 			.module = pass->fragment_shader.module,
-			.pName = "main"
+			.pName = "main",
+			.pSpecializationInfo = &specialization_info
 		}
 	};
 	VkGraphicsPipelineCreateInfo pipeline_info = {
@@ -784,30 +1794,34 @@ int create_geometry_pass(geometry_pass_t* pass, const device_t* device, const sw
 		.pDynamicState = NULL,
 		.pViewportState = &viewport_info,
 		.pDepthStencilState = &depth_stencil_info,
-		.stageCount = 2,
-		.pStages = shader_stages,
-		.renderPass = render_pass->render_pass,
-		.subpass = 0
+		.stageCount = 2, .pStages = shader_stages,
+		.renderPass = app->render_pass.render_pass,
+		.subpass = 1
 	};
-	if (vkCreateGraphicsPipelines(device->device, NULL, 1, &pipeline_info, NULL, &pass->pipeline.pipeline)) {
-		printf("Failed to create a graphics pipeline for the geometry pass.\n");
-		destroy_geometry_pass(pass, device);
+	if (vkCreateGraphicsPipelines(device->device, app->pipeline_cache.cache, 1, &pipeline_info, NULL, &pipeline->pipeline)) {
+		printf("Failed to create a graphics pipeline for the shading pass.\n");
+		destroy_shading_pipelines(pass, device);
+		return 1;
+	}
+	if (!spatial_reuse)
+		return 0;
+	// The spatial reuse pass adds the shading for the first reservoir to the
+	// output of the shading pass
+	blend_attachment_state.blendEnable = VK_TRUE;
+	blend_attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	blend_attachment_state.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	blend_attachment_state.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	blend_attachment_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	shader_stages[1].module = pass->spatial_reuse_fragment_shader.module;
+	pipeline_info.subpass = 2;
+	if (vkCreateGraphicsPipelines(device->device, app->pipeline_cache.cache, 1, &pipeline_info, NULL, &pass->spatial_reuse_pipeline)) {
+		printf("Failed to create a graphics pipeline for the spatial reuse pass.\n");
+		destroy_shading_pipelines(pass, device);
 		return 1;
 	}
 	return 0;
 }
 
-
-//! Frees objects and zeros
-void destroy_shading_pass(shading_pass_t* pass, const device_t* device) {
-	destroy_pipeline_with_bindings(&pass->pipeline, device);
-	destroy_shader(&pass->vertex_shader, device);
-	destroy_shader(&pass->fragment_shader, device);
-	if (pass->light_texture_sampler)
-		vkDestroySampler(device->device, pass->light_texture_sampler, NULL);
-	memset(pass, 0, sizeof(*pass));
-}
-
 //! Creates Vulkan objects for the shading pass
 int create_shading_pass(shading_pass_t* pass, application_t* app)
 {
@@ -822,6 +1836,32 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 	const ltc_table_t* ltc_table = &app->ltc_table;
 	const light_buffers_t* lights = &app->light_buffers;
 	pipeline_with_bindings_t* pipeline = &pass->pipeline;
+	// With compute shading, each work group shades a tile of 8x8 pixels
+	pass->compute = app->render_settings.compute_shading;
+	pass->group_counts[0] = (swapchain->extent.width + 7) / 8;
+	pass->group_counts[1] = (swapchain->extent.height + 7) / 8;
+	// Wavefront stages exchange reservoirs, so they only exist for RIS
+	light_sampling_strategies_t light_sampling = app->render_settings.light_sampling;
+	pass->wavefront = pass->compute && app->render_settings.wavefront_shading
+		&& (light_sampling == light_reservoir || light_sampling == light_reservoir_bvh || light_sampling == light_reservoir_power || light_sampling == light_reservoir_cache);
+	if (pass->wavefront) {
+		VkDeviceSize pixel_count = (VkDeviceSize) swapchain->extent.width * swapchain->extent.height;
+		VkBufferCreateInfo wavefront_buffer_infos[WAVEFRONT_BUFFER_COUNT] = {
+			{ .size = 8 * sizeof(uint32_t), .usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT },
+			{ .size = sizeof(uint32_t) * pixel_count },
+			{ .size = sizeof(uint32_t) * pixel_count },
+			{ .size = WAVEFRONT_SAMPLE_SIZE * pixel_count * app->render_settings.sample_count_light },
+		};
+		for (uint32_t i = 0; i != WAVEFRONT_BUFFER_COUNT; ++i) {
+			wavefront_buffer_infos[i].sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			wavefront_buffer_infos[i].usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		}
+		if (create_aligned_buffers(&pass->wavefront_buffers, device, wavefront_buffer_infos, WAVEFRONT_BUFFER_COUNT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, device->physical_device_properties.limits.minStorageBufferOffsetAlignment)) {
+			printf("Failed to create buffers for wavefront shading.\n");
+			destroy_shading_pass(pass, device);
+			return 1;
+		}
+	}
 	// Create a sampler for light textures
 	VkSamplerCreateInfo sampler_info = {
 		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
@@ -847,17 +1887,32 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 		{ .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER },
 		{ .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER },
 		{ .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER },
-		{ .descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT },
+		// Compute shaders can not read input attachments
+		{ .descriptorType = pass->compute ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT },
 		{ .binding = 5},	// Filled below
 		{ .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = 2 },
 		{ .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = light_texture_count },
 		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // To store lights
 		{ .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR },
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Light BVH
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Light alias table
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Reservoirs of this frame
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Reservoirs of the previous frame
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE }, // Accumulation buffer of the previous frame
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Light clusters
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Light cache
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE }, // Shading buffer (written by compute shading)
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // LOD clamps for material textures
+		// The remaining bindings only exist for wavefront shading
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Queue lengths
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Shadow ray queue
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Final shading queue
+		{ .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, // Selected samples
 	};
 	get_materials_descriptor_layout(&layout_bindings[5], 5, &scene->materials);
-	uint32_t binding_count = COUNT_OF(layout_bindings);
+	uint32_t binding_count = COUNT_OF(layout_bindings) - (pass->wavefront ? 0 : WAVEFRONT_BUFFER_COUNT);
 	descriptor_set_request_t set_request = {
-		.stage_flags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.stage_flags = pass->compute ? VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_FRAGMENT_BIT,
 		.min_descriptor_count = 1,
 		.binding_count = binding_count,
 		.bindings = layout_bindings,
@@ -885,11 +1940,59 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 		}
 	};
 	VkDescriptorBufferInfo light_buffer_info = { .offset = 0 };
+	VkDescriptorBufferInfo light_bvh_info = {
+		.buffer = lights->buffer,
+		.offset = lights->bvh_offset,
+		.range = lights->bvh_size
+	};
+	VkDescriptorBufferInfo light_alias_table_info = {
+		.buffer = lights->buffer,
+		.offset = lights->alias_table_offset,
+		.range = lights->alias_table_size
+	};
+	VkDescriptorBufferInfo reservoir_buffer_info = { .offset = 0 };
+	VkDescriptorBufferInfo previous_reservoir_buffer_info = { .offset = 0 };
+	VkDescriptorImageInfo previous_accum_buffer_info = {
+		.imageLayout = VK_IMAGE_LAYOUT_GENERAL
+	};
+	VkDescriptorImageInfo shading_buffer_info = {
+		.imageLayout = VK_IMAGE_LAYOUT_GENERAL
+	};
+	VkDescriptorBufferInfo wavefront_buffer_infos[WAVEFRONT_BUFFER_COUNT];
+	for (uint32_t i = 0; i != WAVEFRONT_BUFFER_COUNT; ++i) {
+		wavefront_buffer_infos[i].buffer = pass->wavefront ? pass->wavefront_buffers.buffers[i].buffer : VK_NULL_HANDLE;
+		wavefront_buffer_infos[i].offset = 0;
+		wavefront_buffer_infos[i].range = VK_WHOLE_SIZE;
+	}
+	const light_culling_pass_t* light_culling_pass = &app->light_culling_pass;
+	VkDescriptorBufferInfo light_cluster_info = {
+		.buffer = light_culling_pass->cluster_buffer.buffers[0].buffer,
+		.offset = 0,
+		.range = light_culling_pass->cluster_buffer.buffers[0].size
+	};
+	VkDescriptorBufferInfo light_cache_info = {
+		.buffer = app->reservoir_buffers.light_cache.buffers[0].buffer,
+		.offset = 0,
+		.range = app->reservoir_buffers.light_cache.buffers[0].size
+	};
+	VkDescriptorBufferInfo material_lod_clamp_info = {
+		.buffer = scene->materials.streaming.lod_clamps.buffers[0].buffer,
+		.offset = 0,
+		.range = scene->materials.streaming.lod_clamps.buffers[0].size
+	};
 	VkWriteDescriptorSet descriptor_set_writes[COUNT_OF(layout_bindings)] = {
 		{ .dstBinding = 0, .pBufferInfo = &constant_buffer_info },
 		{ .dstBinding = 4, .pImageInfo = &visibility_buffer_info },
 		{ .dstBinding = 6, .pImageInfo = ltc_table_infos },
 		{ .dstBinding = 8, .pBufferInfo = &light_buffer_info },
+		{ .dstBinding = 10, .pBufferInfo = &light_bvh_info },
+		{ .dstBinding = 11, .pBufferInfo = &light_alias_table_info },
+		{ .dstBinding = 12, .pBufferInfo = &reservoir_buffer_info },
+		{ .dstBinding = 13, .pBufferInfo = &previous_reservoir_buffer_info },
+		{ .dstBinding = 14, .pImageInfo = &previous_accum_buffer_info },
+		{ .dstBinding = 15, .pBufferInfo = &light_cluster_info },
+		{ .dstBinding = 16, .pBufferInfo = &light_cache_info },
+		{ .dstBinding = 17, .pImageInfo = &shading_buffer_info },
 		{ .dstBinding = 7 },	// Light Textures
 		{ .dstBinding = 5 },	// Materials
 	};
@@ -900,9 +2003,9 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 		light_texture_writes[i].imageView = app->light_textures.images[i].view;
 		light_texture_writes[i].sampler = pass->light_texture_sampler;
 	}
-	descriptor_set_writes[4].pImageInfo = light_texture_writes;
+	descriptor_set_writes[12].pImageInfo = light_texture_writes;
 	// Materials
-	uint32_t material_write_index = 5;
+	uint32_t material_write_index = 13;
 	descriptor_set_writes[material_write_index].pImageInfo = get_materials_descriptor_infos(&descriptor_set_writes[material_write_index].descriptorCount, &scene->materials);
 	for (uint32_t i = 0; i != mesh_buffer_count; ++i) {
 		VkWriteDescriptorSet write = {
@@ -919,13 +2022,31 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 		.dstBinding = 9, .pNext = &acceleration_structure_info
 	};
 	descriptor_set_writes[material_write_index + 1 + mesh_buffer_count] = acceleration_structure_write;
+	VkWriteDescriptorSet material_lod_clamp_write = {
+		.dstBinding = 18, .pBufferInfo = &material_lod_clamp_info
+	};
+	descriptor_set_writes[material_write_index + 2 + mesh_buffer_count] = material_lod_clamp_write;
+	for (uint32_t i = 0; i != WAVEFRONT_BUFFER_COUNT; ++i) {
+		VkWriteDescriptorSet write = {
+			.dstBinding = 19 + i, .pBufferInfo = &wavefront_buffer_infos[i]
+		};
+		descriptor_set_writes[material_write_index + 3 + mesh_buffer_count + i] = write;
+	}
 	complete_descriptor_set_write(binding_count, descriptor_set_writes, &set_request);
 	light_buffer_info.buffer = lights->buffer;
-	light_buffer_info.range = lights->size;
+	light_buffer_info.range = lights->bvh_offset;
 	for (uint32_t i = 0; i != swapchain->image_count; ++i) {
 		constant_buffer_info.buffer = constant_buffers->buffers.buffers[i].buffer;
 		constant_buffer_info.range = constant_buffers->buffers.buffers[i].size;
 		visibility_buffer_info.imageView = render_targets->targets[i].visibility_buffer.view;
+		shading_buffer_info.imageView = render_targets->targets[i].shading_buffer.view;
+		// The previous frame used the previous swapchain image
+		uint32_t previous_index = (i + swapchain->image_count - 1) % swapchain->image_count;
+		reservoir_buffer_info.buffer = app->reservoir_buffers.buffers.buffers[i].buffer;
+		reservoir_buffer_info.range = app->reservoir_buffers.buffers.buffers[i].size;
+		previous_reservoir_buffer_info.buffer = app->reservoir_buffers.buffers.buffers[previous_index].buffer;
+		previous_reservoir_buffer_info.range = app->reservoir_buffers.buffers.buffers[previous_index].size;
+		previous_accum_buffer_info.imageView = render_targets->targets[previous_index].accum_buffer.view;
 		for (uint32_t j = 0; j != COUNT_OF(descriptor_set_writes); ++j)
 			descriptor_set_writes[j].dstSet = pipeline->descriptor_sets[i];
 		vkUpdateDescriptorSets(device->device, binding_count, descriptor_set_writes, 0, NULL);
@@ -933,13 +2054,23 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 	free(light_texture_writes);
 	free((void*) descriptor_set_writes[material_write_index].pImageInfo);
 
-	// Prepare defines for the shader
-	mis_heuristic_t mis_heuristic = app->render_settings.mis_heuristic;
+	// Prepare defines for the shader. Values that are specialization constants
+	// are set in create_shading_pipelines(). Light and polygon sampling stay
+	// defines (see shading_specialization_t).
+	VkBool32 reuse_reservoirs = (light_sampling == light_reservoir || light_sampling == light_reservoir_bvh || light_sampling == light_reservoir_power || light_sampling == light_reservoir_cache)
+		&& app->scene_specification.polygonal_light_count <= STORED_RESERVOIR_MAX_LIGHT_COUNT;
+	VkBool32 light_cache = light_sampling == light_reservoir_cache && app->scene_specification.polygonal_light_count <= LIGHT_CACHE_MAX_LIGHT_COUNT;
+	VkBool32 spatial_reuse = reuse_reservoirs && app->render_settings.spatial_reuse;
 	sample_polygon_technique_t polygon_technique = app->render_settings.polygon_sampling_technique;
 	error_display_t error_display = app->render_settings.error_display;
 	uint32_t min_polygonal_light_vertex_count = get_min_polygonal_light_vertex_count(&app->scene_specification);
 	uint32_t max_polygonal_light_vertex_count = get_max_polygonal_light_vertex_count(&app->scene_specification);
 	uint32_t max_polygon_vertex_count = get_max_polygon_vertex_count(&app->scene_specification, &app->render_settings);
+	// Compute shading stages all lights in shared memory, if they fit into the
+	// 16 KiB that every device offers. vec3 vertices may be padded to 16 bytes.
+	uint32_t light_array_size = (light_count > 0) ? light_count : 1;
+	VkBool32 shared_lights = pass->compute
+		&& light_array_size * (3 * 16 + 4 + 16 * max_polygonal_light_vertex_count) <= SHARED_POLYGONAL_LIGHTS_MAX_SIZE;
 	uint32_t error_index = 0;
 	VkBool32 error_display_diffuse = VK_FALSE;
 	VkBool32 error_display_specular = VK_FALSE;
@@ -961,24 +2092,40 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 	};
 	char* defines[] = {
 		format_uint("MATERIAL_COUNT=%u", (uint32_t) scene->materials.material_count),
+		format_uint("MATERIAL_LOD_CLAMP=%u", scene->materials.streaming.streamed),
 		format_uint("POLYGONAL_LIGHT_COUNT=%u", app->scene_specification.polygonal_light_count),
 		format_uint("POLYGONAL_LIGHT_ARRAY_SIZE=%u", (app->scene_specification.polygonal_light_count > 0) ? app->scene_specification.polygonal_light_count : 1),
 		format_uint("POLYGONAL_LIGHT_COUNT_CLAMPED=%u", (app->scene_specification.polygonal_light_count < 33) ? app->scene_specification.polygonal_light_count : 33),
 		format_uint("LIGHT_SAMPLES=%u", app->render_settings.sample_count_light),
 		format_uint("LIGHT_SAMPLES_CLAMPED=%u", (app->render_settings.sample_count_light < 33) ? app->render_settings.sample_count_light: 33),
 		format_uint("LIGHT_TEXTURE_COUNT=%u", app->light_textures.image_count),
+		format_uint("ADAPTIVE_CANDIDATE_COUNT=%u", app->render_settings.adaptive_candidate_count),
+		format_uint("RIS_TARGET_FORM_FACTOR=%u", app->render_settings.ris_target_function == ris_target_form_factor),
 		format_uint("MIN_POLYGON_VERTEX_COUNT_BEFORE_CLIPPING=%u", min_polygonal_light_vertex_count),
 		format_uint("MAX_POLYGONAL_LIGHT_VERTEX_COUNT=%u", max_polygonal_light_vertex_count),
+		format_uint("QUANTIZED_LIGHT_VERTICES=%u", lights->quantized_vertices),
 		format_uint("MAX_POLYGON_VERTEX_COUNT=%u", max_polygon_vertex_count),
 		format_uint("SAMPLE_COUNT=%u", app->render_settings.sample_count),
 		format_uint("SAMPLE_COUNT_CLAMPED=%u", (app->render_settings.sample_count < 33) ? app->render_settings.sample_count : 33),
-		format_uint("MIS_HEURISTIC_BALANCE=%u", mis_heuristic == mis_heuristic_balance),
-		format_uint("MIS_HEURISTIC_POWER=%u", mis_heuristic == mis_heuristic_power),
-		format_uint("MIS_HEURISTIC_WEIGHTED=%u", mis_heuristic == mis_heuristic_weighted),
-		format_uint("MIS_HEURISTIC_OPTIMAL_CLAMPED=%u", mis_heuristic == mis_heuristic_optimal_clamped),
-		format_uint("MIS_HEURISTIC_OPTIMAL=%u", mis_heuristic == mis_heuristic_optimal),
 		format_uint("SAMPLE_LIGHT_UNIFORM=%u", app->render_settings.light_sampling == light_uniform),
 		format_uint("SAMPLE_LIGHT_RIS=%u", app->render_settings.light_sampling == light_reservoir),
+		format_uint("SAMPLE_LIGHT_RIS_BVH=%u", app->render_settings.light_sampling == light_reservoir_bvh),
+		format_uint("SAMPLE_LIGHT_POWER=%u", app->render_settings.light_sampling == light_power),
+		format_uint("SAMPLE_LIGHT_RIS_POWER=%u", app->render_settings.light_sampling == light_reservoir_power),
+		format_uint("SAMPLE_LIGHT_RIS_CACHE=%u", light_cache),
+		format_uint("LIGHT_CACHE_CELL_COUNT=%u", LIGHT_CACHE_CELL_COUNT),
+		format_uint("LIGHT_CACHE_SLOT_COUNT=%u", LIGHT_CACHE_SLOT_COUNT),
+		format_uint("TEMPORAL_REUSE=%u", reuse_reservoirs && app->render_settings.temporal_reuse),
+		format_uint("SPATIAL_REUSE=%u", spatial_reuse),
+		format_uint("LIGHT_BVH_MAX_DEPTH=%u", lights->bvh_max_depth),
+		format_uint("LIGHT_CULLING=%u", use_light_culling(&app->render_settings)),
+		format_uint("LIGHT_CLUSTER_TILE_SIZE=%u", LIGHT_CLUSTER_TILE_SIZE),
+		format_uint("LIGHT_CLUSTER_COUNT_X=%u", light_culling_pass->cluster_counts[0]),
+		format_uint("LIGHT_CLUSTER_COUNT_Y=%u", light_culling_pass->cluster_counts[1]),
+		format_uint("LIGHT_CLUSTER_DEPTH_SLICE_COUNT=%u", light_culling_pass->cluster_counts[2]),
+		format_uint("LIGHT_CLUSTER_MAX_LIGHT_COUNT=%u", light_culling_pass->cluster_capacity),
+		format_float("LIGHT_CLUSTER_PROBABILITY=%f", LIGHT_CLUSTER_PROBABILITY),
+		format_float("LIGHT_CULLING_THRESHOLD=%f", app->render_settings.light_culling_threshold),
 		format_uint("SAMPLE_POLYGON_BASELINE=%u", polygon_technique == sample_polygon_baseline),
 		format_uint("SAMPLE_POLYGON_AREA_TURK=%u", polygon_technique == sample_polygon_area_turk),
 		format_uint("SAMPLE_POLYGON_PROJECTED_SOLID_ANGLE=%u", polygon_technique == sample_polygon_projected_solid_angle || polygon_technique == sample_polygon_projected_solid_angle_biased),
@@ -988,17 +2135,47 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 		format_uint("ERROR_DISPLAY_DIFFUSE=%u", error_display_diffuse),
 		format_uint("ERROR_DISPLAY_SPECULAR=%u", error_display_specular),
 		format_uint("ERROR_INDEX=%u", error_index),
+		format_uint("COMPUTE_SHADING=%u", pass->compute),
+		format_uint("SHARED_POLYGONAL_LIGHTS=%u", shared_lights),
+		format_uint("WAVEFRONT_GROUP_SIZE=%u", WAVEFRONT_GROUP_SIZE),
+		format_uint("WAVEFRONT_STAGE=%u", pass->wavefront ? 1 : 0),
+		copy_string("SPATIAL_REUSE_PASS=0"),
 	};
-	// Compile a fragment shader
+	// Compile a fragment shader (or a compute shader from the same file)
 	shader_request_t fragment_shader_request = {
 		.shader_file_path = "src/shaders/shading_pass.frag.glsl",
 		.include_path = "src/shaders",
 		.entry_point = "main",
-		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.stage = pass->compute ? VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_FRAGMENT_BIT,
 		.define_count = COUNT_OF(defines),
 		.defines = defines
 	};
-	int compile_result = compile_glsl_shader_with_second_chance(&pass->fragment_shader, device, &fragment_shader_request);
+	// Wavefront stages after candidate generation and the spatial reuse pass
+	// are variants of the same file that only differ in the last two
+	// defines. All variants compile in parallel.
+	shader_t* variant_shaders[] = {
+		&pass->fragment_shader, &pass->wavefront_shaders[0], &pass->wavefront_shaders[1], &pass->spatial_reuse_fragment_shader
+	};
+	uint32_t variant_wavefront_stages[] = { pass->wavefront ? 1 : 0, 2, 3, 0 };
+	VkBool32 variant_used[] = { VK_TRUE, pass->wavefront, pass->wavefront, spatial_reuse };
+	int variant_results[COUNT_OF(variant_shaders)] = { 0 };
+	#pragma omp parallel for
+	for (int i = 0; i < (int) COUNT_OF(variant_shaders); ++i) {
+		if (!variant_used[i])
+			continue;
+		char* variant_defines[COUNT_OF(defines)];
+		memcpy(variant_defines, defines, sizeof(defines));
+		variant_defines[COUNT_OF(defines) - 2] = format_uint("WAVEFRONT_STAGE=%u", variant_wavefront_stages[i]);
+		variant_defines[COUNT_OF(defines) - 1] = format_uint("SPATIAL_REUSE_PASS=%u", variant_shaders[i] == &pass->spatial_reuse_fragment_shader);
+		shader_request_t variant_request = fragment_shader_request;
+		variant_request.defines = variant_defines;
+		variant_results[i] = compile_glsl_shader_with_second_chance(variant_shaders[i], device, &variant_request);
+		free(variant_defines[COUNT_OF(defines) - 2]);
+		free(variant_defines[COUNT_OF(defines) - 1]);
+	}
+	int compile_result = 0;
+	for (uint32_t i = 0; i != COUNT_OF(variant_shaders); ++i)
+		compile_result |= variant_results[i];
 	for (uint32_t i = 0; i != COUNT_OF(defines); ++i)
 		free(defines[i]);
 	if (compile_result) {
@@ -1007,110 +2184,75 @@ int create_shading_pass(shading_pass_t* pass, application_t* app)
 		return 1;
 	}
 	// Compile a vertex shader
-	shader_request_t vertex_shader_request = {
-		.shader_file_path = "src/shaders/shading_pass.vert.glsl",
-		.include_path = "src/shaders",
-		.entry_point = "main",
-		.stage = VK_SHADER_STAGE_VERTEX_BIT
-	};
-	if (compile_glsl_shader_with_second_chance(&pass->vertex_shader, device, &vertex_shader_request)) {
-		printf("Failed to compile the vertex shader for the shading pass.\n");
-		destroy_shading_pass(pass, device);
-		return 1;
-	}
-
-	// Define the graphics pipeline state
-	VkVertexInputBindingDescription vertex_binding = { .binding = 0, .stride = sizeof(int8_t) * 2 };
-	VkVertexInputAttributeDescription vertex_attribute = { .location = 0, .binding = 0, .format = VK_FORMAT_R8G8_SINT };
-	VkPipelineVertexInputStateCreateInfo vertex_input_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-		.vertexBindingDescriptionCount = 1, .pVertexBindingDescriptions = &vertex_binding,
-		.vertexAttributeDescriptionCount = 1, .pVertexAttributeDescriptions = &vertex_attribute,
-	};
-	VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-		.primitiveRestartEnable = VK_FALSE,
-		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
-	};
-	VkPipelineRasterizationStateCreateInfo raster_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-		.polygonMode = VK_POLYGON_MODE_FILL,
-		.cullMode = VK_CULL_MODE_NONE,
-		.lineWidth = 1.0f,
-	};
-	VkPipelineColorBlendAttachmentState blend_attachment_state = {
-		.blendEnable = VK_FALSE,
-		.alphaBlendOp = VK_BLEND_OP_ADD,
-		.colorBlendOp = VK_BLEND_OP_ADD,
-		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
-	};
-	VkPipelineColorBlendStateCreateInfo blend_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-		.attachmentCount = 1, .pAttachments = &blend_attachment_state,
-		.logicOp = VK_LOGIC_OP_NO_OP,
-		.blendConstants = {1.0f, 1.0f, 1.0f, 1.0f}
-	};
-	VkViewport viewport = {
-		.x = 0.0f, .y = 0.0f,
-		.width = (float) swapchain->extent.width, .height = (float) swapchain->extent.height,
-		.minDepth = 0.0f, .maxDepth = 1.0f
-	};
-	VkRect2D scissor = {.extent = swapchain->extent};
-	VkPipelineViewportStateCreateInfo viewport_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-		.viewportCount = 1, .pViewports = &viewport,
-		.scissorCount = 1, .pScissors = &scissor,
-	};
-	VkPipelineDepthStencilStateCreateInfo depth_stencil_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-		.depthTestEnable = VK_FALSE, .depthWriteEnable = VK_FALSE
-	};
-	VkPipelineMultisampleStateCreateInfo multi_sample_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
-	};
-	VkPipelineShaderStageCreateInfo shader_stages[2] = {
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-			.stage = VK_SHADER_STAGE_VERTEX_BIT,
-			.module = pass->vertex_shader.module,
-			.pName = "main"
-		},
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-			.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-			.module = pass->fragment_shader.module,
-			.pName = "main"
+	if (!pass->compute) {
+		shader_request_t vertex_shader_request = {
+			.shader_file_path = "src/shaders/shading_pass.vert.glsl",
+			.include_path = "src/shaders",
+			.entry_point = "main",
+			.stage = VK_SHADER_STAGE_VERTEX_BIT
+		};
+		if (compile_glsl_shader_with_second_chance(&pass->vertex_shader, device, &vertex_shader_request)) {
+			printf("Failed to compile the vertex shader for the shading pass.\n");
+			destroy_shading_pass(pass, device);
+			return 1;
 		}
-	};
-	VkGraphicsPipelineCreateInfo pipeline_info = {
-		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-		.layout = pipeline->pipeline_layout,
-		.pVertexInputState = &vertex_input_info,
-		.pInputAssemblyState = &input_assembly_info,
-		.pRasterizationState = &raster_info,
-		.pColorBlendState = &blend_info,
-		.pTessellationState = NULL,
-		.pMultisampleState = &multi_sample_info,
-		.pDynamicState = NULL,
-		.pViewportState = &viewport_info,
-		.pDepthStencilState = &depth_stencil_info,
-		.stageCount = 2, .pStages = shader_stages,
-		.renderPass = app->render_pass.render_pass,
-		.subpass = 1
-	};
-	if (vkCreateGraphicsPipelines(device->device, NULL, 1, &pipeline_info, NULL, &pipeline->pipeline)) {
-		printf("Failed to create a graphics pipeline for the shading pass.\n");
+	}
+	if (create_shading_pipelines(pass, app)) {
 		destroy_shading_pass(pass, device);
 		return 1;
 	}
 	return 0;
 }
 
+/*! Records the dispatches for the shading pass and the spatial reuse pass with
+	compute shading. It has to be recorded outside of a render pass, after the
+	visibility buffer has been written.*/
+void record_compute_shading_pass(VkCommandBuffer cmd, const shading_pass_t* pass, uint32_t swapchain_index) {
+	if (pass->wavefront) {
+		// Empty the queues once the previous frame is done with them. The
+		// indirect dispatches start with zero work groups.
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+		const uint32_t empty_queues[8] = { 0, 1, 1, 0, 0, 1, 1, 0 };
+		vkCmdUpdateBuffer(cmd, pass->wavefront_buffers.buffers[0].buffer, 0, sizeof(empty_queues), empty_queues);
+	}
+	// Wait for the visibility buffer, for everything that has been written to
+	// buffers used for shading and for the previous frame to stop reading
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+	};
+	VkPipelineStageFlags all_writes = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	vkCmdPipelineBarrier(cmd, all_writes, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass->pipeline.pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+		pass->pipeline.pipeline_layout, 0, 1, &pass->pipeline.descriptor_sets[swapchain_index], 0, NULL);
+	vkCmdDispatch(cmd, pass->group_counts[0], pass->group_counts[1], 1);
+	// The candidate stage fills the shadow ray queue, which fills the final
+	// shading queue. Each queue also holds the size of the next dispatch.
+	for (uint32_t i = 0; i != COUNT_OF(pass->wavefront_pipelines) && pass->wavefront; ++i) {
+		VkMemoryBarrier queue_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+		};
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &queue_barrier, 0, NULL, 0, NULL);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass->wavefront_pipelines[i]);
+		vkCmdDispatchIndirect(cmd, pass->wavefront_buffers.buffers[0].buffer, i * 4 * sizeof(uint32_t));
+	}
+	if (pass->spatial_reuse_pipeline) {
+		// Reservoirs and colors of the shading pass are read
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass->spatial_reuse_pipeline);
+		vkCmdDispatch(cmd, pass->group_counts[0], pass->group_counts[1], 1);
+	}
+	// The accum pass reads the shading buffer as input attachment
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
 //! Frees objects and zeros
 void destroy_accum_pass(accum_pass_t* pass, const device_t* device) {
 	destroy_pipeline_with_bindings(&pass->pipeline, device);
@@ -1284,9 +2426,9 @@ int create_accum_pass(accum_pass_t * pass, application_t* app)
 		.pDepthStencilState = &depth_stencil_info,
 		.stageCount = 2, .pStages = shader_stages,
 		.renderPass = app->render_pass.render_pass,
-		.subpass = 2
+		.subpass = 3
 	};
-	if (vkCreateGraphicsPipelines(device->device, NULL, 1, &pipeline_info, NULL, &pipeline->pipeline)) {
+	if (vkCreateGraphicsPipelines(device->device, app->pipeline_cache.cache, 1, &pipeline_info, NULL, &pipeline->pipeline)) {
 		printf("Failed to create a graphics pipeline for the accumulation pass.\n");
 		destroy_accum_pass(pass, device);
 		return 1;
@@ -1465,9 +2607,9 @@ int create_copy_pass(copy_pass_t * pass, application_t* app) {
 		.pDepthStencilState = &depth_stencil_info,
 		.stageCount = 2, .pStages = shader_stages,
 		.renderPass = app->render_pass.render_pass,
-		.subpass = 3
+		.subpass = 4
 	};
-	if (vkCreateGraphicsPipelines(device->device, NULL, 1, &pipeline_info, NULL, &pipeline->pipeline)) {
+	if (vkCreateGraphicsPipelines(device->device, app->pipeline_cache.cache, 1, &pipeline_info, NULL, &pipeline->pipeline)) {
 		printf("Failed to create a graphics pipeline for the accumulation pass.\n");
 		destroy_copy_pass(pass, device);
 		return 1;
@@ -1491,7 +2633,7 @@ void destroy_interface_pass(interface_pass_t* pass, const device_t* device) {
 }
 
 //! Creates the pass for rendering a user interface
-int create_interface_pass(interface_pass_t* pass, const device_t* device, imgui_handle_t imgui, const swapchain_t* swapchain, const render_targets_t* render_targets, const render_pass_t* render_pass) {
+int create_interface_pass(interface_pass_t* pass, const device_t* device, imgui_handle_t imgui, const swapchain_t* swapchain, const render_targets_t* render_targets, const render_pass_t* render_pass, VkPipelineCache pipeline_cache) {
 	memset(pass, 0, sizeof(*pass));
 	// Create geometry buffers and map memory
 	uint32_t imgui_quad_count = 0xFFFF;
@@ -1765,9 +2907,9 @@ int create_interface_pass(interface_pass_t* pass, const device_t* device, imgui_
 		.pDynamicState = &dynamic_state,
 		.stageCount = 2, .pStages = shader_stages,
 		.renderPass = render_pass->render_pass,
-		.subpass = 4,
+		.subpass = 5,
 	};
-	if (vkCreateGraphicsPipelines(device->device, NULL, 1, &pipeline_info, NULL, &pipeline->pipeline)) {
+	if (vkCreateGraphicsPipelines(device->device, pipeline_cache, 1, &pipeline_info, NULL, &pipeline->pipeline)) {
 		printf("Failed to create a graphics pipeline for the transfer pass.\n");
 		destroy_interface_pass(pass, device);
 		return 1;
@@ -1783,6 +2925,7 @@ void destroy_render_pass(render_pass_t* pass, const device_t* device) {
 			vkDestroyFramebuffer(device->device, pass->framebuffers[i], NULL);
 	free(pass->framebuffers);
 	if (pass->render_pass) vkDestroyRenderPass(device->device, pass->render_pass, NULL);
+	if (pass->resume_render_pass) vkDestroyRenderPass(device->device, pass->resume_render_pass, NULL);
 	memset(pass, 0, sizeof(*pass));
 }
 
@@ -1862,23 +3005,36 @@ int create_render_pass(render_pass_t* pass, const device_t* device, const swapch
 			.inputAttachmentCount = 1, .pInputAttachments = &visibility_input_reference,
 			.colorAttachmentCount = 1, .pColorAttachments = &shading_output_reference,
 		},
-		{ // 2 - accum pass
+		{ // 2 - spatial reuse pass (may be empty)
+			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+			.inputAttachmentCount = 1, .pInputAttachments = &visibility_input_reference,
+			.colorAttachmentCount = 1, .pColorAttachments = &shading_output_reference,
+		},
+		{ // 3 - accum pass
 			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
 			.inputAttachmentCount = 1, .pInputAttachments = &shading_input_reference,
 			.colorAttachmentCount = 1, .pColorAttachments = &accum_output_reference,
 		},
-		{ // 3 - copy pass
+		{ // 4 - copy pass
 			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
 			.inputAttachmentCount = 1, .pInputAttachments = &accum_input_reference,
 			.colorAttachmentCount = 1, .pColorAttachments = &swapchain_output_reference,
 		},
-		{ // 4 - interface pass
+		{ // 5 - interface pass
 			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
 			.inputAttachmentCount = 0,
 			.colorAttachmentCount = 1, .pColorAttachments = &swapchain_output_reference,
 		},
 	};
 	VkSubpassDependency dependencies[] = {
+		{ // Reservoirs and accumulation of the previous frame have been written
+			.srcSubpass = VK_SUBPASS_EXTERNAL,
+			.dstSubpass = 1,
+			.srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		},
 		{ // Swapchain image has been acquired
 			.srcSubpass = VK_SUBPASS_EXTERNAL,
 			.dstSubpass = 1,
@@ -1895,15 +3051,23 @@ int create_render_pass(render_pass_t* pass, const device_t* device, const swapch
 			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 			.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
 		},
-		{ // The shading pass has finished drawing
-			.srcSubpass = 1,
+		{ // Visibility buffer has been drawn (for spatial reuse)
+			.srcSubpass = 0,
 			.dstSubpass = 2,
 			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
 			.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
 			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 			.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
 		},
-		{ // The accum pass has finished drawing
+		{ // The shading pass has written reservoirs and colors
+			.srcSubpass = 1,
+			.dstSubpass = 2,
+			.srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		},
+		{ // The shading pass and spatial reuse pass have finished drawing
 			.srcSubpass = 2,
 			.dstSubpass = 3,
 			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
@@ -1911,10 +3075,18 @@ int create_render_pass(render_pass_t* pass, const device_t* device, const swapch
 			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 			.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
 		},
-		{ // The copy pass has finished drawing
+		{ // The accum pass has finished drawing
 			.srcSubpass = 3,
 			.dstSubpass = 4,
 			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+		},
+		{ // The copy pass has finished drawing
+			.srcSubpass = 4,
+			.dstSubpass = 5,
+			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
 			.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
 			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 			.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
@@ -1931,6 +3103,19 @@ int create_render_pass(render_pass_t* pass, const device_t* device, const swapch
 		destroy_render_pass(pass, device);
 		return 1;
 	}
+	// The resumed render pass keeps the visibility buffer and shading buffer
+	// as compute shading left them. Otherwise, it is identical, which makes
+	// both render passes compatible with the same framebuffers and pipelines.
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+	attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[2].initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+	if (vkCreateRenderPass(device->device, &renderpass_info, NULL, &pass->resume_render_pass)) {
+		printf("Failed to create a render pass for resuming after compute shading.\n");
+		destroy_render_pass(pass, device);
+		return 1;
+	}
 
 	// Create one framebuffer per swapchain image
 	VkImageView framebuffer_attachments[5];
@@ -2035,9 +3220,17 @@ int record_render_frame_commands(VkCommandBuffer cmd, application_t* app, uint32
 		.clearValueCount = COUNT_OF(clear_values), .pClearValues = clear_values
 	};
 	// Clear query pool
-	vkCmdResetQueryPool(cmd, app->query_pool.pool, swapchain_index*2, 2);
+	vkCmdResetQueryPool(cmd, app->query_pool.pool, swapchain_index * QUERIES_PER_FRAME, QUERIES_PER_FRAME);
 	// Record beginning timestamp
-	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, app->query_pool.pool, swapchain_index*2);
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, app->query_pool.pool, swapchain_index * QUERIES_PER_FRAME);
+	// Upload lights that have changed
+	record_light_buffer_updates(cmd, app, swapchain_index);
+	// Discard reservoirs that are no longer valid
+	record_reservoir_buffer_clear(cmd, &app->reservoir_buffers);
+	// Move animated lights
+	record_light_animation_pass(cmd, &app->light_animation_pass, swapchain_index);
+	// Bin lights into clusters
+	record_light_culling_pass(cmd, &app->light_culling_pass, app->query_pool.pool, swapchain_index * QUERIES_PER_FRAME + 2, swapchain_index);
 	vkCmdBeginRenderPass(cmd, &render_pass_begin, VK_SUBPASS_CONTENTS_INLINE);
 	// Render the scene to the visibility buffer
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app->geometry_pass.pipeline.pipeline);
@@ -2046,13 +3239,33 @@ int record_render_frame_commands(VkCommandBuffer cmd, application_t* app, uint32
 	const VkDeviceSize offsets[1] = {0};
 	vkCmdBindVertexBuffers(cmd, 0, 1, &app->scene.mesh.positions.buffer, offsets);
 	vkCmdDraw(cmd, (uint32_t)app->scene.mesh.triangle_count * 3, 1, 0, 0);
-	// Run the shading pass
-	vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app->shading_pass.pipeline.pipeline);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-		app->shading_pass.pipeline.pipeline_layout, 0, 1, &app->shading_pass.pipeline.descriptor_sets[swapchain_index], 0, NULL);
-	vkCmdBindVertexBuffers(cmd, 0, 1, &app->scene.mesh.triangle.buffer, offsets);
-	vkCmdDraw(cmd, 3, 1, 0, 0);
+	if (app->shading_pass.compute) {
+		// Shade in a compute pass between two render passes. A render pass
+		// can only end in its last subpass.
+		for (uint32_t i = 0; i != 5; ++i)
+			vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdEndRenderPass(cmd);
+		record_compute_shading_pass(cmd, &app->shading_pass, swapchain_index);
+		render_pass_begin.renderPass = app->render_pass.resume_render_pass;
+		vkCmdBeginRenderPass(cmd, &render_pass_begin, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+	}
+	else {
+		// Run the shading pass
+		vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app->shading_pass.pipeline.pipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			app->shading_pass.pipeline.pipeline_layout, 0, 1, &app->shading_pass.pipeline.descriptor_sets[swapchain_index], 0, NULL);
+		vkCmdBindVertexBuffers(cmd, 0, 1, &app->scene.mesh.triangle.buffer, offsets);
+		vkCmdDraw(cmd, 3, 1, 0, 0);
+		// Run the spatial reuse pass (same bindings as the shading pass)
+		vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+		if (app->shading_pass.spatial_reuse_pipeline) {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app->shading_pass.spatial_reuse_pipeline);
+			vkCmdDraw(cmd, 3, 1, 0, 0);
+		}
+	}
 	// Run the accum pass
 	vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app->accum_pass.pipeline.pipeline);
@@ -2081,7 +3294,7 @@ int record_render_frame_commands(VkCommandBuffer cmd, application_t* app, uint32
 	// The frame is rendered completely
 	vkCmdEndRenderPass(cmd);
 	// Record end timestamp
-	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, app->query_pool.pool, swapchain_index*2+1);
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, app->query_pool.pool, swapchain_index * QUERIES_PER_FRAME + 1);
 	// Finish recording
 	if (vkEndCommandBuffer(cmd)) {
 		printf("Failed to end using a command buffer for rendering the scene.\n");
@@ -2419,7 +3632,7 @@ int create_query_pool(query_pool_t* query_pool, swapchain_t* swapchain, const de
 		.pNext = NULL,
 		.flags = 0,
 		.queryType = VK_QUERY_TYPE_TIMESTAMP,
-		.queryCount = swapchain->image_count * 2,
+		.queryCount = swapchain->image_count * QUERIES_PER_FRAME,
 	};
 	if (vkCreateQueryPool(device->device, &pool_create_info, NULL, &query_pool->pool)) {
 		printf("Failed to create query pool for querying timestamps\n");
@@ -2429,6 +3642,77 @@ int create_query_pool(query_pool_t* query_pool, swapchain_t* swapchain, const de
 	return 0;
 }
 
+/*! Writes the contents of the pipeline cache to the given file (unless it is
+	NULL), then frees objects and zeros.*/
+void destroy_pipeline_cache(pipeline_cache_t* cache, const device_t* device, const char* file_path) {
+	if (cache->cache && file_path) {
+		size_t size = 0;
+		void* data = NULL;
+		if (!vkGetPipelineCacheData(device->device, cache->cache, &size, NULL) && size > 0) {
+			data = malloc(size);
+			if (vkGetPipelineCacheData(device->device, cache->cache, &size, data))
+				size = 0;
+		}
+		FILE* file = (size > 0) ? fopen(file_path, "wb") : NULL;
+		if (file) {
+			if (fwrite(data, sizeof(char), size, file) != size)
+				printf("Failed to write the pipeline cache to %s.\n", file_path);
+			fclose(file);
+		}
+		free(data);
+	}
+	if (cache->cache)
+		vkDestroyPipelineCache(device->device, cache->cache, NULL);
+	memset(cache, 0, sizeof(*cache));
+}
+
+/*! Creates a pipeline cache with initial data from the given file, if it
+	exists and has been written for the same device and driver. Otherwise, the
+	cache starts out empty.*/
+int create_pipeline_cache(pipeline_cache_t* cache, const device_t* device, const char* file_path) {
+	memset(cache, 0, sizeof(*cache));
+	// Load the file
+	size_t size = 0;
+	void* data = NULL;
+	FILE* file = fopen(file_path, "rb");
+	if (file) {
+		long file_size;
+		if (!fseek(file, 0, SEEK_END) && (file_size = ftell(file)) > 0) {
+			data = malloc(file_size);
+			fseek(file, 0, SEEK_SET);
+			size = fread(data, sizeof(char), file_size, file);
+		}
+		fclose(file);
+	}
+	// Drivers are supposed to reject data from other devices but not all of
+	// them do, so we check the header
+	const VkPhysicalDeviceProperties* properties = &device->physical_device_properties;
+	uint32_t header[4];
+	if (size >= sizeof(header) + VK_UUID_SIZE) {
+		memcpy(header, data, sizeof(header));
+		if (header[0] < sizeof(header) + VK_UUID_SIZE
+			|| header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+			|| header[2] != properties->vendorID
+			|| header[3] != properties->deviceID
+			|| memcmp((const uint8_t*) data + sizeof(header), properties->pipelineCacheUUID, VK_UUID_SIZE))
+			size = 0;
+	}
+	else
+		size = 0;
+	VkPipelineCacheCreateInfo cache_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = size,
+		.pInitialData = (size > 0) ? data : NULL,
+	};
+	VkResult result = vkCreatePipelineCache(device->device, &cache_info, NULL, &cache->cache);
+	free(data);
+	if (result) {
+		printf("Failed to create a pipeline cache.\n");
+		return 1;
+	}
+	return 0;
+}
+
 //! Destroys all objects associated with this application. Probably the last
 //! thing you invoke before shutdown.
 void destroy_application(application_t* app) {
@@ -2439,8 +3723,11 @@ void destroy_application(application_t* app) {
 	destroy_copy_pass(&app->copy_pass, &app->device);
 	destroy_accum_pass(&app->accum_pass, &app->device);
 	destroy_shading_pass(&app->shading_pass, &app->device);
+	destroy_light_culling_pass(&app->light_culling_pass, &app->device);
+	destroy_light_animation_pass(&app->light_animation_pass, &app->device);
 	destroy_geometry_pass(&app->geometry_pass, &app->device);
 	destroy_render_pass(&app->render_pass, &app->device);
+	destroy_reservoir_buffers(&app->reservoir_buffers, &app->device);
 	destroy_render_targets(&app->render_targets, &app->device);
 	destroy_light_textures(&app->light_textures, &app->device);
 	destroy_light_buffers(&app->light_buffers, &app->device, app->allocator);
@@ -2451,6 +3738,7 @@ void destroy_application(application_t* app) {
 	vmaDestroyAllocator(app->allocator);
 	destroy_scene_specification(&app->scene_specification);
 	destroy_query_pool(&app->query_pool, &app->device);
+	destroy_pipeline_cache(&app->pipeline_cache, &app->device, PIPELINE_CACHE_PATH);
 	destroy_swapchain(&app->swapchain, &app->device);
 	destroy_vulkan_device(&app->device);
 	destroy_imgui(app->imgui);
@@ -2475,24 +3763,53 @@ int update_application(application_t* app, const application_updates_t* update_i
 		glfwSetWindowSize(app->swapchain.window, (int) width, (int) height);
 		update.recreate_swapchain = VK_TRUE;
 	}
+	// Perform a quick load. If the number of lights and vertices stays the
+	// same, lights are uploaded incrementally without rebuilding anything.
+	if (update.quick_load) {
+		remove_emissive_lights(&app->scene_specification);
+		quick_load(&app->scene_specification, &update);
+		if (append_emissive_lights(&app->scene_specification, &app->scene))
+			return 1;
+		if (!update.update_light_count && !update.startup)
+			for (uint32_t i = 0; i != app->scene_specification.polygonal_light_count; ++i)
+				mark_polygonal_light_dirty(&app->light_buffers, i);
+		app->reservoir_buffers.clear_pending = VK_TRUE;
+		*reset_accum = 1;
+	}
+	// New parameters for animated lights are uploaded incrementally as well
+	if (update.update_light_animation && app->light_buffers.animated && !update.update_light_count)
+		for (uint32_t i = 0; i != app->scene_specification.polygonal_light_count; ++i)
+			mark_polygonal_light_dirty(&app->light_buffers, i);
+	// Specialization constants only need new pipelines for the shading pass.
+	// The light cache uses a different grid afterwards, so it gets cleared.
+	if (update.change_specialization && !update.startup) {
+		vkDeviceWaitIdle(app->device.device);
+		destroy_shading_pipelines(&app->shading_pass, &app->device);
+		if (create_shading_pipelines(&app->shading_pass, app))
+			return 1;
+		app->reservoir_buffers.clear_pending = VK_TRUE;
+		*reset_accum = 1;
+	}
 	// Return early, if there is nothing to update
 	if (!update.startup && !update.recreate_swapchain && !update.reload_shaders
-		&& !update.quick_load && !update.update_light_count && !update.update_light_textures
+		&& !update.update_light_count && !update.update_light_textures
 		&& !update.reload_scene && !update.change_shading)
 		return 0;
-	// Perform a quick load
-	if (update.quick_load)
-		quick_load(&app->scene_specification, &update);
+	// A new scene may come with different lights from emissive triangles
+	update.update_light_count |= update.reload_scene;
 	// Flag objects that need to be rebuilt because something changed directly
 	VkBool32 swapchain = update.recreate_swapchain;
 	VkBool32 ltc_table = update.startup;
 	VkBool32 scene = update.startup | update.reload_scene;
 	VkBool32 render_targets = update.startup;
+	VkBool32 reservoir_buffers = update.startup;
 	VkBool32 render_pass = update.startup;
 	VkBool32 constant_buffers = update.startup | update.update_light_count | update.change_shading;
 	VkBool32 light_buffers = update.startup | update.update_light_count;	// TODO: Verify if change_shading is required
 	VkBool32 light_textures = update.startup | update.reload_scene | update.update_light_count | update.update_light_textures;
 	VkBool32 geometry_pass = update.startup | update.reload_shaders;
+	VkBool32 light_animation_pass = update.startup | update.change_shading | update.reload_shaders;
+	VkBool32 light_culling_pass = update.startup | update.change_shading | update.reload_shaders;
 	VkBool32 accum_pass = update.startup | update.reload_shaders;
 	VkBool32 copy_pass = update.startup | update.reload_shaders;
 	VkBool32 shading_pass = update.startup | update.change_shading | update.reload_shaders;
@@ -2503,10 +3820,13 @@ int update_application(application_t* app, const application_updates_t* update_i
 	uint32_t max_dependency_path_length = 16;
 	for (uint32_t i = 0; i != max_dependency_path_length; ++i) {
 		render_targets |= swapchain;
+		reservoir_buffers |= swapchain;
 		render_pass |= swapchain | render_targets;
 		constant_buffers |= swapchain;
 		geometry_pass |= swapchain | scene | constant_buffers | render_targets;
-		shading_pass |= swapchain | ltc_table | scene | render_targets | constant_buffers | light_buffers | light_textures | geometry_pass | shading_pass | interface_pass | frame_queue;
+		light_animation_pass |= swapchain | constant_buffers | light_buffers;
+		light_culling_pass |= swapchain | scene | constant_buffers | light_buffers;
+		shading_pass |= swapchain | ltc_table | scene | render_targets | reservoir_buffers | constant_buffers | light_buffers | light_textures | geometry_pass | light_culling_pass | shading_pass | interface_pass | frame_queue;
 		interface_pass |= swapchain | render_targets;
 		frame_queue |= swapchain;
 		accum_pass |= swapchain | render_targets;
@@ -2519,13 +3839,20 @@ int update_application(application_t* app, const application_updates_t* update_i
 	if (copy_pass) destroy_copy_pass(&app->copy_pass, &app->device);
 	if (accum_pass) destroy_accum_pass(&app->accum_pass, &app->device);
 	if (shading_pass) destroy_shading_pass(&app->shading_pass, &app->device);
+	if (light_culling_pass) destroy_light_culling_pass(&app->light_culling_pass, &app->device);
+	if (light_animation_pass) destroy_light_animation_pass(&app->light_animation_pass, &app->device);
 	if (geometry_pass) destroy_geometry_pass(&app->geometry_pass, &app->device);
 	if (light_textures) destroy_light_textures(&app->light_textures, &app->device);
 	if (light_buffers) destroy_light_buffers(&app->light_buffers, &app->device, app->allocator);
 	if (constant_buffers) destroy_constant_buffers(&app->constant_buffers, &app->device);
 	if (render_pass) destroy_render_pass(&app->render_pass, &app->device);
+	if (reservoir_buffers) destroy_reservoir_buffers(&app->reservoir_buffers, &app->device);
 	if (render_targets) destroy_render_targets(&app->render_targets, &app->device);
-	if (scene) destroy_scene(&app->scene, &app->device);
+	if (scene) {
+		// Lights from the old scene must not outlive it
+		remove_emissive_lights(&app->scene_specification);
+		destroy_scene(&app->scene, &app->device);
+	}
 	if (ltc_table) destroy_ltc_table(&app->ltc_table, &app->device);
 	// Attempt to recreate the swapchain and finish early if the window is
 	// minimized
@@ -2539,20 +3866,43 @@ int update_application(application_t* app, const application_updates_t* update_i
 		}
 	}
 	// Rebuild everything else
+	emissive_light_request_t emissive_light_request;
 	if (   (ltc_table && load_ltc_table(&app->ltc_table, &app->device, "data/ggx_ltc_fit", 51))
-		|| (scene && load_scene(&app->scene, &app->device, app->scene_specification.file_path, app->scene_specification.texture_path, VK_TRUE))
+		|| (scene && load_scene(&app->scene, &app->device, app->scene_specification.file_path, app->scene_specification.texture_path, VK_TRUE, app->scene_specification.stream_textures, get_emissive_light_request(&emissive_light_request, &app->scene_specification)))
+		|| (scene && append_emissive_lights(&app->scene_specification, &app->scene))
 		|| (render_targets && create_render_targets(&app->render_targets, &app->device, &app->swapchain))
+		|| (reservoir_buffers && create_reservoir_buffers(&app->reservoir_buffers, &app->device, &app->swapchain))
 		|| (render_pass && create_render_pass(&app->render_pass, &app->device, &app->swapchain, &app->render_targets))
 		|| (constant_buffers && create_constant_buffers(&app->constant_buffers, &app->device, &app->swapchain, &app->scene_specification, &app->render_settings))
 		|| (light_buffers && create_light_buffers(&app->light_buffers, &app->device, &app->swapchain, &app->scene_specification, app))
 		|| (light_textures && create_and_assign_light_textures(&app->light_textures, &app->device, &app->scene_specification))
-		|| (geometry_pass && create_geometry_pass(&app->geometry_pass, &app->device, &app->swapchain, &app->scene, &app->constant_buffers, &app->render_targets, &app->render_pass))
-		|| (shading_pass && create_shading_pass(&app->shading_pass, app))
-		|| (accum_pass && create_accum_pass(&app->accum_pass, app))
-		|| (copy_pass && create_copy_pass(&app->copy_pass, app))
-		|| (interface_pass && create_interface_pass(&app->interface_pass, &app->device, app->imgui, &app->swapchain, &app->render_targets, &app->render_pass))
 		|| (frame_queue && create_frame_queue(&app->frame_queue, &app->device, &app->swapchain)))
 		return 1;
+	// Passes compile their shaders and create their pipelines in parallel.
+	// Only the shading pass uses objects of another pass (light clusters), so
+	// it shares a section with the light culling pass. If only one section
+	// has work, the shading pass can parallelize its own compilation.
+	int pass_results[4] = { 0 };
+	int pass_section_count = (light_culling_pass || shading_pass) + (geometry_pass || light_animation_pass) + (accum_pass || copy_pass) + interface_pass;
+	#pragma omp parallel sections if(pass_section_count > 1)
+	{
+		#pragma omp section
+		pass_results[0] = (light_culling_pass && create_light_culling_pass(&app->light_culling_pass, app))
+			|| (shading_pass && create_shading_pass(&app->shading_pass, app));
+		#pragma omp section
+		pass_results[1] = (geometry_pass && create_geometry_pass(&app->geometry_pass, &app->device, &app->swapchain, &app->scene, &app->constant_buffers, &app->render_targets, &app->render_pass, app->pipeline_cache.cache))
+			|| (light_animation_pass && create_light_animation_pass(&app->light_animation_pass, app));
+		#pragma omp section
+		pass_results[2] = (accum_pass && create_accum_pass(&app->accum_pass, app))
+			|| (copy_pass && create_copy_pass(&app->copy_pass, app));
+		#pragma omp section
+		pass_results[3] = interface_pass && create_interface_pass(&app->interface_pass, &app->device, app->imgui, &app->swapchain, &app->render_targets, &app->render_pass, app->pipeline_cache.cache);
+	}
+	if (pass_results[0] || pass_results[1] || pass_results[2] || pass_results[3])
+		return 1;
+	// Light indices in old reservoirs may refer to the wrong lights now
+	if (scene || light_buffers || shading_pass)
+		app->reservoir_buffers.clear_pending = VK_TRUE;
 	// If we are here, something has changed and we need to reset the accumalation count
 	*reset_accum = 1;
 	return 0;
@@ -2615,6 +3965,11 @@ int startup_application(application_t* app, int experiment_index, bool_override_
 		destroy_application(app);
 		return 1;
 	}
+	// Pipelines from previous runs come from the pipeline cache
+	if (create_pipeline_cache(&app->pipeline_cache, &app->device, PIPELINE_CACHE_PATH)) {
+		destroy_application(app);
+		return 1;
+	}
 	glfwSetFramebufferSizeCallback(app->swapchain.window, &glfw_framebuffer_size_callback);
 	// Prepare imgui for being used
 	app->imgui = init_imgui(app->swapchain.window);
@@ -2668,6 +4023,11 @@ void setup_experiment(application_updates_t* updates, experiment_list_t* list, s
 		scene->texture_path = copy_string(g_scene_paths[list->experiment->scene_index][2]);
 		updates->reload_scene = VK_TRUE;
 	}
+	// Blurry textures at the start would distort timings and screenshots
+	if (scene->stream_textures) {
+		scene->stream_textures = VK_FALSE;
+		updates->reload_scene = VK_TRUE;
+	}
 	// Prepare camera and lights
 	if (list->experiment->quick_save_path)
 		scene->quick_save_path = copy_string(list->experiment->quick_save_path);
@@ -2677,6 +4037,10 @@ void setup_experiment(application_updates_t* updates, experiment_list_t* list, s
 	// Ensure that render settings are applied properly
 	if (render_settings->v_sync != list->experiment->render_settings.v_sync)
 		updates->recreate_swapchain = VK_TRUE;
+	if (render_settings->quantize_light_vertices != list->experiment->render_settings.quantize_light_vertices
+		|| render_settings->animate_lights != list->experiment->render_settings.animate_lights)
+		updates->update_light_count = VK_TRUE;
+	updates->update_light_animation = VK_TRUE;
 	updates->change_shading = VK_TRUE;
 	(*render_settings) = list->experiment->render_settings;
 
@@ -2889,6 +4253,14 @@ int handle_frame_input(application_t* app) {
 	}
 	// Update the camera
 	control_camera(&app->scene_specification.camera, app->swapchain.window, &reset_accum);
+	// Moving lights make accumulated frames outdated
+	if (app->light_buffers.animated)
+		reset_accum = 1;
+	// So do textures that have become sharper
+	VkBool32 lod_clamps_changed;
+	update_texture_streaming(&app->scene.materials.streaming, &lod_clamps_changed, &app->scene.materials.textures, &app->device);
+	if (lod_clamps_changed)
+		reset_accum = 1;
 
 	// Reset accumulation if needed
 	if (reset_accum) app->accum_num = 0;
@@ -2915,9 +4287,18 @@ void write_constants(void* data, application_t* app) {
 		.error_factor = powf(10.0f, -app->render_settings.error_min_exponent),
 		.exposure_factor = app->render_settings.exposure_factor,
 		.roughness_factor = app->render_settings.roughness_factor,
+		.camera_near = camera->near,
+		.camera_far = camera->far,
+		.light_animation_time = (float) glfwGetTime(),
 	};
 	set_noise_constants(constants.noise_resolution_mask, &constants.noise_texture_index_mask, constants.noise_random_numbers, &app->noise_table, app->render_settings.animate_noise);
 	get_world_to_projection_space(constants.world_to_projection_space, camera, get_aspect_ratio(&app->swapchain));
+	// Remember the camera for reprojection of reservoirs in the next frame
+	reservoir_buffers_t* reservoirs = &app->reservoir_buffers;
+	memcpy(constants.previous_world_to_projection_space, reservoirs->previous_world_to_projection_space, sizeof(constants.previous_world_to_projection_space));
+	memcpy(constants.previous_camera_position_world_space, reservoirs->previous_camera_position_world_space, sizeof(constants.previous_camera_position_world_space));
+	memcpy(reservoirs->previous_world_to_projection_space, constants.world_to_projection_space, sizeof(reservoirs->previous_world_to_projection_space));
+	memcpy(reservoirs->previous_camera_position_world_space, constants.camera_position_world_space, sizeof(reservoirs->previous_camera_position_world_space));
 	// Construct the transform that produces ray directions from pixel
 	// coordinates
 	float viewport_transform[4];
@@ -2979,6 +4360,7 @@ int render_frame(application_t* app) {
 			printf("Failed to reset a fence for reuse in upcoming frames.\n");
 			return 1;
 		}
+		read_light_culling_overflow(&app->light_culling_pass, swapchain_index);
 	}
 	workload->used = VK_TRUE;
 	// Update the constant buffer
@@ -3011,7 +4393,7 @@ int render_frame(application_t* app) {
 	}
 	
 	// Record frametimes
-	record_frame_time(swapchain_index, app->query_pool.pool, app->device.device, app->device.physical_device_properties.limits.timestampPeriod, app->timings, app->accum_num);
+	record_frame_time(swapchain_index, app->query_pool.pool, app->device.device, app->device.physical_device_properties.limits.timestampPeriod, app->timings, app->accum_num, app->light_culling_pass.pipeline.pipeline != VK_NULL_HANDLE);
 
 	// Take a screenshot if requested
 	implement_screenshot(&app->screenshot, &app->swapchain, &app->device, swapchain_index);
@@ -3064,12 +4446,17 @@ int main(int argc, char** argv) {
 	}
 	if (gui_override != bool_override_none) app.render_settings.show_gui = gui_override;
 	// Main loop
+	VkBool32 first_frame = VK_TRUE;
 	while (!glfwWindowShouldClose(app.swapchain.window)) {
 		glfwPollEvents();
 		// Check whether the window is minimized
 		if (app.swapchain.swapchain) {
 			if (handle_frame_input(&app)) break;
 			if (render_frame(&app)) break;
+			// The timer of GLFW starts when the device gets created
+			if (first_frame)
+				printf("Time to first frame: %.3f s\n", glfwGetTime());
+			first_frame = VK_FALSE;
 		}
 	}
 	// Clean up
@@ -38,8 +38,26 @@ typedef struct scene_specification_s {
 	first_person_camera_t camera;
 	//! Number of polygonal lights illuminating the scene
 	uint32_t polygonal_light_count;
-	//! The polygonal lights illuminating the scene
+	//! The polygonal lights illuminating the scene. Lights extracted from
+	//! emissive triangles of the scene come last and have shared_vertices set.
 	polygonal_light_t* polygonal_lights;
+	//! Whether triangles that are flagged as lights in the scene file or use
+	//! one of light_material_names become additional polygonal lights
+	VkBool32 extract_emissive_lights;
+	//! The number of entries in light_material_names
+	uint32_t light_material_count;
+	//! Names of materials whose triangles become polygonal lights
+	char** light_material_names;
+	//! The surface radiance of polygonal lights extracted from the scene
+	float emissive_light_radiance[3];
+	//! Whether adjacent coplanar lights with equal radiance get merged into
+	//! convex polygons when lights are loaded or extracted
+	VkBool32 merge_coplanar_lights;
+	//! The maximal vertex count for polygons created by merging lights
+	uint32_t max_merged_light_vertex_count;
+	//! Whether fine mipmaps of material textures are streamed after the scene
+	//! has been loaded, such that rendering starts sooner. Off by default.
+	VkBool32 stream_textures;
 } scene_specification_t;
 
 //! Available methods to combine diffuse and specular samples
@@ -80,9 +98,35 @@ typedef enum light_sampling_strategies_e {
 	//! Use uniform random light sampling
 	light_uniform,
 	//! Use reservoir sampling
-	light_reservoir
+	light_reservoir,
+	//! Use reservoir sampling with candidates drawn by stochastic traversal
+	//! of a light BVH
+	light_reservoir_bvh,
+	//! Pick one light proportional to its emitted power using an alias table
+	light_power,
+	//! Use reservoir sampling with candidates drawn proportional to emitted
+	//! power using an alias table
+	light_reservoir_power,
+	//! Use reservoir sampling with candidates drawn from a world-space hash
+	//! grid of lights that were useful for nearby shading points, combined
+	//! with uniform or power sampling
+	light_reservoir_cache,
+	//! Number of available light sampling strategies
+	light_sampling_count
 } light_sampling_strategies_t;
 
+//! The target functions that RIS can use to weight candidate lights
+typedef enum ris_target_function_e {
+	//! The norm of the unshadowed shading estimate for the candidate, i.e. the
+	//! same computation that is used for shading
+	ris_target_exact,
+	//! A conservative form factor approximation based on the centroid, area
+	//! and normal of the candidate. Only the chosen light gets shaded exactly.
+	ris_target_form_factor,
+	//! Number of available target functions
+	ris_target_count
+} ris_target_function_t;
+
 //! Settings for how the error of projected solid angle sampling should be
 //! visualized
 typedef enum error_display_e {
@@ -119,6 +163,14 @@ typedef enum bool_override_e {
 	bool_override_none = 2,
 } bool_override_t;
 
+//! The largest number of RIS candidates per reservoir that the user interface
+//! offers
+#define MAX_CANDIDATE_COUNT 1024
+
+//! The largest number of lights per cluster that the user interface offers for
+//! light culling
+#define MAX_LIGHT_CLUSTER_CAPACITY 4096
+
 //! Options that control how the scene will be rendered
 typedef struct render_settings_s {
 	//! Constant factors for the overall brightness and surface roughness
@@ -127,6 +179,14 @@ typedef struct render_settings_s {
 	uint32_t sample_count;
 	//! The number of samples used for choosing lights
 	uint32_t sample_count_light;
+	//! The number of candidates M streamed into each reservoir for RIS. At
+	//! least 1 and at most MAX_CANDIDATE_COUNT.
+	uint32_t candidate_count;
+	//! Whether candidate_count should be scaled per pixel based on the local
+	//! contrast in the previous frame
+	VkBool32 adaptive_candidate_count;
+	//! The target function used to weight RIS candidates
+	ris_target_function_t ris_target_function;
 	//! The heuristic used for multiple importance sampling
 	mis_heuristic_t mis_heuristic;
 	//! Light sampling techniques
@@ -153,6 +213,54 @@ typedef struct render_settings_s {
 	VkBool32 v_sync;
 	//! Whether to use fast atan
 	VkBool32 fast_atan;
+	//! Whether reservoirs from the previous frame should be reprojected and
+	//! merged into the reservoirs of the current frame (RIS only)
+	VkBool32 temporal_reuse;
+	//! Whether a separate sub pass should merge reservoirs of neighbouring
+	//! pixels before shading (RIS only)
+	VkBool32 spatial_reuse;
+	//! The number of randomly chosen neighbours used for spatial reuse
+	uint32_t spatial_reuse_neighbour_count;
+	//! The radius in pixels within which neighbours for spatial reuse are
+	//! chosen
+	float spatial_reuse_radius;
+	//! Whether a compute pass should cull lights per cluster of the view
+	//! frustum such that light selection mostly considers lights in the
+	//! cluster of the shading point (uniform light selection only). Other
+	//! lights keep a small probability, so this does not introduce bias.
+	VkBool32 light_culling;
+	//! Lights are culled for a cluster if the irradiance that they can cause
+	//! in it is below this value. The exposure does not affect it.
+	float light_culling_threshold;
+	//! The maximal number of lights listed per cluster. Clusters with more
+	//! lights fall back to selection from all lights. At least 1 and at most
+	//! MAX_LIGHT_CLUSTER_CAPACITY.
+	uint32_t light_cluster_capacity;
+	//! The probability of drawing a candidate from the light cache rather
+	//! than by uniform or power sampling (light cache only)
+	float light_cache_probability;
+	//! Cells of the light cache have this size relative to their distance to
+	//! the camera
+	float light_cache_cell_scale;
+	//! Whether candidates that are not drawn from the light cache are drawn
+	//! proportional to power rather than uniformly
+	VkBool32 light_cache_power_fallback;
+	//! Whether light vertices are stored with 16 bits per coordinate relative
+	//! to the bounding sphere and planes with 32 bits
+	VkBool32 quantize_light_vertices;
+	//! Whether all polygonal lights move and spin procedurally, driven by a
+	//! compute pass (see generate_polygonal_light_animation())
+	VkBool32 animate_lights;
+	//! The amplitude of the motion of animated lights in world space units
+	float light_animation_amplitude;
+	//! The average frequency of animated lights in Hertz
+	float light_animation_frequency;
+	//! Whether the shading pass and the spatial reuse pass run as compute
+	//! shaders on tiles of 8x8 pixels instead of as fragment shaders
+	VkBool32 compute_shading;
+	//! Whether compute shading with RIS is split into separate kernels for
+	//! candidate generation, shadow rays and final shading
+	VkBool32 wavefront_shading;
 } render_settings_t;
 
 
@@ -281,14 +389,119 @@ typedef struct constant_buffers_s {
 	void* data;
 } constant_buffers_t;
 
+/*! Byte offsets of the arrays in the buffer of polygonal lights. Lights are
+	stored as structure of arrays, such that each shader stage only fetches
+	what it needs. It matches light_buffers in shared_constants.glsl.*/
+typedef struct polygonal_light_buffer_layout_s {
+	//! One vec4 per light holding polygonal_light_t::plane or one uint holding
+	//! the packed normal for quantized lights
+	size_t planes;
+	//! One vec4 per light holding the surface radiance and the area
+	size_t radiance_area;
+	//! One vec4 per light holding the vertex average and the radius of a
+	//! bounding sphere around it
+	size_t bounding_spheres;
+	//! One uvec2 per light holding the index of its first vertex in the
+	//! vertex pool and its vertex count
+	size_t vertex_ranges;
+	//! The vertex pool with vertex_count vec4 holding world space vertices or
+	//! uvec2 holding quantized vertices. The vertices of each light are stored
+	//! consecutively without padding.
+	size_t vertices;
+	//! The total size in bytes
+	size_t size;
+	//! The number of lights for which space is reserved (at least one)
+	uint32_t light_count;
+	//! The number of vertices in the vertex pool (at least one)
+	uint32_t vertex_count;
+	//! Whether the plane and vertices are quantized (see
+	//! quantize_polygonal_light())
+	VkBool32 quantized;
+} polygonal_light_buffer_layout_t;
+
 //! Keeps track of all light buffers used in this application
 typedef struct light_buffers_s {
-	//! One copy of the light buffer per swapchain image
+	//! A single light buffer in device-local memory
 	VkBuffer buffer;
 	VmaAllocation allocation;
 	uint32_t size;
+	//! The light BVH is stored in the same buffer at this offset in bytes,
+	//! which respects the alignment for storage buffers
+	uint32_t bvh_offset;
+	//! The size of the light BVH in bytes
+	uint32_t bvh_size;
+	//! The number of nodes on the longest path from the root of the light BVH
+	//! to a leaf
+	uint32_t bvh_max_depth;
+	//! The offset and size in bytes of the alias table for picking lights
+	//! proportional to power, which is stored in the same buffer
+	uint32_t alias_table_offset, alias_table_size;
+	//! Whether the light buffer holds quantized planes and vertices
+	VkBool32 quantized_vertices;
+	//! Whether lights are animated. In this case, the light buffer holds one
+	//! animated_polygonal_light_t per light at animation_offset, followed by
+	//! plane space vertices (two floats each), which the light animation pass
+	//! uses to overwrite lights each frame.
+	VkBool32 animated;
+	//! The offset and size in bytes of data for the light animation pass
+	uint32_t animation_offset, animation_size;
+	//! If animated is VK_TRUE, the animation of each light
+	polygonal_light_animation_t* animations;
+	//! A copy of the complete contents of the light buffer in host memory.
+	//! Changes are made here first and then staged per region.
+	void* data;
+	/*! A persistently mapped, host-visible staging buffer with one slice of
+		size bytes per swapchain image. Frames fill the slice for their
+		swapchain image, which is no longer in use once its fence has been
+		waited for, so it can be reused without any stalls.*/
+	VkBuffer staging_buffer;
+	VmaAllocation staging_allocation;
+	void* staging_data;
+	uint32_t staging_slice_count;
+	//! One entry per light, non-zero if the light has changed since its data
+	//! was last staged (see mark_polygonal_light_dirty())
+	uint8_t* dirty_lights;
+	//! Indices of all lights with non-zero entries in dirty_lights
+	uint32_t* dirty_light_indices;
+	uint32_t dirty_light_count;
+	//! Space for copy regions, sized for the worst case upon creation
+	VkBufferCopy* copy_regions;
+	//! One entry per light BVH node used by refit_light_bvh()
+	uint8_t* bvh_nodes_changed;
 } light_buffers_t;
 
+/*! The data that the light animation pass reads for each animated light. It
+	matches animated_polygonal_light_t in light_animation.comp.glsl.*/
+typedef struct animated_polygonal_light_s {
+	//! polygonal_light_t::translation and scaling_x
+	float translation[3], scaling_x;
+	//! polygonal_light_t::rotation_angles and scaling_y
+	float rotation_angles[3], scaling_y;
+	//! How the light moves over time
+	polygonal_light_animation_t animation;
+} animated_polygonal_light_t;
+
+/*! Per-pixel reservoirs that persist across frames for temporal reuse. Like
+	render targets, they are duplicated per swapchain image. The shading pass
+	writes the reservoirs for the current swapchain image and reads those for
+	the previous one.*/
+typedef struct reservoir_buffers_s {
+	//! One storage buffer per swapchain image, each with one
+	//! stored_reservoir_t (see reservoir.glsl) per pixel
+	buffers_t buffers;
+	//! Set to VK_TRUE if all reservoirs have to be cleared before the next
+	//! frame gets rendered
+	VkBool32 clear_pending;
+	//! The transform from world to projection space used for the previous
+	//! frame
+	float previous_world_to_projection_space[4][4];
+	//! The camera position used for the previous frame
+	float previous_camera_position_world_space[3];
+	//! A single storage buffer with the world-space hash grid of useful lights
+	//! (see light_cache.glsl). It persists across frames.
+	buffers_t light_cache;
+} reservoir_buffers_t;
+
 //! The sub pass that produces the visibility buffer by rasterizing all
 //! geometry once
 typedef struct geometry_pass_s {
@@ -299,15 +512,96 @@ typedef struct geometry_pass_s {
 } geometry_pass_t;
 
 
+//! The compute pass that lists the lights affecting each cluster of the view
+//! frustum before the render pass begins (see light_clusters.glsl)
+typedef struct light_culling_pass_s {
+	//! Pipeline state and bindings for the light culling pass. If light
+	//! culling is disabled, the pipeline is VK_NULL_HANDLE.
+	pipeline_with_bindings_t pipeline;
+	//! The compute shader that implements the light culling pass
+	shader_t compute_shader;
+	//! A single buffer with light counts and light lists for all clusters. It
+	//! exists even if light culling is disabled.
+	buffers_t cluster_buffer;
+	//! The number of clusters along x, y and depth
+	uint32_t cluster_counts[3];
+	//! The number of lights that fit into the list of each cluster
+	uint32_t cluster_capacity;
+	//! One host-visible buffer per swapchain image counting the clusters whose
+	//! light list overflowed in the frame, along with its mapped memory
+	buffers_t overflow_buffers;
+	void* overflow_data;
+	//! The fraction of clusters with overflowing light lists in the last frame
+	//! that has finished rendering
+	float overflow_rate;
+} light_culling_pass_t;
+
+//! The compute pass that writes animated lights into the light buffer before
+//! lights are culled
+typedef struct light_animation_pass_s {
+	//! Pipeline state and bindings for the light animation pass. If lights
+	//! are not animated, the pipeline is VK_NULL_HANDLE.
+	pipeline_with_bindings_t pipeline;
+	//! The compute shader that implements the light animation pass
+	shader_t compute_shader;
+	//! The number of work groups that is dispatched
+	uint32_t group_count;
+} light_animation_pass_t;
+
+/*! Values of the specialization constants of the shading pass in the order of
+	their constant_id in shading_pass.frag.glsl. Changing them only requires
+	new pipelines, whereas defines require a recompilation. The light sampling
+	strategy and the polygon sampling technique are still defines, because
+	they decide which buffers the shader binds (light BVH, alias table, light
+	cache) and which ray tracing loops get unrolled. Switching them
+	recompiles the shading pass.*/
+typedef struct shading_specialization_s {
+	//! A value of mis_heuristic_t
+	uint32_t mis_heuristic;
+	//! At least one
+	int32_t candidate_count;
+	uint32_t spatial_reuse_neighbour_count;
+	float spatial_reuse_radius;
+	//! Clamped to at most 0.95
+	float light_cache_probability;
+	float light_cache_cell_scale;
+	VkBool32 light_cache_power_fallback;
+} shading_specialization_t;
+
 //! The sub pass that renders a screen filling triangle to perform deferred
-//! shading in a fragment shader, possibly with ray queries for shadows
+//! shading in a fragment shader, possibly with ray queries for shadows. With
+//! render_settings_t::compute_shading, it is a compute pass between two
+//! render passes instead.
 typedef struct shading_pass_s {
 	//! Pipeline state and bindings for the shading pass
 	pipeline_with_bindings_t pipeline;
-	//! The vertex and fragment shader that implements the shading pass
+	//! The vertex and fragment shader that implements the shading pass. In
+	//! compute mode, the fragment shader is a compute shader and there is no
+	//! vertex shader.
 	shader_t vertex_shader, fragment_shader;
 	//! The sampler for light textures
 	VkSampler light_texture_sampler;
+	//! The fragment shader and pipeline for the spatial reuse sub pass. It
+	//! uses the same bindings as the shading pass. The pipeline is
+	//! VK_NULL_HANDLE if spatial reuse is disabled.
+	shader_t spatial_reuse_fragment_shader;
+	VkPipeline spatial_reuse_pipeline;
+	//! VK_TRUE iff both pipelines are compute pipelines that shade tiles of
+	//! 8x8 pixels
+	VkBool32 compute;
+	//! The number of work groups along x and y for compute shading
+	uint32_t group_counts[2];
+	//! VK_TRUE iff compute shading is split into wavefront stages. Then
+	//! pipeline only generates candidates and selects reservoirs.
+	VkBool32 wavefront;
+	//! The compute shaders and pipelines for the wavefront stages after
+	//! candidate generation: Shadow rays (0) and final shading (1)
+	shader_t wavefront_shaders[2];
+	VkPipeline wavefront_pipelines[2];
+	//! Buffers that connect the wavefront stages: Queue lengths with indirect
+	//! dispatch sizes (0), the shadow ray queue (1), the final shading queue
+	//! (2) and LIGHT_SAMPLES selected samples per pixel (3)
+	buffers_t wavefront_buffers;
 } shading_pass_t;
 
 //! The sub pass that renders a screen filling triangle to perform deferred
@@ -374,6 +668,11 @@ typedef struct render_pass_s {
 	VkFramebuffer* framebuffers;
 	//! The render pass that encompasses all subpasses for rendering a frame
 	VkRenderPass render_pass;
+	//! A render pass compatible with render_pass that loads the visibility
+	//! and shading buffer instead of clearing them. With compute shading, it
+	//! resumes the frame after the compute dispatches and only the accum,
+	//! copy and interface subpasses do work.
+	VkRenderPass resume_render_pass;
 } render_pass_t;
 
 
@@ -479,7 +778,8 @@ typedef struct application_updates_s {
 	//! All shaders need to be recompiled
 	VkBool32 reload_shaders;
 	//! The number of light sources in the scene or the number of vertices in a
-	//! polygonal light source has changed
+	//! polygonal light source has changed. Other changes of lights are
+	//! uploaded incrementally (see mark_polygonal_light_dirty()).
 	VkBool32 update_light_count;
 	//! A texture of a polygonal light source has changed
 	VkBool32 update_light_textures;
@@ -487,14 +787,34 @@ typedef struct application_updates_s {
 	VkBool32 reload_scene;
 	//! Settings that define how shading is performed have changed
 	VkBool32 change_shading;
+	//! Only settings that are specialization constants of the shading pass
+	//! have changed (see shading_specialization_t). Its pipelines get
+	//! recreated from the existing shader modules.
+	VkBool32 change_specialization;
 	//! The current camera and lights should be stored to / loaded from a file
 	VkBool32 quick_save, quick_load;
+	//! Settings for the procedural light animation have changed
+	VkBool32 update_light_animation;
 } application_updates_t;
 
+/*! The number of timestamps per swapchain image in the query pool. They mark
+	the beginning and end of the frame, then the beginning and end of the
+	light culling pass.*/
+#define QUERIES_PER_FRAME 4
+
 typedef struct query_pool_s {
 	VkQueryPool pool;
 } query_pool_t;
 
+//! The file that preserves the pipeline cache across runs
+#define PIPELINE_CACHE_PATH "data/pipeline_cache.bin"
+
+//! A pipeline cache used for all pipelines. It is loaded from a file at
+//! startup and written back at shutdown.
+typedef struct pipeline_cache_s {
+	VkPipelineCache cache;
+} pipeline_cache_t;
+
 /*! Bundles together all information needed to run this application.*/
 typedef struct application_s {
 	device_t device;
@@ -511,8 +831,11 @@ typedef struct application_s {
 	render_targets_t render_targets;
 	constant_buffers_t constant_buffers;
 	light_buffers_t light_buffers;
+	reservoir_buffers_t reservoir_buffers;
 	images_t light_textures;
 	geometry_pass_t geometry_pass;
+	light_animation_pass_t light_animation_pass;
+	light_culling_pass_t light_culling_pass;
 	shading_pass_t shading_pass;
 	accum_pass_t accum_pass;
 	copy_pass_t copy_pass;
@@ -524,6 +847,7 @@ typedef struct application_s {
 	bool_override_t run_all_exp;
 	uint32_t accum_num;
 	query_pool_t query_pool;
+	pipeline_cache_t pipeline_cache;
 	VmaAllocator allocator;
 	FILE *timings;
 } application_t;
@@ -547,9 +871,13 @@ typedef struct per_frame_constants_s {
 	float roughness_factor;
 	uint32_t noise_resolution_mask[2];
 	uint32_t noise_texture_index_mask;
-	uint32_t padding_3[3];
+	float light_animation_time;
+	uint32_t padding_3[2];
 	uint32_t noise_random_numbers[4];
 	ltc_constants_t ltc_constants;
+	float previous_world_to_projection_space[4][4];
+	float previous_camera_position_world_space[3];
+	float camera_near, camera_far;
 } per_frame_constants_t;
 
 
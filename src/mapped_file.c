@@ -0,0 +1,80 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "mapped_file.h"
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+int map_file(mapped_file_t* file, const char* file_path) {
+	memset(file, 0, sizeof(*file));
+#ifdef WIN32
+	HANDLE file_handle = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return 1;
+	file->file_handle = file_handle;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_handle, &size) || size.QuadPart == 0)
+		return 1;
+	file->size = (size_t) size.QuadPart;
+	file->mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!file->mapping_handle)
+		return 1;
+	file->data = (const uint8_t*) MapViewOfFile(file->mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	return file->data ? 0 : 1;
+#else
+	int descriptor = open(file_path, O_RDONLY);
+	if (descriptor < 0)
+		return 1;
+	struct stat status;
+	if (fstat(descriptor, &status) || status.st_size <= 0) {
+		close(descriptor);
+		return 1;
+	}
+	void* data = mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	// The mapping keeps the file alive
+	close(descriptor);
+	if (data == MAP_FAILED)
+		return 1;
+	posix_madvise(data, (size_t) status.st_size, POSIX_MADV_SEQUENTIAL);
+	file->data = (const uint8_t*) data;
+	file->size = (size_t) status.st_size;
+	return 0;
+#endif
+}
+
+
+void unmap_file(mapped_file_t* file) {
+#ifdef WIN32
+	if (file->data)
+		UnmapViewOfFile(file->data);
+	if (file->mapping_handle)
+		CloseHandle(file->mapping_handle);
+	if (file->file_handle)
+		CloseHandle(file->file_handle);
+#else
+	if (file->data)
+		munmap((void*) file->data, file->size);
+#endif
+	memset(file, 0, sizeof(*file));
+}
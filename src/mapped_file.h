@@ -0,0 +1,57 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*! A file that is mapped into the address space for reading. The operating
+	system pages it in on demand, so there is no intermediate copy in a
+	buffer of the C runtime.*/
+typedef struct mapped_file_s {
+	//! The contents of the file or NULL if it is not mapped
+	const uint8_t* data;
+	//! The size of the file in bytes
+	size_t size;
+	//! Platform-specific handles for the file and the mapping
+	void* file_handle;
+	void* mapping_handle;
+} mapped_file_t;
+
+
+/*! Maps the whole file at the given path for reading.
+	\param file The output object. Use unmap_file() to clean up, even if this
+		function fails.
+	\param file_path Path to the file that is to be mapped.
+	\return 0 on success. Empty files cannot be mapped.*/
+int map_file(mapped_file_t* file, const char* file_path);
+
+
+//! Unmaps the file, closes handles and zeros the object
+void unmap_file(mapped_file_t* file);
+
+
+/*! Copies size bytes at the given offset in the mapped file to destination
+	and advances the offset.
+	\return 0 on success, 1 if the file ends too early.*/
+static inline int read_mapped_file(void* destination, const mapped_file_t* file, size_t* offset, size_t size) {
+	if (*offset > file->size || file->size - *offset < size)
+		return 1;
+	memcpy(destination, file->data + *offset, size);
+	(*offset) += size;
+	return 0;
+}
@@ -19,6 +19,7 @@
 #include "math_utilities.h"
 #include "string_utilities.h"
 #include <stdint.h>
+#include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,9 +32,14 @@ int set_polygonal_light_vertex_count(polygonal_light_t* light, uint32_t vertex_c
 	memset(vertices, 0, sizeof(float) * 4 * vertex_count);
 	if (light->vertices_plane_space)
 		memcpy(vertices, light->vertices_plane_space, sizeof(float) * 4 * ((vertex_count < light->vertex_count) ? vertex_count : light->vertex_count));
-	free(light->vertices_plane_space);
+	// Shared vertices belong to someone else, so from now on the light gets
+	// its own allocations
+	if (!light->shared_vertices) {
+		free(light->vertices_plane_space);
+		free(light->vertices_world_space);
+	}
+	light->shared_vertices = 0;
 	light->vertices_plane_space = vertices;
-	free(light->vertices_world_space);
 	light->vertices_world_space = (float*) malloc(sizeof(float) * 4 * vertex_count);
 	memset(light->vertices_world_space, 0, sizeof(float) * 4 * vertex_count);
 	light->vertex_count = vertex_count;
@@ -98,12 +104,617 @@ void update_polygonal_light(polygonal_light_t* light) {
 }
 
 
+float get_polygonal_light_power(const polygonal_light_t* light) {
+	float luminance = 0.2126f * light->surface_radiance[0] + 0.7152f * light->surface_radiance[1] + 0.0722f * light->surface_radiance[2];
+	return M_PI_F * luminance * light->area;
+}
+
+
+void get_polygonal_light_bounding_sphere(float center[4], const polygonal_light_t* light) {
+	for (uint32_t j = 0; j != 4; ++j)
+		center[j] = 0.0f;
+	if (light->vertex_count == 0)
+		return;
+	for (uint32_t i = 0; i != light->vertex_count; ++i)
+		for (uint32_t j = 0; j != 3; ++j)
+			center[j] += light->vertices_world_space[i * 4 + j];
+	for (uint32_t j = 0; j != 3; ++j)
+		center[j] /= (float) light->vertex_count;
+	float radius_squared = 0.0f;
+	for (uint32_t i = 0; i != light->vertex_count; ++i) {
+		float distance_squared = 0.0f;
+		for (uint32_t j = 0; j != 3; ++j) {
+			float difference = light->vertices_world_space[i * 4 + j] - center[j];
+			distance_squared += difference * difference;
+		}
+		radius_squared = (distance_squared > radius_squared) ? distance_squared : radius_squared;
+	}
+	center[3] = sqrtf(radius_squared);
+}
+
+
+//! Mimics packSnorm2x16() in GLSL for a single value
+static uint32_t pack_snorm_16(float value) {
+	value = (value < -1.0f) ? -1.0f : ((value > 1.0f) ? 1.0f : value);
+	return ((uint32_t) (int16_t) roundf(value * 32767.0f)) & 0xFFFF;
+}
+
+
+//! Mimics unpackSnorm2x16() in GLSL for a single value
+static float unpack_snorm_16(uint32_t value) {
+	float result = ((float) (int16_t) (uint16_t) value) / 32767.0f;
+	return (result < -1.0f) ? -1.0f : result;
+}
+
+
+/*! Maps a coordinate of an octahedral map in [-1, 1] to a 16-bit UNORM value,
+	such that decode_normal_32_bit() in mesh_quantization.glsl recovers it.
+	That function maps zero to an exact value.*/
+static uint32_t pack_octahedral_coordinate(float value) {
+	float scaled = roundf(value * (65535.0f * 65535.0f / (2.0f * 65534.0f)) + 32768.0f);
+	return (uint32_t) ((scaled < 0.0f) ? 0.0f : ((scaled > 65535.0f) ? 65535.0f : scaled));
+}
+
+
+//! Inverse of pack_octahedral_coordinate()
+static float unpack_octahedral_coordinate(uint32_t value) {
+	float factor = 2.0f * (65534.0f / 65535.0f);
+	return ((float) value / 65535.0f) * factor - (32768.0f / 65535.0f) * factor;
+}
+
+
+void quantize_polygonal_light(uint32_t* packed_normal, uint32_t* quantized_vertices, const float bounding_sphere[4], const polygonal_light_t* light) {
+	// Octahedral map of the normal
+	const float* normal = light->plane;
+	float norm_1 = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	float octahedral[2] = { normal[0] / norm_1, normal[1] / norm_1 };
+	if (normal[2] < 0.0f) {
+		float folded[2] = {
+			(1.0f - fabsf(octahedral[1])) * ((octahedral[0] >= 0.0f) ? 1.0f : -1.0f),
+			(1.0f - fabsf(octahedral[0])) * ((octahedral[1] >= 0.0f) ? 1.0f : -1.0f),
+		};
+		octahedral[0] = folded[0];
+		octahedral[1] = folded[1];
+	}
+	(*packed_normal) = pack_octahedral_coordinate(octahedral[0]) | (pack_octahedral_coordinate(octahedral[1]) << 16);
+	// Vertices relative to the bounding sphere
+	float rcp_radius = (bounding_sphere[3] > 0.0f) ? (1.0f / bounding_sphere[3]) : 0.0f;
+	for (uint32_t i = 0; i != light->vertex_count; ++i) {
+		uint32_t snorm[3];
+		for (uint32_t j = 0; j != 3; ++j)
+			snorm[j] = pack_snorm_16((light->vertices_world_space[i * 4 + j] - bounding_sphere[j]) * rcp_radius);
+		quantized_vertices[2 * i + 0] = snorm[0] | (snorm[1] << 16);
+		quantized_vertices[2 * i + 1] = snorm[2];
+	}
+}
+
+
+void dequantize_polygonal_light_vertex(float vertex[3], const uint32_t quantized_vertex[2], const float bounding_sphere[4]) {
+	uint32_t snorm[3] = { quantized_vertex[0] & 0xFFFF, quantized_vertex[0] >> 16, quantized_vertex[1] & 0xFFFF };
+	for (uint32_t j = 0; j != 3; ++j)
+		vertex[j] = unpack_snorm_16(snorm[j]) * bounding_sphere[3] + bounding_sphere[j];
+}
+
+
+void dequantize_polygonal_light_normal(float normal[3], uint32_t packed_normal) {
+	float octahedral[2] = { unpack_octahedral_coordinate(packed_normal & 0xFFFF), unpack_octahedral_coordinate(packed_normal >> 16) };
+	normal[0] = octahedral[0];
+	normal[1] = octahedral[1];
+	normal[2] = 1.0f - fabsf(octahedral[0]) - fabsf(octahedral[1]);
+	if (normal[2] < 0.0f) {
+		normal[0] = (1.0f - fabsf(octahedral[1])) * ((octahedral[0] >= 0.0f) ? 1.0f : -1.0f);
+		normal[1] = (1.0f - fabsf(octahedral[0])) * ((octahedral[1] >= 0.0f) ? 1.0f : -1.0f);
+	}
+	float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	for (uint32_t j = 0; j != 3; ++j)
+		normal[j] /= length;
+}
+
+
+void write_polygonal_light_alias_table(polygonal_light_alias_entry_t* table, const polygonal_light_t* lights, uint32_t light_count) {
+	if (light_count == 0) {
+		polygonal_light_alias_entry_t entry = { .threshold = 1.0f, .alias = 0, .density = 1.0f };
+		table[0] = entry;
+		return;
+	}
+	// Gather powers
+	double total_power = 0.0;
+	for (uint32_t i = 0; i != light_count; ++i) {
+		float power = get_polygonal_light_power(&lights[i]);
+		power = (power > 0.0f) ? power : 0.0f;
+		table[i].density = power;
+		total_power += power;
+	}
+	for (uint32_t i = 0; i != light_count; ++i) {
+		table[i].density = (total_power > 0.0) ? ((float) (table[i].density / total_power)) : (1.0f / light_count);
+		// The threshold is first used to hold the scaled density
+		table[i].threshold = table[i].density * light_count;
+		table[i].alias = i;
+		table[i].padding = 0.0f;
+	}
+	// Vose's method: Distribute the excess of large entries onto small ones
+	uint32_t* small = (uint32_t*) malloc(sizeof(uint32_t) * light_count);
+	uint32_t* large = (uint32_t*) malloc(sizeof(uint32_t) * light_count);
+	uint32_t small_count = 0, large_count = 0;
+	for (uint32_t i = 0; i != light_count; ++i) {
+		if (table[i].threshold < 1.0f)
+			small[small_count++] = i;
+		else
+			large[large_count++] = i;
+	}
+	while (small_count > 0 && large_count > 0) {
+		uint32_t small_index = small[--small_count];
+		uint32_t large_index = large[--large_count];
+		table[small_index].alias = large_index;
+		table[large_index].threshold = (table[large_index].threshold + table[small_index].threshold) - 1.0f;
+		if (table[large_index].threshold < 1.0f)
+			small[small_count++] = large_index;
+		else
+			large[large_count++] = large_index;
+	}
+	// Whatever remains is (up to rounding) exactly one
+	while (large_count > 0)
+		table[large[--large_count]].threshold = 1.0f;
+	while (small_count > 0)
+		table[small[--small_count]].threshold = 1.0f;
+	free(small);
+	free(large);
+}
+
+
+//! Advances the given state of a hash-based random number generator and
+//! returns a uniform random number in [0, 1)
+static float get_hashed_random_number(uint32_t* state) {
+	uint32_t x = (*state) = (*state) * 747796405u + 2891336453u;
+	x = ((x >> ((x >> 28u) + 4u)) ^ x) * 277803737u;
+	x = (x >> 22u) ^ x;
+	return (float) (x >> 8) * (1.0f / 16777216.0f);
+}
+
+
+void generate_polygonal_light_animation(polygonal_light_animation_t* animation, uint32_t light_index, float amplitude, float frequency) {
+	memset(animation, 0, sizeof(*animation));
+	uint32_t state = light_index;
+	// Pick a direction uniformly on the sphere
+	float z = 2.0f * get_hashed_random_number(&state) - 1.0f;
+	float phi = 2.0f * M_PI_F * get_hashed_random_number(&state);
+	float r = sqrtf(1.0f - z * z);
+	animation->translation_amplitude[0] = amplitude * r * cosf(phi);
+	animation->translation_amplitude[1] = amplitude * r * sinf(phi);
+	animation->translation_amplitude[2] = amplitude * z;
+	animation->frequency = frequency * (0.5f + get_hashed_random_number(&state));
+	animation->phase = get_hashed_random_number(&state);
+	animation->spin_velocity = 2.0f * M_PI_F * frequency * (2.0f * get_hashed_random_number(&state) - 1.0f);
+}
+
+
+void get_animated_polygonal_light_aabb(float aabb_min[3], float aabb_max[3], const polygonal_light_t* light, const polygonal_light_animation_t* animation) {
+	if (animation->spin_velocity == 0.0f) {
+		// Without spin, the polygon only gets translated
+		memcpy(aabb_min, light->vertices_world_space, sizeof(float) * 3);
+		memcpy(aabb_max, light->vertices_world_space, sizeof(float) * 3);
+		for (uint32_t i = 1; i != light->vertex_count; ++i) {
+			for (uint32_t j = 0; j != 3; ++j) {
+				float coordinate = light->vertices_world_space[i * 4 + j];
+				aabb_min[j] = (coordinate < aabb_min[j]) ? coordinate : aabb_min[j];
+				aabb_max[j] = (coordinate > aabb_max[j]) ? coordinate : aabb_max[j];
+			}
+		}
+	}
+	else {
+		// Spinning sweeps a disk around the translation
+		float radius_squared = 0.0f;
+		for (uint32_t i = 0; i != light->vertex_count; ++i) {
+			float x = light->scaling_x * light->vertices_plane_space[i * 4 + 0];
+			float y = light->scaling_y * light->vertices_plane_space[i * 4 + 1];
+			radius_squared = (x * x + y * y > radius_squared) ? (x * x + y * y) : radius_squared;
+		}
+		float radius = sqrtf(radius_squared);
+		for (uint32_t j = 0; j != 3; ++j) {
+			aabb_min[j] = light->translation[j] - radius;
+			aabb_max[j] = light->translation[j] + radius;
+		}
+	}
+	for (uint32_t j = 0; j != 3; ++j) {
+		float amplitude = fabsf(animation->translation_amplitude[j]);
+		aabb_min[j] -= amplitude;
+		aabb_max[j] += amplitude;
+	}
+}
+
+
+int create_triangle_polygonal_light(polygonal_light_t* light, const float vertices[3][3], const float radiance[3], float* vertex_storage) {
+	// Use the centroid as translation
+	float center[3];
+	for (uint32_t i = 0; i != 3; ++i)
+		center[i] = (vertices[0][i] + vertices[1][i] + vertices[2][i]) * (1.0f / 3.0f);
+	// Compute the normal
+	float edges[2][3];
+	for (uint32_t i = 0; i != 3; ++i) {
+		edges[0][i] = vertices[1][i] - vertices[0][i];
+		edges[1][i] = vertices[2][i] - vertices[0][i];
+	}
+	float normal[3] = {
+		edges[0][1] * edges[1][2] - edges[0][2] * edges[1][1],
+		edges[0][2] * edges[1][0] - edges[0][0] * edges[1][2],
+		edges[0][0] * edges[1][1] - edges[0][1] * edges[1][0],
+	};
+	float normal_length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	if (!(normal_length > 0.0f))
+		return 1;
+	for (uint32_t i = 0; i != 3; ++i)
+		normal[i] /= normal_length;
+	memset(light, 0, sizeof(*light));
+	// Pick Euler angles such that the third column of the rotation matrix in
+	// update_polygonal_light() is the normal. The rotation around z is zero.
+	float normal_x = (normal[0] < -1.0f) ? -1.0f : ((normal[0] > 1.0f) ? 1.0f : normal[0]);
+	light->rotation_angles[0] = atan2f(-normal[1], normal[2]);
+	light->rotation_angles[1] = asinf(-normal_x);
+	light->rotation_angles[2] = 0.0f;
+	// The first two columns of this rotation matrix span the plane
+	float cx = cosf(light->rotation_angles[0]);
+	float sx = sinf(light->rotation_angles[0]);
+	float cy = cosf(light->rotation_angles[1]);
+	float sy = sinf(light->rotation_angles[1]);
+	float tangent[2][3] = {
+		{cy, -sx * sy, cx * sy},
+		{0.0f, cx, sx},
+	};
+	// Project the vertices onto the plane
+	light->vertices_plane_space = vertex_storage;
+	light->vertices_world_space = vertex_storage + 12;
+	memset(vertex_storage, 0, sizeof(float) * 24);
+	for (uint32_t i = 0; i != 3; ++i) {
+		float offset[3] = { vertices[i][0] - center[0], vertices[i][1] - center[1], vertices[i][2] - center[2] };
+		for (uint32_t j = 0; j != 2; ++j)
+			light->vertices_plane_space[i * 4 + j] = offset[0] * tangent[j][0] + offset[1] * tangent[j][1] + offset[2] * tangent[j][2];
+	}
+	memcpy(light->translation, center, sizeof(center));
+	memcpy(light->radiant_flux, radiance, sizeof(light->radiant_flux));
+	light->scaling_x = light->scaling_y = 1.0f;
+	light->vertex_count = 3;
+	light->texturing_technique = polygon_texturing_none;
+	light->shared_vertices = 1;
+	update_polygonal_light(light);
+	return 0;
+}
+
+
+//! An entry of the spatial hash, which is used to weld vertices and to find
+//! shared edges when merging lights
+typedef struct light_merge_key_s {
+	//! Either a quantized vertex position or a pair of vertex indices
+	uint64_t key;
+	//! The index of a vertex across all lights or of a light for edges
+	uint32_t index;
+	//! The index of the light for vertices or of the edge within the light
+	//! for edges
+	uint32_t edge;
+} light_merge_key_t;
+
+//! A pair of lights that share an edge, which may allow merging them
+typedef struct light_merge_pair_s {
+	//! Indices of the two lights
+	uint32_t lights[2];
+	//! For each light, the index of the first vertex of the shared edge
+	uint32_t edges[2];
+} light_merge_pair_t;
+
+//! Comparison function for qsort() that orders entries by key and index
+static int compare_light_merge_keys(const void* lhs, const void* rhs) {
+	const light_merge_key_t* l = (const light_merge_key_t*) lhs;
+	const light_merge_key_t* r = (const light_merge_key_t*) rhs;
+	if (l->key != r->key) return (l->key < r->key) ? -1 : 1;
+	if (l->index != r->index) return (l->index < r->index) ? -1 : 1;
+	return (l->edge < r->edge) ? -1 : ((l->edge > r->edge) ? 1 : 0);
+}
+
+//! Returns the dot product of the given normal with the cross product of the
+//! edges from vertex b to a and from b to c. Polygonal lights wind clockwise
+//! around their plane normal (see update_polygonal_light()), so that is
+//! positive at convex corners.
+static float get_light_merge_turn(const float normal[3], const float* a, const float* b, const float* c) {
+	float e[2][3] = {
+		{a[0] - b[0], a[1] - b[1], a[2] - b[2]},
+		{c[0] - b[0], c[1] - b[1], c[2] - b[2]},
+	};
+	return normal[0] * (e[0][1] * e[1][2] - e[0][2] * e[1][1])
+		+ normal[1] * (e[0][2] * e[1][0] - e[0][0] * e[1][2])
+		+ normal[2] * (e[0][0] * e[1][1] - e[0][1] * e[1][0]);
+}
+
+/*! Checks whether the given polygon (as list of welded vertex indices) is
+	convex with respect to the given normal.
+	\return The number of vertices that are not collinear with their
+		neighbors or 0 if the polygon is not convex.*/
+static uint32_t get_light_merge_corner_count(const uint32_t* polygon, uint32_t vertex_count, const float* positions, const float normal[3]) {
+	uint32_t corner_count = 0;
+	for (uint32_t i = 0; i != vertex_count; ++i) {
+		const float* a = &positions[3 * polygon[(i + vertex_count - 1) % vertex_count]];
+		const float* b = &positions[3 * polygon[i]];
+		const float* c = &positions[3 * polygon[(i + 1) % vertex_count]];
+		float length_squared[2] = {0.0f, 0.0f};
+		for (uint32_t j = 0; j != 3; ++j) {
+			length_squared[0] += (b[j] - a[j]) * (b[j] - a[j]);
+			length_squared[1] += (c[j] - b[j]) * (c[j] - b[j]);
+		}
+		float turn = get_light_merge_turn(normal, a, b, c);
+		float tolerance = 1.0e-5f * sqrtf(length_squared[0] * length_squared[1]);
+		if (turn < -tolerance)
+			return 0;
+		corner_count += (turn > tolerance) ? 1 : 0;
+	}
+	return corner_count;
+}
+
+//! Tests whether two lights have the same emission and lie in the same plane
+static int can_merge_polygonal_lights(const polygonal_light_t* lhs, const polygonal_light_t* rhs, float tolerance) {
+	for (uint32_t i = 0; i != 3; ++i) {
+		float difference = fabsf(lhs->surface_radiance[i] - rhs->surface_radiance[i]);
+		if (difference > 1.0e-5f * fmaxf(fabsf(lhs->surface_radiance[i]), fabsf(rhs->surface_radiance[i])))
+			return 0;
+	}
+	float normal_dot = lhs->plane[0] * rhs->plane[0] + lhs->plane[1] * rhs->plane[1] + lhs->plane[2] * rhs->plane[2];
+	if (normal_dot < 1.0f - 1.0e-4f)
+		return 0;
+	for (uint32_t i = 0; i != rhs->vertex_count; ++i) {
+		const float* vertex = &rhs->vertices_world_space[i * 4];
+		float distance = lhs->plane[0] * vertex[0] + lhs->plane[1] * vertex[1] + lhs->plane[2] * vertex[2] + lhs->plane[3];
+		if (fabsf(distance) > tolerance)
+			return 0;
+	}
+	return 1;
+}
+
+//! Returns the representative of the given light in a union-find structure
+static uint32_t find_light_merge_group(uint32_t* groups, uint32_t light) {
+	while (groups[light] != light) {
+		groups[light] = groups[groups[light]];
+		light = groups[light];
+	}
+	return light;
+}
+
+
+uint32_t merge_coplanar_polygonal_lights(polygonal_light_t* lights, uint32_t light_count, uint32_t max_vertex_count) {
+	if (light_count < 2 || max_vertex_count < 4)
+		return light_count;
+	// Make sure that world-space vertices and planes are up to date
+	#pragma omp parallel for
+	for (int i = 0; i < (int) light_count; ++i)
+		update_polygonal_light(&lights[i]);
+	// Textured lights cannot be merged because texture coordinates would
+	// change
+	uint8_t* mergeable = malloc(sizeof(uint8_t) * light_count);
+	uint32_t* vertex_offsets = malloc(sizeof(uint32_t) * (light_count + 1));
+	vertex_offsets[0] = 0;
+	float box_min[3] = {3.4e38f, 3.4e38f, 3.4e38f};
+	float box_max[3] = {-3.4e38f, -3.4e38f, -3.4e38f};
+	for (uint32_t i = 0; i != light_count; ++i) {
+		const polygonal_light_t* light = &lights[i];
+		mergeable[i] = light->texturing_technique == polygon_texturing_none && light->texture_file_path == NULL && light->vertex_count >= 3 && light->area > 0.0f;
+		vertex_offsets[i + 1] = vertex_offsets[i] + light->vertex_count;
+		for (uint32_t j = 0; j != light->vertex_count; ++j) {
+			for (uint32_t k = 0; k != 3; ++k) {
+				box_min[k] = fminf(box_min[k], light->vertices_world_space[j * 4 + k]);
+				box_max[k] = fmaxf(box_max[k], light->vertices_world_space[j * 4 + k]);
+			}
+		}
+	}
+	// Vertices are welded if they fall into the same cell of a 21-bit grid
+	// over the bounding box of all lights
+	float extent = fmaxf(fmaxf(box_max[0] - box_min[0], box_max[1] - box_min[1]), fmaxf(box_max[2] - box_min[2], 1.0e-20f));
+	float cell_size = extent / (float) ((1 << 21) - 1);
+	uint32_t total_vertex_count = vertex_offsets[light_count];
+	light_merge_key_t* vertex_keys = malloc(sizeof(light_merge_key_t) * total_vertex_count);
+	#pragma omp parallel for
+	for (int i = 0; i < (int) light_count; ++i) {
+		const polygonal_light_t* light = &lights[i];
+		for (uint32_t j = 0; j != light->vertex_count; ++j) {
+			uint64_t key = 0;
+			for (uint32_t k = 0; k != 3; ++k) {
+				uint64_t coordinate = (uint64_t) ((light->vertices_world_space[j * 4 + k] - box_min[k]) / cell_size + 0.5f);
+				key |= ((coordinate < 0x1FFFFF) ? coordinate : 0x1FFFFF) << (21 * k);
+			}
+			light_merge_key_t entry = { key, vertex_offsets[i] + j, (uint32_t) i };
+			vertex_keys[vertex_offsets[i] + j] = entry;
+		}
+	}
+	qsort(vertex_keys, total_vertex_count, sizeof(light_merge_key_t), compare_light_merge_keys);
+	uint32_t* vertex_ids = malloc(sizeof(uint32_t) * total_vertex_count);
+	float* positions = malloc(sizeof(float) * 3 * total_vertex_count);
+	uint32_t unique_vertex_count = 0;
+	for (uint32_t i = 0; i != total_vertex_count; ++i) {
+		if (i == 0 || vertex_keys[i].key != vertex_keys[i - 1].key) {
+			const light_merge_key_t* vertex = &vertex_keys[i];
+			memcpy(&positions[3 * unique_vertex_count], &lights[vertex->edge].vertices_world_space[4 * (vertex->index - vertex_offsets[vertex->edge])], sizeof(float) * 3);
+			++unique_vertex_count;
+		}
+		vertex_ids[vertex_keys[i].index] = unique_vertex_count - 1;
+	}
+	free(vertex_keys);
+	// Find edges that are shared by exactly two mergeable lights
+	light_merge_key_t* edge_keys = malloc(sizeof(light_merge_key_t) * total_vertex_count);
+	#pragma omp parallel for
+	for (int i = 0; i < (int) light_count; ++i) {
+		uint32_t vertex_count = lights[i].vertex_count;
+		for (uint32_t j = 0; j != vertex_count; ++j) {
+			uint64_t a = vertex_ids[vertex_offsets[i] + j];
+			uint64_t b = vertex_ids[vertex_offsets[i] + (j + 1) % vertex_count];
+			light_merge_key_t entry = { (a < b) ? ((a << 32) | b) : ((b << 32) | a), (uint32_t) i, j };
+			if (!mergeable[i] || a == b) entry.key = 0xFFFFFFFFFFFFFFFFull;
+			edge_keys[vertex_offsets[i] + j] = entry;
+		}
+	}
+	qsort(edge_keys, total_vertex_count, sizeof(light_merge_key_t), compare_light_merge_keys);
+	light_merge_pair_t* pairs = malloc(sizeof(light_merge_pair_t) * (total_vertex_count / 2 + 1));
+	uint32_t pair_count = 0;
+	for (uint32_t i = 0; i + 1 < total_vertex_count; ++i) {
+		const light_merge_key_t* edge = &edge_keys[i];
+		int shared_by_two = edge->key != 0xFFFFFFFFFFFFFFFFull && edge[1].key == edge->key
+			&& (i == 0 || edge[-1].key != edge->key)
+			&& (i + 2 == total_vertex_count || edge[2].key != edge->key)
+			&& edge[1].index != edge->index;
+		if (shared_by_two) {
+			light_merge_pair_t pair = { {edge[0].index, edge[1].index}, {edge[0].edge, edge[1].edge} };
+			pairs[pair_count++] = pair;
+		}
+	}
+	free(edge_keys);
+	// Test which pairs have equal emission, lie in a common plane and have
+	// consistent winding, i.e. the shared edge has opposite directions
+	float plane_tolerance = 16.0f * cell_size;
+	uint8_t* compatible = malloc(sizeof(uint8_t) * (pair_count + 1));
+	#pragma omp parallel for
+	for (int i = 0; i < (int) pair_count; ++i) {
+		const light_merge_pair_t* pair = &pairs[i];
+		const polygonal_light_t* lhs = &lights[pair->lights[0]];
+		const polygonal_light_t* rhs = &lights[pair->lights[1]];
+		uint32_t lhs_start = vertex_ids[vertex_offsets[pair->lights[0]] + pair->edges[0]];
+		uint32_t rhs_start = vertex_ids[vertex_offsets[pair->lights[1]] + pair->edges[1]];
+		compatible[i] = lhs_start != rhs_start
+			&& can_merge_polygonal_lights(lhs, rhs, plane_tolerance)
+			&& can_merge_polygonal_lights(rhs, lhs, plane_tolerance);
+	}
+	// Greedily merge polygons along compatible edges. Each group of lights
+	// stores its polygon as list of welded vertex indices. Collinear vertices
+	// are kept until the end, such that all original edges remain intact.
+	uint32_t* groups = malloc(sizeof(uint32_t) * light_count);
+	uint32_t** polygons = malloc(sizeof(uint32_t*) * light_count);
+	uint32_t* polygon_sizes = malloc(sizeof(uint32_t) * light_count);
+	for (uint32_t i = 0; i != light_count; ++i) {
+		groups[i] = i;
+		polygons[i] = NULL;
+		polygon_sizes[i] = lights[i].vertex_count;
+	}
+	uint32_t merge_count = 0;
+	for (uint32_t i = 0; i != pair_count; ++i) {
+		if (!compatible[i])
+			continue;
+		const light_merge_pair_t* pair = &pairs[i];
+		uint32_t lhs = find_light_merge_group(groups, pair->lights[0]);
+		uint32_t rhs = find_light_merge_group(groups, pair->lights[1]);
+		if (lhs == rhs)
+			continue;
+		// Polygons of lights that have not been merged yet are created lazily
+		uint32_t sides[2] = {lhs, rhs};
+		for (uint32_t j = 0; j != 2; ++j) {
+			if (!polygons[sides[j]]) {
+				polygons[sides[j]] = malloc(sizeof(uint32_t) * polygon_sizes[sides[j]]);
+				memcpy(polygons[sides[j]], &vertex_ids[vertex_offsets[sides[j]]], sizeof(uint32_t) * polygon_sizes[sides[j]]);
+			}
+		}
+		// Locate the shared edge u -> v in the left polygon and v -> u in the
+		// right polygon
+		uint32_t u = vertex_ids[vertex_offsets[pair->lights[0]] + pair->edges[0]];
+		uint32_t v = vertex_ids[vertex_offsets[pair->lights[0]] + (pair->edges[0] + 1) % lights[pair->lights[0]].vertex_count];
+		const uint32_t* lhs_polygon = polygons[lhs];
+		const uint32_t* rhs_polygon = polygons[rhs];
+		uint32_t lhs_size = polygon_sizes[lhs];
+		uint32_t rhs_size = polygon_sizes[rhs];
+		uint32_t lhs_edge = lhs_size, rhs_edge = rhs_size;
+		for (uint32_t j = 0; j != lhs_size; ++j)
+			if (lhs_polygon[j] == u && lhs_polygon[(j + 1) % lhs_size] == v)
+				lhs_edge = j;
+		for (uint32_t j = 0; j != rhs_size; ++j)
+			if (rhs_polygon[j] == v && rhs_polygon[(j + 1) % rhs_size] == u)
+				rhs_edge = j;
+		if (lhs_edge == lhs_size || rhs_edge == rhs_size)
+			continue;
+		// Walk around the left polygon from v to u, then around the right
+		// polygon from u to v without repeating the end points
+		uint32_t merged_size = lhs_size + rhs_size - 2;
+		uint32_t* merged = malloc(sizeof(uint32_t) * merged_size);
+		for (uint32_t j = 0; j != lhs_size; ++j)
+			merged[j] = lhs_polygon[(lhs_edge + 1 + j) % lhs_size];
+		for (uint32_t j = 0; j != rhs_size - 2; ++j)
+			merged[lhs_size + j] = rhs_polygon[(rhs_edge + 2 + j) % rhs_size];
+		// Polygons that touch themselves are not simple
+		int valid = 1;
+		for (uint32_t j = 0; j != merged_size && valid; ++j)
+			for (uint32_t k = j + 1; k != merged_size && valid; ++k)
+				valid = merged[j] != merged[k];
+		uint32_t corner_count = valid ? get_light_merge_corner_count(merged, merged_size, positions, lights[lhs].plane) : 0;
+		if (corner_count < 3 || corner_count > max_vertex_count) {
+			free(merged);
+			continue;
+		}
+		free(polygons[lhs]);
+		free(polygons[rhs]);
+		polygons[lhs] = merged;
+		polygons[rhs] = NULL;
+		polygon_sizes[lhs] = merged_size;
+		groups[rhs] = lhs;
+		++merge_count;
+	}
+	free(compatible);
+	free(pairs);
+	// Replace merged groups by a single light, which uses the transform of the
+	// first light in the group
+	#pragma omp parallel for
+	for (int i = 0; i < (int) light_count; ++i) {
+		if (groups[i] != (uint32_t) i || !polygons[i] || polygon_sizes[i] == lights[i].vertex_count)
+			continue;
+		polygonal_light_t merged = lights[i];
+		merged.vertex_count = 0;
+		merged.vertices_plane_space = merged.vertices_world_space = NULL;
+		merged.shared_vertices = 0;
+		set_polygonal_light_vertex_count(&merged, get_light_merge_corner_count(polygons[i], polygon_sizes[i], positions, lights[i].plane));
+		float scalings[2] = {merged.scaling_x, merged.scaling_y};
+		uint32_t size = polygon_sizes[i];
+		uint32_t corner_index = 0;
+		for (uint32_t j = 0; j != size; ++j) {
+			const float* a = &positions[3 * polygons[i][(j + size - 1) % size]];
+			const float* b = &positions[3 * polygons[i][j]];
+			const float* c = &positions[3 * polygons[i][(j + 1) % size]];
+			float length_squared[2] = {0.0f, 0.0f};
+			for (uint32_t k = 0; k != 3; ++k) {
+				length_squared[0] += (b[k] - a[k]) * (b[k] - a[k]);
+				length_squared[1] += (c[k] - b[k]) * (c[k] - b[k]);
+			}
+			if (get_light_merge_turn(lights[i].plane, a, b, c) <= 1.0e-5f * sqrtf(length_squared[0] * length_squared[1]))
+				continue;
+			// Invert the transform from update_polygonal_light()
+			for (uint32_t k = 0; k != 2; ++k) {
+				float coordinate = 0.0f;
+				for (uint32_t l = 0; l != 3; ++l)
+					coordinate += merged.rotation[l][k] * (b[l] - merged.translation[l]);
+				merged.vertices_plane_space[corner_index * 4 + k] = coordinate / scalings[k];
+			}
+			++corner_index;
+		}
+		update_polygonal_light(&merged);
+		destroy_polygonal_light(&lights[i]);
+		lights[i] = merged;
+	}
+	// Destroy lights that have been merged into others and compact the array
+	uint32_t merged_light_count = 0;
+	for (uint32_t i = 0; i != light_count; ++i) {
+		free(polygons[i]);
+		if (groups[i] != i)
+			destroy_polygonal_light(&lights[i]);
+		else
+			lights[merged_light_count++] = lights[i];
+	}
+	free(polygon_sizes);
+	free(polygons);
+	free(groups);
+	free(positions);
+	free(vertex_ids);
+	free(vertex_offsets);
+	free(mergeable);
+	if (merge_count)
+		printf("Merged %u coplanar polygonal lights into %u.\n", light_count, merged_light_count);
+	return merged_light_count;
+}
+
 polygonal_light_t duplicate_polygonal_light(const polygonal_light_t* light) {
 	polygonal_light_t result = *light;
 	result.texture_file_path = copy_string(light->texture_file_path);
 	result.vertex_count = 0;
 	result.vertices_plane_space = NULL;
 	result.vertices_world_space = NULL;
+	result.shared_vertices = 0;
 	set_polygonal_light_vertex_count(&result, light->vertex_count);
 	memcpy(result.vertices_plane_space, light->vertices_plane_space, sizeof(float) * 4 * light->vertex_count);
 	return result;
@@ -111,8 +722,10 @@ polygonal_light_t duplicate_polygonal_light(const polygonal_light_t* light) {
 
 
 void destroy_polygonal_light(polygonal_light_t* light) {
-	free(light->vertices_plane_space);
-	free(light->vertices_world_space);
+	if (!light->shared_vertices) {
+		free(light->vertices_plane_space);
+		free(light->vertices_world_space);
+	}
 	free(light->texture_file_path);
 	memset(light, 0, sizeof(*light));
 }
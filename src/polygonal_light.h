@@ -96,27 +96,49 @@ typedef struct polygonal_light_s {
 	//! Written by update_polygonal_light() but allocated before. Due to GLSL
 	//! padding rules, vertex i is at entries 4 * i + 0 to 4 * i + 2.
 	float* vertices_world_space;
+	//! Non-zero if the vertex arrays are owned by someone else (e.g. a scene
+	//! that extracted the light from its triangles). They are not freed or
+	//! reallocated with the light then.
+	uint32_t shared_vertices;
 } polygonal_light_t;
 
-/*! This struct represents a convex polygonal light source. The polygon is
-	planar but oriented arbitrarily in 3D space. By design, it matches the
-	layout of the corresponding structure in the shader.*/
-typedef struct polygonal_light_upload_s {
-	//! Written by update_polygonal_light()
-	float surface_radiance[3];
-	float padding_1;
-	float plane[4];
-	uint32_t vertex_count;
-	float padding_2[3];
-} polygonal_light_upload_t;
+/*! An entry of an alias table for picking polygonal lights proportional to
+	their emitted power (Walker's method with Vose's construction). It matches
+	the layout of the corresponding structure in the shader.*/
+typedef struct polygonal_light_alias_entry_s {
+	//! If a uniform random number in [0,1) is less than this threshold, the
+	//! light for this entry is picked, otherwise the alias is picked
+	float threshold;
+	//! The index of the light that is picked if the threshold is exceeded
+	uint32_t alias;
+	//! The probability that the light for this entry is picked overall
+	float density;
+	float padding;
+} polygonal_light_alias_entry_t;
+
+/*! A procedural animation of a polygonal light, which the light animation
+	pass evaluates on the GPU. At time t in seconds, the translation of the
+	light is offset by translation_amplitude * sin(2 pi (frequency * t + phase))
+	and rotation_angles[2] is increased by spin_velocity * t. The latter spins
+	the light in its plane, so neither the normal nor the area change and the
+	light BVH and the alias table remain valid. It matches the layout of the
+	corresponding structure in the shader.*/
+typedef struct polygonal_light_animation_s {
+	//! The largest offset of the translation along x, y and z
+	float translation_amplitude[3];
+	//! The number of oscillations of the translation per second
+	float frequency;
+	//! The angular velocity of the spin in radians per second
+	float spin_velocity;
+	//! An offset for the oscillation in periods
+	float phase;
+	float padding[2];
+} polygonal_light_animation_t;
 
 //! This many bytes at the beginning of the structure polygonal_light_t are
 //! stored into a quicksave. After that, there is some data of variable size.
 #define POLYGONAL_LIGHT_QUICKSAVE_SIZE (sizeof(float) * 20 + sizeof(uint32_t) * 2)
 
-//! This many bytes at the beginning of the structure polygonal_light_t are
-//! written into a light buffer. After that, there is variable size data.
-#define POLYGONAL_LIGHT_FIXED_CONSTANT_BUFFER_SIZE (sizeof(float) * 12)
 
 
 //! Sets the vertex_count member and allocates the appropriate amount of memory
@@ -129,6 +151,73 @@ EXTERN_C int set_polygonal_light_vertex_count(polygonal_light_t* light, uint32_t
 //! already allocated with appropriate size but 
 EXTERN_C void update_polygonal_light(polygonal_light_t* light);
 
+//! Returns the luminance of the power emitted by the given polygonal light,
+//! ignoring textures. update_polygonal_light() must have been called.
+EXTERN_C float get_polygonal_light_power(const polygonal_light_t* light);
+
+//! Writes the average of the world space vertices of the given light to
+//! center[0 to 2] and the radius of a sphere around it that bounds the polygon
+//! to center[3]. update_polygonal_light() must have been called.
+EXTERN_C void get_polygonal_light_bounding_sphere(float center[4], const polygonal_light_t* light);
+
+/*! Compresses the normal and vertices of a light as expected by the shader
+	with QUANTIZED_LIGHT_VERTICES.
+	\param packed_normal Receives the normal in octahedral encoding with two
+		16-bit UNORM values, matching decode_normal_32_bit().
+	\param quantized_vertices Receives two integers per vertex, which hold
+		16-bit SNORM coordinates relative to bounding_sphere.
+	\param bounding_sphere Output of get_polygonal_light_bounding_sphere().*/
+EXTERN_C void quantize_polygonal_light(uint32_t* packed_normal, uint32_t* quantized_vertices, const float bounding_sphere[4], const polygonal_light_t* light);
+
+//! Inverts the quantization of a vertex by quantize_polygonal_light() in the
+//! same way as the shader
+EXTERN_C void dequantize_polygonal_light_vertex(float vertex[3], const uint32_t quantized_vertex[2], const float bounding_sphere[4]);
+
+//! Inverts the quantization of a normal by quantize_polygonal_light() in the
+//! same way as the shader
+EXTERN_C void dequantize_polygonal_light_normal(float normal[3], uint32_t packed_normal);
+
+/*! Writes an alias table with one entry per light that picks lights
+	proportional to get_polygonal_light_power(). If the total power is zero,
+	the table picks lights uniformly. For zero lights, a single entry is
+	written, such that table must always provide space for at least one
+	entry.*/
+EXTERN_C void write_polygonal_light_alias_table(polygonal_light_alias_entry_t* table, const polygonal_light_t* lights, uint32_t light_count);
+
+/*! Produces a procedural animation for the light with the given index. The
+	direction of motion, the phase and the spin are pseudo-random but
+	deterministic.
+	\param amplitude The length of translation_amplitude in world space units.
+	\param frequency The average number of oscillations per second. Spins
+		make about the same number of revolutions.*/
+EXTERN_C void generate_polygonal_light_animation(polygonal_light_animation_t* animation, uint32_t light_index, float amplitude, float frequency);
+
+/*! Computes an axis-aligned bounding box for all poses that the given light
+	takes on over the course of the given animation. update_polygonal_light()
+	must have been called.*/
+EXTERN_C void get_animated_polygonal_light_aabb(float aabb_min[3], float aabb_max[3], const polygonal_light_t* light, const polygonal_light_animation_t* animation);
+
+/*! Turns the given triangle into a polygonal light with three vertices,
+	uniform surface radiance and no texture. It does not allocate anything.
+	Instead, the light uses the given storage for its vertices and is marked
+	as shared_vertices. update_polygonal_light() gets called.
+	\param vertices The world-space positions of the triangle vertices.
+	\param radiance The surface radiance of the light.
+	\param vertex_storage 24 floats, which have to outlive the light.
+	\return 0 if the light is valid, 1 if the triangle is degenerate. Then the
+		light is left untouched.*/
+EXTERN_C int create_triangle_polygonal_light(polygonal_light_t* light, const float vertices[3][3], const float radiance[3], float* vertex_storage);
+
+/*! Merges lights that share an edge, lie in a common plane and have equal
+	surface radiance into convex polygons. Textured lights are left alone.
+	Vertices are welded using a spatial hash on a fine grid over all lights.
+	Merged lights keep the transform of one of their parts, get their own
+	vertex allocations and replace their parts in the array, which gets
+	compacted without changing the order of remaining lights.
+	\param max_vertex_count No merged light gets more vertices than that.
+	\return The new number of lights in the array.*/
+EXTERN_C uint32_t merge_coplanar_polygonal_lights(polygonal_light_t* lights, uint32_t light_count, uint32_t max_vertex_count);
+
 //! Returns a deep copy of the given polygonal light
 EXTERN_C polygonal_light_t duplicate_polygonal_light(const polygonal_light_t* light);
 
@@ -17,10 +17,15 @@
 #include "scene.h"
 #include "textures.h"
 #include "string_utilities.h"
+#include "mapped_file.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+//! The number of bytes of mesh data that load_scene() copies per thread at
+//! once
+#define SCENE_LOAD_CHUNK_SIZE ((size_t) 4 * 1024 * 1024)
+
 const char* get_material_texture_suffix(material_texture_type_t type) {
 	switch (type) {
 	case material_texture_type_base_color: return "BaseColor";
@@ -116,6 +121,7 @@ void destroy_materials(materials_t* materials, const device_t* device) {
 			free(materials->material_names[i]);
 		free(materials->material_names);
 	}
+	destroy_texture_streaming(&materials->streaming, device);
 	destroy_images(&materials->textures, device);
 	if (materials->sampler) vkDestroySampler(device->device, materials->sampler, NULL);
 	memset(materials, 0, sizeof(*materials));
@@ -406,35 +412,102 @@ int create_acceleration_structure(acceleration_structure_t* structure, const dev
 }
 
 
-int load_scene(scene_t* scene, const device_t* device, const char* file_path, const char* texture_path, VkBool32 request_acceleration_structure) {
+uint32_t extract_emissive_lights(scene_t* scene, const char* mesh_data, const emissive_light_request_t* request) {
+	const mesh_t* mesh = &scene->mesh;
+	const uint32_t* positions = (const uint32_t*) (mesh_data + mesh->positions.offset);
+	const uint16_t* material_indices = (const uint16_t*) (mesh_data + mesh->material_indices.offset);
+	// Figure out which materials are emissive
+	uint64_t material_count = scene->materials.material_count;
+	uint8_t* emissive_materials = calloc(material_count + 1, sizeof(uint8_t));
+	for (uint64_t i = 0; i != material_count; ++i)
+		for (uint32_t j = 0; j != request->material_count; ++j)
+			if (strcmp(scene->materials.material_names[i], request->material_names[j]) == 0)
+				emissive_materials[i] = 1;
+	// Count emissive triangles without branches, so that the compiler can
+	// vectorize this loop
+	uint32_t light_flag_mask = request->use_light_flag ? 1 : 0;
+	uint64_t triangle_count = mesh->triangle_count;
+	uint64_t emissive_count = 0;
+	for (uint64_t i = 0; i != triangle_count; ++i) {
+		uint16_t material_index = material_indices[i];
+		uint32_t material_emissive = emissive_materials[(material_index < material_count) ? material_index : material_count];
+		emissive_count += ((positions[i * 6 + 1] >> 31) & light_flag_mask) | material_emissive;
+	}
+	if (emissive_count == 0) {
+		free(emissive_materials);
+		return 0;
+	}
+	// Allocate the lights and their vertices in one go
+	scene->emissive_lights = malloc(sizeof(polygonal_light_t) * emissive_count);
+	scene->emissive_light_vertices = malloc(sizeof(float) * 24 * emissive_count);
+	// Decode triangles and turn them into lights. Decoding matches
+	// decode_position_64_bit() in the shaders.
+	uint32_t light_count = 0;
+	for (uint64_t i = 0; i != triangle_count && light_count != emissive_count; ++i) {
+		uint16_t material_index = material_indices[i];
+		uint32_t material_emissive = emissive_materials[(material_index < material_count) ? material_index : material_count];
+		if (!(((positions[i * 6 + 1] >> 31) & light_flag_mask) | material_emissive))
+			continue;
+		float vertices[3][3];
+		for (uint32_t j = 0; j != 3; ++j) {
+			uint32_t low = positions[i * 6 + j * 2 + 0];
+			uint32_t high = positions[i * 6 + j * 2 + 1];
+			uint32_t quantized[3] = {
+				low & 0x1FFFFF,
+				((low & 0xFFE00000) >> 21) | ((high & 0x3FF) << 11),
+				(high & 0x7FFFFC00) >> 10,
+			};
+			for (uint32_t k = 0; k != 3; ++k)
+				vertices[j][k] = ((float) quantized[k]) * mesh->dequantization_factor[k] + mesh->dequantization_summand[k];
+		}
+		// Degenerate triangles are skipped
+		if (!create_triangle_polygonal_light(&scene->emissive_lights[light_count], vertices, request->radiance, scene->emissive_light_vertices + 24 * light_count))
+			++light_count;
+	}
+	free(emissive_materials);
+	// Triangles of the same emitter can often be merged into larger polygons
+	if (request->max_merged_vertex_count >= 4)
+		light_count = merge_coplanar_polygonal_lights(scene->emissive_lights, light_count, request->max_merged_vertex_count);
+	scene->emissive_light_count = light_count;
+	printf("Extracted %u polygonal lights from emissive triangles.\n", light_count);
+	return light_count;
+}
+
+
+int load_scene(scene_t* scene, const device_t* device, const char* file_path, const char* texture_path, VkBool32 request_acceleration_structure, VkBool32 stream_textures, const emissive_light_request_t* emissive_light_request) {
+	double start_time = glfwGetTime();
 	// Clear the output object
 	memset(scene, 0, sizeof(*scene));
-	// Open the source file
-	FILE* file = fopen(file_path, "rb");
-	if (!file) {
+	// Map the source file, which avoids copies through buffers of the C
+	// runtime for the mesh data
+	mapped_file_t file;
+	if (map_file(&file, file_path)) {
 		printf("Failed to open the scene file at %s.\n", file_path);
+		unmap_file(&file);
 		destroy_scene(scene, device);
 		return 1;
 	}
 	// Read the header
-	uint32_t file_marker, version;
-	fread(&file_marker, sizeof(file_marker), 1, file);
-	fread(&version, sizeof(version), 1, file);
-	if (file_marker != 0xabcabc || version != 1) {
+	size_t offset = 0;
+	uint32_t file_marker = 0, version = 0;
+	read_mapped_file(&file_marker, &file, &offset, sizeof(file_marker));
+	read_mapped_file(&version, &file, &offset, sizeof(version));
+	if (file_marker != 0xabcabc || version != 1
+		|| read_mapped_file(&scene->materials.material_count, &file, &offset, sizeof(uint64_t))
+		|| read_mapped_file(&scene->mesh.triangle_count, &file, &offset, sizeof(uint64_t))
+		|| read_mapped_file(scene->mesh.dequantization_factor, &file, &offset, sizeof(float) * 3)
+		|| read_mapped_file(scene->mesh.dequantization_summand, &file, &offset, sizeof(float) * 3))
+	{
 		printf("The scene file at path %s is invalid or unsupported. The format marker is 0x%x, the version is %d.\n", file_path, file_marker, version);
-		fclose(file);
+		unmap_file(&file);
 		destroy_scene(scene, device);
 		return 1;
 	}
-	fread(&scene->materials.material_count, sizeof(uint64_t), 1, file);
-	fread(&scene->mesh.triangle_count, sizeof(uint64_t), 1, file);
-	fread(scene->mesh.dequantization_factor, sizeof(float), 3, file);
-	fread(scene->mesh.dequantization_summand, sizeof(float), 3, file);
 	printf("Triangle count: %llu\n", scene->mesh.triangle_count);
 	// If there are no triangles, abort
 	if (scene->mesh.triangle_count == 0) {
 		printf("The scene file at path %s is completely empty, i.e. it holds 0 triangles.\n", file_path);
-		fclose(file);
+		unmap_file(&file);
 		destroy_scene(scene, device);
 		return 1;
 	}
@@ -443,9 +516,16 @@ int load_scene(scene_t* scene, const device_t* device, const char* file_path, co
 	memset(scene->materials.material_names, 0, sizeof(char*) * scene->materials.material_count);
 	for (uint64_t i = 0; i != scene->materials.material_count; ++i) {
 		uint64_t name_length;
-		fread(&name_length, sizeof(name_length), 1, file);
+		if (read_mapped_file(&name_length, &file, &offset, sizeof(name_length)) || name_length >= file.size) {
+			printf("The scene file at path %s ends within the list of material names.\n", file_path);
+			unmap_file(&file);
+			destroy_scene(scene, device);
+			return 1;
+		}
 		scene->materials.material_names[i] = malloc(sizeof(char) * (name_length + 1));
-		fread(scene->materials.material_names[i], sizeof(char), name_length + 1, file);
+		scene->materials.material_names[i][0] = 0;
+		read_mapped_file(scene->materials.material_names[i], &file, &offset, sizeof(char) * (name_length + 1));
+		scene->materials.material_names[i][name_length] = 0;
 	}
 
 	// Allocate staging buffers for the mesh
@@ -453,7 +533,7 @@ int load_scene(scene_t* scene, const device_t* device, const char* file_path, co
 	if (create_mesh(&scene->mesh, device, VK_TRUE)) {
 		printf("Failed to create staging buffers and allocate memory for meshes of the scene file at path %s. It has %llu triangles.\n",
 			file_path, scene->mesh.triangle_count);
-		fclose(file);
+		unmap_file(&file);
 		destroy_scene(scene, device);
 		return 1;
 	}
@@ -461,26 +541,50 @@ int load_scene(scene_t* scene, const device_t* device, const char* file_path, co
 	char* staging_data;
 	if (vkMapMemory(device->device, scene->mesh.memory, 0, scene->mesh.size, 0, (void**) &staging_data)) {
 		printf("Failed to map memory of the staging buffer for meshes of the scene file at path %s.\n", file_path);
-		fclose(file);
+		unmap_file(&file);
 		destroy_scene(scene, device);
 		return 1;
 	}
-	// Read the binary mesh data. The file has it exactly in the format in
-	// which it goes onto the GPU.
+	// Copy the binary mesh data. The file has it exactly in the format in
+	// which it goes onto the GPU. The copy runs in chunks on all cores, such
+	// that page faults of the mapped file overlap with the copying.
+	VkDeviceSize payload_size = 0;
 	for (uint32_t i = 0; i != mesh_buffer_count; ++i)
-		fread(staging_data + scene->mesh.buffers[i].offset, scene->mesh.buffers[i].size, 1, file);
+		payload_size += scene->mesh.buffers[i].size;
+	uint32_t eof_marker = 0;
+	if (offset > file.size || file.size - offset < payload_size + sizeof(eof_marker)) {
+		printf("The scene file at path %s is too small for %llu triangles.\n", file_path, scene->mesh.triangle_count);
+		unmap_file(&file);
+		destroy_scene(scene, device);
+		return 1;
+	}
+	for (uint32_t i = 0; i != mesh_buffer_count; ++i) {
+		const uint8_t* source = file.data + offset;
+		char* destination = staging_data + scene->mesh.buffers[i].offset;
+		size_t size = (size_t) scene->mesh.buffers[i].size;
+		int chunk_count = (int) ((size + SCENE_LOAD_CHUNK_SIZE - 1) / SCENE_LOAD_CHUNK_SIZE);
+		#pragma omp parallel for
+		for (int j = 0; j < chunk_count; ++j) {
+			size_t chunk_begin = (size_t) j * SCENE_LOAD_CHUNK_SIZE;
+			size_t chunk_size = (size - chunk_begin < SCENE_LOAD_CHUNK_SIZE) ? (size - chunk_begin) : SCENE_LOAD_CHUNK_SIZE;
+			memcpy(destination + chunk_begin, source + chunk_begin, chunk_size);
+		}
+		offset += size;
+	}
 	// Write the screen-filling triangle
 	int8_t triangle_vertices[3][2] = { {-1, -1}, {3, -1}, {-1, 3} };
 	memcpy(staging_data + scene->mesh.triangle.offset, triangle_vertices, sizeof(triangle_vertices));
 	// If everything went well, we have reached an end-of-file marker
-	uint32_t eof_marker = 0;
-	fread(&eof_marker, sizeof(eof_marker), 1, file);
-	fclose(file);
+	read_mapped_file(&eof_marker, &file, &offset, sizeof(eof_marker));
+	unmap_file(&file);
 	if (eof_marker != 0xE0FE0F) {
 		printf("The scene file at path %s seems to be invalid. The geometry data is not followed by the expected end of file marker.\n", file_path);
 		destroy_scene(scene, device);
 		return 1;
 	}
+	// Turn emissive triangles into lights while the mesh data is mapped
+	if (emissive_light_request)
+		extract_emissive_lights(scene, staging_data, emissive_light_request);
 	// Create an acceleration structure now that the mesh data is available
 	if (request_acceleration_structure && device->ray_tracing_supported) {
 		if (create_acceleration_structure(&scene->acceleration_structure, device, &scene->mesh, staging_data)) {
@@ -519,9 +623,16 @@ int load_scene(scene_t* scene, const device_t* device, const char* file_path, co
 		destroy_scene(scene, device);
 		return 1;
 	}
+	double mesh_time = glfwGetTime() - start_time;
 
-	// Now load all textures
+	// Now load all textures, preferably from a texture pack
 	uint32_t texture_count = (uint32_t) (scene->materials.material_count * material_texture_count);
+	const char* pack_path_pieces[] = { texture_path, "/", MATERIAL_TEXTURE_PACK_FILE_NAME };
+	char* pack_path = concatenate_strings(COUNT_OF(pack_path_pieces), pack_path_pieces);
+	FILE* pack_file = fopen(pack_path, "rb");
+	VkBool32 use_pack = (pack_file != NULL);
+	if (pack_file)
+		fclose(pack_file);
 	char** texture_file_paths = malloc(sizeof(char*) * texture_count);
 	memset(texture_file_paths, 0, sizeof(char*) * texture_count);
 	for (uint32_t i = 0; i != scene->materials.material_count; ++i) {
@@ -530,12 +641,22 @@ int load_scene(scene_t* scene, const device_t* device, const char* file_path, co
 				texture_path, "/", scene->materials.material_names[i], "_",
 				get_material_texture_suffix((material_texture_type_t) j), ".vkt"
 			};
-			texture_file_paths[i * material_texture_count + j] = concatenate_strings(COUNT_OF(path_pieces), path_pieces);
+			// Textures in a pack are identified by their file name without
+			// directory and extension
+			texture_file_paths[i * material_texture_count + j] = use_pack
+				? concatenate_strings(COUNT_OF(path_pieces) - 3, path_pieces + 2)
+				: concatenate_strings(COUNT_OF(path_pieces), path_pieces);
 		}
 	}
-	result = load_2d_textures(&scene->materials.textures, device, texture_count, (const char* const*) texture_file_paths, VK_IMAGE_USAGE_SAMPLED_BIT);
+	// Streaming needs LOD clamps in shaders. Without it, everything is
+	// loaded right away.
+	uint32_t max_resolution = (stream_textures && device->min_lod_supported) ? MATERIAL_TEXTURE_STREAMING_RESOLUTION : UINT32_MAX;
+	result = load_2d_textures_streamed(&scene->materials.textures, &scene->materials.streaming, device, texture_count,
+		(const char* const*) texture_file_paths, use_pack ? pack_path : NULL, max_resolution, VK_IMAGE_USAGE_SAMPLED_BIT);
 	for (uint32_t i = 0; i != texture_count; ++i)
 		free(texture_file_paths[i]);
+	free(texture_file_paths);
+	free(pack_path);
 	if (result) {
 		printf("Failed to load material textures for the scene file at path %s using texture path %s.\n", file_path, texture_path);
 		destroy_scene(scene, device);
@@ -555,6 +676,7 @@ int load_scene(scene_t* scene, const device_t* device, const char* file_path, co
 		destroy_scene(scene, device);
 		return 1;
 	}
+	printf("Loaded the scene %s in %.3f s (%.3f s for meshes and acceleration structures).\n", file_path, glfwGetTime() - start_time, mesh_time);
 	return 0;
 }
 
@@ -563,6 +685,13 @@ void destroy_scene(scene_t* scene, const device_t* device) {
 	destroy_mesh(&scene->mesh, device);
 	destroy_materials(&scene->materials, device);
 	destroy_acceleration_structure(&scene->acceleration_structure, device);
+	for (uint32_t i = 0; i != scene->emissive_light_count; ++i)
+		destroy_polygonal_light(&scene->emissive_lights[i]);
+	free(scene->emissive_lights);
+	free(scene->emissive_light_vertices);
+	scene->emissive_lights = NULL;
+	scene->emissive_light_vertices = NULL;
+	scene->emissive_light_count = 0;
 }
 
 
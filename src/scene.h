@@ -16,10 +16,21 @@
 
 #pragma once
 #include "vulkan_basics.h"
+#include "textures.h"
+#include "polygonal_light.h"
 #include <stdio.h>
 #include <stdint.h>
 
 
+//! The file name of the texture pack that load_scene() uses for material
+//! textures if it exists in the texture directory
+#define MATERIAL_TEXTURE_PACK_FILE_NAME "textures.vkp"
+
+//! When material textures are streamed, mipmaps up to this resolution are
+//! loaded right away and finer ones get streamed
+#define MATERIAL_TEXTURE_STREAMING_RESOLUTION 64
+
+
 //! This enumeration characterizes the buffers that are needed to store a mesh.
 //! The numerical values represent the array indices of the respective buffers.
 typedef enum mesh_buffer_type_e {
@@ -57,7 +68,9 @@ typedef struct mesh_s {
 				positions for each triangle. The bits of these two uints from
 				least significant to most significant are:
 				xxxx xxxx xxxx xxxx xxxx xyyy yyyy yyyy
-				yyyy yyyy yyzz zzzz zzzz zzzz zzzz zzz-
+				yyyy yyyy yyzz zzzz zzzz zzzz zzzz zzzl
+				The bit l is set for all vertices of triangles that belong to
+				light sources.
 				\sa dequantization_factor, dequantization_summand */
 			buffer_t positions;
 			/*! 3*triangle_count normal vectors and texture coordinate pairs
@@ -130,6 +143,9 @@ typedef struct materials_s {
 		i * material_texture_count and are indexed by material_texture_t
 		entries.*/
 	images_t textures;
+	//! Uploads finer mipmaps of textures after loading. If nothing is
+	//! streamed, it still provides a buffer with LOD clamps of zero.
+	texture_streaming_t streaming;
 	//! A sampler used for all material textures
 	VkSampler sampler;
 } materials_t;
@@ -153,8 +169,27 @@ typedef struct acceleration_structure_s {
 	buffers_t buffers;
 } acceleration_structure_t;
 
+/*! Asks load_scene() to turn emissive triangles of the scene into polygonal
+	lights. A triangle is emissive if it is flagged as light in its positions
+	(see mesh_t.positions) or if its material is in the given list.*/
+typedef struct emissive_light_request_s {
+	//! Whether triangles flagged as lights in the mesh become lights
+	VkBool32 use_light_flag;
+	//! The number of entries in material_names
+	uint32_t material_count;
+	//! Names of materials whose triangles become lights
+	const char* const* material_names;
+	//! The surface radiance for all extracted lights
+	float radiance[3];
+	//! If this is at least 4, adjacent triangles get merged into convex
+	//! polygons with up to this many vertices
+	uint32_t max_merged_vertex_count;
+} emissive_light_request_t;
+
+
 /*! A static scene that is ready to be rendered. It includes geometry and
-	materials but no cameras or light sources.*/
+	materials but no cameras. Light sources are only included, if they were
+	extracted from emissive triangles.*/
 typedef struct scene_s {
 	//! The mesh that holds all scene geometry in world space
 	mesh_t mesh;
@@ -163,6 +198,14 @@ typedef struct scene_s {
 	//! Acceleration structures for ray tracing in this scene or a bunch of
 	//! NULL handles if no acceleration structure was requested
 	acceleration_structure_t acceleration_structure;
+	//! The number of lights in emissive_lights
+	uint32_t emissive_light_count;
+	//! One triangular light per emissive triangle of the mesh or NULL. They
+	//! have shared_vertices set and store them in emissive_light_vertices,
+	//! unless they were created by merging triangles.
+	polygonal_light_t* emissive_lights;
+	//! A single allocation with 24 floats per extracted triangle
+	float* emissive_light_vertices;
 } scene_t;
 
 
@@ -174,11 +217,24 @@ const char* get_material_texture_suffix(material_texture_type_t type);
 /*! Loads a scene from the file at the given path. The calling side has to
 	clean up using destroy_scene(). Textures are supposed to be in a directory
 	at texture_path. Their names are <material name>_<type suffix>.vkt. Such
-	*.vkt files have to be created beforehand using a Python script. If ray
+	*.vkt files have to be created beforehand using a Python script. If the
+	directory contains a texture pack named MATERIAL_TEXTURE_PACK_FILE_NAME,
+	textures are loaded from there instead. If ray
 	tracing is supported by the given device, an acceleration structure will be
 	created on request. Otherwise, the method succeeds without creating one.
+	\param stream_textures Whether mipmaps of material textures above
+		MATERIAL_TEXTURE_STREAMING_RESOLUTION should be streamed through
+		scene->materials.streaming. Ignored if the device does not support it.
+	\param emissive_light_request NULL or a description of triangles that
+		should be turned into scene->emissive_lights.
 	\return 0 on success.*/
-int load_scene(scene_t* scene, const device_t* device, const char* file_path, const char* texture_path, VkBool32 request_acceleration_structure);
+int load_scene(scene_t* scene, const device_t* device, const char* file_path, const char* texture_path, VkBool32 request_acceleration_structure, VkBool32 stream_textures, const emissive_light_request_t* emissive_light_request);
+
+/*! Creates scene->emissive_lights from the given mesh data, which is laid out
+	as in the staging buffers of the mesh. Triangles are processed in a single
+	pass and all lights share two allocations.
+	\return The number of extracted lights.*/
+uint32_t extract_emissive_lights(scene_t* scene, const char* mesh_data, const emissive_light_request_t* request);
 
 //! Frees and nulls the given scene
 void destroy_scene(scene_t* scene, const device_t* device);
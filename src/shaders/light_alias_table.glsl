@@ -0,0 +1,48 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/*! An entry of an alias table over all polygonal lights. It matches
+	polygonal_light_alias_entry_t in the C code.*/
+struct light_alias_entry_t {
+	//! Below this threshold, the light of this entry is picked, above it the
+	//! alias
+	float threshold;
+	//! The index of the alternative light
+	uint alias;
+	//! The probability of picking the light of this entry overall
+	float density;
+	float padding;
+};
+
+layout (std430, binding = 11) readonly buffer light_alias_table_buffer {
+	light_alias_entry_t g_light_alias_table[];
+};
+
+
+/*! Picks a polygonal light proportional to its emitted power in constant time
+	using the alias table.
+	\param density Overwritten by the probability of picking the returned
+		light.
+	\param random A uniform random number in [0,1).
+	\return The index of the chosen light.*/
+int sample_light_alias_table(out float density, float random) {
+	float scaled = random * float(POLYGONAL_LIGHT_ARRAY_SIZE);
+	uint entry_index = min(uint(scaled), uint(POLYGONAL_LIGHT_ARRAY_SIZE - 1));
+	light_alias_entry_t entry = g_light_alias_table[entry_index];
+	uint light_index = (scaled - float(entry_index) < entry.threshold) ? entry_index : entry.alias;
+	density = g_light_alias_table[light_index].density;
+	return int(light_index);
+}
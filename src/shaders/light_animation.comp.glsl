@@ -0,0 +1,113 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+
+#version 460
+#extension GL_GOOGLE_include_directive : enable
+#define POLYGONAL_LIGHT_BINDING 1
+#include "shared_constants.glsl"
+#include "math_constants.glsl"
+
+layout (local_size_x = LIGHT_ANIMATION_GROUP_SIZE) in;
+
+/*! The untransformed pose and the animation of a polygonal light. It matches
+	animated_polygonal_light_t in main.h.*/
+struct animated_polygonal_light_t {
+	//! xyz: polygonal_light_t::translation, w: polygonal_light_t::scaling_x
+	vec4 translation_scaling_x;
+	//! xyz: polygonal_light_t::rotation_angles, w: polygonal_light_t::scaling_y
+	vec4 rotation_angles_scaling_y;
+	//! xyz: polygonal_light_animation_t::translation_amplitude, w: frequency
+	vec4 amplitude_frequency;
+	//! x: polygonal_light_animation_t::spin_velocity, y: phase
+	vec4 spin_phase;
+};
+
+layout (std430, binding = 2) readonly buffer animated_light_buffer {
+	//! The pose and animation of each light
+	animated_polygonal_light_t g_animated_polygonal_lights[POLYGONAL_LIGHT_ARRAY_SIZE];
+	//! polygonal_light_t::vertices_plane_space for all lights, using the same
+	//! indices as the vertex pool in the light buffer
+	vec2 g_polygonal_light_plane_space_vertices[];
+};
+
+
+//! Evaluates the animation of one light at the current time and writes its
+//! vertices, plane, area and bounding sphere to the light buffer. This does
+//! the same as update_polygonal_light() and write_light() in the C code.
+void main() {
+	uint light_index = gl_GlobalInvocationID.x;
+	if (light_index >= POLYGONAL_LIGHT_COUNT)
+		return;
+	animated_polygonal_light_t animated = g_animated_polygonal_lights[light_index];
+	float time = g_light_animation_time;
+	// Apply the animation
+	vec3 translation = animated.translation_scaling_x.xyz
+		+ animated.amplitude_frequency.xyz * sin(2.0f * M_PI * fma(animated.amplitude_frequency.w, time, animated.spin_phase.y));
+	vec3 angles = animated.rotation_angles_scaling_y.xyz;
+	angles.z = fma(animated.spin_phase.x, time, angles.z);
+	vec2 scaling = vec2(animated.translation_scaling_x.w, animated.rotation_angles_scaling_y.w);
+	// Construct columns of the rotation matrix from Euler angles
+	vec3 c = cos(angles);
+	vec3 s = sin(angles);
+	vec3 axis_x = scaling.x * vec3(c.y * c.z, -s.x * s.y * c.z + c.x * s.z, c.x * s.y * c.z + s.x * s.z);
+	vec3 axis_y = scaling.y * vec3(-c.y * s.z, s.x * s.y * s.z + c.x * c.z, -c.x * s.y * s.z + s.x * c.z);
+	vec3 normal = vec3(-s.y, -s.x * c.y, c.x * c.y);
+	// Compute the vertex average and the signed area of the triangle fan
+	uvec2 vertex_range = g_polygonal_light_vertex_ranges[light_index];
+	vec2 first_vertex = g_polygonal_light_plane_space_vertices[vertex_range.x];
+	vec2 previous_edge = vec2(0.0f);
+	vec3 center = vec3(0.0f);
+	float signed_area = 0.0f;
+	for (uint i = 0; i != vertex_range.y; ++i) {
+		vec2 vertex = g_polygonal_light_plane_space_vertices[vertex_range.x + i];
+		vec2 edge = vertex - first_vertex;
+		signed_area += 0.5f * (edge.x * previous_edge.y - previous_edge.x * edge.y);
+		previous_edge = edge;
+		vec3 world_space_vertex = translation + vertex.x * axis_x + vertex.y * axis_y;
+		center += world_space_vertex;
+#if !QUANTIZED_LIGHT_VERTICES
+		g_polygonal_light_vertices[vertex_range.x + i] = vec4(world_space_vertex, 0.0f);
+#endif
+	}
+	center /= float(max(1u, vertex_range.y));
+	signed_area *= scaling.x * scaling.y;
+	// Flip the plane if the winding is the wrong way around
+	normal = (signed_area > 0.0f) ? normal : -normal;
+	// Bound the polygon
+	float radius_squared = 0.0f;
+	for (uint i = 0; i != vertex_range.y; ++i) {
+		vec2 vertex = g_polygonal_light_plane_space_vertices[vertex_range.x + i];
+		vec3 offset = translation + vertex.x * axis_x + vertex.y * axis_y - center;
+		radius_squared = max(radius_squared, dot(offset, offset));
+	}
+	float radius = sqrt(radius_squared);
+	vec4 bounding_sphere = vec4(center, radius);
+	g_polygonal_light_bounding_spheres[light_index] = bounding_sphere;
+	g_polygonal_light_radiance_area[light_index].w = abs(signed_area);
+#if QUANTIZED_LIGHT_VERTICES
+	g_polygonal_light_packed_normals[light_index] = encode_normal_32_bit(normal);
+	// Store vertices relative to the bounding sphere
+	float rcp_radius = (radius > 0.0f) ? (1.0f / radius) : 0.0f;
+	for (uint i = 0; i != vertex_range.y; ++i) {
+		vec2 vertex = g_polygonal_light_plane_space_vertices[vertex_range.x + i];
+		vec3 offset = (translation + vertex.x * axis_x + vertex.y * axis_y - center) * rcp_radius;
+		g_polygonal_light_quantized_vertices[vertex_range.x + i] = uvec2(packSnorm2x16(offset.xy), packSnorm2x16(vec2(offset.z, 0.0f)));
+	}
+#else
+	g_polygonal_light_planes[light_index] = vec4(normal, -dot(normal, translation));
+#endif
+}
@@ -0,0 +1,108 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+//! The bit that marks leaves in light_bvh_node_t.child_or_light_index
+#define LIGHT_BVH_LEAF_BIT 0x80000000u
+
+/*! A node of a bounding volume hierarchy over all polygonal lights. It matches
+	light_bvh_node_t in the C code.*/
+struct light_bvh_node_t {
+	//! The axis-aligned bounding box of all lights below this node
+	vec3 aabb_min;
+	//! The total power emitted by all lights below this node
+	float power;
+	vec3 aabb_max;
+	//! The opening angle of the bidirectional orientation cone in radians
+	float theta_o;
+	//! The axis of the orientation cone
+	vec3 axis;
+	//! For inner nodes, the index of the second child (the first child is the
+	//! next node). For leaves, LIGHT_BVH_LEAF_BIT and the light index.
+	uint child_or_light_index;
+};
+
+layout (std430, binding = 10) readonly buffer light_bvh_buffer {
+	light_bvh_node_t g_light_bvh_nodes[];
+};
+
+
+/*! Returns a conservative estimate of the irradiance that lights below the
+	given node contribute at the given shading point. The estimate follows
+	Conty Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive
+	Tree Splitting", with bidirectional cones since lights are two-sided.*/
+float get_light_bvh_node_importance(light_bvh_node_t node, vec3 position, vec3 normal) {
+	vec3 center = 0.5f * (node.aabb_min + node.aabb_max);
+	vec3 half_diagonal = 0.5f * (node.aabb_max - node.aabb_min);
+	vec3 to_center = center - position;
+	float radius_squared = dot(half_diagonal, half_diagonal);
+	float distance_squared = dot(to_center, to_center);
+	// Inside the bounding sphere, orientations do not give us any bounds
+	if (distance_squared <= radius_squared)
+		return node.power / max(radius_squared, 1.0e-8f);
+	float distance = sqrt(distance_squared);
+	vec3 direction = to_center / distance;
+	// The angle that the bounding sphere subtends
+	float theta_u = asin(sqrt(radius_squared) / distance);
+	// The smallest angle between the direction towards the shading point and
+	// any light normal (up to sign)
+	float theta = acos(min(1.0f, abs(dot(node.axis, direction))));
+	float theta_prime = max(0.0f, theta - node.theta_o - theta_u);
+	// The smallest angle between the shading normal and any direction towards
+	// the bounding sphere
+	float theta_i = acos(clamp(dot(normal, direction), -1.0f, 1.0f));
+	float theta_i_prime = max(0.0f, theta_i - theta_u);
+	return node.power * cos(theta_prime) * max(0.0f, cos(theta_i_prime)) / distance_squared;
+}
+
+
+/*! Picks a polygonal light by stochastic traversal of the light BVH. At each
+	inner node, a child is chosen proportional to its importance. The random
+	number gets rescaled at each step such that it can be reused.
+	\param density Overwritten by the probability of picking the returned
+		light, or zero if no light has a non-zero importance.
+	\param position, normal The shading point and its normal in world space.
+	\param random A uniform random number in [0,1).
+	\return The index of the chosen light or -1 if density is zero.*/
+int sample_light_bvh(out float density, vec3 position, vec3 normal, float random) {
+	density = 1.0f;
+	uint node_index = 0;
+	[[dont_unroll]]
+	for (uint depth = 0; depth != LIGHT_BVH_MAX_DEPTH; ++depth) {
+		uint child_or_light_index = g_light_bvh_nodes[node_index].child_or_light_index;
+		if ((child_or_light_index & LIGHT_BVH_LEAF_BIT) != 0)
+			return int(child_or_light_index & ~LIGHT_BVH_LEAF_BIT);
+		float importance_left = get_light_bvh_node_importance(g_light_bvh_nodes[node_index + 1], position, normal);
+		float importance_right = get_light_bvh_node_importance(g_light_bvh_nodes[child_or_light_index], position, normal);
+		float importance_sum = importance_left + importance_right;
+		if (!(importance_sum > 0.0f))
+			break;
+		float probability_left = importance_left / importance_sum;
+		if (random < probability_left) {
+			node_index = node_index + 1;
+			density *= probability_left;
+			random = random / probability_left;
+		}
+		else {
+			node_index = child_or_light_index;
+			density *= 1.0f - probability_left;
+			random = (random - probability_left) / (1.0f - probability_left);
+		}
+		// Stay in [0,1) despite rounding error
+		random = min(random, 0.99999994f);
+	}
+	density = 0.0f;
+	return -1;
+}
@@ -0,0 +1,161 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+//! The light cache is a hash grid in world space. Each cell is keyed on a
+//! quantized position and the dominant axis of the normal. Cells are larger
+//! further away from the camera, LIGHT_CACHE_CELL_SCALE times the distance.
+//! Each cell stores a checksum of its key followed by LIGHT_CACHE_SLOT_COUNT
+//! slots. A slot packs a 12-bit logarithmic weight above a 20-bit light index
+//! and each light always maps to the same slot, so a cell never lists a light
+//! twice. Zero marks an empty slot. Defines LIGHT_CACHE_CELL_COUNT (a power of
+//! two) and LIGHT_CACHE_BINDING are needed as well.
+#define LIGHT_CACHE_CELL_STRIDE (LIGHT_CACHE_SLOT_COUNT + 1)
+#define LIGHT_CACHE_LIGHT_INDEX_MASK 0xFFFFFu
+//! Weights use 16 steps per power of two
+#define LIGHT_CACHE_WEIGHT_STEPS 16.0f
+//! A different light only replaces the light in a slot, if its weight is at
+//! least half as large. Otherwise, the old weight decays by one step.
+#define LIGHT_CACHE_REPLACEMENT_MARGIN 16
+
+layout (std430, binding = LIGHT_CACHE_BINDING) coherent buffer light_cache_buffer {
+	uint g_light_cache[];
+};
+
+
+//! A copy of one cell of the light cache, which is loaded once per shading
+//! point such that sampling and density evaluation are consistent
+struct light_cache_cell_t {
+	//! The index of the light in each slot or -1 if the slot is empty
+	int light_indices[LIGHT_CACHE_SLOT_COUNT];
+	//! The weight for each slot, zero for empty slots
+	float weights[LIGHT_CACHE_SLOT_COUNT];
+	//! The sum of all weights
+	float weight_sum;
+};
+
+
+//! A simple integer hash function (PCG)
+uint hash_light_cache(uint value) {
+	uint state = value * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+
+/*! Finds the cell of the light cache for the given shading point.
+	\return The index of the cell and a non-zero checksum of its key.*/
+uvec2 get_light_cache_key(vec3 position, vec3 normal) {
+	float cell_size = LIGHT_CACHE_CELL_SCALE * max(distance(position, g_camera_position_world_space), g_camera_near);
+	int level = int(floor(log2(cell_size)));
+	ivec3 cell = ivec3(floor(position * exp2(-float(level))));
+	vec3 abs_normal = abs(normal);
+	uint axis = (abs_normal.x > abs_normal.y && abs_normal.x > abs_normal.z) ? 0 : ((abs_normal.y > abs_normal.z) ? 1 : 2);
+	uint normal_bucket = 2 * axis + ((normal[axis] < 0.0f) ? 1 : 0);
+	uint hash = hash_light_cache(uint(cell.x));
+	hash = hash_light_cache(hash ^ uint(cell.y));
+	hash = hash_light_cache(hash ^ uint(cell.z));
+	hash = hash_light_cache(hash ^ uint(level + 128) ^ (normal_bucket << 8));
+	return uvec2(hash & (LIGHT_CACHE_CELL_COUNT - 1), hash_light_cache(hash) | 1);
+}
+
+
+//! Returns the slot in a cell that the given light uses
+uint get_light_cache_slot(uint light_index) {
+	return hash_light_cache(light_index) % LIGHT_CACHE_SLOT_COUNT;
+}
+
+
+//! Converts a 12-bit weight code to a weight
+float decode_light_cache_weight(uint code) {
+	return exp2((float(code) - 2048.0f) / LIGHT_CACHE_WEIGHT_STEPS);
+}
+
+
+//! Loads a cell of the light cache. Cells that currently belong to another key
+//! are treated as empty.
+light_cache_cell_t load_light_cache_cell(uvec2 key) {
+	light_cache_cell_t result;
+	uint first = key.x * LIGHT_CACHE_CELL_STRIDE;
+	bool valid = (g_light_cache[first] == key.y);
+	result.weight_sum = 0.0f;
+	[[unroll]]
+	for (uint i = 0; i != LIGHT_CACHE_SLOT_COUNT; ++i) {
+		uint slot = valid ? g_light_cache[first + 1 + i] : 0;
+		result.light_indices[i] = (slot != 0) ? int(slot & LIGHT_CACHE_LIGHT_INDEX_MASK) : -1;
+		result.weights[i] = (slot != 0) ? decode_light_cache_weight(slot >> 20) : 0.0f;
+		result.weight_sum += result.weights[i];
+	}
+	return result;
+}
+
+
+/*! Picks a light from a cell proportional to the weights.
+	\param random A uniform random number in [0,1).
+	\return The index of the light or -1 if the cell is empty.*/
+int sample_light_cache(light_cache_cell_t cell, float random) {
+	float target = random * cell.weight_sum;
+	int light_index = -1;
+	[[unroll]]
+	for (uint i = 0; i != LIGHT_CACHE_SLOT_COUNT; ++i) {
+		if (cell.weights[i] > 0.0f) {
+			light_index = cell.light_indices[i];
+			if (target < cell.weights[i])
+				break;
+			target -= cell.weights[i];
+		}
+	}
+	return light_index;
+}
+
+
+//! Returns the probability that sample_light_cache() picks the given light
+float get_light_cache_density(light_cache_cell_t cell, int light_index) {
+	uint slot = get_light_cache_slot(uint(light_index));
+	return (cell.weight_sum > 0.0f && cell.light_indices[slot] == light_index) ? (cell.weights[slot] / cell.weight_sum) : 0.0f;
+}
+
+
+/*! Records that the given light was useful for a shading point in the given
+	cell. Its weight gets averaged with the weight that is already stored (in
+	the log domain). Updates are lock-free and may get lost under contention,
+	which is acceptable for a cache.
+	\param key The output of get_light_cache_key().
+	\param weight The value of the target function for the light.*/
+void update_light_cache(uvec2 key, int light_index, float weight) {
+	if (light_index < 0 || !(weight > 0.0f) || isinf(weight))
+		return;
+	uint first = key.x * LIGHT_CACHE_CELL_STRIDE;
+	// Take over the cell if it belongs to another key
+	if (g_light_cache[first] != key.y && atomicExchange(g_light_cache[first], key.y) != key.y) {
+		[[unroll]]
+		for (uint i = 0; i != LIGHT_CACHE_SLOT_COUNT; ++i)
+			atomicExchange(g_light_cache[first + 1 + i], 0);
+	}
+	uint code = uint(clamp(round(log2(weight) * LIGHT_CACHE_WEIGHT_STEPS) + 2048.0f, 1.0f, 4095.0f));
+	uint slot_index = first + 1 + get_light_cache_slot(uint(light_index));
+	uint old_slot = g_light_cache[slot_index];
+	uint old_code = old_slot >> 20;
+	uint new_slot;
+	if (old_slot == 0)
+		new_slot = (code << 20) | uint(light_index);
+	else if ((old_slot & LIGHT_CACHE_LIGHT_INDEX_MASK) == uint(light_index))
+		new_slot = (((old_code + code + 1) / 2) << 20) | uint(light_index);
+	else if (code + LIGHT_CACHE_REPLACEMENT_MARGIN >= old_code)
+		new_slot = (code << 20) | uint(light_index);
+	else
+		new_slot = old_slot - (1u << 20);
+	atomicCompSwap(g_light_cache[slot_index], old_slot, new_slot);
+}
@@ -0,0 +1,119 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+//! Light clusters partition the view frustum into screen-space tiles of
+//! LIGHT_CLUSTER_TILE_SIZE^2 pixels and LIGHT_CLUSTER_DEPTH_SLICE_COUNT slices
+//! with exponentially growing depth. The light culling pass lists the lights
+//! that may contribute to each cluster. Defines LIGHT_CLUSTER_COUNT_X,
+//! LIGHT_CLUSTER_COUNT_Y, LIGHT_CLUSTER_MAX_LIGHT_COUNT and
+//! LIGHT_CULLING_THRESHOLD are needed as well.
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_COUNT_X * LIGHT_CLUSTER_COUNT_Y * LIGHT_CLUSTER_DEPTH_SLICE_COUNT)
+
+#ifndef LIGHT_CLUSTER_BUFFER_QUALIFIER
+#define LIGHT_CLUSTER_BUFFER_QUALIFIER readonly
+#endif
+
+layout (std430, binding = LIGHT_CLUSTER_BINDING) LIGHT_CLUSTER_BUFFER_QUALIFIER buffer light_cluster_buffer {
+	//! The number of lights that affect each cluster. If it exceeds
+	//! LIGHT_CLUSTER_MAX_LIGHT_COUNT, the list is incomplete and should not be
+	//! used.
+	uint g_light_cluster_counts[LIGHT_CLUSTER_COUNT];
+	//! LIGHT_CLUSTER_MAX_LIGHT_COUNT light indices per cluster
+	uint g_light_cluster_lights[];
+};
+
+
+//! Returns the normalized view direction of the camera in world space
+vec3 get_camera_forward() {
+	return normalize(g_pixel_to_ray_direction_world_space * vec3(fma(vec2(g_viewport_size), vec2(0.5f), vec2(-0.5f)), 1.0f));
+}
+
+
+//! Returns the distance along the view direction at which the given depth
+//! slice begins
+float get_light_cluster_slice_depth(uint slice) {
+	return g_camera_near * pow(g_camera_far / g_camera_near, float(slice) / float(LIGHT_CLUSTER_DEPTH_SLICE_COUNT));
+}
+
+
+//! Returns the index of the given cluster in g_light_cluster_counts
+uint get_light_cluster_index(uvec3 cluster) {
+	return (cluster.z * LIGHT_CLUSTER_COUNT_Y + cluster.y) * LIGHT_CLUSTER_COUNT_X + cluster.x;
+}
+
+
+/*! Determines the cluster that holds the given point, which is visible on the
+	given pixel.
+	eturn false if the point is closer than the near plane or farther than
+		the far plane. Then it is outside of all cluster boxes and the light
+		lists do not apply to it.*/
+bool get_light_cluster(out uvec3 cluster, uvec2 pixel, vec3 position_world_space) {
+	float depth = dot(position_world_space - g_camera_position_world_space, get_camera_forward());
+	float slice = floor(log(max(depth, g_camera_near) / g_camera_near) / log(g_camera_far / g_camera_near) * float(LIGHT_CLUSTER_DEPTH_SLICE_COUNT));
+	uint slice_index = min(uint(slice), LIGHT_CLUSTER_DEPTH_SLICE_COUNT - 1);
+	uvec2 tile = min(pixel / LIGHT_CLUSTER_TILE_SIZE, uvec2(LIGHT_CLUSTER_COUNT_X - 1, LIGHT_CLUSTER_COUNT_Y - 1));
+	cluster = uvec3(tile, slice_index);
+	return depth >= g_camera_near && depth <= g_camera_far;
+}
+
+
+//! Computes a world space bounding box for the given cluster from its corners
+void get_light_cluster_box(out vec3 box_min, out vec3 box_max, uvec3 cluster) {
+	vec3 forward = get_camera_forward();
+	vec2 pixel_min = vec2(cluster.xy * LIGHT_CLUSTER_TILE_SIZE) - vec2(0.5f);
+	vec2 pixel_max = vec2(min((cluster.xy + uvec2(1)) * LIGHT_CLUSTER_TILE_SIZE, g_viewport_size)) - vec2(0.5f);
+	float depths[2] = { get_light_cluster_slice_depth(cluster.z), get_light_cluster_slice_depth(cluster.z + 1) };
+	box_min = vec3(3.4e38f);
+	box_max = vec3(-3.4e38f);
+	[[unroll]]
+	for (uint i = 0; i != 8; ++i) {
+		vec2 pixel = vec2(((i & 1) != 0) ? pixel_max.x : pixel_min.x, ((i & 2) != 0) ? pixel_max.y : pixel_min.y);
+		vec3 ray_direction = g_pixel_to_ray_direction_world_space * vec3(pixel, 1.0f);
+		vec3 corner = g_camera_position_world_space + ray_direction * (depths[i / 4] / dot(ray_direction, forward));
+		box_min = min(box_min, corner);
+		box_max = max(box_max, corner);
+	}
+}
+
+
+/*! Returns true if the given light may contribute noticeably to points in the
+	given box. The culling pass lists exactly the lights for which this returns
+	true. Lights are two-sided, so the plane only bounds the distance. The
+	cutoff distance is chosen such that the irradiance, which is at most the
+	luminance times the area over the squared distance, falls below
+	LIGHT_CULLING_THRESHOLD. It does not depend on the exposure, such that the
+	converged image does not either.*/
+bool light_affects_box(uint light_index, vec3 box_min, vec3 box_max) {
+	// Bounding sphere and area of the polygon
+	vec4 bounding_sphere = g_polygonal_light_bounding_spheres[light_index];
+	vec4 radiance_area = g_polygonal_light_radiance_area[light_index];
+	vec4 plane = get_polygonal_light_plane(light_index);
+	vec3 center = bounding_sphere.xyz;
+	float radius = bounding_sphere.w;
+	float area = radiance_area.w;
+	float luminance = dot(radiance_area.xyz, vec3(0.2126f, 0.7152f, 0.0722f));
+	float cutoff = sqrt(max(0.0f, luminance * area / LIGHT_CULLING_THRESHOLD));
+	// Distance from the box to the bounding sphere
+	vec3 closest = clamp(center, box_min, box_max);
+	if (distance(closest, center) - radius > cutoff)
+		return false;
+	// Distance from the box to the plane, if the box is on one side
+	vec3 box_center = 0.5f * (box_min + box_max);
+	vec3 box_extent = 0.5f * (box_max - box_min);
+	float center_distance = dot(plane, vec4(box_center, 1.0f));
+	float extent_distance = dot(abs(plane.xyz), box_extent);
+	return abs(center_distance) - extent_distance <= cutoff;
+}
@@ -0,0 +1,63 @@
+//  Copyright (C) 2023, Ishaan Shah, International Institute of Information Technology, Hyderabad
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#version 460
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_control_flow_attributes : enable
+#define POLYGONAL_LIGHT_BINDING 1
+#define LIGHT_CLUSTER_BINDING 2
+#define LIGHT_CLUSTER_BUFFER_QUALIFIER writeonly
+#include "shared_constants.glsl"
+#include "light_clusters.glsl"
+
+//! The number of threads that cull lights for one cluster together
+#define LIGHT_CULLING_GROUP_SIZE 64
+
+layout (local_size_x = LIGHT_CULLING_GROUP_SIZE) in;
+
+//! The number of clusters whose light list overflowed in this frame. The host
+//! reads it to report how often culling is ineffective.
+layout (std430, binding = 3) buffer light_cluster_overflow {
+	uint g_light_cluster_overflow_count;
+};
+
+//! The number of lights found for the cluster of this work group so far
+shared uint s_light_count;
+
+
+void main() {
+	uvec3 cluster = gl_WorkGroupID;
+	uint cluster_index = get_light_cluster_index(cluster);
+	if (gl_LocalInvocationIndex == 0)
+		s_light_count = 0;
+	vec3 box_min, box_max;
+	get_light_cluster_box(box_min, box_max, cluster);
+	barrier();
+	// Test all lights in parallel
+	for (uint i = gl_LocalInvocationIndex; i < POLYGONAL_LIGHT_COUNT; i += LIGHT_CULLING_GROUP_SIZE) {
+		if (light_affects_box(i, box_min, box_max)) {
+			uint slot = atomicAdd(s_light_count, 1);
+			if (slot < LIGHT_CLUSTER_MAX_LIGHT_COUNT)
+				g_light_cluster_lights[cluster_index * LIGHT_CLUSTER_MAX_LIGHT_COUNT + slot] = i;
+		}
+	}
+	barrier();
+	if (gl_LocalInvocationIndex == 0) {
+		g_light_cluster_counts[cluster_index] = s_light_count;
+		if (s_light_count > LIGHT_CLUSTER_MAX_LIGHT_COUNT)
+			atomicAdd(g_light_cluster_overflow_count, 1);
+	}
+}
@@ -14,6 +14,9 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 
+#ifndef MESH_QUANTIZATION_GLSL
+#define MESH_QUANTIZATION_GLSL
+
 /*! Decodes a normal encoded into two 16-bit UNORM numbers using octahedral
 	maps. The returned normal vector is guaranteed to be normalized.*/
 vec3 decode_normal_32_bit(vec2 octahedral_normal) {
@@ -33,6 +36,21 @@ vec3 decode_normal_32_bit(vec2 octahedral_normal) {
 }
 
 
+/*! Inverse of decode_normal_32_bit(). Returns the octahedral map of the given
+	normalized vector packed into two 16-bit UNORM numbers (x in the lower
+	half).*/
+uint encode_normal_32_bit(vec3 normal) {
+	vec2 octahedral_normal = normal.xy / (abs(normal.x) + abs(normal.y) + abs(normal.z));
+	vec2 sign_not_zero = vec2(
+		(octahedral_normal.x >= 0.0f) ? 1.0f : -1.0f,
+		(octahedral_normal.y >= 0.0f) ? 1.0f : -1.0f);
+	octahedral_normal = (normal.z < 0.0f) ? ((1.0f - abs(octahedral_normal.yx)) * sign_not_zero) : octahedral_normal;
+	// Match the mapping of decode_normal_32_bit(), which represents 0 exactly
+	uvec2 packed_normal = uvec2(clamp(round(fma(octahedral_normal, vec2(65535.0f * 65535.0f / (2.0f * 65534.0f)), vec2(32768.0f))), 0.0f, 65535.0f));
+	return packed_normal.x | (packed_normal.y << 16);
+}
+
+
 /*! Unpacks the given position that is quantized using 21-bits per coordinate
 	and packed into two 32-bit unsigned integers.*/
 vec3 decode_position_64_bit(uvec2 quantized_position, vec3 dequantization_factor, vec3 dequantization_summand) {
@@ -43,3 +61,5 @@ vec3 decode_position_64_bit(uvec2 quantized_position, vec3 dequantization_factor
 	);
 	return fma(position, dequantization_factor, dequantization_summand);
 }
+
+#endif
@@ -33,11 +33,13 @@ struct polygonal_light_t {
 	//! coordinates is zero, iff the point is on the plane of this light
 	//! source. plane.xyz has unit length.
 	vec4 plane;
+	//! The area of the polygon in world space
+	float area;
 	uint vertex_count;
 #ifdef MAX_POLYGONAL_LIGHT_VERTEX_COUNT
 	//! The 3D vertex locations of the polygon in world space. If vertex_count 
 	//! < MAX_POLYGONAL_LIGHT_VERTEX_COUNT, the first vertex is repeated at
-	//! that index.
+	//! all remaining indices.
 	vec3 vertices_world_space[MAX_POLYGONAL_LIGHT_VERTEX_COUNT];
 #endif
 };
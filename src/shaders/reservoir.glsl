@@ -22,6 +22,8 @@ struct reservoir_t {
     int light_index;
     // The probabilty with which this sample was chosen
     float sample_value;
+    // The number of candidates that have been streamed into the reservoir
+    uint sample_count;
 };
 
 void initialize_reservoir(inout reservoir_t reservoir) {
@@ -29,13 +31,100 @@ void initialize_reservoir(inout reservoir_t reservoir) {
     reservoir.light_index = -1;
     reservoir.light_sample = vec3(0);
     reservoir.sample_value = 0;
+    reservoir.sample_count = 0;
 }
 
 void insert_in_reservoir(inout reservoir_t reservoir, float w, int light_index, vec3 light_sample, float sample_value, float rand) {
     reservoir.w_sum += w;
+    reservoir.sample_count += 1;
     if (w > 0 && rand < (w / reservoir.w_sum)) {
         reservoir.light_sample = light_sample;
         reservoir.light_index = light_index;
         reservoir.sample_value = sample_value;
     }
-}
\ No newline at end of file
+}
+
+/*! Combines another reservoir into the given one. The sample of the other
+    reservoir competes with a weight that accounts for all candidates it has
+    seen, so the merged reservoir behaves as if it had seen all of them.
+    \param sample_value The target function for the sample of other evaluated
+        at the shading point of reservoir.*/
+void merge_reservoir(inout reservoir_t reservoir, reservoir_t other, float sample_value, float rand) {
+    if (other.light_index < 0 || other.sample_value <= 0) {
+        reservoir.sample_count += other.sample_count;
+        return;
+    }
+    float w = sample_value * other.w_sum / other.sample_value;
+    reservoir.w_sum += w;
+    reservoir.sample_count += other.sample_count;
+    if (w > 0 && rand < (w / reservoir.w_sum)) {
+        reservoir.light_sample = other.light_sample;
+        reservoir.light_index = other.light_index;
+        reservoir.sample_value = sample_value;
+    }
+}
+
+/*! Reservoir data that is kept across frames, one per pixel. It also stores
+    a bit of geometry of the shading point to reject reuse across edges.*/
+struct stored_reservoir_t {
+    vec3 light_sample;
+    float w_sum;
+    // Low 20 bits are the light index, high 12 bits are the sample count. A
+    // sample count of zero marks an invalid reservoir.
+    uint light_index_and_sample_count;
+    float sample_value;
+    // Octahedral encoding of the shading normal as produced by packSnorm2x16()
+    uint packed_normal;
+    // Distance from the camera to the shading point
+    float depth;
+};
+
+//! The largest sample count that fits into a stored reservoir
+#define STORED_RESERVOIR_MAX_SAMPLE_COUNT 4095
+
+//! Maps a unit vector to the octahedron and unfolds it to [-1,1]^2
+vec2 encode_octahedral_normal(vec3 normal) {
+    normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+    vec2 folded = (1.0f - abs(normal.yx)) * vec2(normal.x >= 0.0f ? 1.0f : -1.0f, normal.y >= 0.0f ? 1.0f : -1.0f);
+    return (normal.z >= 0.0f) ? normal.xy : folded;
+}
+
+//! Inverse of encode_octahedral_normal()
+vec3 decode_octahedral_normal(vec2 encoded) {
+    vec3 normal = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    float offset = max(-normal.z, 0.0f);
+    normal.x += (normal.x >= 0.0f) ? -offset : offset;
+    normal.y += (normal.y >= 0.0f) ? -offset : offset;
+    return normalize(normal);
+}
+
+/*! Packs a reservoir along with the geometry of its shading point. The sample
+    count gets clamped to what can be stored.*/
+stored_reservoir_t store_reservoir(reservoir_t reservoir, vec3 normal, float depth) {
+    stored_reservoir_t result;
+    uint sample_count = min(reservoir.sample_count, uint(STORED_RESERVOIR_MAX_SAMPLE_COUNT));
+    bool valid = reservoir.light_index >= 0 && sample_count > 0;
+    result.light_sample = reservoir.light_sample;
+    result.w_sum = (reservoir.sample_count > 0) ? reservoir.w_sum * (float(sample_count) / float(reservoir.sample_count)) : 0.0f;
+    result.light_index_and_sample_count = valid ? ((uint(reservoir.light_index) & 0xFFFFF) | (sample_count << 20)) : 0;
+    result.sample_value = reservoir.sample_value;
+    result.packed_normal = packSnorm2x16(encode_octahedral_normal(normal));
+    result.depth = depth;
+    return result;
+}
+
+/*! Unpacks a stored reservoir. If its sample count exceeds max_sample_count,
+    the weights are scaled down such that old samples do not dominate.*/
+reservoir_t load_reservoir(stored_reservoir_t stored, uint max_sample_count) {
+    reservoir_t result;
+    result.sample_count = stored.light_index_and_sample_count >> 20;
+    result.light_index = (result.sample_count > 0) ? int(stored.light_index_and_sample_count & 0xFFFFF) : -1;
+    result.light_sample = stored.light_sample;
+    result.sample_value = stored.sample_value;
+    result.w_sum = stored.w_sum;
+    if (result.sample_count > max_sample_count) {
+        result.w_sum *= float(max_sample_count) / float(result.sample_count);
+        result.sample_count = max_sample_count;
+    }
+    return result;
+}
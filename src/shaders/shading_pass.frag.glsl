@@ -21,6 +21,9 @@
 #extension GL_EXT_nonuniform_qualifier : enable
 #extension GL_EXT_control_flow_attributes : enable
 #extension GL_EXT_ray_query : enable
+#if MATERIAL_LOD_CLAMP
+#extension GL_ARB_sparse_texture_clamp : enable
+#endif
 #include "noise_utility.glsl"
 #include "brdfs.glsl"
 #include "mesh_quantization.glsl"
@@ -31,6 +34,8 @@
 #include "srgb_utility.glsl"
 #include "unrolling.glsl"
 #include "reservoir.glsl"
+#include "light_bvh.glsl"
+#include "light_alias_table.glsl"
 
 /*! Ray tracing instructions directly inside loops cause huge slow-downs. The
 	[[unroll]] directive from GL_EXT_control_flow_attributes only helps to some
@@ -39,17 +44,65 @@
 	\see unrolling.glsl */
 #define RAY_TRACING_FOR_LOOP(INDEX, COUNT, CLAMPED_COUNT, CODE) UNROLLED_FOR_LOOP(INDEX, COUNT, CLAMPED_COUNT, CODE)
 
+/*! Switches that neither change bindings nor array sizes nor unrolling are
+	specialization constants. Changing them only requires new pipelines, not
+	a new compilation. The constant_id has to match shading_specialization_t
+	in main.c.*/
+//! The used MIS heuristic as value of mis_heuristic_t
+layout (constant_id = 0) const uint MIS_HEURISTIC = 3;
+//! The number of candidates streamed into each reservoir by RIS
+layout (constant_id = 1) const int RIS_CANDIDATE_COUNT = 32;
+//! The number of neighbours and their maximal distance in pixels for spatial
+//! reuse
+layout (constant_id = 2) const uint SPATIAL_REUSE_NEIGHBOUR_COUNT = 5;
+layout (constant_id = 3) const float SPATIAL_REUSE_RADIUS = 30.0f;
+//! The probability to pick a light from the light cache and the size of
+//! cells relative to their distance to the camera
+layout (constant_id = 4) const float LIGHT_CACHE_PROBABILITY = 0.5f;
+layout (constant_id = 5) const float LIGHT_CACHE_CELL_SCALE = 0.02f;
+//! Whether the light cache falls back to power sampling instead of uniform
+//! sampling
+layout (constant_id = 6) const bool LIGHT_CACHE_POWER_FALLBACK = false;
+
+//! Flags for the individual MIS heuristics (see mis_heuristic_t)
+const bool MIS_HEURISTIC_BALANCE = (MIS_HEURISTIC == 0);
+const bool MIS_HEURISTIC_POWER = (MIS_HEURISTIC == 1);
+const bool MIS_HEURISTIC_WEIGHTED = (MIS_HEURISTIC == 2);
+const bool MIS_HEURISTIC_OPTIMAL_CLAMPED = (MIS_HEURISTIC == 3);
+const bool MIS_HEURISTIC_OPTIMAL = (MIS_HEURISTIC == 4);
+
 //! Bindings for mesh geometry (see mesh_t in the C code)
 layout (binding = 1) uniform utextureBuffer g_quantized_vertex_positions;
 layout (binding = 2) uniform textureBuffer g_packed_normals_and_tex_coords;
 layout (binding = 3) uniform utextureBuffer g_material_indices;
 
+#if COMPUTE_SHADING
+#if WAVEFRONT_STAGE >= 2
+//! Wavefront stages after candidate generation handle one queued pixel per
+//! thread
+layout (local_size_x = WAVEFRONT_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+#else
+//! Each work group shades a tile of 8x8 pixels
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+#endif
+//! The texture with primitive indices per pixel produced by the visibility pass
+layout (binding = 4, r32ui) uniform readonly uimage2D g_visibility_buffer;
+#else
 //! The texture with primitive indices per pixel produced by the visibility pass
 layout (binding = 4, input_attachment_index = 0) uniform usubpassInput g_visibility_buffer;
+#endif
 
 //! Textures (base color, specular, normal consecutively) for each material
 layout (binding = 5) uniform sampler2D g_material_textures[3 * MATERIAL_COUNT];
 
+#if MATERIAL_LOD_CLAMP
+//! For each material texture, the finest mipmap level that has been streamed
+//! in already. Sampling must not use finer levels.
+layout (std430, binding = 18) readonly buffer material_lod_clamps {
+	float g_material_lod_clamps[];
+};
+#endif
+
 //! Textures for each polygonal light. These can be plane space textures, light
 //! probes or IES profiles
 layout (binding = 7) uniform sampler2D g_light_textures[LIGHT_TEXTURE_COUNT];
@@ -58,10 +111,166 @@ layout (binding = 7) uniform sampler2D g_light_textures[LIGHT_TEXTURE_COUNT];
 //! geometry
 layout(binding = 9, set = 0) uniform accelerationStructureEXT g_top_level_acceleration_structure;
 
+#if LIGHT_CULLING
+//! Lists of lights per cluster produced by the light culling pass
+#define LIGHT_CLUSTER_BINDING 15
+#include "light_clusters.glsl"
+#endif
+
+#if SAMPLE_LIGHT_RIS_CACHE
+//! The world-space hash grid of useful lights, which persists across frames
+#define LIGHT_CACHE_BINDING 16
+#include "light_cache.glsl"
+//! The cell of the light cache for the current shading point
+light_cache_cell_t g_light_cache_cell;
+#endif
+
+#if ADAPTIVE_CANDIDATE_COUNT
+//! The accumulation buffer written by the previous frame
+layout (binding = 14, rgba32f) uniform readonly image2D g_previous_accum_buffer;
+#endif
+
+//! Reservoirs are written to memory if they are reused later
+#define STORE_RESERVOIRS (TEMPORAL_REUSE || SPATIAL_REUSE)
+
+#if STORE_RESERVOIRS
+//! One reservoir per pixel written by the shading pass of this frame and read
+//! by the spatial reuse pass
+#if SPATIAL_REUSE_PASS
+layout (std430, binding = 12) readonly buffer reservoir_buffer {
+#else
+layout (std430, binding = 12) writeonly buffer reservoir_buffer {
+#endif
+	stored_reservoir_t g_reservoirs[];
+};
+#endif
+#if TEMPORAL_REUSE && !SPATIAL_REUSE_PASS
+//! One reservoir per pixel written by the previous frame
+layout (std430, binding = 13) readonly buffer previous_reservoir_buffer {
+	stored_reservoir_t g_previous_reservoirs[];
+};
+#endif
+
+#if WAVEFRONT_STAGE
+/*! With wavefront shading, candidate generation (stage 1), shadow rays
+	(stage 2) and final shading (stage 3) are separate kernels. Each stage
+	appends the pixels that need more work to a queue for the next stage and
+	grows the work group count of its indirect dispatch along with it.*/
+layout (std430, binding = 19) buffer wavefront_queue_lengths {
+	uint g_shadow_dispatch[3];
+	uint g_shadow_queue_length;
+	uint g_shading_dispatch[3];
+	uint g_shading_queue_length;
+};
+//! Packed pixels (see pack_queued_pixel()) that need shadow rays
+layout (std430, binding = 20) buffer shadow_queue {
+	uint g_shadow_queue[];
+};
+//! Packed pixels that receive light and need final shading
+layout (std430, binding = 21) buffer shading_queue {
+	uint g_shading_queue[];
+};
+
+//! A sample selected by RIS for a pixel along with the result of shading it
+struct wavefront_sample_t {
+	//! The corresponding attributes of the selected reservoir_t. A negative
+	//! light index marks samples that are not shaded.
+	vec3 light_sample;
+	int light_index;
+	//! The shadowed estimate written by the shadow ray stage
+	vec3 color;
+	float w_sum;
+	float sample_value;
+	uint sample_count;
+};
+//! LIGHT_SAMPLES consecutive samples per pixel
+layout (std430, binding = 22) buffer wavefront_samples {
+	wavefront_sample_t g_wavefront_samples[];
+};
+
+
+//! Turns a pixel into a single queue entry
+uint pack_queued_pixel(ivec2 pixel) {
+	return uint(pixel.x) | (uint(pixel.y) << 16);
+}
+
+
+//! Inverse of pack_queued_pixel()
+ivec2 unpack_queued_pixel(uint packed_pixel) {
+	return ivec2(packed_pixel & 0xFFFF, packed_pixel >> 16);
+}
+
+
+//! Returns the index in g_wavefront_samples for the given pixel and sample
+uint get_wavefront_sample_index(ivec2 pixel, uint sample_index) {
+	return (uint(pixel.y) * g_viewport_size.x + uint(pixel.x)) * LIGHT_SAMPLES + sample_index;
+}
+
+
+//! Appends the given pixel to the queue of the shadow ray stage
+void enqueue_shadow_rays(ivec2 pixel) {
+	uint slot = atomicAdd(g_shadow_queue_length, 1);
+	if (slot % WAVEFRONT_GROUP_SIZE == 0)
+		atomicAdd(g_shadow_dispatch[0], 1);
+	g_shadow_queue[slot] = pack_queued_pixel(pixel);
+}
+
+
+//! Appends the given pixel to the queue of the final shading stage
+void enqueue_final_shading(ivec2 pixel) {
+	uint slot = atomicAdd(g_shading_queue_length, 1);
+	if (slot % WAVEFRONT_GROUP_SIZE == 0)
+		atomicAdd(g_shading_dispatch[0], 1);
+	g_shading_queue[slot] = pack_queued_pixel(pixel);
+}
+#endif
+
+#if COMPUTE_SHADING
+//! The shading buffer, which a compute shader writes in place of a color
+//! attachment
+layout (binding = 17, rgba32f) uniform image2D g_shading_buffer;
+#else
 //! The pixel index with origin in the upper left corner
 layout(origin_upper_left) in vec4 gl_FragCoord;
 //! Color written to the swapchain image
 layout (location = 0) out vec4 g_out_color;
+#endif
+
+
+//! Returns the integer index of the pixel that is being shaded
+ivec2 get_pixel() {
+#if COMPUTE_SHADING
+	return ivec2(gl_GlobalInvocationID.xy);
+#else
+	return ivec2(gl_FragCoord.xy);
+#endif
+}
+
+
+//! Returns the primitive index from the visibility buffer for the given pixel
+//! (which has to be the one that is being shaded)
+uint load_visibility_buffer(ivec2 pixel) {
+#if COMPUTE_SHADING
+	return imageLoad(g_visibility_buffer, pixel).r;
+#else
+	return subpassLoad(g_visibility_buffer).r;
+#endif
+}
+
+
+/*! Writes the shading result for the given pixel (which has to be the one
+	that is being shaded). The spatial reuse pass adds the color to the
+	output of the shading pass.*/
+void write_shading_buffer(ivec2 pixel, vec4 color) {
+#if COMPUTE_SHADING && SPATIAL_REUSE_PASS
+	vec4 previous = imageLoad(g_shading_buffer, pixel);
+	imageStore(g_shading_buffer, pixel, vec4(previous.rgb + color.rgb, previous.a));
+#elif COMPUTE_SHADING
+	imageStore(g_shading_buffer, pixel, color);
+#else
+	g_out_color = color;
+#endif
+}
 
 
 /*! Turns an error value into a color that makes it easy to see the magnitude
@@ -146,9 +355,38 @@ vec3 get_polygon_radiance(vec3 sampled_dir, vec3 shading_position, polygonal_lig
 
 
 float get_polygon_area(polygonal_light_t light) {
-	vec3 v1 = light.vertices_world_space[1] - light.vertices_world_space[0];
-	vec3 v2 = light.vertices_world_space[2] - light.vertices_world_space[0];
-	return length(cross_stable(v1, v2)) / 2;
+	return light.area;
+}
+
+
+/*! A cheap, conservative approximation of the unshadowed light reflected at
+	the shading point due to the given light. The polygon is treated as a
+	disk at its vertex average with a bounding sphere. Both cosines are
+	widened by the angle that the bounding sphere subtends, such that the
+	result is only zero if the light can not contribute at all. That keeps
+	RIS unbiased when it is used as target function. Vertices are not
+	fetched at all.
+	\return Luminance of the approximate reflected radiance.*/
+float get_polygon_form_factor_target(shading_data_t shading_data, ltc_coefficients_t ltc, uint light_index) {
+	vec4 bounding_sphere = get_polygonal_light_bounding_sphere(light_index);
+	vec4 radiance_area = get_polygonal_light_radiance_area(light_index);
+	vec3 plane_normal = get_polygonal_light_plane(light_index).xyz;
+	vec3 center = bounding_sphere.xyz;
+	float radius = bounding_sphere.w;
+	float area = radiance_area.w;
+	vec3 to_light = center - shading_data.position;
+	float distance_squared = max(dot(to_light, to_light), 1.0e-20f);
+	vec3 light_dir = to_light * inversesqrt(distance_squared);
+	// The sine of the half-angle of the cone that bounds the polygon
+	float sin_bound = min(1.0f, radius * inversesqrt(distance_squared));
+	float cos_receiver = clamp(dot(shading_data.normal, light_dir) + sin_bound, 0.0f, 1.0f);
+	// Lights are two-sided
+	float cos_light = clamp(abs(dot(plane_normal, light_dir)) + sin_bound, 0.0f, 1.0f);
+	// The solid angle of a polygon never exceeds a hemisphere
+	float projected_solid_angle = min(area * cos_light / distance_squared, 2.0f * M_PI) * cos_receiver;
+	vec3 luminance_weights = vec3(0.2126f, 0.7152f, 0.0722f);
+	float albedo = dot(shading_data.diffuse_albedo, luminance_weights) + ltc.albedo * dot(shading_data.fresnel_0, luminance_weights);
+	return dot(radiance_area.xyz, luminance_weights) * albedo * projected_solid_angle * (1.0f / M_PI);
 }
 
 /*! Determines the radiance received from the given direction due to the given
@@ -217,14 +455,13 @@ vec3 get_polygon_radiance_brdf_product(inout bool out_visibility, vec3 sampled_d
 		that sample (i.e. sampled_density).
 	\see mis_heuristic_t */
 float get_mis_weight_over_density(float sampled_density, float other_density) {
-#if MIS_HEURISTIC_BALANCE
-	return 1.0f / (sampled_density + other_density);
-#elif MIS_HEURISTIC_POWER
-	return sampled_density / (sampled_density * sampled_density + other_density * other_density);
-#else
-	// Not supported, use get_mis_estimate()
-	return 0.0f;
-#endif
+	if (MIS_HEURISTIC_BALANCE)
+		return 1.0f / (sampled_density + other_density);
+	else if (MIS_HEURISTIC_POWER)
+		return sampled_density / (sampled_density * sampled_density + other_density * other_density);
+	else
+		// Not supported, use get_mis_estimate()
+		return 0.0f;
 }
 
 
@@ -244,28 +481,27 @@ float get_mis_weight_over_density(float sampled_density, float other_density) {
 	\return An unbiased multiple importance sampling estimator. Note that it
 		may be negative when optimal MIS is used.*/
 vec3 get_mis_estimate(vec3 integrand, vec3 sampled_weight, float sampled_density, vec3 other_weight, float other_density, float visibility_estimate) {
-#if MIS_HEURISTIC_WEIGHTED
-	vec3 weighted_sum = sampled_weight * sampled_density + other_weight * other_density;
-	return (sampled_weight * integrand) / weighted_sum;
-
-#elif MIS_HEURISTIC_OPTIMAL_CLAMPED || MIS_HEURISTIC_OPTIMAL
-	float balance_weight_over_density = 1.0f / (sampled_density + other_density);
-	vec3 weighted_sum = sampled_weight * sampled_density + other_weight * other_density;
-#if MIS_HEURISTIC_OPTIMAL_CLAMPED
-	vec3 weighted_weight_over_density = sampled_weight / weighted_sum;
-	vec3 mixed_weight_over_density = vec3(fma(-visibility_estimate, balance_weight_over_density, balance_weight_over_density));
-	mixed_weight_over_density = fma(vec3(visibility_estimate), weighted_weight_over_density, vec3(mixed_weight_over_density));
-	// For visible samples, we use the actual integrand
-	vec3 visible_estimate = mixed_weight_over_density * integrand;
-	return visible_estimate;
-
-#elif MIS_HEURISTIC_OPTIMAL
-	return visibility_estimate * sampled_weight + balance_weight_over_density * (integrand - visibility_estimate * weighted_sum);
-#endif
-
-#else
-	return get_mis_weight_over_density(sampled_density, other_density) * integrand;
-#endif
+	if (MIS_HEURISTIC_WEIGHTED) {
+		vec3 weighted_sum = sampled_weight * sampled_density + other_weight * other_density;
+		return (sampled_weight * integrand) / weighted_sum;
+	}
+	else if (MIS_HEURISTIC_OPTIMAL_CLAMPED) {
+		float balance_weight_over_density = 1.0f / (sampled_density + other_density);
+		vec3 weighted_sum = sampled_weight * sampled_density + other_weight * other_density;
+		vec3 weighted_weight_over_density = sampled_weight / weighted_sum;
+		vec3 mixed_weight_over_density = vec3(fma(-visibility_estimate, balance_weight_over_density, balance_weight_over_density));
+		mixed_weight_over_density = fma(vec3(visibility_estimate), weighted_weight_over_density, vec3(mixed_weight_over_density));
+		// For visible samples, we use the actual integrand
+		vec3 visible_estimate = mixed_weight_over_density * integrand;
+		return visible_estimate;
+	}
+	else if (MIS_HEURISTIC_OPTIMAL) {
+		float balance_weight_over_density = 1.0f / (sampled_density + other_density);
+		vec3 weighted_sum = sampled_weight * sampled_density + other_weight * other_density;
+		return visibility_estimate * sampled_weight + balance_weight_over_density * (integrand - visibility_estimate * weighted_sum);
+	}
+	else
+		return get_mis_weight_over_density(sampled_density, other_density) * integrand;
 }
 
 
@@ -356,11 +592,11 @@ vec3 evaluate_polygonal_light_shading_peters(
 	vec3 specular_weight_rgb = vec3(specular_weight);
 	// For optimal MIS, constant factors in the diffuse and specular weight
 	// matter
-#if MIS_HEURISTIC_OPTIMAL
-	vec3 radiance_over_pi = polygonal_light.surface_radiance * M_INV_PI;
-	diffuse_weight *= radiance_over_pi;
-	specular_weight_rgb *= radiance_over_pi;
-#endif
+	if (MIS_HEURISTIC_OPTIMAL) {
+		vec3 radiance_over_pi = polygonal_light.surface_radiance * M_INV_PI;
+		diffuse_weight *= radiance_over_pi;
+		specular_weight_rgb *= radiance_over_pi;
+	}
 	// Take the requested number of samples with both techniques
 	RAY_TRACING_FOR_LOOP(i, SAMPLE_COUNT, SAMPLE_COUNT_CLAMPED,
 		// Take the samples
@@ -509,11 +745,11 @@ vec3 evaluate_polygonal_light_shading(
 	vec3 specular_weight_rgb = vec3(specular_weight);
 	// For optimal MIS, constant factors in the diffuse and specular weight
 	// matter
-#if MIS_HEURISTIC_OPTIMAL
-	vec3 radiance_over_pi = polygonal_light.surface_radiance * M_INV_PI;
-	diffuse_weight *= radiance_over_pi;
-	specular_weight_rgb *= radiance_over_pi;
-#endif
+	if (MIS_HEURISTIC_OPTIMAL) {
+		vec3 radiance_over_pi = polygonal_light.surface_radiance * M_INV_PI;
+		diffuse_weight *= radiance_over_pi;
+		specular_weight_rgb *= radiance_over_pi;
+	}
 	// Take the requested number of samples with both techniques
 	RAY_TRACING_FOR_LOOP(i, SAMPLE_COUNT, SAMPLE_COUNT_CLAMPED,
 		// Take the samples
@@ -627,10 +863,17 @@ shading_data_t get_shading_data(ivec2 pixel, int primitive_index, vec3 ray_direc
 			tex_coord_derivs[i] += barycentrics_derivs[i][j] * tex_coords[j];
 	// Read all three textures
 	uint material_index = texelFetch(g_material_indices, primitive_index).r;
+	vec3 normal_tangent_space;
+#if MATERIAL_LOD_CLAMP
+	// Mipmaps that are still being streamed must not be accessed
+	vec3 base_color = textureGradClampARB(g_material_textures[nonuniformEXT(3 * material_index + 0)], tex_coord, tex_coord_derivs[0], tex_coord_derivs[1], g_material_lod_clamps[3 * material_index + 0]).rgb;
+	vec3 specular_data = textureGradClampARB(g_material_textures[nonuniformEXT(3 * material_index + 1)], tex_coord, tex_coord_derivs[0], tex_coord_derivs[1], g_material_lod_clamps[3 * material_index + 1]).rgb;
+	normal_tangent_space.xy = textureGradClampARB(g_material_textures[nonuniformEXT(3 * material_index + 2)], tex_coord, tex_coord_derivs[0], tex_coord_derivs[1], g_material_lod_clamps[3 * material_index + 2]).rg;
+#else
 	vec3 base_color = textureGrad(g_material_textures[nonuniformEXT(3 * material_index + 0)], tex_coord, tex_coord_derivs[0], tex_coord_derivs[1]).rgb;
 	vec3 specular_data = textureGrad(g_material_textures[nonuniformEXT(3 * material_index + 1)], tex_coord, tex_coord_derivs[0], tex_coord_derivs[1]).rgb;
-	vec3 normal_tangent_space;
 	normal_tangent_space.xy = textureGrad(g_material_textures[nonuniformEXT(3 * material_index + 2)], tex_coord, tex_coord_derivs[0], tex_coord_derivs[1]).rg;
+#endif
 	normal_tangent_space.xy = fma(normal_tangent_space.xy, vec2(2.0f), vec2(-1.0f));
 	normal_tangent_space.z = sqrt(max(0.0f, fma(-normal_tangent_space.x, normal_tangent_space.x, fma(-normal_tangent_space.y, normal_tangent_space.y, 1.0f))));
 	// Prepare BRDF parameters (i.e. immitate Falcor to be compatible with its
@@ -671,11 +914,339 @@ shading_data_t get_shading_data(ivec2 pixel, int primitive_index, vec3 ray_direc
 	return result;
 }
 
+/*! Picks a polygonal light using the strategy selected through defines.
+	\param density Overwritten by the probability of picking the returned
+		light. Zero if no light could be picked.
+	\return The index of the picked light or -1.*/
+int pick_polygonal_light(out float density, shading_data_t shading_data, inout noise_accessor_t accessor) {
+#if SAMPLE_LIGHT_RIS_BVH
+	return sample_light_bvh(density, shading_data.position, shading_data.normal, get_noise_1(accessor));
+#elif SAMPLE_LIGHT_POWER || SAMPLE_LIGHT_RIS_POWER
+	return sample_light_alias_table(density, get_noise_1(accessor));
+#elif SAMPLE_LIGHT_RIS_CACHE
+	// Mix sampling from the cell of the light cache with uniform or power
+	// sampling, which ensures that all lights can be picked. The density of
+	// the mixture is the balance heuristic for the two techniques.
+	float cache_probability = (g_light_cache_cell.weight_sum > 0.0f) ? LIGHT_CACHE_PROBABILITY : 0.0f;
+	float random = get_noise_1(accessor);
+	int light_index;
+	if (random < cache_probability)
+		light_index = sample_light_cache(g_light_cache_cell, random / cache_probability);
+	else {
+		random = (random - cache_probability) / (1.0f - cache_probability);
+		if (LIGHT_CACHE_POWER_FALLBACK) {
+			float power_density;
+			light_index = sample_light_alias_table(power_density, random);
+		}
+		else
+			light_index = min(int(random * POLYGONAL_LIGHT_COUNT), POLYGONAL_LIGHT_COUNT - 1);
+	}
+	float fallback_density = LIGHT_CACHE_POWER_FALLBACK ? g_light_alias_table[light_index].density : (1.0f / float(POLYGONAL_LIGHT_COUNT));
+	density = mix(fallback_density, get_light_cache_density(g_light_cache_cell, light_index), cache_probability);
+	return light_index;
+#else
+#if LIGHT_CULLING
+	// Mix uniform sampling among lights in the cluster of the shading point
+	// with uniform sampling among all lights. Culled lights keep a non-zero
+	// density, so culling does not introduce bias. Empty or overflowing lists
+	// and points outside of all clusters only use the latter.
+	uvec3 cluster;
+	uint cluster_index = 0;
+	uint cluster_light_count = 0;
+	if (get_light_cluster(cluster, uvec2(get_pixel()), shading_data.position)) {
+		cluster_index = get_light_cluster_index(cluster);
+		cluster_light_count = g_light_cluster_counts[cluster_index];
+		if (cluster_light_count > LIGHT_CLUSTER_MAX_LIGHT_COUNT)
+			cluster_light_count = 0;
+	}
+	float cluster_probability = (cluster_light_count > 0) ? LIGHT_CLUSTER_PROBABILITY : 0.0f;
+	float random = get_noise_1(accessor);
+	int light_index;
+	bool listed;
+	if (random < cluster_probability) {
+		uint slot = min(uint(random / cluster_probability * float(cluster_light_count)), cluster_light_count - 1);
+		light_index = int(g_light_cluster_lights[cluster_index * LIGHT_CLUSTER_MAX_LIGHT_COUNT + slot]);
+		listed = true;
+	}
+	else {
+		random = (random - cluster_probability) / (1.0f - cluster_probability);
+		light_index = min(int(random * POLYGONAL_LIGHT_COUNT), POLYGONAL_LIGHT_COUNT - 1);
+		// Repeat the test of the culling pass to find out if the light is listed
+		listed = false;
+		if (cluster_light_count > 0) {
+			vec3 box_min, box_max;
+			get_light_cluster_box(box_min, box_max, cluster);
+			listed = light_affects_box(uint(light_index), box_min, box_max);
+		}
+	}
+	float cluster_density = listed ? (1.0f / float(cluster_light_count)) : 0.0f;
+	density = mix(1.0f / float(POLYGONAL_LIGHT_COUNT), cluster_density, cluster_probability);
+	return light_index;
+#endif
+	density = 1.0f / float(POLYGONAL_LIGHT_COUNT);
+	return int(get_noise_1(accessor) * POLYGONAL_LIGHT_COUNT);
+#endif
+}
+
+/*! Evaluates the target function p_hat that RIS uses to weight candidate
+	lights. With RIS_TARGET_FORM_FACTOR, it is a cheap approximation and
+	light_sample is left untouched. Otherwise, it is the norm of the
+	unshadowed shading estimate for the light and light_sample may be
+	overwritten by a new sample unless eval_only is true.*/
+float get_ris_target_function(shading_data_t shading_data, ltc_coefficients_t ltc, int light_index, inout vec3 light_sample, bool eval_only, inout noise_accessor_t noise_accessor) {
+#if RIS_TARGET_FORM_FACTOR
+	return get_polygon_form_factor_target(shading_data, ltc, uint(light_index));
+#else
+	bool dummy_vis = false;
+	return length(evaluate_polygonal_light_shading(shading_data, ltc, get_polygonal_light(uint(light_index)), light_sample, eval_only, dummy_vis, noise_accessor));
+#endif
+}
+
+
+/*! Shades using the sample in the given reservoir with a shadow ray and
+	weights the result by the unbiased contribution weight of the reservoir.
+	\return The contribution of the reservoir to the pixel color.*/
+vec3 shade_reservoir(reservoir_t res, shading_data_t shading_data, ltc_coefficients_t ltc, inout noise_accessor_t noise_accessor) {
+	if (res.light_index < 0)
+		return vec3(0.0f);
+	polygonal_light_t polygonal_light = get_polygonal_light(uint(res.light_index));
+	bool visibility = true;
+#if SAMPLE_POLYGON_LTC_CP
+	vec3 color = evaluate_polygonal_light_shading_peters(shading_data, ltc, polygonal_light, noise_accessor);
+#else
+#if RIS_TARGET_FORM_FACTOR
+	// The reservoir only picked the light, so the light gets shaded with a
+	// new sample. RIS with an unbiased estimate per light remains unbiased.
+	vec3 light_sample = res.light_sample;
+	vec3 color = evaluate_polygonal_light_shading(shading_data, ltc, polygonal_light, light_sample, false, visibility, noise_accessor);
+#else
+	vec3 color = evaluate_polygonal_light_shading(shading_data, ltc, polygonal_light, res.light_sample, true, visibility, noise_accessor);
+#endif
+#endif
+	float p_hat = res.sample_value;
+	float W = res.w_sum / (res.sample_count * p_hat);	// (1 / p_optimal)
+
+#if SAMPLE_POLYGON_LTC_CP || SAMPLE_POLYGON_PROJECTED_SOLID_ANGLE
+	// Visibility is embedded in the call so make sure that we don't divide by 0
+	if (p_hat == 0.0)
+		W = 0.0;
+#endif
+
+#if !SAMPLE_POLYGON_PROJECTED_SOLID_ANGLE && !SAMPLE_POLYGON_LTC_CP
+	W = W * int(visibility);
+#endif
+	return color * W;
+}
+
+/*! Evaluates the target function for the sample of a reservoir that was
+	created for another shading point (without visibility).*/
+float get_reservoir_sample_value(reservoir_t res, shading_data_t shading_data, ltc_coefficients_t ltc, inout noise_accessor_t noise_accessor) {
+	if (res.light_index < 0)
+		return 0.0f;
+	vec3 light_sample = res.light_sample;
+	return get_ris_target_function(shading_data, ltc, res.light_index, light_sample, true, noise_accessor);
+}
+
+/*! Determines how many candidates are streamed into reservoirs for the given
+	pixel. With ADAPTIVE_CANDIDATE_COUNT, RIS_CANDIDATE_COUNT gets scaled by
+	the relative standard deviation of luminance in a small neighbourhood of
+	the previous frame, such that smooth regions use fewer candidates and
+	noisy regions or edges use more.*/
+int get_candidate_count(ivec2 pixel) {
+#if ADAPTIVE_CANDIDATE_COUNT
+	const ivec2 offsets[5] = { ivec2(0, 0), ivec2(1, 0), ivec2(-1, 0), ivec2(0, 1), ivec2(0, -1) };
+	float mean = 0.0f;
+	float mean_square = 0.0f;
+	[[unroll]]
+	for (uint i = 0; i != 5; ++i) {
+		ivec2 neighbour = clamp(pixel + offsets[i], ivec2(0), ivec2(g_viewport_size) - ivec2(1));
+		float luminance = dot(imageLoad(g_previous_accum_buffer, neighbour).rgb, vec3(0.2126f, 0.7152f, 0.0722f));
+		mean += luminance;
+		mean_square += luminance * luminance;
+	}
+	mean *= 0.2f;
+	mean_square *= 0.2f;
+	float deviation = sqrt(max(0.0f, fma(-mean, mean, mean_square)));
+	// Black regions give no information, so they use the minimum
+	float scale = (mean > 0.0f) ? clamp(0.25f + deviation / mean, 0.25f, 2.0f) : 0.25f;
+	return max(1, int(round(RIS_CANDIDATE_COUNT * scale)));
+#else
+	return RIS_CANDIDATE_COUNT;
+#endif
+}
+
+#if TEMPORAL_REUSE && !SPATIAL_REUSE_PASS
+/*! Finds the reservoir of the previous frame for the given shading point and
+	merges it into the given reservoir, unless the geometry differs too much.
+	\param max_sample_count The sample count of the previous reservoir is
+		clamped to this value.*/
+void reuse_temporal_reservoir(inout reservoir_t res, shading_data_t shading_data, ltc_coefficients_t ltc, uint max_sample_count, inout noise_accessor_t noise_accessor) {
+	// Reproject into the previous frame
+	vec4 previous_position = g_previous_world_to_projection_space * vec4(shading_data.position, 1.0f);
+	if (previous_position.w <= 0.0f)
+		return;
+	vec2 previous_pixel = fma(previous_position.xy / previous_position.w, vec2(0.5f), vec2(0.5f)) * vec2(g_viewport_size);
+	if (any(lessThan(previous_pixel, vec2(0.0f))) || any(greaterThanEqual(previous_pixel, vec2(g_viewport_size))))
+		return;
+	uvec2 previous_pixel_index = uvec2(previous_pixel);
+	stored_reservoir_t stored = g_previous_reservoirs[previous_pixel_index.y * g_viewport_size.x + previous_pixel_index.x];
+	// Reject reservoirs of other surfaces
+	vec3 previous_normal = decode_octahedral_normal(unpackSnorm2x16(stored.packed_normal));
+	float depth = distance(g_previous_camera_position_world_space, shading_data.position);
+	if (dot(previous_normal, shading_data.normal) < 0.9f || abs(stored.depth - depth) > 0.05f * depth)
+		return;
+	reservoir_t previous = load_reservoir(stored, max_sample_count);
+	// Evaluate the target function for the old sample at this shading point
+	float sample_value = get_reservoir_sample_value(previous, shading_data, ltc, noise_accessor);
+	merge_reservoir(res, previous, sample_value, get_noise_1(noise_accessor));
+}
+#endif
+
+#if SPATIAL_REUSE_PASS
+/*! Entry point of the spatial reuse pass. It merges the reservoir that the
+	shading pass stored for this pixel with those of randomly chosen
+	neighbours on similar geometry, shades with the result and adds it to the
+	output of the shading pass.*/
 void main() {
+#if SHARED_POLYGONAL_LIGHTS
+	stage_shared_polygonal_lights();
+#endif
+	ivec2 pixel = get_pixel();
+#if COMPUTE_SHADING
+	if (any(greaterThanEqual(pixel, ivec2(g_viewport_size))))
+		return;
+#endif
+	uint primitive_index = load_visibility_buffer(pixel);
+	// Background and emissive surfaces are handled by the shading pass
+	if (primitive_index == 0xFFFFFFFF || (primitive_index >> 31) > 0) {
+#if COMPUTE_SHADING
+		return;
+#else
+		discard;
+#endif
+	}
+	vec3 view_ray_direction = g_pixel_to_ray_direction_world_space * vec3(pixel, 1.0f);
+	shading_data_t shading_data = get_shading_data(pixel, int(primitive_index), view_ray_direction);
+	float fresnel_luminance = dot(shading_data.fresnel_0, vec3(0.2126f, 0.7152f, 0.0722f));
+	ltc_coefficients_t ltc = get_ltc_coefficients(fresnel_luminance, shading_data.roughness, shading_data.position, shading_data.normal, shading_data.outgoing, g_ltc_constants);
+	// Use different random numbers than the shading pass
+	noise_accessor_t noise_accessor = get_noise_accessor(pixel, g_viewport_size, g_noise_random_numbers.yzwx);
+	// Start with the reservoir of this pixel. The shading pass has already
+	// evaluated the target function for its sample here.
+	reservoir_t center = load_reservoir(g_reservoirs[uint(pixel.y) * g_viewport_size.x + uint(pixel.x)], STORED_RESERVOIR_MAX_SAMPLE_COUNT);
+	reservoir_t res;
+	initialize_reservoir(res);
+	merge_reservoir(res, center, center.sample_value, get_noise_1(noise_accessor));
+	float depth = distance(g_camera_position_world_space, shading_data.position);
+	for (uint i = 0; i != SPATIAL_REUSE_NEIGHBOUR_COUNT; ++i) {
+		// Pick a neighbour uniformly in a disk
+		vec2 random = get_noise_2(noise_accessor);
+		float radius = SPATIAL_REUSE_RADIUS * sqrt(random.x);
+		float angle = 2.0f * M_PI * random.y;
+		ivec2 neighbour = pixel + ivec2(round(radius * vec2(cos(angle), sin(angle))));
+		if (neighbour == pixel || any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, ivec2(g_viewport_size))))
+			continue;
+		stored_reservoir_t stored = g_reservoirs[uint(neighbour.y) * g_viewport_size.x + uint(neighbour.x)];
+		// Reject neighbours on different geometry
+		vec3 neighbour_normal = decode_octahedral_normal(unpackSnorm2x16(stored.packed_normal));
+		if (dot(neighbour_normal, shading_data.normal) < 0.9f || abs(stored.depth - depth) > 0.1f * depth)
+			continue;
+		reservoir_t neighbour_res = load_reservoir(stored, STORED_RESERVOIR_MAX_SAMPLE_COUNT);
+		float sample_value = get_reservoir_sample_value(neighbour_res, shading_data, ltc, noise_accessor);
+		merge_reservoir(res, neighbour_res, sample_value, get_noise_1(noise_accessor));
+	}
+	vec3 final_color = shade_reservoir(res, shading_data, ltc, noise_accessor) / LIGHT_SAMPLES;
+	if (isnan(final_color.r) || isnan(final_color.g) || isnan(final_color.b)
+		|| isinf(final_color.r) || isinf(final_color.g) || isinf(final_color.b))
+		final_color = vec3(1.0f, 0.0f, 0.8f) / g_exposure_factor;
+	// The output gets added to that of the shading pass
+	write_shading_buffer(pixel, vec4(final_color * g_exposure_factor, 0.0f));
+}
+#elif WAVEFRONT_STAGE == 2
+/*! Entry point of the shadow ray stage of wavefront shading. For each queued
+	pixel, it shades with the samples that candidate generation has selected,
+	which traces all shadow rays. Pixels that receive any light are queued
+	for final shading.*/
+void main() {
+#if SHARED_POLYGONAL_LIGHTS
+	stage_shared_polygonal_lights();
+#endif
+	uint queue_index = gl_GlobalInvocationID.x;
+	if (queue_index >= g_shadow_queue_length)
+		return;
+	ivec2 pixel = unpack_queued_pixel(g_shadow_queue[queue_index]);
+	// Shading data is cheaper to recompute than to pass between stages
+	uint primitive_index = load_visibility_buffer(pixel);
+	vec3 view_ray_direction = g_pixel_to_ray_direction_world_space * vec3(pixel, 1.0f);
+	shading_data_t shading_data = get_shading_data(pixel, int(primitive_index), view_ray_direction);
+	float fresnel_luminance = dot(shading_data.fresnel_0, vec3(0.2126f, 0.7152f, 0.0722f));
+	ltc_coefficients_t ltc = get_ltc_coefficients(fresnel_luminance, shading_data.roughness, shading_data.position, shading_data.normal, shading_data.outgoing, g_ltc_constants);
+	// Use different random numbers than candidate generation
+	noise_accessor_t noise_accessor = get_noise_accessor(pixel, g_viewport_size, g_noise_random_numbers.zwxy);
+#if SAMPLE_LIGHT_RIS_CACHE
+	uvec2 light_cache_key = get_light_cache_key(shading_data.position, shading_data.normal);
+#endif
+	bool receives_light = false;
+	for (uint j = 0; j != LIGHT_SAMPLES; ++j) {
+		uint sample_index = get_wavefront_sample_index(pixel, j);
+		wavefront_sample_t selected = g_wavefront_samples[sample_index];
+		if (selected.light_index < 0)
+			continue;
+		reservoir_t res;
+		res.light_sample = selected.light_sample;
+		res.light_index = selected.light_index;
+		res.w_sum = selected.w_sum;
+		res.sample_value = selected.sample_value;
+		res.sample_count = selected.sample_count;
+		vec3 color = shade_reservoir(res, shading_data, ltc, noise_accessor);
+#if SAMPLE_LIGHT_RIS_CACHE
+		// Lights that turned out to be unoccluded are remembered
+		if (any(greaterThan(color, vec3(0.0f))))
+			update_light_cache(light_cache_key, res.light_index, res.sample_value);
+#endif
+		g_wavefront_samples[sample_index].color = color;
+		// NaNs have to reach the final stage, too
+		receives_light = receives_light || any(notEqual(color, vec3(0.0f)));
+	}
+	if (receives_light)
+		enqueue_final_shading(pixel);
+}
+#elif WAVEFRONT_STAGE == 3
+/*! Entry point of the final shading stage of wavefront shading. It combines
+	the shaded samples of each queued pixel. All other pixels have been
+	written by candidate generation already.*/
+void main() {
+	uint queue_index = gl_GlobalInvocationID.x;
+	if (queue_index >= g_shading_queue_length)
+		return;
+	ivec2 pixel = unpack_queued_pixel(g_shading_queue[queue_index]);
+	vec3 final_color = vec3(0.0f);
+	for (uint j = 0; j != LIGHT_SAMPLES; ++j) {
+		wavefront_sample_t selected = g_wavefront_samples[get_wavefront_sample_index(pixel, j)];
+		if (selected.light_index >= 0)
+			final_color += selected.color / LIGHT_SAMPLES;
+	}
+	// If there are NaNs or INFs, we want to know. Make them pink.
+	if (isnan(final_color.r) || isnan(final_color.g) || isnan(final_color.b)
+		|| isinf(final_color.r) || isinf(final_color.g) || isinf(final_color.b))
+		final_color = vec3(1.0f, 0.0f, 0.8f) / g_exposure_factor;
+	write_shading_buffer(pixel, vec4(final_color * g_exposure_factor, 1.0f));
+}
+#else
+void main() {
+#if SHARED_POLYGONAL_LIGHTS
+	// Has to happen before threads outside of the viewport return
+	stage_shared_polygonal_lights();
+#endif
 	// Obtain an integer pixel index
-	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	ivec2 pixel = get_pixel();
+#if COMPUTE_SHADING
+	// Tiles at the border of the viewport may be incomplete
+	if (any(greaterThanEqual(pixel, ivec2(g_viewport_size))))
+		return;
+#endif
 	// Get the primitive index from the visibility buffer
-	uint primitive_index = subpassLoad(g_visibility_buffer).r;
+	uint primitive_index = load_visibility_buffer(pixel);
 
 	// Set the backgroudd color
 	vec3 final_color = vec3(0.0f);
@@ -685,7 +1256,10 @@ void main() {
 	shading_data_t shading_data;
 	if (primitive_index == 0xFFFFFFFF) {
 		view_ray_end = vec4(view_ray_direction, 0.0f);
-		g_out_color = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		write_shading_buffer(pixel, vec4(0.0f, 0.0f, 0.0f, 1.0f));
+#if STORE_RESERVOIRS
+		g_reservoirs[uint(pixel.y) * g_viewport_size.x + uint(pixel.x)].light_index_and_sample_count = 0;
+#endif
 		return;
 	} else {
 		// Prepare shading data for the visible surface point
@@ -695,6 +1269,9 @@ void main() {
 
 	if ((primitive_index >> 31) > 0) {
 		final_color = vec3(1);
+#if STORE_RESERVOIRS
+		g_reservoirs[uint(pixel.y) * g_viewport_size.x + uint(pixel.x)].light_index_and_sample_count = 0;
+#endif
 	} else {
 		// Get ready to use linearly transformed cosines
 		float fresnel_luminance = dot(shading_data.fresnel_0, vec3(0.2126f, 0.7152f, 0.0722f));
@@ -704,61 +1281,90 @@ void main() {
 		// For non LTC method this stores the sampled direction (will only work for 1 spp)
 		vec3 light_sample = vec3(0);
 
-#if SAMPLE_LIGHT_UNIFORM
+#if SAMPLE_LIGHT_UNIFORM || SAMPLE_LIGHT_POWER
 		vec3 result = vec3(0);
 		polygonal_light_t chosen_light; 
 		for (int i = 0; i < LIGHT_SAMPLES; i++) {
 			bool visibility = true;
-			int light_idx = int(get_noise_1(noise_accessor) * POLYGONAL_LIGHT_COUNT);
-			chosen_light = g_polygonal_lights[light_idx];
+			float light_density;
+			int light_idx = pick_polygonal_light(light_density, shading_data, noise_accessor);
+			if (light_idx < 0)
+				continue;
+			chosen_light = get_polygonal_light(uint(light_idx));
 #if SAMPLE_POLYGON_LTC_CP
-			result = evaluate_polygonal_light_shading_peters(shading_data, ltc, chosen_light, noise_accessor) * POLYGONAL_LIGHT_COUNT;
+			result = evaluate_polygonal_light_shading_peters(shading_data, ltc, chosen_light, noise_accessor) / light_density;
 #else
-			result = evaluate_polygonal_light_shading(shading_data, ltc, chosen_light, light_sample, false, visibility, noise_accessor) * POLYGONAL_LIGHT_COUNT;
+			result = evaluate_polygonal_light_shading(shading_data, ltc, chosen_light, light_sample, false, visibility, noise_accessor) / light_density;
 #endif
 			result /= LIGHT_SAMPLES;
 			final_color += result * int(visibility);
 		}
 #else
+#if SAMPLE_LIGHT_RIS_CACHE
+		uvec2 light_cache_key = get_light_cache_key(shading_data.position, shading_data.normal);
+		g_light_cache_cell = load_light_cache_cell(light_cache_key);
+#endif
+#if WAVEFRONT_STAGE
+		bool needs_shadow_rays = false;
+#endif
 		for (int j = 0; j < LIGHT_SAMPLES; j++) {
 			reservoir_t res;
 			initialize_reservoir(res);
-			int m = 32;
-			bool dummy_vis = false;
+			int m = get_candidate_count(pixel);
 			for (int i = 0; i < m; i += 1) {
-				dummy_vis = false;
-				int light_idx = int(get_noise_1(noise_accessor) * POLYGONAL_LIGHT_COUNT);
-				vec3 color = evaluate_polygonal_light_shading(shading_data, ltc, g_polygonal_lights[light_idx], light_sample, false, dummy_vis, noise_accessor);
-				float p_hat = length(color);
-				float p = 1.f / float(POLYGONAL_LIGHT_COUNT);
+				float p;
+				int light_idx = pick_polygonal_light(p, shading_data, noise_accessor);
+				if (light_idx < 0) {
+					++res.sample_count;
+					continue;
+				}
+				float p_hat = get_ris_target_function(shading_data, ltc, light_idx, light_sample, false, noise_accessor);
 				float w = p_hat / p;
 				insert_in_reservoir(res, w, light_idx, light_sample, p_hat, get_noise_1(noise_accessor));
 			}
-			
-			if (res.light_index >= 0) {
-				polygonal_light_t polygonal_light = g_polygonal_lights[res.light_index];
-				bool visibility = true;
-#if SAMPLE_POLYGON_LTC_CP
-				vec3 color = evaluate_polygonal_light_shading_peters(shading_data, ltc, polygonal_light, noise_accessor);
-#else
-				vec3 color = evaluate_polygonal_light_shading(shading_data, ltc, polygonal_light, res.light_sample, true, visibility, noise_accessor);
+#if STORE_RESERVOIRS
+			// Only the first reservoir is reused
+			if (j == 0) {
+#if TEMPORAL_REUSE
+				reuse_temporal_reservoir(res, shading_data, ltc, uint(20 * RIS_CANDIDATE_COUNT), noise_accessor);
 #endif
-				float p_hat = res.sample_value;
-				float W = res.w_sum / (m * p_hat);	// (1 / p_optimal)
-
-#if SAMPLE_POLYGON_LTC_CP || SAMPLE_POLYGON_PROJECTED_SOLID_ANGLE
-				// Visibility is embedded in the call so make sure that we don't divide by 0
-				if (p_hat == 0.0)
-					W = 0.0;
+				float depth = distance(g_camera_position_world_space, shading_data.position);
+				g_reservoirs[uint(pixel.y) * g_viewport_size.x + uint(pixel.x)] = store_reservoir(res, shading_data.normal, depth);
+#if SPATIAL_REUSE
+				// The spatial reuse pass shades with this reservoir
+#if SAMPLE_LIGHT_RIS_CACHE
+				update_light_cache(light_cache_key, res.light_index, res.sample_value);
 #endif
-
-#if !SAMPLE_POLYGON_PROJECTED_SOLID_ANGLE && !SAMPLE_POLYGON_LTC_CP
-				W = W * int(visibility);
+#if WAVEFRONT_STAGE
+				g_wavefront_samples[get_wavefront_sample_index(pixel, 0)].light_index = -1;
+#endif
+				continue;
 #endif
-				vec3 result = (color * W) / LIGHT_SAMPLES;
-				final_color += result;
 			}
+#endif
+#if WAVEFRONT_STAGE
+			// The shadow ray stage shades with this reservoir
+			uint sample_index = get_wavefront_sample_index(pixel, uint(j));
+			g_wavefront_samples[sample_index].light_sample = res.light_sample;
+			g_wavefront_samples[sample_index].light_index = res.light_index;
+			g_wavefront_samples[sample_index].w_sum = res.w_sum;
+			g_wavefront_samples[sample_index].sample_value = res.sample_value;
+			g_wavefront_samples[sample_index].sample_count = res.sample_count;
+			needs_shadow_rays = needs_shadow_rays || (res.light_index >= 0);
+#else
+			vec3 color = shade_reservoir(res, shading_data, ltc, noise_accessor);
+#if SAMPLE_LIGHT_RIS_CACHE
+			// Lights that turned out to be unoccluded are remembered
+			if (any(greaterThan(color, vec3(0.0f))))
+				update_light_cache(light_cache_key, res.light_index, res.sample_value);
+#endif
+			final_color += color / LIGHT_SAMPLES;
+#endif
 		}
+#if WAVEFRONT_STAGE
+		if (needs_shadow_rays)
+			enqueue_shadow_rays(pixel);
+#endif
 #endif
 	}
 	// If there are NaNs or INFs, we want to know. Make them pink.
@@ -766,5 +1372,6 @@ void main() {
 		|| isinf(final_color.r) || isinf(final_color.g) || isinf(final_color.b))
 		final_color = vec3(1.0f, 0.0f, 0.8f) / g_exposure_factor;
 	// Output the result of shading
-	g_out_color = vec4(final_color * g_exposure_factor, 1.0f);
+	write_shading_buffer(pixel, vec4(final_color * g_exposure_factor, 1.0f));
 }
+#endif
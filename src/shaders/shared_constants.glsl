@@ -17,6 +17,7 @@
 
 #include "polygonal_light_utility.glsl"
 #include "ltc_utility.glsl"
+#include "mesh_quantization.glsl"
 
 layout (std140, row_major, binding = 0) uniform per_frame_constants {
 	//! Bounding-box dependent constants needed for dequantization of positions
@@ -53,14 +54,190 @@ layout (std140, row_major, binding = 0) uniform per_frame_constants {
 	//! Number of textures in g_noise_table, which must be a power of two,
 	//! minus one
 	uint g_noise_texture_index_mask;
+	//! The time in seconds at which animated lights are evaluated
+	float g_light_animation_time;
 	//! Constants to randomize access to noise textures
 	uvec4 g_noise_random_numbers;
 	//! Constants for accessing linearly transformed cosine tables
 	ltc_constants_t g_ltc_constants;
+	//! g_world_to_projection_space for the previous frame
+	mat4 g_previous_world_to_projection_space;
+	//! g_camera_position_world_space for the previous frame
+	vec3 g_previous_camera_position_world_space;
+	//! Distances of the near and far clipping plane to the camera
+	float g_camera_near, g_camera_far;
 };
 
+#ifndef POLYGONAL_LIGHT_BINDING
+//! The binding used for the polygonal light buffer (differs between passes)
+#define POLYGONAL_LIGHT_BINDING 8
+#endif
+
 #ifdef POLYGONAL_LIGHT_ARRAY_SIZE
-layout (std140, row_major, binding = 8) buffer light_buffers {
-	polygonal_light_t g_polygonal_lights[POLYGONAL_LIGHT_ARRAY_SIZE];
+/*! Polygonal lights are stored as structure of arrays, such that each shader
+	stage only fetches the attributes that it needs. The layout matches
+	polygonal_light_buffer_layout_t in the C code.*/
+layout (std430, binding = POLYGONAL_LIGHT_BINDING) buffer light_buffers {
+#if QUANTIZED_LIGHT_VERTICES
+	//! The normal of each light in octahedral encoding with two 16-bit UNORM
+	//! values. The plane passes through the vertex average.
+	uint g_polygonal_light_packed_normals[POLYGONAL_LIGHT_ARRAY_SIZE];
+#else
+	//! polygonal_light_t::plane for each light
+	vec4 g_polygonal_light_planes[POLYGONAL_LIGHT_ARRAY_SIZE];
+#endif
+	//! xyz: polygonal_light_t::surface_radiance, w: polygonal_light_t::area
+	vec4 g_polygonal_light_radiance_area[POLYGONAL_LIGHT_ARRAY_SIZE];
+	//! xyz: The average of all vertices of a light, w: The radius of a sphere
+	//! around it that bounds the polygon
+	vec4 g_polygonal_light_bounding_spheres[POLYGONAL_LIGHT_ARRAY_SIZE];
+	//! x: The index of the first vertex of each light in
+	//! the vertex pool, y: polygonal_light_t::vertex_count
+	uvec2 g_polygonal_light_vertex_ranges[POLYGONAL_LIGHT_ARRAY_SIZE];
+#if QUANTIZED_LIGHT_VERTICES
+	//! A pool of vertices, each of which is stored as three 16-bit SNORM
+	//! values relative to the bounding sphere of its light (x, y in the first
+	//! component, z in the lower half of the second one). Under std430, it is
+	//! only aligned to 8 bytes.
+	uvec2 g_polygonal_light_quantized_vertices[];
+#else
+	//! A pool of world space vertices (xyz). The vertices of each light are
+	//! stored consecutively without any padding.
+	vec4 g_polygonal_light_vertices[];
+#endif
 };
+
+
+//! Reads polygonal_light_t::plane for the light with the given index from the
+//! light buffer
+vec4 load_polygonal_light_plane(uint light_index) {
+#if QUANTIZED_LIGHT_VERTICES
+	vec3 normal = decode_normal_32_bit(unpackUnorm2x16(g_polygonal_light_packed_normals[light_index]));
+	return vec4(normal, -dot(normal, g_polygonal_light_bounding_spheres[light_index].xyz));
+#else
+	return g_polygonal_light_planes[light_index];
+#endif
+}
+
+
+#if SHARED_POLYGONAL_LIGHTS
+/*! With compute shading, each work group copies all lights to shared memory
+	once, such that the many light fetches of RIS candidates do not go
+	through the cache hierarchy over and over again. The host only enables it
+	when these arrays fit into the guaranteed 16 KiB of shared memory.
+	Vertices are stored decoded and padded as in polygonal_light_t.*/
+shared vec4 g_shared_polygonal_light_planes[POLYGONAL_LIGHT_ARRAY_SIZE];
+shared vec4 g_shared_polygonal_light_radiance_area[POLYGONAL_LIGHT_ARRAY_SIZE];
+shared vec4 g_shared_polygonal_light_bounding_spheres[POLYGONAL_LIGHT_ARRAY_SIZE];
+shared uint g_shared_polygonal_light_vertex_counts[POLYGONAL_LIGHT_ARRAY_SIZE];
+shared vec3 g_shared_polygonal_light_vertices[POLYGONAL_LIGHT_ARRAY_SIZE * MAX_POLYGONAL_LIGHT_VERTEX_COUNT];
+#endif
+
+
+//! Returns polygonal_light_t::plane for the light with the given index
+vec4 get_polygonal_light_plane(uint light_index) {
+#if SHARED_POLYGONAL_LIGHTS
+	return g_shared_polygonal_light_planes[light_index];
+#else
+	return load_polygonal_light_plane(light_index);
+#endif
+}
+
+
+//! Returns surface radiance (xyz) and area (w) of the light with the given
+//! index
+vec4 get_polygonal_light_radiance_area(uint light_index) {
+#if SHARED_POLYGONAL_LIGHTS
+	return g_shared_polygonal_light_radiance_area[light_index];
+#else
+	return g_polygonal_light_radiance_area[light_index];
+#endif
+}
+
+
+//! Returns the bounding sphere (see g_polygonal_light_bounding_spheres) of the
+//! light with the given index
+vec4 get_polygonal_light_bounding_sphere(uint light_index) {
+#if SHARED_POLYGONAL_LIGHTS
+	return g_shared_polygonal_light_bounding_spheres[light_index];
+#else
+	return g_polygonal_light_bounding_spheres[light_index];
+#endif
+}
+
+
+/*! Returns a vertex from the vertex pool in world space.
+	\param bounding_sphere The bounding sphere of the light that the vertex
+		belongs to. Only used for quantized vertices.*/
+vec3 get_polygonal_light_vertex(uint vertex_index, vec4 bounding_sphere) {
+#if QUANTIZED_LIGHT_VERTICES
+	uvec2 quantized = g_polygonal_light_quantized_vertices[vertex_index];
+	vec3 offset = vec3(unpackSnorm2x16(quantized.x), unpackSnorm2x16(quantized.y).x);
+	return fma(offset, vec3(bounding_sphere.w), bounding_sphere.xyz);
+#else
+	return g_polygonal_light_vertices[vertex_index].xyz;
+#endif
+}
+
+#if SHARED_POLYGONAL_LIGHTS
+/*! Copies all polygonal lights into shared memory cooperatively. All threads
+	of the work group have to invoke it in uniform control flow before they
+	access any light.*/
+void stage_shared_polygonal_lights() {
+	uint thread_count = gl_WorkGroupSize.x * gl_WorkGroupSize.y * gl_WorkGroupSize.z;
+	for (uint light_index = gl_LocalInvocationIndex; light_index < POLYGONAL_LIGHT_COUNT; light_index += thread_count) {
+		vec4 bounding_sphere = g_polygonal_light_bounding_spheres[light_index];
+		uvec2 vertex_range = g_polygonal_light_vertex_ranges[light_index];
+		g_shared_polygonal_light_planes[light_index] = load_polygonal_light_plane(light_index);
+		g_shared_polygonal_light_radiance_area[light_index] = g_polygonal_light_radiance_area[light_index];
+		g_shared_polygonal_light_bounding_spheres[light_index] = bounding_sphere;
+		g_shared_polygonal_light_vertex_counts[light_index] = vertex_range.y;
+		vec3 first_vertex = get_polygonal_light_vertex(vertex_range.x, bounding_sphere);
+		for (uint i = 0; i != MAX_POLYGONAL_LIGHT_VERTEX_COUNT; ++i)
+			g_shared_polygonal_light_vertices[light_index * MAX_POLYGONAL_LIGHT_VERTEX_COUNT + i] =
+				(i == 0 || i >= vertex_range.y) ? first_vertex : get_polygonal_light_vertex(vertex_range.x + i, bounding_sphere);
+	}
+	barrier();
+}
+#endif
+
+#ifdef MAX_POLYGONAL_LIGHT_VERTEX_COUNT
+//! Gathers all attributes of the polygonal light with the given index
+polygonal_light_t get_polygonal_light(uint light_index) {
+	polygonal_light_t light;
+#if SHARED_POLYGONAL_LIGHTS
+	vec4 radiance_area = g_shared_polygonal_light_radiance_area[light_index];
+	light.surface_radiance = radiance_area.xyz;
+	light.area = radiance_area.w;
+	light.plane = g_shared_polygonal_light_planes[light_index];
+	light.vertex_count = g_shared_polygonal_light_vertex_counts[light_index];
+	[[unroll]]
+	for (uint i = 0; i != MAX_POLYGONAL_LIGHT_VERTEX_COUNT; ++i)
+		light.vertices_world_space[i] = g_shared_polygonal_light_vertices[light_index * MAX_POLYGONAL_LIGHT_VERTEX_COUNT + i];
+#else
+	vec4 radiance_area = g_polygonal_light_radiance_area[light_index];
+	light.surface_radiance = radiance_area.xyz;
+	light.area = radiance_area.w;
+	light.plane = get_polygonal_light_plane(light_index);
+	uvec2 vertex_range = g_polygonal_light_vertex_ranges[light_index];
+	light.vertex_count = vertex_range.y;
+#if QUANTIZED_LIGHT_VERTICES
+	vec4 bounding_sphere = g_polygonal_light_bounding_spheres[light_index];
+#else
+	vec4 bounding_sphere = vec4(0.0f);
+#endif
+	// Only vertices that exist are fetched. Remaining entries repeat the
+	// first vertex.
+	vec3 first_vertex = get_polygonal_light_vertex(vertex_range.x, bounding_sphere);
+	[[unroll]]
+	for (uint i = 0; i != MAX_POLYGONAL_LIGHT_VERTEX_COUNT; ++i) {
+		if (i == 0 || i >= vertex_range.y)
+			light.vertices_world_space[i] = first_vertex;
+		else
+			light.vertices_world_space[i] = get_polygonal_light_vertex(vertex_range.x + i, bounding_sphere);
+	}
+#endif
+	return light;
+}
+#endif
 #endif
\ No newline at end of file
@@ -15,10 +15,19 @@
 
 
 #include "textures.h"
+#include "mapped_file.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+//! Texture data is read in batches of roughly this many bytes. Copies for
+//! one batch are submitted while the next one is being read.
+#define TEXTURE_LOADING_BATCH_SIZE (64 * 1024 * 1024)
+
+//! The size in bytes of the smallest possible entry in the index of a texture
+//! pack, i.e. one with an empty name and no mipmaps
+#define TEXTURE_PACK_MIN_ENTRY_SIZE (5 * sizeof(uint32_t) + 2 * sizeof(uint64_t))
+
 //! Stores meta-data about a single mipmap of a texture. Matches binary data in
 //! the file format.
 typedef struct texture_2d_mipmap_header_s {
@@ -49,9 +58,24 @@ typedef struct texture_2d_header_s {
 	//! While the texture is being loaded, this this is a file handle for the
 	//! texture being loaded. Otherwise it is NULL.
 	FILE* file;
+	//! If the texture comes from a texture pack, this points to its data in
+	//! the mapped pack. Otherwise it is NULL.
+	const uint8_t* payload;
+	//! The offset in bytes of the texture data in its *.vkt file
+	long data_offset;
+	//! The number of finest mipmaps that are left out when the texture is
+	//! loaded and get streamed later (see texture_streaming_t)
+	uint32_t streamed_mipmap_count;
 } texture_2d_header_t;
 
 
+//! Returns the offset in bytes of the first mipmap that is loaded right away
+//! from the beginning of the texture data
+static inline VkDeviceSize get_loaded_data_offset(const texture_2d_header_t* header) {
+	return header->streamed_mipmap_count ? header->mipmaps[header->streamed_mipmap_count].offset : 0;
+}
+
+
 //! Struct holding intermediate data for texture loading
 typedef struct texture_2d_loading_s {
 	//! GPU objects for textures
@@ -92,89 +116,116 @@ void destroy_texture_loading(texture_2d_loading_t* loading, const device_t* devi
 }
 
 
-int load_2d_textures(images_t* textures, const device_t* device, uint32_t texture_count, const char* const* file_paths, VkBufferUsageFlags usage) {
-	memset(textures, 0, sizeof(*textures));
-	texture_2d_loading_t loading = { .texture_count = texture_count };
-	// Open all the texture files and read their headers
-	loading.headers = malloc(sizeof(texture_2d_header_t) * texture_count);
-	memset(loading.headers, 0, sizeof(texture_2d_header_t) * texture_count);
-	for (uint32_t i = 0; i != texture_count; ++i) {
-		texture_2d_header_t* header = &loading.headers[i];
-		// Open the file
-		FILE* file = loading.headers[i].file = fopen(file_paths[i], "rb");
-		if (!file) {
-			printf("Failed to open the texture file at path %s.\n", file_paths[i]);
-			destroy_texture_loading(&loading, device);
-			return 1;
-		}
-		// Check the file format marker
-		uint32_t marker, version;
-		fread(&marker, sizeof(marker), 1, file);
-		fread(&version, sizeof(version), 1, file);
-		if (marker != 0xbc1bc1 || version != 1) {
-			printf("The texture at path %s does not seem to have the correct format. It is supposed to be converted to a custom format for the renderer using the texture conversion utility. Aborting.\n", file_paths[i]);
-			destroy_texture_loading(&loading, device);
-			return 1;
-		}
-		// Load meta-data about the texture
-		fread(&header->mipmap_count, sizeof(uint32_t), 1, file);
-		loading.total_mipmap_count += header->mipmap_count;
-		fread(&header->resolution, sizeof(uint32_t), 2, file);
-		fread(&header->format, sizeof(uint32_t), 1, file);
-		fread(&header->size, sizeof(uint64_t), 1, file);
-		// Load meta-data about mipmaps
-		header->mipmaps = malloc(sizeof(texture_2d_mipmap_header_t) * header->mipmap_count);
-		memset(header->mipmaps, 0, sizeof(texture_2d_mipmap_header_t) * header->mipmap_count);
-		for (uint32_t k = 0; k != header->mipmap_count; ++k) {
-			fread(&header->mipmaps[k].resolution, sizeof(uint32_t), 2, file);
-			fread(&header->mipmaps[k].size, sizeof(uint64_t), 1, file);
-			fread(&header->mipmaps[k].offset, sizeof(uint64_t), 1, file);
-		}
+/*! Opens the texture file at the given path and reads its header. The file
+	remains open and is positioned at the beginning of the texture data.
+	\return 0 on success.*/
+static int read_texture_header(texture_2d_header_t* header, const char* file_path) {
+	// Open the file
+	FILE* file = header->file = fopen(file_path, "rb");
+	if (!file) {
+		printf("Failed to open the texture file at path %s.\n", file_path);
+		return 1;
+	}
+	// Check the file format marker
+	uint32_t marker = 0, version = 0;
+	fread(&marker, sizeof(marker), 1, file);
+	fread(&version, sizeof(version), 1, file);
+	if (marker != 0xbc1bc1 || version != 1) {
+		printf("The texture at path %s does not seem to have the correct format. It is supposed to be converted to a custom format for the renderer using the texture conversion utility. Aborting.\n", file_path);
+		return 1;
 	}
+	// Load meta-data about the texture
+	fread(&header->mipmap_count, sizeof(uint32_t), 1, file);
+	fread(&header->resolution, sizeof(uint32_t), 2, file);
+	fread(&header->format, sizeof(uint32_t), 1, file);
+	fread(&header->size, sizeof(uint64_t), 1, file);
+	// Load meta-data about mipmaps
+	header->mipmaps = malloc(sizeof(texture_2d_mipmap_header_t) * header->mipmap_count);
+	memset(header->mipmaps, 0, sizeof(texture_2d_mipmap_header_t) * header->mipmap_count);
+	for (uint32_t k = 0; k != header->mipmap_count; ++k) {
+		fread(&header->mipmaps[k].resolution, sizeof(uint32_t), 2, file);
+		fread(&header->mipmaps[k].size, sizeof(uint64_t), 1, file);
+		fread(&header->mipmaps[k].offset, sizeof(uint64_t), 1, file);
+	}
+	header->data_offset = ftell(file);
+	return 0;
+}
+
+
+/*! Reads the texture data from the file opened by read_texture_header() to
+	the given pointer into staging memory and closes the file. For textures
+	from a mapped texture pack, it copies header->payload instead. Mipmaps that
+	are streamed later are skipped.
+	\return 0 on success.*/
+static int read_texture_data(texture_2d_header_t* header, char* texture_data, const char* file_path) {
+	VkDeviceSize skipped_size = get_loaded_data_offset(header);
+	VkDeviceSize loaded_size = header->size - skipped_size;
+	if (header->payload) {
+		memcpy(texture_data, header->payload + skipped_size, loaded_size);
+		return 0;
+	}
+	size_t read_size = 0;
+	if (!fseek(header->file, (long) skipped_size, SEEK_CUR))
+		read_size = fread(texture_data, 1, loaded_size, header->file);
+	// We should have arrived at the end of the file
+	uint32_t texture_eof_marker = 0;
+	fread(&texture_eof_marker, 1, sizeof(texture_eof_marker), header->file);
+	fclose(header->file);
+	header->file = NULL;
+	if (read_size != loaded_size || texture_eof_marker != 0xE0FE0F) {
+		printf("The texture file at path %s seems to be invalid. The texture data is not followed by the expected end of file marker.\n", file_path);
+		return 1;
+	}
+	return 0;
+}
+
+
+/*! Creates staging buffers and images for the given textures, reads their
+	data and copies it to the images. Headers in loading must be complete.
+	\param textures Receives the textures on success.
+	\param loading Headers of the textures to load. This object is cleaned up
+		using destroy_texture_loading() in any case.
+	\param texture_names Paths or names of the textures for error messages.
+	\param streaming NULL or an object that takes over the headers on
+		success, so that it can stream the mipmaps that have been left out.
+	\return 0 on success.*/
+static int upload_2d_textures(images_t* textures, texture_2d_loading_t* loading, texture_streaming_t* streaming, const device_t* device, const char* const* texture_names, VkBufferUsageFlags usage) {
+	uint32_t texture_count = loading->texture_count;
+	loading->total_mipmap_count = 0;
+	for (uint32_t i = 0; i != texture_count; ++i)
+		loading->total_mipmap_count += loading->headers[i].mipmap_count - loading->headers[i].streamed_mipmap_count;
+	int* results = malloc(sizeof(int) * (texture_count + 1));
+	memset(results, 0, sizeof(int) * (texture_count + 1));
 
 	// Allocate staging buffers for textures
-	loading.buffer_requests = malloc(sizeof(VkBufferCreateInfo) * texture_count);
+	loading->buffer_requests = malloc(sizeof(VkBufferCreateInfo) * texture_count);
 	for (uint32_t i = 0; i != texture_count; ++i) {
 		VkBufferCreateInfo request = {
 			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-			.size = loading.headers[i].size,
+			.size = loading->headers[i].size - get_loaded_data_offset(&loading->headers[i]),
 			.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
 		};
-		loading.buffer_requests[i] = request;
+		loading->buffer_requests[i] = request;
 	}
-	if (create_buffers(&loading.staging, device, loading.buffer_requests, texture_count, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+	if (create_buffers(&loading->staging, device, loading->buffer_requests, texture_count, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
 		printf("Failed to create %d staging buffers for textures.\n", texture_count);
-		destroy_texture_loading(&loading, device);
+		free(results);
+		destroy_texture_loading(loading, device);
 		return 1;
 	};
-	// Read the data of each texture into the staging buffers
-	for (uint32_t i = 0; i != texture_count; ++i) {
-		texture_2d_header_t* header = &loading.headers[i];
-		VkDeviceMemory memory = loading.staging.memory;
-		char* texture_data;
-		if (vkMapMemory(device->device, memory, loading.staging.buffers[i].offset, header->size, 0, (void**) &texture_data)) {
-			printf("Failed to map memory of the staging buffer for the texture at path %s.\n", file_paths[i]);
-			destroy_texture_loading(&loading, device);
-			return 1;
-		}
-		fread(texture_data, 1, header->size, header->file);
-		vkUnmapMemory(device->device, memory);
-		// We should have arrived at the end of the file
-		uint32_t texture_eof_marker = 0;
-		fread(&texture_eof_marker, 1, sizeof(texture_eof_marker), header->file);
-		if (texture_eof_marker != 0xE0FE0F) {
-			printf("The texture file at path %s seems to be invalid. The texture data is not followed by the expected end of file marker.\n", file_paths[i]);
-			destroy_texture_loading(&loading, device);
-			return 1;
-		}
-		fclose(header->file);
-		header->file = NULL;
+	// The whole staging allocation stays mapped while textures are read
+	char* staging_data;
+	if (vkMapMemory(device->device, loading->staging.memory, 0, VK_WHOLE_SIZE, 0, (void**) &staging_data)) {
+		printf("Failed to map memory of the staging buffers for %d textures.\n", texture_count);
+		free(results);
+		destroy_texture_loading(loading, device);
+		return 1;
 	}
 
-	// Create the GPU-resident texture objects
-	loading.image_requests = malloc(sizeof(image_request_t) * texture_count);
+	// Create the GPU-resident texture objects. They only depend on headers.
+	loading->image_requests = malloc(sizeof(image_request_t) * texture_count);
 	for (uint32_t i = 0; i != texture_count; ++i) {
-		texture_2d_header_t* header = &loading.headers[i];
+		texture_2d_header_t* header = &loading->headers[i];
 		image_request_t request = {
 			.image_info = {
 				.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -193,49 +244,557 @@ int load_2d_textures(images_t* textures, const device_t* device, uint32_t textur
 				.subresourceRange = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT }
 			}
 		};
-		loading.image_requests[i] = request;
+		loading->image_requests[i] = request;
 	}
-	if (create_images(&loading.textures, device, loading.image_requests, texture_count, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) {
+	if (create_images(&loading->textures, device, loading->image_requests, texture_count, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) {
 		printf("Failed to create texture objects on GPU for %d textures.\n", texture_count);
-		destroy_texture_loading(&loading, device);
+		free(results);
+		destroy_texture_loading(loading, device);
 		return 1;
 	}
 
-	// Copy textures from the staging buffers to the GPU-resident images
-	loading.buffer_to_image_regions = malloc(sizeof(VkBufferImageCopy) * loading.total_mipmap_count);
-	loading.source_texture_buffers = malloc(sizeof(VkBuffer) * loading.total_mipmap_count);
-	loading.destination_images = malloc(sizeof(VkImage) * loading.total_mipmap_count);
+	// Prepare copies from the staging buffers to the GPU-resident images
+	loading->buffer_to_image_regions = malloc(sizeof(VkBufferImageCopy) * loading->total_mipmap_count);
+	loading->source_texture_buffers = malloc(sizeof(VkBuffer) * loading->total_mipmap_count);
+	loading->destination_images = malloc(sizeof(VkImage) * loading->total_mipmap_count);
 	uint32_t region_index = 0;
 	for (uint32_t i = 0; i != texture_count; ++i) {
-		texture_2d_header_t* header = &loading.headers[i];
-		for (uint32_t j = 0; j != header->mipmap_count; ++j) {
+		texture_2d_header_t* header = &loading->headers[i];
+		for (uint32_t j = header->streamed_mipmap_count; j != header->mipmap_count; ++j) {
 			VkBufferImageCopy region = {
 				.imageExtent = { header->mipmaps[j].resolution.width, header->mipmaps[j].resolution.height, 1 },
-				.bufferOffset = header->mipmaps[j].offset,
+				.bufferOffset = header->mipmaps[j].offset - get_loaded_data_offset(header),
 				.imageSubresource = {
 					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 					.mipLevel = j,
 					.layerCount = 1
 				}
 			};
-			loading.buffer_to_image_regions[region_index] = region;
-			loading.source_texture_buffers[region_index] = loading.staging.buffers[i].buffer;
-			loading.destination_images[region_index] = loading.textures.images[i].image;
+			loading->buffer_to_image_regions[region_index] = region;
+			loading->source_texture_buffers[region_index] = loading->staging.buffers[i].buffer;
+			loading->destination_images[region_index] = loading->textures.images[i].image;
 			++region_index;
 		}
 	}
-	if (copy_buffers_to_images(device,
-		loading.total_mipmap_count, loading.source_texture_buffers, loading.destination_images,
-		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, loading.buffer_to_image_regions))
-	{
-		printf("Failed to copy %d textures from staging buffers to GPU images.\n", texture_count);
-		destroy_texture_loading(&loading, device);
+
+	// Read texture data in batches on all threads. While the other threads
+	// read one batch, the master thread submits copies for the previous batch.
+	uint32_t batch_begin = 0, previous_batch_begin = 0;
+	uint32_t region_begin = 0, previous_region_begin = 0;
+	int copy_result = 0;
+	while (previous_batch_begin != texture_count && !copy_result) {
+		uint32_t batch_end = batch_begin;
+		uint32_t region_end = region_begin;
+		VkDeviceSize batch_size = 0;
+		while (batch_end != texture_count && (batch_end == batch_begin || batch_size + loading->buffer_requests[batch_end].size <= TEXTURE_LOADING_BATCH_SIZE)) {
+			batch_size += loading->buffer_requests[batch_end].size;
+			region_end += loading->headers[batch_end].mipmap_count - loading->headers[batch_end].streamed_mipmap_count;
+			++batch_end;
+		}
+		#pragma omp parallel
+		{
+			#pragma omp master
+			{
+				if (previous_batch_begin != batch_begin)
+					copy_result = copy_buffers_to_images(device,
+						region_begin - previous_region_begin, loading->source_texture_buffers + previous_region_begin, loading->destination_images + previous_region_begin,
+						VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, loading->buffer_to_image_regions + previous_region_begin);
+			}
+			#pragma omp for schedule(dynamic)
+			for (int i = (int) batch_begin; i < (int) batch_end; ++i)
+				results[i] = read_texture_data(&loading->headers[i], staging_data + loading->staging.buffers[i].offset, texture_names[i]);
+		}
+		for (uint32_t i = batch_begin; i != batch_end; ++i)
+			copy_result |= results[i];
+		previous_batch_begin = batch_begin;
+		previous_region_begin = region_begin;
+		batch_begin = batch_end;
+		region_begin = region_end;
+	}
+	free(results);
+	vkUnmapMemory(device->device, loading->staging.memory);
+	if (copy_result) {
+		printf("Failed to read %d textures and copy them from staging buffers to GPU images.\n", texture_count);
+		destroy_texture_loading(loading, device);
 		return 1;
 	}
 
 	// Hand over the result and clean up
-	(*textures) = loading.textures;
-	memset(&loading.textures, 0, sizeof(loading.textures));
-	destroy_texture_loading(&loading, device);
+	(*textures) = loading->textures;
+	memset(&loading->textures, 0, sizeof(loading->textures));
+	if (streaming) {
+		streaming->texture_count = texture_count;
+		streaming->headers = loading->headers;
+		loading->headers = NULL;
+	}
+	destroy_texture_loading(loading, device);
+	return 0;
+}
+
+
+/*! Reads the header of the texture with the given index from the index of a
+	mapped texture pack and advances the offset. The name of the texture is
+	returned through name and name_length.
+	\return 0 on success.*/
+static int read_texture_pack_entry(texture_2d_header_t* header, const char** name, uint32_t* name_length, const mapped_file_t* pack, size_t* offset) {
+	uint32_t format = 0;
+	uint64_t payload_offset = 0;
+	if (read_mapped_file(name_length, pack, offset, sizeof(uint32_t))
+		|| (*offset) + (*name_length) > pack->size)
+		return 1;
+	(*name) = (const char*) (pack->data + (*offset));
+	(*offset) += (*name_length);
+	if (read_mapped_file(&header->mipmap_count, pack, offset, sizeof(uint32_t))
+		|| read_mapped_file(&header->resolution, pack, offset, 2 * sizeof(uint32_t))
+		|| read_mapped_file(&format, pack, offset, sizeof(uint32_t))
+		|| read_mapped_file(&header->size, pack, offset, sizeof(uint64_t))
+		|| read_mapped_file(&payload_offset, pack, offset, sizeof(uint64_t))
+		|| header->mipmap_count > 32)
+		return 1;
+	header->format = (VkFormat) format;
+	if (payload_offset > pack->size || pack->size - payload_offset < header->size)
+		return 1;
+	header->payload = pack->data + payload_offset;
+	header->mipmaps = malloc(sizeof(texture_2d_mipmap_header_t) * header->mipmap_count);
+	memset(header->mipmaps, 0, sizeof(texture_2d_mipmap_header_t) * header->mipmap_count);
+	for (uint32_t i = 0; i != header->mipmap_count; ++i) {
+		texture_2d_mipmap_header_t* mipmap = &header->mipmaps[i];
+		if (read_mapped_file(&mipmap->resolution, pack, offset, 2 * sizeof(uint32_t))
+			|| read_mapped_file(&mipmap->size, pack, offset, sizeof(uint64_t))
+			|| read_mapped_file(&mipmap->offset, pack, offset, sizeof(uint64_t))
+			|| mipmap->offset > header->size || header->size - mipmap->offset < mipmap->size)
+			return 1;
+	}
+	return 0;
+}
+
+
+/*! Allocates loading->headers for loading->texture_count textures and fills
+	them from the index of the given mapped texture pack. The texture data
+	remains in the mapped pack.
+	\return 0 on success.*/
+static int read_texture_pack_headers(texture_2d_loading_t* loading, const mapped_file_t* pack, const char* pack_path, const char* const* texture_names) {
+	uint32_t texture_count = loading->texture_count;
+	loading->headers = malloc(sizeof(texture_2d_header_t) * texture_count);
+	memset(loading->headers, 0, sizeof(texture_2d_header_t) * texture_count);
+	// Check the file format marker
+	size_t offset = 0;
+	uint32_t marker = 0, version = 0, pack_texture_count = 0, page_size = 0, eof_marker = 0;
+	read_mapped_file(&marker, pack, &offset, sizeof(marker));
+	read_mapped_file(&version, pack, &offset, sizeof(version));
+	read_mapped_file(&pack_texture_count, pack, &offset, sizeof(pack_texture_count));
+	read_mapped_file(&page_size, pack, &offset, sizeof(page_size));
+	if (pack->size >= sizeof(eof_marker))
+		memcpy(&eof_marker, pack->data + pack->size - sizeof(eof_marker), sizeof(eof_marker));
+	if (marker != 0xbc1bc2 || version != 1 || eof_marker != 0xE0FE0F) {
+		printf("The texture pack at path %s does not seem to have the correct format. It is supposed to be created using the pack mode of the texture conversion utility. Aborting.\n", pack_path);
+		return 1;
+	}
+	// The texture count must not exceed what the file could hold. Otherwise,
+	// the allocations below could overflow or fail.
+	if (offset > pack->size || pack_texture_count > (pack->size - offset) / TEXTURE_PACK_MIN_ENTRY_SIZE) {
+		printf("The index of the texture pack at path %s is corrupted.\n", pack_path);
+		return 1;
+	}
+	// Read the whole index
+	size_t pack_entry_count = (size_t) pack_texture_count + 1;
+	texture_2d_header_t* pack_headers = malloc(sizeof(texture_2d_header_t) * pack_entry_count);
+	memset(pack_headers, 0, sizeof(texture_2d_header_t) * pack_entry_count);
+	const char** pack_names = malloc(sizeof(char*) * pack_entry_count);
+	uint32_t* pack_name_lengths = malloc(sizeof(uint32_t) * pack_entry_count);
+	int result = 0;
+	for (uint32_t i = 0; i != pack_texture_count && !result; ++i)
+		result = read_texture_pack_entry(&pack_headers[i], &pack_names[i], &pack_name_lengths[i], pack, &offset);
+	if (result)
+		printf("The index of the texture pack at path %s is corrupted.\n", pack_path);
+	// Look up the requested textures by name
+	for (uint32_t i = 0; i != texture_count && !result; ++i) {
+		uint32_t name_length = (uint32_t) strlen(texture_names[i]);
+		uint32_t j = 0;
+		for (; j != pack_texture_count; ++j)
+			if (pack_name_lengths[j] == name_length && memcmp(pack_names[j], texture_names[i], name_length) == 0)
+				break;
+		if (j == pack_texture_count) {
+			printf("The texture pack at path %s does not contain a texture named %s.\n", pack_path, texture_names[i]);
+			result = 1;
+			break;
+		}
+		loading->headers[i] = pack_headers[j];
+		loading->headers[i].mipmaps = malloc(sizeof(texture_2d_mipmap_header_t) * pack_headers[j].mipmap_count);
+		memcpy(loading->headers[i].mipmaps, pack_headers[j].mipmaps, sizeof(texture_2d_mipmap_header_t) * pack_headers[j].mipmap_count);
+	}
+	for (uint32_t i = 0; i != pack_texture_count; ++i)
+		free(pack_headers[i].mipmaps);
+	free(pack_headers);
+	free(pack_names);
+	free(pack_name_lengths);
+	return result;
+}
+
+
+/*! Allocates loading->headers for loading->texture_count textures and opens
+	all the texture files to read their headers on all threads. The files
+	remain open.
+	\return 0 on success.*/
+static int read_texture_headers(texture_2d_loading_t* loading, const char* const* file_paths) {
+	uint32_t texture_count = loading->texture_count;
+	loading->headers = malloc(sizeof(texture_2d_header_t) * texture_count);
+	memset(loading->headers, 0, sizeof(texture_2d_header_t) * texture_count);
+	int* results = malloc(sizeof(int) * (texture_count + 1));
+	memset(results, 0, sizeof(int) * (texture_count + 1));
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int) texture_count; ++i)
+		results[i] = read_texture_header(&loading->headers[i], file_paths[i]);
+	int result = 0;
+	for (uint32_t i = 0; i != texture_count; ++i)
+		result |= results[i];
+	free(results);
+	return result;
+}
+
+
+int load_2d_textures(images_t* textures, const device_t* device, uint32_t texture_count, const char* const* file_paths, VkBufferUsageFlags usage) {
+	memset(textures, 0, sizeof(*textures));
+	texture_2d_loading_t loading = { .texture_count = texture_count };
+	if (read_texture_headers(&loading, file_paths)) {
+		destroy_texture_loading(&loading, device);
+		return 1;
+	}
+	return upload_2d_textures(textures, &loading, NULL, device, file_paths, usage);
+}
+
+
+/*! Records commands that copy streaming->lod_values to streaming->lod_clamps
+	once all preceding commands on the queue are done reading it.*/
+static void record_lod_clamp_update(VkCommandBuffer cmd, const texture_streaming_t* streaming) {
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+	};
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	// vkCmdUpdateBuffer() takes at most 64 KiB at once
+	VkDeviceSize size = sizeof(float) * streaming->texture_count;
+	for (VkDeviceSize offset = 0; offset < size; offset += 65536)
+		vkCmdUpdateBuffer(cmd, streaming->lod_clamps.buffers[0].buffer, offset, (size - offset < 65536) ? (size - offset) : 65536, ((const char*) streaming->lod_values) + offset);
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+
+//! Ends recording of the streaming command buffer and submits it
+static int submit_texture_streaming(texture_streaming_t* streaming, const device_t* device) {
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &streaming->command_buffer
+	};
+	if (vkEndCommandBuffer(streaming->command_buffer) || vkQueueSubmit(device->queue, 1, &submit_info, streaming->fence))
+		return 1;
+	streaming->submitted = VK_TRUE;
+	return 0;
+}
+
+
+int load_2d_textures_streamed(images_t* textures, texture_streaming_t* streaming, const device_t* device, uint32_t texture_count, const char* const* texture_names, const char* pack_path, uint32_t max_resolution, VkBufferUsageFlags usage) {
+	memset(textures, 0, sizeof(*textures));
+	memset(streaming, 0, sizeof(*streaming));
+	streaming->texture_count = texture_count;
+	// Read all headers. The texture pack stays mapped for streaming.
+	texture_2d_loading_t loading = { .texture_count = texture_count };
+	if (pack_path && map_file(&streaming->pack, pack_path)) {
+		printf("Failed to open the texture pack at path %s.\n", pack_path);
+		destroy_texture_streaming(streaming, device);
+		return 1;
+	}
+	if (pack_path ? read_texture_pack_headers(&loading, &streaming->pack, pack_path, texture_names) : read_texture_headers(&loading, texture_names)) {
+		destroy_texture_loading(&loading, device);
+		destroy_texture_streaming(streaming, device);
+		return 1;
+	}
+	// Leave out mipmaps above the maximal resolution but always load the
+	// coarsest one
+	VkDeviceSize staging_size = TEXTURE_STREAMING_STAGING_SIZE;
+	for (uint32_t i = 0; i != texture_count; ++i) {
+		texture_2d_header_t* header = &loading.headers[i];
+		while (header->streamed_mipmap_count + 1 < header->mipmap_count
+			&& (header->mipmaps[header->streamed_mipmap_count].resolution.width > max_resolution
+			|| header->mipmaps[header->streamed_mipmap_count].resolution.height > max_resolution))
+		{
+			if (staging_size < header->mipmaps[header->streamed_mipmap_count].size)
+				staging_size = header->mipmaps[header->streamed_mipmap_count].size;
+			++header->streamed_mipmap_count;
+		}
+		streaming->pending_mipmap_count += header->streamed_mipmap_count;
+	}
+	streaming->streamed = (streaming->pending_mipmap_count > 0);
+	// Keep the names around to open files for streaming
+	streaming->texture_names = malloc(sizeof(char*) * texture_count);
+	for (uint32_t i = 0; i != texture_count; ++i) {
+		size_t name_size = strlen(texture_names[i]) + 1;
+		streaming->texture_names[i] = malloc(name_size);
+		memcpy(streaming->texture_names[i], texture_names[i], name_size);
+	}
+	// Load the coarse mipmaps
+	if (upload_2d_textures(textures, &loading, streaming, device, texture_names, usage)) {
+		destroy_texture_streaming(streaming, device);
+		return 1;
+	}
+
+	// Create the buffer with LOD clamps and the objects for uploads
+	streaming->resident_levels = malloc(sizeof(uint32_t) * (texture_count + 1));
+	streaming->lod_values = malloc(sizeof(float) * (texture_count + 1));
+	for (uint32_t i = 0; i != texture_count; ++i) {
+		streaming->resident_levels[i] = streaming->headers[i].streamed_mipmap_count;
+		streaming->lod_values[i] = (float) streaming->resident_levels[i];
+	}
+	VkBufferCreateInfo lod_clamp_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = sizeof(float) * ((texture_count > 0) ? texture_count : 1),
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+	};
+	VkBufferCreateInfo staging_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = staging_size,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+	};
+	VkCommandBufferAllocateInfo command_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandPool = device->command_pool,
+		.commandBufferCount = 1
+	};
+	VkFenceCreateInfo fence_info = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	if (create_buffers(&streaming->lod_clamps, device, &lod_clamp_info, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+		|| (streaming->streamed && create_buffers(&streaming->staging, device, &staging_info, 1, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		|| (streaming->streamed && vkMapMemory(device->device, streaming->staging.memory, 0, VK_WHOLE_SIZE, 0, &streaming->staging_data))
+		|| vkAllocateCommandBuffers(device->device, &command_buffer_info, &streaming->command_buffer)
+		|| vkCreateFence(device->device, &fence_info, NULL, &streaming->fence))
+	{
+		printf("Failed to create objects for streaming of %u textures.\n", texture_count);
+		destroy_texture_streaming(streaming, device);
+		destroy_images(textures, device);
+		return 1;
+	}
+	// Mipmaps that are not resident yet never get sampled but they still have
+	// to be in the layout that the descriptors specify
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+	};
+	if (vkBeginCommandBuffer(streaming->command_buffer, &begin_info)) {
+		printf("Failed to begin recording commands for texture streaming.\n");
+		destroy_texture_streaming(streaming, device);
+		destroy_images(textures, device);
+		return 1;
+	}
+	VkImageMemoryBarrier* barriers = malloc(sizeof(VkImageMemoryBarrier) * (texture_count + 1));
+	uint32_t barrier_count = 0;
+	for (uint32_t i = 0; i != texture_count; ++i) {
+		if (!streaming->resident_levels[i])
+			continue;
+		VkImageMemoryBarrier barrier = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = textures->images[i].image,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = streaming->resident_levels[i],
+				.layerCount = 1
+			}
+		};
+		barriers[barrier_count++] = barrier;
+	}
+	if (barrier_count)
+		vkCmdPipelineBarrier(streaming->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0, 0, NULL, 0, NULL, barrier_count, barriers);
+	free(barriers);
+	record_lod_clamp_update(streaming->command_buffer, streaming);
+	if (submit_texture_streaming(streaming, device)) {
+		printf("Failed to submit initial commands for texture streaming.\n");
+		destroy_texture_streaming(streaming, device);
+		destroy_images(textures, device);
+		return 1;
+	}
 	return 0;
 }
+
+
+/*! Reads the next finer mipmap of the texture with the given index to the
+	given location in the staging buffer.
+	\return 0 on success.*/
+static int read_streamed_mipmap(const texture_streaming_t* streaming, uint32_t texture_index, char* staging_data) {
+	const texture_2d_header_t* header = &streaming->headers[texture_index];
+	uint32_t level = streaming->resident_levels[texture_index] - 1;
+	const texture_2d_mipmap_header_t* mipmap = &header->mipmaps[level];
+	if (header->payload) {
+		memcpy(staging_data, header->payload + mipmap->offset, mipmap->size);
+		return 0;
+	}
+	const char* file_path = streaming->texture_names[texture_index];
+	FILE* file = fopen(file_path, "rb");
+	if (!file) {
+		printf("Failed to open the texture file at path %s.\n", file_path);
+		return 1;
+	}
+	int result = fseek(file, header->data_offset + (long) mipmap->offset, SEEK_SET)
+		|| fread(staging_data, 1, mipmap->size, file) != mipmap->size;
+	fclose(file);
+	if (result)
+		printf("Failed to read mipmap %u of the texture file at path %s.\n", level, file_path);
+	return result;
+}
+
+
+void update_texture_streaming(texture_streaming_t* streaming, VkBool32* lod_clamps_changed, const images_t* textures, const device_t* device) {
+	(*lod_clamps_changed) = VK_FALSE;
+	// Wait for the previous upload without blocking
+	if (streaming->submitted) {
+		if (vkGetFenceStatus(device->device, streaming->fence) != VK_SUCCESS)
+			return;
+		vkResetFences(device->device, 1, &streaming->fence);
+		streaming->submitted = VK_FALSE;
+		(*lod_clamps_changed) = streaming->streamed;
+	}
+	// Once everything is resident, the staging memory is no longer needed
+	if (streaming->pending_mipmap_count == 0) {
+		if (streaming->staging_data)
+			vkUnmapMemory(device->device, streaming->staging.memory);
+		streaming->staging_data = NULL;
+		destroy_buffers(&streaming->staging, device);
+		return;
+	}
+	// Sweep over the textures and pick the next finer mipmap of each one
+	// until the staging buffer is full
+	uint32_t texture_count = streaming->texture_count;
+	uint32_t* batch_textures = malloc(sizeof(uint32_t) * texture_count);
+	VkDeviceSize* batch_offsets = malloc(sizeof(VkDeviceSize) * texture_count);
+	uint32_t batch_count = 0;
+	VkDeviceSize staging_size = streaming->staging.buffers[0].size;
+	VkDeviceSize staging_offset = 0;
+	uint32_t first_texture = streaming->next_texture;
+	for (uint32_t j = 0; j != texture_count; ++j) {
+		uint32_t i = (first_texture + j) % texture_count;
+		if (!streaming->resident_levels[i])
+			continue;
+		const texture_2d_mipmap_header_t* mipmap = &streaming->headers[i].mipmaps[streaming->resident_levels[i] - 1];
+		// Offsets have to be multiples of the texel block size
+		VkDeviceSize offset = align_memory_offset(staging_offset, 16);
+		if (offset + mipmap->size > staging_size)
+			break;
+		batch_textures[batch_count] = i;
+		batch_offsets[batch_count] = offset;
+		++batch_count;
+		staging_offset = offset + mipmap->size;
+		streaming->next_texture = (i + 1) % texture_count;
+	}
+	// Read the mipmaps on all threads
+	int* results = malloc(sizeof(int) * (batch_count + 1));
+	memset(results, 0, sizeof(int) * (batch_count + 1));
+	#pragma omp parallel for schedule(dynamic)
+	for (int j = 0; j < (int) batch_count; ++j)
+		results[j] = read_streamed_mipmap(streaming, batch_textures[j], ((char*) streaming->staging_data) + batch_offsets[j]);
+	int result = 0;
+	for (uint32_t j = 0; j != batch_count; ++j)
+		result |= results[j];
+	free(results);
+	// Record copies with layout transitions for the affected mipmaps
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+	};
+	if (!result && vkBeginCommandBuffer(streaming->command_buffer, &begin_info))
+		result = 1;
+	VkImageMemoryBarrier* barriers = malloc(sizeof(VkImageMemoryBarrier) * (batch_count + 1));
+	for (uint32_t j = 0; j != batch_count && !result; ++j) {
+		uint32_t i = batch_textures[j];
+		VkImageMemoryBarrier barrier = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.srcAccessMask = 0,
+			.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = textures->images[i].image,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = streaming->resident_levels[i] - 1,
+				.levelCount = 1,
+				.layerCount = 1
+			}
+		};
+		barriers[j] = barrier;
+	}
+	if (!result) {
+		VkCommandBuffer cmd = streaming->command_buffer;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, NULL, 0, NULL, batch_count, barriers);
+		for (uint32_t j = 0; j != batch_count; ++j) {
+			uint32_t i = batch_textures[j];
+			const texture_2d_mipmap_header_t* mipmap = &streaming->headers[i].mipmaps[streaming->resident_levels[i] - 1];
+			VkBufferImageCopy region = {
+				.bufferOffset = batch_offsets[j],
+				.imageSubresource = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = streaming->resident_levels[i] - 1,
+					.layerCount = 1
+				},
+				.imageExtent = { mipmap->resolution.width, mipmap->resolution.height, 1 }
+			};
+			vkCmdCopyBufferToImage(cmd, streaming->staging.buffers[0].buffer, textures->images[i].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			barriers[j].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[j].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barriers[j].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[j].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0, 0, NULL, 0, NULL, batch_count, barriers);
+		// The new mipmaps may be sampled once the copies are done
+		for (uint32_t j = 0; j != batch_count; ++j) {
+			uint32_t i = batch_textures[j];
+			--streaming->resident_levels[i];
+			streaming->lod_values[i] = (float) streaming->resident_levels[i];
+		}
+		streaming->pending_mipmap_count -= batch_count;
+		record_lod_clamp_update(cmd, streaming);
+		result = submit_texture_streaming(streaming, device);
+	}
+	free(barriers);
+	free(batch_textures);
+	free(batch_offsets);
+	if (result) {
+		printf("Failed to stream mipmaps for %u textures. Textures will stay blurry.\n", batch_count);
+		streaming->pending_mipmap_count = 0;
+	}
+}
+
+
+void destroy_texture_streaming(texture_streaming_t* streaming, const device_t* device) {
+	if (streaming->submitted)
+		vkWaitForFences(device->device, 1, &streaming->fence, VK_TRUE, UINT64_MAX);
+	if (streaming->fence) vkDestroyFence(device->device, streaming->fence, NULL);
+	if (streaming->command_buffer) vkFreeCommandBuffers(device->device, device->command_pool, 1, &streaming->command_buffer);
+	if (streaming->staging_data) vkUnmapMemory(device->device, streaming->staging.memory);
+	destroy_buffers(&streaming->staging, device);
+	destroy_buffers(&streaming->lod_clamps, device);
+	if (streaming->headers) {
+		for (uint32_t i = 0; i != streaming->texture_count; ++i)
+			free(streaming->headers[i].mipmaps);
+		free(streaming->headers);
+	}
+	if (streaming->texture_names) {
+		for (uint32_t i = 0; i != streaming->texture_count; ++i)
+			free(streaming->texture_names[i]);
+		free(streaming->texture_names);
+	}
+	unmap_file(&streaming->pack);
+	free(streaming->resident_levels);
+	free(streaming->lod_values);
+	memset(streaming, 0, sizeof(*streaming));
+}
@@ -16,6 +16,58 @@
 
 #pragma once
 #include "vulkan_basics.h"
+#include "mapped_file.h"
+
+
+//! The size in bytes of the staging buffer used to stream mipmaps. It is
+//! enlarged as needed to hold the largest streamed mipmap.
+#define TEXTURE_STREAMING_STAGING_SIZE (16 * 1024 * 1024)
+
+
+/*! Uploads the finer mipmaps of textures progressively while rendering is
+	already underway. Textures are loaded with their coarsest mipmaps only and
+	each call to update_texture_streaming() uploads the next finer mipmap for
+	as many textures as fit into the staging buffer, sweeping from coarse to
+	fine across all textures. Until a mipmap is resident, shaders clamp the
+	level of detail for its texture using lod_clamps.*/
+typedef struct texture_streaming_s {
+	//! The number of textures that are handled
+	uint32_t texture_count;
+	//! Meta-data for each texture (see textures.c)
+	struct texture_2d_header_s* headers;
+	//! Paths to the texture files or names of the textures in pack
+	char** texture_names;
+	//! The texture pack from which mipmaps are streamed. If it is not mapped,
+	//! mipmaps are read from the files at texture_names.
+	mapped_file_t pack;
+	//! For each texture, the finest mipmap level that is resident. It only
+	//! changes once copies have been recorded.
+	uint32_t* resident_levels;
+	//! For each texture, resident_levels as float. These are the minimal
+	//! levels of detail for sampling.
+	float* lod_values;
+	//! A device-local storage buffer with one float per texture, matching
+	//! lod_values once submitted copies have completed
+	buffers_t lod_clamps;
+	//! The number of mipmaps across all textures that are not resident yet
+	uint32_t pending_mipmap_count;
+	//! The index of the texture that is considered first for the next upload
+	uint32_t next_texture;
+	//! Whether some mipmaps were left out when the textures were loaded.
+	//! Shaders only need to clamp the level of detail in this case.
+	VkBool32 streamed;
+	//! A host-visible staging buffer for uploads and its mapped memory
+	buffers_t staging;
+	void* staging_data;
+	//! The command buffer for uploads and a fence that is signaled once the
+	//! last submission has completed
+	VkCommandBuffer command_buffer;
+	VkFence fence;
+	//! Whether the command buffer has been submitted and the fence has not
+	//! been checked since
+	VkBool32 submitted;
+} texture_streaming_t;
+
 
 /*! Loads 2D textures from files into GPU memory.
     \param textures Upon success, this object holds all loaded textures in the
@@ -33,3 +85,38 @@
     \note Since this function always creates a new memory allocation, it is
         advisable to load many textures at once.*/
 int load_2d_textures(images_t* textures, const device_t* device, uint32_t texture_count, const char* const* file_paths, VkBufferUsageFlags usage);
+
+
+/*! Like load_2d_textures() but the finest mipmaps are not loaded right away.
+    Instead, they are uploaded progressively by update_texture_streaming().
+    Optionally, all textures come from a single texture pack. Such *.vkp files
+    are created from *.vkt files by the accompanying texture conversion tool
+    in pack mode. The pack starts with an index of all textures, followed by
+    the texture data of each texture at a page-aligned offset. It is mapped
+    into memory as a whole, which avoids opening one file per texture.
+    \param streaming The object used for streaming. Clean up using
+        destroy_texture_streaming() before destroying textures.
+    \param texture_names Paths to *.vkt files or names of textures in the
+        pack. The name of a texture in the pack is the file name of the *.vkt
+        file that it was created from without extension.
+    \param pack_path NULL to load *.vkt files or the path to a *.vkp file.
+    \param max_resolution Mipmaps up to this resolution (along both axes) are
+        loaded right away. Pass UINT32_MAX to load everything. Streaming
+        requires the shaderResourceMinLod feature in shaders.
+    \return 0 upon success.*/
+int load_2d_textures_streamed(images_t* textures, texture_streaming_t* streaming, const device_t* device, uint32_t texture_count, const char* const* texture_names, const char* pack_path, uint32_t max_resolution, VkBufferUsageFlags usage);
+
+
+/*! Checks whether the last upload has completed and if so, reads the next
+    batch of mipmaps to the staging buffer and submits copies to the device
+    queue. It never waits for the device. Call it once per frame.
+    \param lod_clamps_changed Set to VK_TRUE if an upload has completed since
+        the last call, i.e. textures have become sharper.
+    \param textures The textures that were loaded with this object.
+    \note If reading fails, streaming stops and the affected textures keep
+        using coarser mipmaps.*/
+void update_texture_streaming(texture_streaming_t* streaming, VkBool32* lod_clamps_changed, const images_t* textures, const device_t* device);
+
+
+//! Waits for pending uploads, frees all objects and zeros the object
+void destroy_texture_streaming(texture_streaming_t* streaming, const device_t* device);
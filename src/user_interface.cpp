@@ -51,6 +51,8 @@ void specify_user_interface(application_updates_t* updates, application_t* app,
 	// Display the frame rate
 	ImGui::SameLine();
 	ImGui::Text("Frame time: %.2f ms", frame_time * 1000.0f);
+	if (app->light_culling_pass.pipeline.pipeline)
+		ImGui::Text("Light culling: %.3f ms, %.1f%% of clusters overflow", get_light_culling_time() * 1000.0f, app->light_culling_pass.overflow_rate * 100.0f);
 	// Display a text that changes each frame to indicate to the user whether
 	// the renderer is running
 	static uint32_t frame_index = 0;
@@ -78,6 +80,20 @@ void specify_user_interface(application_updates_t* updates, application_t* app,
 		scene->quick_save_path = copy_string(g_scene_paths[scene_index][3]);
 		updates->quick_load = updates->reload_scene = VK_TRUE;
 	}
+	// Lights are merged when they are loaded, so they have to be reloaded
+	if (ImGui::Checkbox("Merge coplanar lights", (bool*) &scene->merge_coplanar_lights)) {
+		updates->quick_load = VK_TRUE;
+		updates->reload_scene |= scene->extract_emissive_lights;
+	}
+	// Extracting lights from emissive triangles happens while loading a scene
+	if (ImGui::Checkbox("Lights from emissive triangles", (bool*) &scene->extract_emissive_lights))
+		updates->reload_scene = VK_TRUE;
+	if (scene->extract_emissive_lights)
+		if (ImGui::InputFloat3("Emissive radiance", scene->emissive_light_radiance, "%.3f", ImGuiInputTextFlags_EnterReturnsTrue))
+			updates->reload_scene = VK_TRUE;
+	// Streaming is set up while loading a scene
+	if (ImGui::Checkbox("Stream texture mipmaps", (bool*) &scene->stream_textures))
+		updates->reload_scene = VK_TRUE;
 
 	const char* polygon_sampling_techniques[sample_polygon_count];
 	polygon_sampling_techniques[sample_polygon_baseline] = "Baseline (zero cost, bogus results)";
@@ -99,19 +115,102 @@ void specify_user_interface(application_updates_t* updates, application_t* app,
 		mis_heuristics[mis_heuristic_optimal] = "Optimal heuristic (Peters)";
 		uint32_t mis_heuristic_count = COUNT_OF(mis_heuristics);
 		if (ImGui::Combo("MIS heuristic", (int*) &settings->mis_heuristic, mis_heuristics, mis_heuristic_count))
-			updates->change_shading = VK_TRUE;
+			updates->change_specialization = VK_TRUE;
 	}
 	if (show_mis && (settings->mis_heuristic == mis_heuristic_optimal_clamped || settings->mis_heuristic == mis_heuristic_optimal))
 		if(ImGui::DragFloat("MIS visibility estimate", &settings->mis_visibility_estimate, 0.01f, 0.0f, 1.0f, "%.2f")) *reset_accum = 1;
 
 	{
 		// Light sampling strategy
-		const char* light_sampling_strategies[3];
+		const char* light_sampling_strategies[light_sampling_count];
 		light_sampling_strategies[light_uniform] = "Uniform";
 		light_sampling_strategies[light_reservoir] = "RIS";
+		light_sampling_strategies[light_reservoir_bvh] = "RIS (light BVH)";
+		light_sampling_strategies[light_power] = "Power";
+		light_sampling_strategies[light_reservoir_power] = "RIS (power)";
+		light_sampling_strategies[light_reservoir_cache] = "RIS (light cache)";
 		// Create the interface and remap outputs
-		if (ImGui::Combo("Light sampling", (int *) &settings->light_sampling, light_sampling_strategies, 2))
+		if (ImGui::Combo("Light sampling", (int *) &settings->light_sampling, light_sampling_strategies, light_sampling_count))
+			updates->change_shading = VK_TRUE;
+	}
+
+	// Culling lights per cluster only works with uniform light selection
+	if (settings->light_sampling == light_uniform || settings->light_sampling == light_reservoir) {
+		if (ImGui::Checkbox("Light culling", (bool*) &settings->light_culling))
+			updates->change_shading = VK_TRUE;
+		// Lists that overflow are not used, so this trades memory for quality
+		int cluster_capacity = (int) settings->light_cluster_capacity;
+		if (settings->light_culling && ImGui::InputInt("Lights per cluster", &cluster_capacity, 64, 512)) {
+			if (cluster_capacity < 1) cluster_capacity = 1;
+			if (cluster_capacity > MAX_LIGHT_CLUSTER_CAPACITY) cluster_capacity = MAX_LIGHT_CLUSTER_CAPACITY;
+			settings->light_cluster_capacity = (uint32_t) cluster_capacity;
+			updates->change_shading = VK_TRUE;
+		}
+	}
+
+	// Changing the storage format of lights requires a new light buffer
+	if (ImGui::Checkbox("Quantize light vertices", (bool*) &settings->quantize_light_vertices)) {
+		updates->update_light_count = VK_TRUE;
+		updates->change_shading = VK_TRUE;
+	}
+
+	// Animated lights need a different light buffer and an extra pass
+	if (ImGui::Checkbox("Animate lights", (bool*) &settings->animate_lights)) {
+		updates->update_light_count = VK_TRUE;
+		updates->change_shading = VK_TRUE;
+	}
+	if (settings->animate_lights) {
+		if (ImGui::SliderFloat("Animation amplitude", &settings->light_animation_amplitude, 0.0f, 5.0f, "%.2f"))
+			updates->update_light_animation = VK_TRUE;
+		if (ImGui::SliderFloat("Animation frequency", &settings->light_animation_frequency, 0.0f, 2.0f, "%.2f Hz"))
+			updates->update_light_animation = VK_TRUE;
+	}
+
+	// Shading in a compute shader allows comparisons of timings
+	if (ImGui::Checkbox("Compute shading", (bool*) &settings->compute_shading))
+		updates->change_shading = VK_TRUE;
+	if (settings->compute_shading)
+		if (ImGui::Checkbox("Wavefront shading", (bool*) &settings->wavefront_shading))
+			updates->change_shading = VK_TRUE;
+
+	// Settings for the light cache
+	if (settings->light_sampling == light_reservoir_cache) {
+		if (ImGui::SliderFloat("Cache probability", &settings->light_cache_probability, 0.0f, 0.95f, "%.2f"))
+			updates->change_specialization = VK_TRUE;
+		if (ImGui::SliderFloat("Cache cell scale", &settings->light_cache_cell_scale, 0.001f, 0.2f, "%.3f"))
+			updates->change_specialization = VK_TRUE;
+		if (ImGui::Checkbox("Cache power fallback", (bool*) &settings->light_cache_power_fallback))
+			updates->change_specialization = VK_TRUE;
+	}
+
+	// Reusing reservoirs of the previous frame and of neighbouring pixels
+	if (settings->light_sampling == light_reservoir || settings->light_sampling == light_reservoir_bvh || settings->light_sampling == light_reservoir_power || settings->light_sampling == light_reservoir_cache) {
+		// Changing the number of RIS candidates
+		// Edit a signed copy, such that negative inputs do not wrap around
+		int candidate_count = (int) settings->candidate_count;
+		if (ImGui::InputInt("RIS candidates", &candidate_count, 1, 8)) {
+			if (candidate_count < 1) candidate_count = 1;
+			if (candidate_count > MAX_CANDIDATE_COUNT) candidate_count = MAX_CANDIDATE_COUNT;
+			settings->candidate_count = (uint32_t) candidate_count;
+			updates->change_specialization = VK_TRUE;
+		}
+		if (ImGui::Checkbox("Adaptive candidates", (bool*) &settings->adaptive_candidate_count))
+			updates->change_shading = VK_TRUE;
+		const char* ris_target_functions[ris_target_count];
+		ris_target_functions[ris_target_exact] = "Exact";
+		ris_target_functions[ris_target_form_factor] = "Form factor";
+		if (ImGui::Combo("RIS target", (int*) &settings->ris_target_function, ris_target_functions, ris_target_count))
+			updates->change_shading = VK_TRUE;
+		if (ImGui::Checkbox("Temporal reuse", (bool*) &settings->temporal_reuse))
+			updates->change_shading = VK_TRUE;
+		if (ImGui::Checkbox("Spatial reuse", (bool*) &settings->spatial_reuse))
 			updates->change_shading = VK_TRUE;
+		if (settings->spatial_reuse) {
+			if (ImGui::SliderInt("Spatial neighbours", (int*) &settings->spatial_reuse_neighbour_count, 1, 16))
+				updates->change_specialization = VK_TRUE;
+			if (ImGui::SliderFloat("Spatial radius", &settings->spatial_reuse_radius, 1.0f, 64.0f, "%.0f px"))
+				updates->change_specialization = VK_TRUE;
+		}
 	}
 
 	// Switching vertical synchronization
@@ -17,6 +17,10 @@
 #include "vulkan_basics.h"
 #include "string_utilities.h"
 #include "math_utilities.h"
+#include "fs.h"
+#ifdef USE_SHADERC
+#include <shaderc/shaderc.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -130,6 +134,10 @@ int create_vulkan_device(device_t* device, const char* application_internal_name
 				device->ray_tracing_supported = VK_TRUE;
 		free(extensions);
 	}
+	// Figure out whether the LOD for texture reads can be clamped in shaders
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(device->physical_device, &supported_features);
+	device->min_lod_supported = supported_features.shaderResourceMinLod;
 	// Select device extensions
 	const char* base_device_extension_names[] = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -164,6 +172,8 @@ int create_vulkan_device(device_t* device, const char* application_internal_name
 	VkPhysicalDeviceFeatures enabled_features = {
 		.shaderSampledImageArrayDynamicIndexing = VK_TRUE,
 		.samplerAnisotropy = VK_TRUE,
+		.fragmentStoresAndAtomics = VK_TRUE,
+		.shaderResourceMinLod = device->min_lod_supported,
 	};
 	VkPhysicalDeviceAccelerationStructureFeaturesKHR acceleration_structure_features = {
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
@@ -975,11 +985,264 @@ const char* get_shader_stage_name(VkShaderStageFlags stage) {
 }
 
 
+//! The offset basis of the FNV-1a hash used by hash_bytes()
+#define SHADER_HASH_SEED 0xcbf29ce484222325ull
+
+/*! Updates a 64-bit FNV-1a hash with the given bytes. Start with
+	SHADER_HASH_SEED.*/
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+	const uint8_t* bytes = (const uint8_t*) data;
+	for (size_t i = 0; i != size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+
+/*! Reads SPIR-V code from the file at the given path into the given shader.
+	\return 0 on success, 1 if the file does not exist or is not SPIR-V.*/
+static int load_spirv_file(shader_t* shader, const char* spirv_path) {
+	FILE* file = fopen(spirv_path, "rb");
+	if (!file)
+		return 1;
+	long file_size;
+	if (fseek(file, 0, SEEK_END) || (file_size = ftell(file)) <= 0 || file_size % sizeof(uint32_t) != 0) {
+		printf("Failed to determine the file size for the compiled shader %s.\n", spirv_path);
+		fclose(file);
+		return 1;
+	}
+	shader->spirv_code = malloc(file_size);
+	fseek(file, 0, SEEK_SET);
+	shader->spirv_size = fread(shader->spirv_code, sizeof(char), file_size, file);
+	fclose(file);
+	if (shader->spirv_size != (size_t) file_size) {
+		free(shader->spirv_code);
+		shader->spirv_code = NULL;
+		shader->spirv_size = 0;
+		return 1;
+	}
+	return 0;
+}
+
+
+//! Creates the Vulkan shader module for SPIR-V code loaded into the shader
+static int create_shader_module(shader_t* shader, const device_t* device, const shader_request_t* request) {
+	VkShaderModuleCreateInfo module_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.codeSize = shader->spirv_size,
+		.pCode = shader->spirv_code
+	};
+	if (vkCreateShaderModule(device->device, &module_info, NULL, &shader->module)) {
+		printf("Failed to create a shader module from %s.\n", request->shader_file_path);
+		destroy_shader(shader, device);
+		return 1;
+	}
+	return 0;
+}
+
+
+#ifdef USE_SHADERC
+
+/*! Reads a whole text file into a null-terminated string that has to be freed
+	by the calling side. Returns NULL if the file cannot be read.*/
+static char* read_text_file(size_t* size, const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+	long file_size;
+	if (fseek(file, 0, SEEK_END) || (file_size = ftell(file)) < 0) {
+		fclose(file);
+		return NULL;
+	}
+	char* text = malloc(file_size + 1);
+	fseek(file, 0, SEEK_SET);
+	(*size) = fread(text, sizeof(char), file_size, file);
+	text[*size] = 0;
+	fclose(file);
+	return text;
+}
+
+
+//! Translates a shader stage to the corresponding kind of shaderc shader
+static shaderc_shader_kind get_shaderc_shader_kind(VkShaderStageFlags stage) {
+	switch (stage) {
+	case VK_SHADER_STAGE_VERTEX_BIT: return shaderc_vertex_shader;
+	case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT: return shaderc_tess_control_shader;
+	case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT: return shaderc_tess_evaluation_shader;
+	case VK_SHADER_STAGE_GEOMETRY_BIT: return shaderc_geometry_shader;
+	case VK_SHADER_STAGE_FRAGMENT_BIT: return shaderc_fragment_shader;
+	case VK_SHADER_STAGE_COMPUTE_BIT: return shaderc_compute_shader;
+	case VK_SHADER_STAGE_RAYGEN_BIT_KHR: return shaderc_raygen_shader;
+	case VK_SHADER_STAGE_ANY_HIT_BIT_KHR: return shaderc_anyhit_shader;
+	case VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR: return shaderc_closesthit_shader;
+	case VK_SHADER_STAGE_INTERSECTION_BIT_KHR: return shaderc_intersection_shader;
+	case VK_SHADER_STAGE_MISS_BIT_KHR: return shaderc_miss_shader;
+	case VK_SHADER_STAGE_CALLABLE_BIT_KHR: return shaderc_callable_shader;
+	case VK_SHADER_STAGE_TASK_BIT_NV: return shaderc_task_shader;
+	case VK_SHADER_STAGE_MESH_BIT_NV: return shaderc_mesh_shader;
+	default: return shaderc_glsl_infer_from_source;
+	};
+}
+
+
+/*! Resolves #include directives for shaderc. Relative includes are searched
+	next to the including file first, then in the include path of the request,
+	which is passed as user data.*/
+static shaderc_include_result* resolve_include(void* user_data, const char* requested_source, int type, const char* requesting_source, size_t include_depth) {
+	const shader_request_t* request = (const shader_request_t*) user_data;
+	shaderc_include_result* result = calloc(1, sizeof(shaderc_include_result));
+	char* path = NULL;
+	char* content = NULL;
+	size_t content_size = 0;
+	if (type == shaderc_include_type_relative) {
+		const char* slash = strrchr(requesting_source, '/');
+		const char* backslash = strrchr(requesting_source, '\\');
+		if (backslash > slash) slash = backslash;
+		size_t directory_length = slash ? (slash - requesting_source + 1) : 0;
+		path = malloc(directory_length + strlen(requested_source) + 1);
+		memcpy(path, requesting_source, directory_length);
+		strcpy(path + directory_length, requested_source);
+		content = read_text_file(&content_size, path);
+	}
+	if (!content) {
+		free(path);
+		const char* path_pieces[] = { request->include_path, "/", requested_source };
+		path = concatenate_strings(COUNT_OF(path_pieces), path_pieces);
+		content = read_text_file(&content_size, path);
+	}
+	if (!content) {
+		// An empty source name signals failure, the content is the message
+		free(path);
+		const char* message_pieces[] = { "Cannot find the include file ", requested_source };
+		content = concatenate_strings(COUNT_OF(message_pieces), message_pieces);
+		content_size = strlen(content);
+		path = copy_string("");
+	}
+	result->source_name = path;
+	result->source_name_length = strlen(path);
+	result->content = content;
+	result->content_length = content_size;
+	return result;
+}
+
+
+//! Frees an include result produced by resolve_include()
+static void release_include(void* user_data, shaderc_include_result* include_result) {
+	free((void*) include_result->source_name);
+	free((void*) include_result->content);
+	free(include_result);
+}
+
+
+/*! Compiles the requested shader in-process using shaderc. The SPIR-V code is
+	cached in SHADER_CACHE_DIRECTORY under a hash of the preprocessed source,
+	the defines and all other compile options. A cache hit skips compilation.*/
+static int compile_glsl_shader_shaderc(shader_t* shader, const device_t* device, const shader_request_t* request) {
+	size_t source_size;
+	char* source = read_text_file(&source_size, request->shader_file_path);
+	if (!source) {
+		printf("The shader file at path %s does not exist or cannot be opened.\n", request->shader_file_path);
+		return 1;
+	}
+	// Set up compile options equivalent to those for glslangValidator
+	shaderc_compile_options_t options = shaderc_compile_options_initialize();
+	shaderc_compile_options_set_source_language(options, shaderc_source_language_glsl);
+	shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+	shaderc_compile_options_set_target_spirv(options, shaderc_spirv_version_1_5);
+#ifndef NDEBUG
+	shaderc_compile_options_set_generate_debug_info(options);
+	shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_zero);
+#endif
+	for (uint32_t i = 0; i != request->define_count; ++i) {
+		const char* define = request->defines[i];
+		const char* equals = strchr(define, '=');
+		if (equals)
+			shaderc_compile_options_add_macro_definition(options, define, equals - define, equals + 1, strlen(equals + 1));
+		else
+			shaderc_compile_options_add_macro_definition(options, define, strlen(define), NULL, 0);
+	}
+	shaderc_compile_options_set_include_callbacks(options, resolve_include, release_include, (void*) request);
+	shaderc_compiler_t compiler = shaderc_compiler_initialize();
+	shaderc_shader_kind kind = get_shaderc_shader_kind(request->stage);
+	// Preprocess to find out whether the shader or any include has changed
+	shaderc_compilation_result_t preprocessed = shaderc_compile_into_preprocessed_text(compiler, source, source_size, kind, request->shader_file_path, request->entry_point, options);
+	if (shaderc_result_get_compilation_status(preprocessed) != shaderc_compilation_status_success) {
+		printf("Failed to preprocess the shader at path %s:\n%s\n", request->shader_file_path, shaderc_result_get_error_message(preprocessed));
+		shaderc_result_release(preprocessed);
+		shaderc_compiler_release(compiler);
+		shaderc_compile_options_release(options);
+		free(source);
+		return 1;
+	}
+	uint64_t hash = SHADER_HASH_SEED;
+	unsigned int spirv_version[2];
+	shaderc_get_spv_version(&spirv_version[0], &spirv_version[1]);
+	hash = hash_bytes(hash, spirv_version, sizeof(spirv_version));
+	hash = hash_bytes(hash, &request->stage, sizeof(request->stage));
+	hash = hash_bytes(hash, request->entry_point, strlen(request->entry_point) + 1);
+	for (uint32_t i = 0; i != request->define_count; ++i)
+		hash = hash_bytes(hash, request->defines[i], strlen(request->defines[i]) + 1);
+#ifndef NDEBUG
+	hash = hash_bytes(hash, "debug", 5);
+#endif
+	hash = hash_bytes(hash, shaderc_result_get_bytes(preprocessed), shaderc_result_get_length(preprocessed));
+	shaderc_result_release(preprocessed);
+	char hash_string[17];
+	sprintf(hash_string, "%08x%08x", (uint32_t) (hash >> 32), (uint32_t) hash);
+	const char* spirv_path_pieces[] = { SHADER_CACHE_DIRECTORY, "/", hash_string, ".spv" };
+	char* spirv_path = concatenate_strings(COUNT_OF(spirv_path_pieces), spirv_path_pieces);
+	// Use the cached SPIR-V if possible
+	if (!load_spirv_file(shader, spirv_path)) {
+		free(spirv_path);
+		shaderc_compiler_release(compiler);
+		shaderc_compile_options_release(options);
+		free(source);
+		return create_shader_module(shader, device, request);
+	}
+	// Compile the shader
+	shaderc_compilation_result_t result = shaderc_compile_into_spv(compiler, source, source_size, kind, request->shader_file_path, request->entry_point, options);
+	shaderc_compiler_release(compiler);
+	shaderc_compile_options_release(options);
+	free(source);
+	if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) {
+		printf("Failed to compile the shader at path %s:\n%s\n", request->shader_file_path, shaderc_result_get_error_message(result));
+		shaderc_result_release(result);
+		free(spirv_path);
+		return 1;
+	}
+	shader->spirv_size = shaderc_result_get_length(result);
+	shader->spirv_code = malloc(shader->spirv_size);
+	memcpy(shader->spirv_code, shaderc_result_get_bytes(result), shader->spirv_size);
+	shaderc_result_release(result);
+	// Store it in the cache. Writing to a temporary file first ensures that
+	// other instances never read partially written SPIR-V.
+	mkdir(SHADER_CACHE_DIRECTORY);
+	const char* temporary_path_pieces[] = { spirv_path, ".tmp" };
+	char* temporary_path = concatenate_strings(COUNT_OF(temporary_path_pieces), temporary_path_pieces);
+	FILE* file = fopen(temporary_path, "wb");
+	if (file) {
+		size_t written = fwrite(shader->spirv_code, sizeof(char), shader->spirv_size, file);
+		fclose(file);
+		if (written != shader->spirv_size || rename(temporary_path, spirv_path))
+			remove(temporary_path);
+	}
+	free(temporary_path);
+	free(spirv_path);
+	return create_shader_module(shader, device, request);
+}
+
+#endif
+
+
 int compile_glsl_shader(shader_t* shader, const device_t* device, const shader_request_t* request) {
 	if (!get_shader_stage_name(request->stage)) {
 		printf("Invalid stage specification %u passed for shader %s.", request->stage, request->shader_file_path);
 		return 1;
 	}
+#ifdef USE_SHADERC
+	return compile_glsl_shader_shaderc(shader, device, request);
+#else
 	// Verify that the shader file exists by opening and closing it
 #ifndef NDEBUG
 	FILE* shader_file = fopen(request->shader_file_path, "r");
@@ -989,11 +1252,6 @@ int compile_glsl_shader(shader_t* shader, const device_t* device, const shader_r
 	}
 	fclose(shader_file);
 #endif
-	// Delete the prospective output file such that we can verify its existence
-	// to see if the compiler did anything
-	const char* spirv_path_pieces[] = {request->shader_file_path, ".spv"};
-	char* spirv_path = concatenate_strings(COUNT_OF(spirv_path_pieces), spirv_path_pieces);
-	remove(spirv_path);
 	// Build the part of the command line for defines
 	const char** define_pieces = malloc(sizeof(char*) * 2 * request->define_count);
 	for (uint32_t i = 0; i != request->define_count; ++i) {
@@ -1002,6 +1260,18 @@ int compile_glsl_shader(shader_t* shader, const device_t* device, const shader_r
 	}
 	char* concatenated_defines = concatenate_strings(2 * request->define_count, define_pieces);
 	free(define_pieces);
+	// The output file name depends on the defines and the stage, such that
+	// different variants of one shader never write to the same file
+	uint64_t hash = SHADER_HASH_SEED;
+	hash = hash_bytes(hash, &request->stage, sizeof(request->stage));
+	hash = hash_bytes(hash, concatenated_defines, strlen(concatenated_defines));
+	char hash_string[17];
+	sprintf(hash_string, "%08x%08x", (uint32_t) (hash >> 32), (uint32_t) hash);
+	// Delete the prospective output file such that we can verify its existence
+	// to see if the compiler did anything
+	const char* spirv_path_pieces[] = {request->shader_file_path, ".", hash_string, ".spv"};
+	char* spirv_path = concatenate_strings(COUNT_OF(spirv_path_pieces), spirv_path_pieces);
+	remove(spirv_path);
 	// Construct the command line
 	const char* command_line_pieces[] = {
 		"glslangValidator -V100 --target-env spirv1.5 ",
@@ -1028,44 +1298,29 @@ int compile_glsl_shader(shader_t* shader, const device_t* device, const shader_r
 #endif
 	// Invoke the command line and see whether it produced an output file
 	system(command_line);
-	FILE* file = fopen(spirv_path, "rb");
-	if (!file) {
+	if (load_spirv_file(shader, spirv_path)) {
 		printf("glslangValidator failed to compile the shader at path %s. The full command line is:\n%s\n", request->shader_file_path, command_line);
 		free(command_line);
 		free(spirv_path);
 		return 1;
 	}
+	remove(spirv_path);
 	free(command_line);
 	free(spirv_path);
-	// Read the SPIR-V code from the file
-	if (fseek(file, 0, SEEK_END) || (shader->spirv_size = ftell(file)) < 0) {
-		printf("Failed to determine the file size for the compiled shader %s.", spirv_path);
-		fclose(file);
-		return 1;
-	}
-	shader->spirv_code = malloc(shader->spirv_size);
-	fseek(file, 0, SEEK_SET);
-	shader->spirv_size = fread(shader->spirv_code, sizeof(char), shader->spirv_size, file);
-	fclose(file);
-	// Create the Vulkan shader module
-	VkShaderModuleCreateInfo module_info = {
-		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-		.codeSize = shader->spirv_size,
-		.pCode = shader->spirv_code
-	};
-	if (vkCreateShaderModule(device->device, &module_info, NULL, &shader->module)) {
-		printf("Failed to create a shader module from %s.\n", request->shader_file_path);
-		destroy_shader(shader, device);
-	}
-	return 0;
+	return create_shader_module(shader, device, request);
+#endif
 }
 
 
 int compile_glsl_shader_with_second_chance(shader_t* shader, const device_t* device, const shader_request_t* request) {
 	while (compile_glsl_shader(shader, device, request)) {
-		printf("Try again (Y/n)? ");
+		// Shaders may compile in parallel, so prompts must not interleave
 		char response;
-		scanf("%1c", &response);
+		#pragma omp critical
+		{
+			printf("Try again (Y/n)? ");
+			scanf("%1c", &response);
+		}
 		if (response == 'N' || response == 'n') {
 			printf("\nGiving up.\n");
 			return 1;
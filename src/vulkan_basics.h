@@ -40,6 +40,9 @@ typedef struct device_s {
 	const char** device_extension_names;
 	//! Boolean indicating whether ray tracing is available with the device
 	VkBool32 ray_tracing_supported;
+	//! Boolean indicating whether shaders may clamp the level of detail for
+	//! texture reads (shaderResourceMinLod), which texture streaming uses
+	VkBool32 min_lod_supported;
 
 	//! Number of available physical devices
 	uint32_t physical_device_count;
@@ -187,6 +190,11 @@ typedef struct buffers_s {
 } buffers_t;
 
 
+//! The directory (relative to the CWD) that holds compiled SPIR-V code keyed
+//! by a hash of the preprocessed source (see compile_glsl_shader())
+#define SHADER_CACHE_DIRECTORY "shader_cache"
+
+
 //! Handles all information needed to compile a shader into a module
 typedef struct shader_request_s {
 	//! A path to the file with the GLSL source code (relative to the CWD)
@@ -506,8 +514,11 @@ static inline int copy_buffers_to_images(const device_t* device,
 	\param device The used device.
 	\param shader_request All attributes characterizing the shader to compile
 	\return 0 on success.
-	\note This function creates a file with extension .spv next to the given
-		shader. If it existed before, it is overwritten without prompt.
+	\note If the renderer is built with shaderc (USE_SHADERC), compilation
+		happens in-process and SPIR-V is cached in SHADER_CACHE_DIRECTORY under
+		a hash of the preprocessed source and all options. Otherwise, this
+		function invokes glslangValidator, which writes a temporary .spv file
+		next to the given shader with a name that depends on the defines.
 	\note The debug build compiles shaders in a way that is optimal for
 		debugging, the release build optimizes for speed.*/
 int compile_glsl_shader(shader_t* shader, const device_t* device, const shader_request_t* request);
@@ -144,10 +144,28 @@ def convert_materials(destination_directory, source_directory, skip_existing=Tru
         sleep(0.2)
 
 
+def pack_materials(directory):
+    """
+    Combines all *.vkt files in the given directory into a single texture pack
+    named textures.vkp in the same directory. If the renderer finds this pack,
+    it loads all material textures from it instead of opening each *.vkt file
+    on its own.
+    :param directory: The directory holding the *.vkt files.
+    """
+    texture_conversion_path = "tools/texture_conversion/build/Release/texture_conversion.exe"
+    if not os.path.exists(texture_conversion_path):
+        texture_conversion_path = "tools/texture_conversion/build/texture_conversion"
+    texture_files = [os.path.join(directory, file) for file in sorted(os.listdir(directory)) if os.path.splitext(file)[1] == ".vkt"]
+    process = Popen([texture_conversion_path, "pack", os.path.join(directory, "textures.vkp")] + texture_files)
+    if process.wait() != 0:
+        print("Failed to pack the textures in %s." % directory)
+
+
 if __name__ == "__main__":
     complete_materials("E:/ZeroDay_v1/MEASURE_SEVEN/tex", {
         "Default_Material": (None, None),
         "lambert1": (0.5, 1.0),
         "": (0.5, 1.0),
     })
-    convert_materials("data/ZeroDay_textures", "E:/ZeroDay_v1/MEASURE_SEVEN/tex")
\ No newline at end of file
+    convert_materials("data/ZeroDay_textures", "E:/ZeroDay_v1/MEASURE_SEVEN/tex")
+    pack_materials("data/ZeroDay_textures")
\ No newline at end of file
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
 
@@ -102,7 +103,171 @@ static inline int32_t get_mipmap_count(int32_t extent) {
 }
 
 
+//! Texture data in texture packs starts at multiples of this many bytes
+#define TEXTURE_PACK_PAGE_SIZE 4096
+
+
+/*! Meta data about a texture that is being written to a texture pack.*/
+typedef struct packed_texture_s {
+	//! The name of the texture in the pack, i.e. the file name of the *.vkt
+	//! file without directory and extension
+	char* name;
+	//! The header and mipmap headers of the *.vkt file
+	texture_file_header_t header;
+	mipmap_header_t* mipmaps;
+	//! The offset of the texture data in the *.vkt file in bytes
+	long source_offset;
+	//! The offset of the texture data in the texture pack in bytes
+	uint64_t pack_offset;
+} packed_texture_t;
+
+
+//! Frees all memory referenced by the given array of packed textures
+static void free_packed_textures(packed_texture_t* textures, int32_t texture_count) {
+	for (int32_t i = 0; i != texture_count; ++i) {
+		free(textures[i].name);
+		free(textures[i].mipmaps);
+	}
+	free(textures);
+}
+
+
+/*! Combines the given *.vkt files into a single texture pack (*.vkp). The
+	pack holds a header, an index with the name, meta data and data offset of
+	each texture and the texture data at page-aligned offsets. The renderer
+	maps it into memory in one go, rather than opening one file per texture.
+	\return 0 on success.*/
+static int pack_textures(const char* output_file_path, int32_t texture_count, char** input_file_paths) {
+	packed_texture_t* textures = malloc(sizeof(packed_texture_t) * texture_count);
+	memset(textures, 0, sizeof(packed_texture_t) * texture_count);
+	// Read the headers of all textures and determine the index size
+	uint64_t index_size = 4 * sizeof(uint32_t);
+	for (int32_t i = 0; i != texture_count; ++i) {
+		packed_texture_t* texture = &textures[i];
+		FILE* file = fopen(input_file_paths[i], "rb");
+		if (!file) {
+			printf("Failed to open the texture file at path %s.\n", input_file_paths[i]);
+			free_packed_textures(textures, texture_count);
+			return 1;
+		}
+		fread((void*) &texture->header, sizeof(int32_t), 8, file);
+		if (texture->header.file_marker != 0xbc1bc1 || texture->header.version != 1 || texture->header.mipmap_count < 0 || texture->header.mipmap_count > 32) {
+			printf("The file at path %s is not a valid *.vkt file.\n", input_file_paths[i]);
+			fclose(file);
+			free_packed_textures(textures, texture_count);
+			return 1;
+		}
+		texture->mipmaps = malloc(sizeof(mipmap_header_t) * texture->header.mipmap_count);
+		fread((void*) texture->mipmaps, sizeof(mipmap_header_t), texture->header.mipmap_count, file);
+		texture->source_offset = ftell(file);
+		fclose(file);
+		// Strip the directory and the extension from the file path
+		const char* name = input_file_paths[i];
+		for (const char* character = name; *character; ++character)
+			if (*character == '/' || *character == '\\')
+				name = character + 1;
+		size_t name_length = strlen(name);
+		const char* extension = strrchr(name, '.');
+		if (extension)
+			name_length = extension - name;
+		texture->name = malloc(name_length + 1);
+		memcpy(texture->name, name, name_length);
+		texture->name[name_length] = 0;
+		index_size += sizeof(uint32_t) + name_length + 4 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+		index_size += sizeof(mipmap_header_t) * texture->header.mipmap_count;
+	}
+	// Place the texture data behind the index
+	uint64_t pack_offset = index_size;
+	for (int32_t i = 0; i != texture_count; ++i) {
+		pack_offset = ((pack_offset + TEXTURE_PACK_PAGE_SIZE - 1) / TEXTURE_PACK_PAGE_SIZE) * TEXTURE_PACK_PAGE_SIZE;
+		textures[i].pack_offset = pack_offset;
+		pack_offset += textures[i].header.payload_size;
+	}
+
+	// Open the output file for writing
+	FILE* file = fopen(output_file_path, "wb");
+	if (!file) {
+		printf("Failed to open the output file: %s\n", output_file_path);
+		free_packed_textures(textures, texture_count);
+		return 1;
+	}
+	// Write the header and the index
+	uint32_t pack_header[4] = { 0xbc1bc2, 1, (uint32_t) texture_count, TEXTURE_PACK_PAGE_SIZE };
+	fwrite((void*) pack_header, sizeof(uint32_t), 4, file);
+	for (int32_t i = 0; i != texture_count; ++i) {
+		packed_texture_t* texture = &textures[i];
+		uint32_t name_length = (uint32_t) strlen(texture->name);
+		uint32_t meta_data[4] = {
+			(uint32_t) texture->header.mipmap_count,
+			(uint32_t) texture->header.width, (uint32_t) texture->header.height,
+			(uint32_t) texture->header.format
+		};
+		uint64_t sizes[2] = { texture->header.payload_size, texture->pack_offset };
+		fwrite((void*) &name_length, sizeof(name_length), 1, file);
+		fwrite((void*) texture->name, 1, name_length, file);
+		fwrite((void*) meta_data, sizeof(uint32_t), 4, file);
+		fwrite((void*) sizes, sizeof(uint64_t), 2, file);
+		fwrite((void*) texture->mipmaps, sizeof(mipmap_header_t), texture->header.mipmap_count, file);
+	}
+	// Copy the texture data with padding in between
+	size_t chunk_size = 1 << 20;
+	uint8_t* chunk = malloc(chunk_size);
+	uint64_t written_size = index_size;
+	int result = 0;
+	for (int32_t i = 0; i != texture_count && !result; ++i) {
+		packed_texture_t* texture = &textures[i];
+		memset(chunk, 0, TEXTURE_PACK_PAGE_SIZE);
+		fwrite((void*) chunk, 1, (size_t) (texture->pack_offset - written_size), file);
+		FILE* source = fopen(input_file_paths[i], "rb");
+		if (!source || fseek(source, texture->source_offset, SEEK_SET)) {
+			printf("Failed to open the texture file at path %s.\n", input_file_paths[i]);
+			if (source)
+				fclose(source);
+			result = 1;
+			break;
+		}
+		size_t remaining_size = texture->header.payload_size;
+		while (remaining_size > 0) {
+			size_t read_size = fread((void*) chunk, 1, (remaining_size < chunk_size) ? remaining_size : chunk_size, source);
+			if (read_size == 0)
+				break;
+			fwrite((void*) chunk, 1, read_size, file);
+			remaining_size -= read_size;
+		}
+		int32_t eof = 0;
+		fread((void*) &eof, sizeof(eof), 1, source);
+		fclose(source);
+		if (remaining_size > 0 || eof != 0xe0fe0f) {
+			printf("The texture file at path %s seems to be invalid. The texture data is not followed by the expected end of file marker.\n", input_file_paths[i]);
+			result = 1;
+		}
+		written_size = texture->pack_offset + texture->header.payload_size;
+	}
+	// Write an end of file marker
+	int32_t eof = 0xe0fe0f;
+	fwrite((void*) &eof, sizeof(eof), 1, file);
+	// Clean up
+	fclose(file);
+	free(chunk);
+	free_packed_textures(textures, texture_count);
+	if (result)
+		remove(output_file_path);
+	else
+		printf("Packed %d textures into %s.\n", texture_count, output_file_path);
+	return result;
+}
+
+
 int main(int argc, char** argv) {
+	// In pack mode, combine *.vkt files into a texture pack
+	if (argc >= 2 && strcmp(argv[1], "pack") == 0) {
+		if (argc < 4) {
+			printf("Usage: texture_compression pack <output_file_path> <input_file_path_1> ... <input_file_path_n>\n");
+			printf("Combines *.vkt files into a single texture pack (*.vkp). Textures in the pack are named after their input files without extension.\n");
+			return 1;
+		}
+		return pack_textures(argv[2], argc - 3, argv + 3);
+	}
 	// Grab and validate input arguments
 	int32_t format_int = 0;
 	if (argc >= 4)
@@ -133,6 +298,7 @@ VK_FORMAT_BC5_UNORM_BLOCK = 141\n");
 		printf("For a list of supported input file formats, see:\n");
 		printf("https://github.com/nothings/stb/blob/master/stb_image.h\n");
 		printf("The output format is *.vkt, which is a renderer specific format with mipmaps (similar to *.dds).\n");
+		printf("Run texture_compression pack without further arguments to learn how to create texture packs.\n");
 		return 1;
 	}
 	const char* input_file_path = argv[argc - 2];